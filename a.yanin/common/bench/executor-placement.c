@@ -0,0 +1,318 @@
+// clock_gettime(2) is not part of C
+#define _POSIX_C_SOURCE 200809L
+
+// Measures how the placement of the thread pool's workers affects the throughput of tasks that
+// read memory owned by a NUMA node.
+//
+// Usage: executor-placement <none|compact|scatter> [<workers>] [<tasks>]
+//
+// Each node the pool reports gets a buffer, first touched by one of the node's workers, so that the
+// kernel backs it with the node's memory. The tasks then each sum a slice of a buffer. They are
+// submitted twice: once anywhere, and once to the node owning the buffer. For each run, the
+// benchmark reports the throughput and the share of the tasks that ran on the owner node.
+//
+// On a machine with a single node, every read is local, and the runs only show the cost of pinning.
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <common/executor/thread-pool.h>
+#include <common/log/log.h>
+
+enum {
+    DEFAULT_WORKER_COUNT = 4,
+    DEFAULT_TASK_COUNT = 1 << 16,
+    // the most nodes the benchmark keeps buffers for
+    MAX_NODE_COUNT = 64,
+    // the size of each node's buffer
+    NODE_BUFFER_SIZE = 16 << 20,
+    // the number of bytes a task reads
+    TASK_SLICE_SIZE = 64 << 10,
+    // the number of tasks submitted to discover the nodes
+    PROBE_TASK_COUNT = 4 * MAX_NODE_COUNT,
+};
+
+typedef struct {
+    executor_t *executor;
+    size_t node_count;
+    uint64_t *buffers[MAX_NODE_COUNT];
+
+    size_t task_count;
+    atomic_size_t done;
+    // the number of tasks that ran on the node owning their buffer
+    atomic_size_t local;
+    // keeps the sums from being optimized away
+    atomic_uint_least64_t checksum;
+    // the highest node a probe task ran on
+    atomic_size_t max_node;
+
+    pthread_mutex_t mtx;
+    pthread_cond_t cond;
+} bench_t;
+
+typedef struct {
+    bench_t *bench;
+    size_t node;
+    size_t offset;
+} task_data_t;
+
+static uint64_t now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t) now.tv_sec * 1000000000 + (uint64_t) now.tv_nsec;
+}
+
+static void bench_task_done(bench_t *bench) {
+    if (atomic_fetch_add_explicit(&bench->done, 1, memory_order_acq_rel) + 1 == bench->task_count) {
+        pthread_mutex_lock(&bench->mtx);
+        pthread_cond_signal(&bench->cond);
+        pthread_mutex_unlock(&bench->mtx);
+    }
+}
+
+// Waits for the `task_count` tasks submitted since the last call to run.
+static void bench_await(bench_t *bench) {
+    pthread_mutex_lock(&bench->mtx);
+
+    while (atomic_load_explicit(&bench->done, memory_order_acquire) < bench->task_count) {
+        pthread_cond_wait(&bench->cond, &bench->mtx);
+    }
+
+    pthread_mutex_unlock(&bench->mtx);
+    atomic_store_explicit(&bench->done, 0, memory_order_relaxed);
+}
+
+static error_t *probe_task(void *data) {
+    bench_t *bench = data;
+    size_t node = executor_current_node(bench->executor);
+
+    if (node == EXECUTOR_ANY_NODE) {
+        node = 0;
+    }
+
+    size_t max = atomic_load_explicit(&bench->max_node, memory_order_relaxed);
+
+    while (node > max && !atomic_compare_exchange_weak_explicit(
+            &bench->max_node, &max, node, memory_order_relaxed, memory_order_relaxed)) {}
+
+    bench_task_done(bench);
+
+    return NULL;
+}
+
+static error_t *touch_task(void *data) {
+    task_data_t *task = data;
+    memset(task->bench->buffers[task->node], 1, NODE_BUFFER_SIZE);
+    bench_task_done(task->bench);
+
+    return NULL;
+}
+
+static error_t *sum_task(void *data) {
+    task_data_t *task = data;
+    bench_t *bench = task->bench;
+    uint64_t const *slice = bench->buffers[task->node] + task->offset / sizeof(uint64_t);
+    uint64_t sum = 0;
+
+    for (size_t i = 0; i < TASK_SLICE_SIZE / sizeof(uint64_t); ++i) {
+        sum += slice[i];
+    }
+
+    atomic_fetch_add_explicit(&bench->checksum, sum, memory_order_relaxed);
+
+    size_t node = executor_current_node(bench->executor);
+
+    if (node == task->node || (node == EXECUTOR_ANY_NODE && bench->node_count == 1)) {
+        atomic_fetch_add_explicit(&bench->local, 1, memory_order_relaxed);
+    }
+
+    bench_task_done(bench);
+
+    return NULL;
+}
+
+// Finds out how many nodes the pool has by asking the workers that run a batch of tasks.
+//
+// The tasks submitted from outside the pool are spread across its nodes, so every node runs some.
+static void bench_probe_nodes(bench_t *bench) {
+    bench->task_count = PROBE_TASK_COUNT;
+
+    for (size_t i = 0; i < PROBE_TASK_COUNT; ++i) {
+        executor_submit(bench->executor, (task_t) {
+            .cb = probe_task,
+            .data = bench,
+        });
+    }
+
+    bench_await(bench);
+    bench->node_count = atomic_load_explicit(&bench->max_node, memory_order_relaxed) + 1;
+
+    if (bench->node_count > MAX_NODE_COUNT) {
+        bench->node_count = MAX_NODE_COUNT;
+    }
+}
+
+// Allocates the buffers, each first touched on its node.
+static void bench_touch_buffers(bench_t *bench) {
+    task_data_t tasks[MAX_NODE_COUNT];
+
+    for (size_t node = 0; node < bench->node_count; ++node) {
+        bench->buffers[node] = malloc(NODE_BUFFER_SIZE);
+
+        if (bench->buffers[node] == NULL) {
+            abort();
+        }
+
+        // one at a time, so that each node's workers are idle and pick up their own task
+        tasks[node] = (task_data_t) {
+            .bench = bench,
+            .node = node,
+        };
+        bench->task_count = 1;
+        executor_submit_to_node(bench->executor, (task_t) {
+            .cb = touch_task,
+            .data = &tasks[node],
+        }, node);
+        bench_await(bench);
+    }
+}
+
+static void bench_run(bench_t *bench, task_data_t *tasks, size_t task_count, bool to_owner) {
+    bench->task_count = task_count;
+    atomic_store_explicit(&bench->local, 0, memory_order_relaxed);
+
+    for (size_t i = 0; i < task_count; ++i) {
+        // the owners are scattered (by Fibonacci hashing) rather than assigned round-robin, which
+        // would match the order the pool spreads the tasks in and make every read local
+        uint64_t hash = (uint64_t) i * UINT64_C(0x9e3779b97f4a7c15);
+
+        tasks[i] = (task_data_t) {
+            .bench = bench,
+            .node = (size_t) (hash >> 32) % bench->node_count,
+            .offset = (i * TASK_SLICE_SIZE) % NODE_BUFFER_SIZE,
+        };
+    }
+
+    uint64_t start = now_ns();
+
+    for (size_t i = 0; i < task_count; ++i) {
+        task_t task = {
+            .cb = sum_task,
+            .data = &tasks[i],
+        };
+
+        if (to_owner) {
+            executor_submit_to_node(bench->executor, task, tasks[i].node);
+        } else {
+            executor_submit(bench->executor, task);
+        }
+    }
+
+    bench_await(bench);
+
+    double elapsed = (double) (now_ns() - start) / 1e9;
+    size_t local = atomic_load_explicit(&bench->local, memory_order_relaxed);
+
+    printf("%-10s %12.0f %12.2f %10.1f\n",
+        to_owner ? "owner node" : "any node",
+        (double) task_count / elapsed,
+        (double) task_count * TASK_SLICE_SIZE / elapsed / 1e9,
+        100.0 * (double) local / (double) task_count);
+}
+
+static void print_usage(void) {
+    fputs("Usage: executor-placement <none|compact|scatter> [<workers>] [<tasks>]\n", stderr);
+}
+
+int main(int argc, char **argv) {
+    error_t *err = NULL;
+
+    if (argc < 2 || argc > 4) {
+        print_usage();
+
+        return 1;
+    }
+
+    executor_thread_pool_placement_policy_t policy = THREAD_POOL_PLACEMENT_NONE;
+
+    if (strcmp(argv[1], "compact") == 0) {
+        policy = THREAD_POOL_PLACEMENT_COMPACT;
+    } else if (strcmp(argv[1], "scatter") == 0) {
+        policy = THREAD_POOL_PLACEMENT_SCATTER;
+    } else if (strcmp(argv[1], "none") != 0) {
+        print_usage();
+
+        return 1;
+    }
+
+    size_t worker_count = argc > 2 ? strtoull(argv[2], NULL, 10) : DEFAULT_WORKER_COUNT;
+    size_t task_count = argc > 3 ? strtoull(argv[3], NULL, 10) : DEFAULT_TASK_COUNT;
+
+    if (worker_count == 0 || task_count == 0) {
+        fputs("The worker and task counts must be positive\n", stderr);
+
+        return 1;
+    }
+
+    log_set_level(LOG_WARN);
+
+    executor_thread_pool_config_t config = {
+        .min_size = worker_count,
+        .max_size = worker_count,
+        .placement = {
+            .policy = policy,
+        },
+    };
+    executor_thread_pool_t *pool = NULL;
+    err = executor_thread_pool_new("bench", &config, &pool);
+    if (err) goto new_fail;
+
+    bench_t bench = {
+        .executor = (executor_t *) pool,
+    };
+    pthread_mutex_init(&bench.mtx, NULL);
+    pthread_cond_init(&bench.cond, NULL);
+
+    task_data_t *tasks = calloc(task_count, sizeof(task_data_t));
+
+    if (tasks == NULL) {
+        abort();
+    }
+
+    bench_probe_nodes(&bench);
+    bench_touch_buffers(&bench);
+
+    printf("%s placement, %zu workers, %zu nodes, %zu tasks of %d KiB\n",
+        argv[1], worker_count, bench.node_count, task_count, TASK_SLICE_SIZE >> 10);
+    printf("%-10s %12s %12s %10s\n", "submitted", "tasks/s", "GB/s", "local, %");
+    bench_run(&bench, tasks, task_count, false);
+    bench_run(&bench, tasks, task_count, true);
+
+    executor_shutdown(bench.executor);
+    executor_await_termination(bench.executor);
+    executor_free(bench.executor);
+
+    for (size_t node = 0; node < bench.node_count; ++node) {
+        free(bench.buffers[node]);
+    }
+
+    free(tasks);
+    pthread_cond_destroy(&bench.cond);
+    pthread_mutex_destroy(&bench.mtx);
+
+new_fail:
+    if (err) {
+        error_log_free(&err, LOG_ERR, ERROR_VERBOSITY_SOURCE_CHAIN);
+
+        return 1;
+    }
+
+    return 0;
+}
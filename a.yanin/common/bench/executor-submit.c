@@ -0,0 +1,224 @@
+// clock_gettime(2) is not part of C
+#define _POSIX_C_SOURCE 200809L
+
+// Measures the task throughput and the submit-to-run latency of an executor as the number of
+// threads submitting to it grows.
+//
+// Usage: executor-submit <thread-pool|work-stealing> [<workers>] [<tasks>]
+//
+// Each run submits `<tasks>` tasks in total, from 1, 2, 4, ..., 64 threads.
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <common/executor/thread-pool.h>
+#include <common/executor/work-stealing.h>
+#include <common/log/log.h>
+
+enum {
+    DEFAULT_WORKER_COUNT = 4,
+    DEFAULT_TASK_COUNT = 1 << 20,
+    MAX_PRODUCER_COUNT = 64,
+};
+
+typedef struct {
+    executor_t *executor;
+    size_t task_count;
+
+    atomic_size_t done;
+    // the sum of the submit-to-run latencies, in nanoseconds
+    atomic_uint_least64_t latency_sum;
+    atomic_uint_least64_t latency_max;
+
+    pthread_mutex_t mtx;
+    pthread_cond_t cond;
+} bench_t;
+
+typedef struct {
+    bench_t *bench;
+    uint64_t submitted_at;
+} task_data_t;
+
+typedef struct {
+    bench_t *bench;
+    // allocated before the run so that the only allocations measured are the executor's own
+    task_data_t *tasks;
+    size_t task_count;
+} producer_t;
+
+static uint64_t now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t) now.tv_sec * 1000000000 + (uint64_t) now.tv_nsec;
+}
+
+static error_t *bench_task(void *data) {
+    task_data_t *task = data;
+    bench_t *bench = task->bench;
+    uint64_t latency = now_ns() - task->submitted_at;
+
+    atomic_fetch_add_explicit(&bench->latency_sum, latency, memory_order_relaxed);
+    uint64_t max = atomic_load_explicit(&bench->latency_max, memory_order_relaxed);
+
+    while (latency > max && !atomic_compare_exchange_weak_explicit(
+            &bench->latency_max, &max, latency, memory_order_relaxed, memory_order_relaxed)) {}
+
+    if (atomic_fetch_add_explicit(&bench->done, 1, memory_order_acq_rel) + 1 == bench->task_count) {
+        pthread_mutex_lock(&bench->mtx);
+        pthread_cond_signal(&bench->cond);
+        pthread_mutex_unlock(&bench->mtx);
+    }
+
+    return NULL;
+}
+
+static void *producer_run(void *data) {
+    producer_t *producer = data;
+
+    for (size_t i = 0; i < producer->task_count; ++i) {
+        task_data_t *task = &producer->tasks[i];
+        task->bench = producer->bench;
+        task->submitted_at = now_ns();
+        executor_submit(producer->bench->executor, (task_t) {
+            .cb = bench_task,
+            .data = task,
+        });
+    }
+
+    return NULL;
+}
+
+// Submits `task_count` tasks from `producer_count` threads at once and waits for them to run.
+static void bench_run(executor_t *executor, size_t producer_count, size_t task_count) {
+    bench_t bench = {
+        .executor = executor,
+        .task_count = task_count / producer_count * producer_count,
+    };
+    pthread_mutex_init(&bench.mtx, NULL);
+    pthread_cond_init(&bench.cond, NULL);
+
+    task_data_t *tasks = calloc(bench.task_count, sizeof(task_data_t));
+
+    if (tasks == NULL) {
+        abort();
+    }
+
+    producer_t producers[MAX_PRODUCER_COUNT];
+    pthread_t threads[MAX_PRODUCER_COUNT];
+    uint64_t start = now_ns();
+
+    for (size_t i = 0; i < producer_count; ++i) {
+        producers[i] = (producer_t) {
+            .bench = &bench,
+            .tasks = tasks + i * (task_count / producer_count),
+            .task_count = task_count / producer_count,
+        };
+
+        if (pthread_create(&threads[i], NULL, producer_run, &producers[i]) != 0) {
+            abort();
+        }
+    }
+
+    for (size_t i = 0; i < producer_count; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+
+    pthread_mutex_lock(&bench.mtx);
+
+    while (atomic_load_explicit(&bench.done, memory_order_acquire) < bench.task_count) {
+        pthread_cond_wait(&bench.cond, &bench.mtx);
+    }
+
+    pthread_mutex_unlock(&bench.mtx);
+
+    double elapsed = (double) (now_ns() - start) / 1e9;
+    uint64_t latency_sum = atomic_load_explicit(&bench.latency_sum, memory_order_relaxed);
+    uint64_t latency_max = atomic_load_explicit(&bench.latency_max, memory_order_relaxed);
+
+    printf("%9zu %12.0f %14.2f %14.2f\n",
+        producer_count,
+        (double) bench.task_count / elapsed,
+        (double) latency_sum / (double) bench.task_count / 1e3,
+        (double) latency_max / 1e3);
+
+    free(tasks);
+    pthread_cond_destroy(&bench.cond);
+    pthread_mutex_destroy(&bench.mtx);
+}
+
+// Creates the executor named `kind`, which must be either `thread-pool` or `work-stealing`.
+static error_t *executor_new(char const *kind, size_t worker_count, executor_t **result) {
+    error_t *err = NULL;
+
+    if (strcmp(kind, "thread-pool") == 0) {
+        executor_thread_pool_config_t config = {
+            .min_size = worker_count,
+            .max_size = worker_count,
+        };
+        executor_thread_pool_t *executor = NULL;
+        err = executor_thread_pool_new("bench", &config, &executor);
+        *result = (executor_t *) executor;
+    } else {
+        executor_work_stealing_t *executor = NULL;
+        err = executor_work_stealing_new("bench", worker_count, &executor);
+        *result = (executor_t *) executor;
+    }
+
+    return err;
+}
+
+static void print_usage(void) {
+    fputs("Usage: executor-submit <thread-pool|work-stealing> [<workers>] [<tasks>]\n", stderr);
+}
+
+int main(int argc, char **argv) {
+    error_t *err = NULL;
+
+    if (argc < 2 || argc > 4
+            || (strcmp(argv[1], "thread-pool") != 0 && strcmp(argv[1], "work-stealing") != 0)) {
+        print_usage();
+
+        return 1;
+    }
+
+    size_t worker_count = argc > 2 ? strtoull(argv[2], NULL, 10) : DEFAULT_WORKER_COUNT;
+    size_t task_count = argc > 3 ? strtoull(argv[3], NULL, 10) : DEFAULT_TASK_COUNT;
+
+    if (worker_count == 0 || task_count < MAX_PRODUCER_COUNT) {
+        fputs("The worker count must be positive, and there must be at least 64 tasks\n", stderr);
+
+        return 1;
+    }
+
+    log_set_level(LOG_WARN);
+
+    executor_t *executor = NULL;
+    err = executor_new(argv[1], worker_count, &executor);
+    if (err) goto new_fail;
+
+    printf("%s, %zu workers, %zu tasks per run\n", argv[1], worker_count, task_count);
+    printf("%9s %12s %14s %14s\n", "producers", "tasks/s", "mean lat, us", "max lat, us");
+
+    for (size_t producer_count = 1; producer_count <= MAX_PRODUCER_COUNT; producer_count *= 2) {
+        bench_run(executor, producer_count, task_count);
+    }
+
+    executor_shutdown(executor);
+    executor_await_termination(executor);
+    executor_free(executor);
+
+new_fail:
+    if (err) {
+        error_log_free(&err, LOG_ERR, ERROR_VERBOSITY_SOURCE_CHAIN);
+
+        return 1;
+    }
+
+    return 0;
+}
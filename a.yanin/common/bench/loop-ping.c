@@ -0,0 +1,313 @@
+// clock_gettime(2) and socketpair(2) are not part of C
+#define _POSIX_C_SOURCE 200809L
+
+// Measures the cost of a loop iteration with each of the backends.
+//
+// Usage: loop-ping <poll|epoll|io_uring> [<active>] [<idle>] [<round trips>]
+//
+// The `active` connections are socket pairs with both ends registered in the loop, which bounce a
+// byte between them for as long as the benchmark runs. The `idle` handlers are ends of socket pairs
+// that never receive anything, like the connections of clients that keep them open between
+// requests. A single-threaded executor runs the handlers inline, so the time is all spent in the
+// loop and the handlers' reads and writes. The benchmark reports the round trips per second and
+// the time of a round trip, which takes two wakeups when there's a single active connection.
+//
+// To count the system calls, run it under `strace -c -f`.
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <sys/resource.h>
+#include <sys/socket.h>
+
+#include <common/error-codes/adapter.h>
+#include <common/executor/single.h>
+#include <common/log/log.h>
+#include <common/loop/loop.h>
+#include <common/posix/adapter.h>
+#include <common/posix/file.h>
+#include <common/posix/io.h>
+
+enum {
+    DEFAULT_ACTIVE_COUNT = 1,
+    DEFAULT_IDLE_COUNT = 10000,
+    DEFAULT_ROUND_TRIP_COUNT = 1 << 16,
+    // the fds the process needs besides the connections
+    SPARE_FD_COUNT = 64,
+};
+
+typedef struct {
+    loop_t *loop;
+    size_t round_trip_count;
+    size_t round_trips;
+} bench_t;
+
+// An end of a socket pair.
+typedef struct {
+    handler_t handler;
+    bench_t *bench;
+    // whether a byte arriving at this end completes a round trip
+    bool counts;
+} conn_t;
+
+static uint64_t now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t) now.tv_sec * 1000000000 + (uint64_t) now.tv_nsec;
+}
+
+static void conn_free(conn_t *self) {
+    error_t *err = error_from_posix(wrapper_close(handler_fd(&self->handler)));
+
+    if (err) {
+        error_log_free(&err, LOG_WARN, ERROR_VERBOSITY_SOURCE_CHAIN);
+    }
+}
+
+// Sends the byte that has arrived back to the other end.
+static error_t *conn_process(conn_t *self, loop_t *loop, poll_flags_t flags) {
+    error_t *err = NULL;
+
+    if (!(flags & LOOP_READ)) {
+        return NULL;
+    }
+
+    char buf = 0;
+    ssize_t count = 0;
+    err = error_from_posix(wrapper_read(handler_fd(&self->handler), &buf, 1, &count));
+    if (err) goto read_fail;
+
+    if (count == 0) {
+        // the other end has been closed
+        handler_unregister(&self->handler);
+
+        return NULL;
+    }
+
+    bench_t *bench = self->bench;
+
+    if (self->counts && ++bench->round_trips == bench->round_trip_count) {
+        loop_stop(loop);
+    } else {
+        err = error_from_posix(wrapper_write(handler_fd(&self->handler), &buf, 1, &count));
+    }
+
+read_fail:
+    return err;
+}
+
+static handler_vtable_t const conn_vtable = {
+    .free = (handler_vtable_free_t) conn_free,
+    .process = (handler_vtable_process_t) conn_process,
+    .on_error = NULL,
+};
+
+static error_t *conn_new(bench_t *bench, int fd, bool counts, conn_t **result) {
+    error_t *err = NULL;
+
+    conn_t *self = calloc(1, sizeof(conn_t));
+    err = error_wrap("Could not allocate memory", OK_IF(self != NULL));
+    if (err) goto calloc_fail;
+
+    handler_init(&self->handler, &conn_vtable, fd);
+    self->bench = bench;
+    self->counts = counts;
+    handler_set_pending_mask(&self->handler, LOOP_READ);
+
+    *result = self;
+
+calloc_fail:
+    return err;
+}
+
+// Registers a handler of `fd` in the loop.
+//
+// The fd is closed if this fails.
+static error_t *bench_add_end(bench_t *bench, int fd, bool counts) {
+    error_t *err = NULL;
+
+    err = error_from_posix(wrapper_fcntli(fd, F_SETFL, O_NONBLOCK));
+    if (err) goto fcntli_fail;
+
+    conn_t *conn = NULL;
+    err = conn_new(bench, fd, counts, &conn);
+    if (err) goto conn_new_fail;
+
+    err = loop_register(bench->loop, &conn->handler);
+    if (err) goto loop_register_fail;
+
+    return err;
+
+loop_register_fail:
+    // closes the fd
+    handler_free(&conn->handler);
+
+    return err;
+
+conn_new_fail:
+fcntli_fail:
+    wrapper_close(fd);
+
+    return err;
+}
+
+// Registers both ends of a new socket pair in the loop.
+//
+// If `first_fd` is not `NULL`, the first end's fd is stored there.
+static error_t *bench_add_pair(bench_t *bench, bool active, int *first_fd) {
+    error_t *err = NULL;
+
+    int fds[2];
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+        err = error_wrap("Could not create a socket pair", error_from_errno(errno));
+
+        goto socketpair_fail;
+    }
+
+    err = bench_add_end(bench, fds[0], false);
+    if (err) goto first_fail;
+
+    // the first end is closed when the loop frees its handler
+    err = bench_add_end(bench, fds[1], active);
+    if (err) goto socketpair_fail;
+
+    if (first_fd != NULL) {
+        *first_fd = fds[0];
+    }
+
+    return err;
+
+first_fail:
+    wrapper_close(fds[1]);
+
+socketpair_fail:
+    return err;
+}
+
+// Lets the process open as many fds as it's allowed to.
+static error_t *raise_fd_limit(size_t needed) {
+    struct rlimit limit;
+
+    if (getrlimit(RLIMIT_NOFILE, &limit) != 0) {
+        return error_wrap("Could not get the fd limit", error_from_errno(errno));
+    }
+
+    if (limit.rlim_cur != RLIM_INFINITY && limit.rlim_cur < needed) {
+        limit.rlim_cur = limit.rlim_max;
+
+        if (setrlimit(RLIMIT_NOFILE, &limit) != 0) {
+            return error_wrap("Could not raise the fd limit", error_from_errno(errno));
+        }
+    }
+
+    return error_wrap("The fd limit is too low for this many connections", OK_IF(
+        limit.rlim_cur == RLIM_INFINITY || limit.rlim_cur >= needed));
+}
+
+static void print_usage(void) {
+    fputs("Usage: loop-ping <poll|epoll|io_uring> [<active>] [<idle>] [<round trips>]\n", stderr);
+}
+
+int main(int argc, char **argv) {
+    error_t *err = NULL;
+
+    if (argc < 2 || argc > 5) {
+        print_usage();
+
+        return 1;
+    }
+
+    loop_backend_t backend = LOOP_BACKEND_DEFAULT;
+
+    if (strcmp(argv[1], "poll") == 0) {
+        backend = LOOP_BACKEND_POLL;
+    } else if (strcmp(argv[1], "epoll") == 0) {
+        backend = LOOP_BACKEND_EPOLL;
+    } else if (strcmp(argv[1], "io_uring") == 0) {
+        backend = LOOP_BACKEND_IO_URING;
+    } else {
+        print_usage();
+
+        return 1;
+    }
+
+    size_t active_count = argc > 2 ? strtoull(argv[2], NULL, 10) : DEFAULT_ACTIVE_COUNT;
+    size_t idle_count = argc > 3 ? strtoull(argv[3], NULL, 10) : DEFAULT_IDLE_COUNT;
+    size_t round_trip_count = argc > 4 ? strtoull(argv[4], NULL, 10) : DEFAULT_ROUND_TRIP_COUNT;
+
+    if (active_count == 0 || round_trip_count == 0) {
+        fputs("The active connection and round trip counts must be positive\n", stderr);
+
+        return 1;
+    }
+
+    log_set_level(LOG_WARN);
+
+    // the idle handlers come in pairs as well
+    size_t pair_count = active_count + (idle_count + 1) / 2;
+    err = raise_fd_limit(2 * pair_count + SPARE_FD_COUNT);
+    if (err) goto limit_fail;
+
+    executor_single_t *executor = NULL;
+    err = executor_single_new("bench", &executor);
+    if (err) goto executor_new_fail;
+
+    bench_t bench = {
+        .round_trip_count = round_trip_count,
+    };
+    err = loop_new_with_backend((executor_t *) executor, backend, &bench.loop);
+    if (err) goto loop_new_fail;
+
+    for (size_t i = 0; i < (idle_count + 1) / 2; ++i) {
+        err = bench_add_pair(&bench, false, NULL);
+        if (err) goto add_fail;
+    }
+
+    for (size_t i = 0; i < active_count; ++i) {
+        int fd = -1;
+        err = bench_add_pair(&bench, true, &fd);
+        if (err) goto add_fail;
+
+        // the first byte, which the ends then keep sending back to each other
+        ssize_t count = 0;
+        err = error_from_posix(wrapper_write(fd, "x", 1, &count));
+        if (err) goto add_fail;
+    }
+
+    printf("%s backend, %zu active and %zu idle connections, %zu round trips\n",
+        argv[1], active_count, (idle_count + 1) / 2 * 2, round_trip_count);
+
+    uint64_t start = now_ns();
+    err = loop_run(bench.loop);
+    double elapsed = (double) (now_ns() - start) / 1e9;
+    if (err) goto run_fail;
+
+    printf("%14s %18s\n", "round trips/s", "us per round trip");
+    printf("%14.0f %18.2f\n",
+        (double) bench.round_trips / elapsed,
+        elapsed * 1e6 / (double) bench.round_trips);
+
+run_fail:
+add_fail:
+    // also frees the handlers if the loop has never run
+    loop_free(bench.loop);
+
+loop_new_fail:
+    executor_free((executor_t *) executor);
+
+executor_new_fail:
+limit_fail:
+    if (err) {
+        error_log_free(&err, LOG_ERR, ERROR_VERBOSITY_SOURCE_CHAIN);
+
+        return 1;
+    }
+
+    return 0;
+}
@@ -145,6 +145,8 @@ DLIST_STATIC void DLIST_NAME(free)(DLIST_TYPE *self) {
     }
 }
 
+// only used in assertions
+[[maybe_unused]]
 static bool DLIST_NAME(contains)(
     DLIST_TYPE const *self,
     DLIST_NODE_TYPE const *node
@@ -490,9 +492,11 @@ DLIST_STATIC void DLIST_NAME(swap)(DLIST_TYPE *self, DLIST_NODE_TYPE *lhs, DLIST
     }
 }
 
+// only used in assertions
+[[maybe_unused]]
 static bool DLIST_NAME(is_valid)(DLIST_TYPE const *self) {
-    size_t actual_len = 0;
-    DLIST_NODE_TYPE const *actual_end = NULL;
+    [[maybe_unused]] size_t actual_len = 0;
+    [[maybe_unused]] DLIST_NODE_TYPE const *actual_end = NULL;
 
     for (DLIST_NODE_TYPE const *node = self->head;
             node != NULL;
@@ -199,7 +199,7 @@ HASH_STATIC void HASH_NAME(free)(HASH_TYPE *self) {
     self->capacity = 0;
 }
 
-static bool should_rehash(size_t non_free_entries, size_t capacity) {
+static bool HASH_NAME(should_rehash)(size_t non_free_entries, size_t capacity) {
     assert(capacity > 0);
 
     return (double) non_free_entries / capacity >= HASH_MAX_LOAD_FACTOR;
@@ -256,7 +256,7 @@ HASH_STATIC common_error_code_t HASH_NAME(insert)(
 
     common_error_code_t status = COMMON_ERROR_CODE_OK;
 
-    if (should_rehash(self->non_free_entries, self->capacity)) {
+    if (HASH_NAME(should_rehash)(self->non_free_entries, self->capacity)) {
         GOTO_ON_ERROR(status = HASH_NAME(rehash)(self), fail);
     }
 
@@ -0,0 +1,225 @@
+#include "common/collections.h"
+
+#pragma GCC diagnostic push
+
+#ifndef MPMC_ELEMENT_TYPE
+#error "MPMC_ELEMENT_TYPE is not defined"
+#endif
+
+#ifndef MPMC_LABEL
+#error "MPMC_LABEL is not defined"
+#endif
+
+#ifndef MPMC_CONFIG
+#define MPMC_CONFIG COLLECTION_DEFAULT
+#endif
+
+#ifndef MPMC_GENERIC_NAME
+#define MPMC_GENERIC_NAME(LABEL, ITEM) \
+    CONCAT(mpmc_, CONCAT(LABEL, CONCAT(_, ITEM)))
+#endif
+
+#define MPMC_NAME(ITEM) MPMC_GENERIC_NAME(MPMC_LABEL, ITEM)
+#define MPMC_TYPE MPMC_NAME(t)
+#define MPMC_CELL_TYPE MPMC_NAME(cell_t)
+
+// the assumed size of a cache line
+#define MPMC_CACHE_LINE 64
+
+#if (MPMC_CONFIG) & COLLECTION_STATIC
+#define MPMC_STATIC static
+#pragma GCC diagnostic ignored "-Wunused-function"
+#else
+#define MPMC_STATIC
+#endif
+
+#if (MPMC_CONFIG) & COLLECTION_DECLARE
+
+#include <stdatomic.h>
+#include <stddef.h>
+
+#include "common/error-codes/error-codes.h"
+
+typedef struct {
+    // the position of the element the cell is ready for:
+    // - `pos` if it's vacant and can be filled by the push at `pos`;
+    // - `pos + 1` if it has been filled by the push at `pos` and can be taken by the pop at `pos`
+    atomic_size_t seq;
+    MPMC_ELEMENT_TYPE value;
+} MPMC_CELL_TYPE;
+
+// A bounded lock-free queue that any number of threads can push to and pop from concurrently
+// (D. Vyukov's design).
+//
+// Neither operation allocates, and they only ever contend over the respective position counter.
+typedef struct {
+    MPMC_CELL_TYPE *cells;
+    size_t mask;
+
+    // the counters are kept on separate cache lines so that the producers and the consumers don't
+    // keep stealing them from each other
+    char pad_head[MPMC_CACHE_LINE];
+    atomic_size_t push_pos;
+    char pad_push[MPMC_CACHE_LINE - sizeof(atomic_size_t)];
+    atomic_size_t pop_pos;
+    char pad_pop[MPMC_CACHE_LINE - sizeof(atomic_size_t)];
+} MPMC_TYPE;
+
+// Initializes a queue that holds up to `capacity` elements, rounded up to a power of two.
+MPMC_STATIC common_error_code_t MPMC_NAME(init)(MPMC_TYPE *self, size_t capacity);
+MPMC_STATIC void MPMC_NAME(free)(MPMC_TYPE *self);
+
+// Adds an element to the back of the queue.
+//
+// Returns `false` if the queue is full.
+MPMC_STATIC bool MPMC_NAME(push)(MPMC_TYPE *self, MPMC_ELEMENT_TYPE value);
+
+// Takes the element at the front of the queue.
+//
+// Returns `false` if the queue is empty, or if the element at the front is still being pushed.
+MPMC_STATIC bool MPMC_NAME(pop)(MPMC_TYPE *self, MPMC_ELEMENT_TYPE *result);
+
+// Returns the number of elements in the queue, including those still being pushed.
+//
+// The value may be stale by the time it's used.
+MPMC_STATIC size_t MPMC_NAME(len)(MPMC_TYPE *self);
+MPMC_STATIC size_t MPMC_NAME(capacity)(MPMC_TYPE const *self);
+
+#endif // #if (MPMC_CONFIG) & COLLECTION_DECLARE
+
+#if (MPMC_CONFIG) & COLLECTION_DEFINE
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+MPMC_STATIC common_error_code_t MPMC_NAME(init)(MPMC_TYPE *self, size_t capacity) {
+    assert(self != NULL);
+    assert(capacity > 0);
+
+    size_t rounded = 1;
+
+    while (rounded < capacity) {
+        rounded *= 2;
+    }
+
+    MPMC_CELL_TYPE *cells = malloc(rounded * sizeof(MPMC_CELL_TYPE));
+
+    if (cells == NULL) {
+        return COMMON_ERROR_CODE_MEMORY_ALLOCATION_FAILURE;
+    }
+
+    for (size_t i = 0; i < rounded; ++i) {
+        atomic_init(&cells[i].seq, i);
+    }
+
+    self->cells = cells;
+    self->mask = rounded - 1;
+    atomic_init(&self->push_pos, 0);
+    atomic_init(&self->pop_pos, 0);
+
+    return COMMON_ERROR_CODE_OK;
+}
+
+MPMC_STATIC void MPMC_NAME(free)(MPMC_TYPE *self) {
+    assert(self != NULL);
+
+    free(self->cells);
+    self->cells = NULL;
+    self->mask = 0;
+}
+
+MPMC_STATIC bool MPMC_NAME(push)(MPMC_TYPE *self, MPMC_ELEMENT_TYPE value) {
+    assert(self != NULL);
+
+    size_t pos = atomic_load_explicit(&self->push_pos, memory_order_relaxed);
+    MPMC_CELL_TYPE *cell = NULL;
+
+    while (true) {
+        cell = &self->cells[pos & self->mask];
+        size_t seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+        intptr_t diff = (intptr_t) seq - (intptr_t) pos;
+
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(
+                    &self->push_pos, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            // the cell still holds the element pushed a lap ago
+            return false;
+        } else {
+            pos = atomic_load_explicit(&self->push_pos, memory_order_relaxed);
+        }
+    }
+
+    cell->value = value;
+    atomic_store_explicit(&cell->seq, pos + 1, memory_order_release);
+
+    return true;
+}
+
+MPMC_STATIC bool MPMC_NAME(pop)(MPMC_TYPE *self, MPMC_ELEMENT_TYPE *result) {
+    assert(self != NULL);
+    assert(result != NULL);
+
+    size_t pos = atomic_load_explicit(&self->pop_pos, memory_order_relaxed);
+    MPMC_CELL_TYPE *cell = NULL;
+
+    while (true) {
+        cell = &self->cells[pos & self->mask];
+        size_t seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+        intptr_t diff = (intptr_t) seq - (intptr_t) (pos + 1);
+
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(
+                    &self->pop_pos, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return false;
+        } else {
+            pos = atomic_load_explicit(&self->pop_pos, memory_order_relaxed);
+        }
+    }
+
+    *result = cell->value;
+    // vacate the cell for the push a lap ahead
+    atomic_store_explicit(&cell->seq, pos + self->mask + 1, memory_order_release);
+
+    return true;
+}
+
+MPMC_STATIC size_t MPMC_NAME(len)(MPMC_TYPE *self) {
+    assert(self != NULL);
+
+    size_t pop_pos = atomic_load(&self->pop_pos);
+    size_t push_pos = atomic_load(&self->push_pos);
+
+    return push_pos > pop_pos ? push_pos - pop_pos : 0;
+}
+
+MPMC_STATIC size_t MPMC_NAME(capacity)(MPMC_TYPE const *self) {
+    assert(self != NULL);
+
+    return self->mask + 1;
+}
+
+#endif // #if (MPMC_CONFIG) & COLLECTION_DEFINE
+
+#undef MPMC_STATIC
+
+#undef MPMC_CACHE_LINE
+#undef MPMC_CELL_TYPE
+#undef MPMC_TYPE
+#undef MPMC_NAME
+
+#if !((MPMC_CONFIG) & COLLECTION_EXPORT_GENERIC_NAME)
+#undef MPMC_GENERIC_NAME
+#endif
+
+#undef MPMC_CONFIG
+#undef MPMC_LABEL
+#undef MPMC_ELEMENT_TYPE
+
+#pragma GCC diagnostic pop
@@ -0,0 +1,234 @@
+#include "common/collections.h"
+
+#pragma GCC diagnostic push
+
+#ifndef RING_ELEMENT_TYPE
+#error "RING_ELEMENT_TYPE is not defined"
+#endif
+
+#ifndef RING_LABEL
+#error "RING_LABEL is not defined"
+#endif
+
+#ifndef RING_CONFIG
+#define RING_CONFIG COLLECTION_DEFAULT
+#endif
+
+#ifndef RING_GENERIC_NAME
+#define RING_GENERIC_NAME(LABEL, ITEM) \
+    CONCAT(ring_, CONCAT(LABEL, CONCAT(_, ITEM)))
+#endif
+
+#define RING_NAME(ITEM) RING_GENERIC_NAME(RING_LABEL, ITEM)
+#define RING_TYPE RING_NAME(t)
+
+#define RING_ENLARGEMENT_MULTIPLIER 2
+
+#if (RING_CONFIG) & COLLECTION_STATIC
+#define RING_STATIC static
+#pragma GCC diagnostic ignored "-Wunused-function"
+#else
+#define RING_STATIC
+#endif
+
+#if (RING_CONFIG) & COLLECTION_DECLARE
+
+#include <stddef.h>
+
+#include "common/error-codes/error-codes.h"
+
+// The elements occupy `len` consecutive slots of `storage` starting from `head`, wrapping around
+// the end of the buffer.
+typedef struct {
+    RING_ELEMENT_TYPE *storage;
+    size_t capacity;
+    size_t head;
+    size_t len;
+} RING_TYPE;
+
+RING_STATIC RING_TYPE RING_NAME(new)(void);
+RING_STATIC void RING_NAME(free)(RING_TYPE *self);
+
+RING_STATIC common_error_code_t RING_NAME(resize)(RING_TYPE *self, size_t new_capacity);
+
+// Appends an element to the back of the queue.
+RING_STATIC common_error_code_t RING_NAME(push)(RING_TYPE *self, RING_ELEMENT_TYPE value);
+
+// Removes the element at the front of the queue.
+RING_STATIC void RING_NAME(pop_front)(RING_TYPE *self);
+RING_STATIC void RING_NAME(clear)(RING_TYPE *self);
+
+// Returns the element `pos` positions away from the front, or `NULL` if out of bounds.
+RING_STATIC RING_ELEMENT_TYPE const *RING_NAME(get)(RING_TYPE const *self, size_t pos);
+RING_STATIC RING_ELEMENT_TYPE *RING_NAME(get_mut)(RING_TYPE *self, size_t pos);
+
+RING_STATIC size_t RING_NAME(len)(RING_TYPE const *self);
+RING_STATIC size_t RING_NAME(capacity)(RING_TYPE const *self);
+
+#endif // #if (RING_CONFIG) & COLLECTION_DECLARE
+
+#if (RING_CONFIG) & COLLECTION_DEFINE
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+RING_STATIC RING_TYPE RING_NAME(new)(void) {
+    RING_TYPE result = {
+        .storage = NULL,
+        .capacity = 0,
+        .head = 0,
+        .len = 0,
+    };
+
+    return result;
+}
+
+RING_STATIC void RING_NAME(free)(RING_TYPE *self) {
+    assert(self != NULL);
+
+    free(self->storage);
+    *self = RING_NAME(new)();
+}
+
+RING_STATIC common_error_code_t RING_NAME(resize)(RING_TYPE *self, size_t new_capacity) {
+    assert(self != NULL);
+    assert(new_capacity >= self->len);
+
+    if (new_capacity == 0) {
+        RING_NAME(free)(self);
+
+        return COMMON_ERROR_CODE_OK;
+    }
+
+    if (self->capacity == new_capacity) {
+        return COMMON_ERROR_CODE_OK;
+    }
+
+    RING_ELEMENT_TYPE *storage = malloc(new_capacity * sizeof(RING_ELEMENT_TYPE));
+
+    if (storage == NULL) {
+        return COMMON_ERROR_CODE_MEMORY_ALLOCATION_FAILURE;
+    }
+
+    // unwrap the elements so that they start at the beginning of the new buffer
+    size_t first_len = self->capacity - self->head;
+
+    if (first_len > self->len) {
+        first_len = self->len;
+    }
+
+    if (self->len > 0) {
+        memcpy(storage, self->storage + self->head, first_len * sizeof(RING_ELEMENT_TYPE));
+        memcpy(
+            storage + first_len,
+            self->storage,
+            (self->len - first_len) * sizeof(RING_ELEMENT_TYPE)
+        );
+    }
+
+    free(self->storage);
+    self->storage = storage;
+    self->capacity = new_capacity;
+    self->head = 0;
+
+    return COMMON_ERROR_CODE_OK;
+}
+
+RING_STATIC common_error_code_t RING_NAME(push)(RING_TYPE *self, RING_ELEMENT_TYPE value) {
+    assert(self != NULL);
+
+    if (self->len == self->capacity) {
+        size_t new_capacity = self->capacity * RING_ENLARGEMENT_MULTIPLIER;
+
+        if (self->capacity == 0) {
+            new_capacity = 1;
+        }
+
+        common_error_code_t code = RING_NAME(resize)(self, new_capacity);
+
+        if (code != COMMON_ERROR_CODE_OK) {
+            return code;
+        }
+    }
+
+    size_t tail = self->head + self->len;
+
+    if (tail >= self->capacity) {
+        tail -= self->capacity;
+    }
+
+    self->storage[tail] = value;
+    self->len++;
+
+    return COMMON_ERROR_CODE_OK;
+}
+
+RING_STATIC void RING_NAME(pop_front)(RING_TYPE *self) {
+    assert(self != NULL);
+    assert(self->len > 0);
+
+    self->len--;
+    self->head++;
+
+    if (self->head == self->capacity || self->len == 0) {
+        self->head = 0;
+    }
+}
+
+RING_STATIC void RING_NAME(clear)(RING_TYPE *self) {
+    assert(self != NULL);
+
+    self->head = 0;
+    self->len = 0;
+}
+
+RING_STATIC RING_ELEMENT_TYPE const *RING_NAME(get)(RING_TYPE const *self, size_t pos) {
+    assert(self != NULL);
+
+    if (pos >= self->len) {
+        return NULL;
+    }
+
+    size_t idx = self->head + pos;
+
+    if (idx >= self->capacity) {
+        idx -= self->capacity;
+    }
+
+    return &self->storage[idx];
+}
+
+RING_STATIC RING_ELEMENT_TYPE *RING_NAME(get_mut)(RING_TYPE *self, size_t pos) {
+    return (RING_ELEMENT_TYPE *) RING_NAME(get)(self, pos);
+}
+
+RING_STATIC size_t RING_NAME(len)(RING_TYPE const *self) {
+    assert(self != NULL);
+
+    return self->len;
+}
+
+RING_STATIC size_t RING_NAME(capacity)(RING_TYPE const *self) {
+    assert(self != NULL);
+
+    return self->capacity;
+}
+
+#endif // #if (RING_CONFIG) & COLLECTION_DEFINE
+
+#undef RING_STATIC
+
+#undef RING_ENLARGEMENT_MULTIPLIER
+#undef RING_TYPE
+#undef RING_NAME
+
+#if !((RING_CONFIG) & COLLECTION_EXPORT_GENERIC_NAME)
+#undef RING_GENERIC_NAME
+#endif
+
+#undef RING_CONFIG
+#undef RING_LABEL
+#undef RING_ELEMENT_TYPE
+
+#pragma GCC diagnostic pop
@@ -273,19 +273,18 @@ VEC_STATIC void VEC_NAME(remove)(VEC_TYPE *self, size_t pos) {
 
 VEC_STATIC void VEC_NAME(remove_slice)(VEC_TYPE *self, size_t start, size_t end) {
     assert(self != NULL);
-    assert(start < end);
+    assert(start <= end);
 
     if (end > self->len) {
         end = self->len;
     }
 
-    size_t count = end - start;
     memmove(
         self->storage + start,
-        self->storage + start + end,
-        count
+        self->storage + end,
+        (self->len - end) * sizeof(VEC_ELEMENT_TYPE)
     );
-    self->len -= count;
+    self->len -= end - start;
 }
 
 VEC_STATIC void VEC_NAME(set_len)(VEC_TYPE *self, size_t new_len) {
@@ -2,23 +2,78 @@
 
 #include <common/executor/executor.h>
 
-// A multi-threaded executor with a fixed-size thread pool.
+// A multi-threaded executor with a thread pool.
 //
-// Tasks submitted to the executor are added to a queue.
+// Tasks submitted to the executor are added to the queue of their lane.
+// A queue is lock-free and does not allocate until it holds a few thousand tasks; past that, the
+// tasks spill into a list guarded by a mutex.
+// The workers prefer the more urgent lanes, but let the others go first every few turns (see
+// `executor_lane_order`).
+//
+// The pool can be adaptive: a supervisor thread then measures how long the tasks wait in the queue
+// and how busy the workers are. If the tasks keep waiting (e.g., because the workers are blocked),
+// the pool grows; if the workers are mostly idle for a while, the idle ones are retired.
+//
+// The workers can be pinned to CPUs. The pool then has a set of queues per NUMA node its workers
+// run on: a worker takes the tasks queued on its own node first and only steals from the other
+// nodes when its node has nothing to do in that lane. The tasks submitted by a worker stay on its
+// node, while those submitted from the outside are spread across the nodes (unless
+// `executor_submit_to_node` asks for a specific one). The node numbers the pool uses with the
+// executor API are the indices of these queues, not the system's node numbers.
 typedef struct executor_thread_pool executor_thread_pool_t;
 
+typedef enum {
+    // The workers are not pinned, and the pool has a single queue. This is the default.
+    THREAD_POOL_PLACEMENT_NONE,
+
+    // The workers are pinned to the available CPUs in order, filling up a NUMA node before moving
+    // on to the next one.
+    THREAD_POOL_PLACEMENT_COMPACT,
+
+    // The workers are pinned to the available CPUs round-robin across the NUMA nodes.
+    THREAD_POOL_PLACEMENT_SCATTER,
+
+    // The workers are pinned to the CPUs listed in the placement, in order.
+    THREAD_POOL_PLACEMENT_CPU_LIST,
+} executor_thread_pool_placement_policy_t;
+
+typedef struct {
+    executor_thread_pool_placement_policy_t policy;
+
+    // The CPUs to pin the workers to, for `THREAD_POOL_PLACEMENT_CPU_LIST`.
+    // If there are more workers than CPUs, the list wraps around.
+    //
+    // Must have at least one entry, each of which the process is allowed to run on.
+    int const *cpus;
+    size_t cpu_count;
+} executor_thread_pool_placement_t;
+
+typedef struct {
+    // The number of threads the pool starts with and never shrinks below. Must be positive.
+    size_t min_size;
+
+    // The number of threads the pool never grows beyond. Must be at least `min_size`.
+    //
+    // If equal to `min_size`, the pool has a fixed size and does not measure its load.
+    size_t max_size;
+
+    // Where the workers run. Pinning the workers fails if CPU affinity is not supported.
+    executor_thread_pool_placement_t placement;
+} executor_thread_pool_config_t;
+
 typedef error_t *(*executor_thread_pool_on_error_cb_t)(
     executor_thread_pool_t *self,
     error_t *err,
     task_t task
 );
 
-// Creates a new thread pool executor with the given `size`.
+// Creates a new thread pool executor.
 //
-// The threads are spawn immediately; if any thread fails to start, an error is returned.
+// The first `config->min_size` threads are spawn immediately; if any thread fails to start, an
+// error is returned.
 error_t *executor_thread_pool_new(
     char const *pool_name,
-    size_t size,
+    executor_thread_pool_config_t const *config,
     executor_thread_pool_t **result
 );
 
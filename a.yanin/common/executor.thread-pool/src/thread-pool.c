@@ -1,22 +1,70 @@
 #include <common/executor/thread-pool.h>
 
 #include <common/error-codes/adapter.h>
+#include <common/posix/adapter.h>
+#include <common/posix/time.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdatomic.h>
 #include <stdio.h>
+#include <time.h>
 
+#include "topology.h"
 #include "util.h"
 
-#define VEC_ELEMENT_TYPE pthread_t
-#define VEC_LABEL pthread
-#define VEC_CONFIG (COLLECTION_DECLARE | COLLECTION_DEFINE | COLLECTION_STATIC)
-#include <common/collections/vec.h>
+// A task waiting in the queue.
+typedef struct {
+    task_t task;
+    // when the task was submitted, in nanoseconds; only recorded if the pool is adaptive
+    uint64_t submitted_ns;
+} queued_task_t;
 
-#define DLIST_ELEMENT_TYPE task_t
-#define DLIST_LABEL task
-#define DLIST_CONFIG (COLLECTION_DECLARE | COLLECTION_DEFINE | COLLECTION_STATIC)
-#include <common/collections/dlist.h>
+#define RING_ELEMENT_TYPE queued_task_t
+#define RING_LABEL task
+#define RING_CONFIG (COLLECTION_DECLARE | COLLECTION_DEFINE | COLLECTION_STATIC)
+#include <common/collections/ring.h>
+
+#define MPMC_ELEMENT_TYPE queued_task_t
+#define MPMC_LABEL task
+#define MPMC_CONFIG (COLLECTION_DECLARE | COLLECTION_DEFINE | COLLECTION_STATIC)
+#include <common/collections/mpmc.h>
+
+enum {
+    // The number of tasks the lock-free queue of a lane can hold before they start to spill into
+    // its overflow list.
+    THREAD_POOL_QUEUE_CAPACITY = 4096,
+
+    // How often the supervisor of an adaptive pool looks at the load, in milliseconds.
+    THREAD_POOL_TICK_MS = 100,
+
+    // The mean queue delay above which a tick counts as overloaded, in microseconds.
+    THREAD_POOL_GROW_DELAY_US = 2000,
+
+    // The mean queue delay below which a tick may count as underloaded, in microseconds.
+    //
+    // The gap between this and `THREAD_POOL_GROW_DELAY_US` keeps the pool from flapping.
+    THREAD_POOL_SHRINK_DELAY_US = 200,
+
+    // The number of consecutive overloaded ticks after which the pool grows by a thread per tick.
+    THREAD_POOL_GROW_TICKS = 2,
+
+    // The number of consecutive underloaded ticks after which an idle thread is retired.
+    THREAD_POOL_SHRINK_TICKS = 50,
+
+    // The number of ticks between retirements while the pool stays underloaded.
+    THREAD_POOL_RETIRE_INTERVAL_TICKS = 10,
+
+    // The utilization, in percent, that the remaining threads must stay under for a thread to be
+    // retired.
+    THREAD_POOL_SHRINK_UTILIZATION = 50,
+};
+
+typedef struct worker_slot worker_slot_t;
 
 static thread_local size_t current_thread_idx = 0;
 static thread_local char const *current_pool_name = NULL;
+// the slot of the calling thread if it's a worker of some pool
+static thread_local worker_slot_t *current_slot = NULL;
 
 typedef enum {
     // The thread pool is initializing.
@@ -31,18 +79,114 @@ typedef enum {
     THREAD_POOL_STOPPING,
 } thread_pool_state_t;
 
+typedef enum {
+    // No thread occupies the slot.
+    WORKER_SLOT_VACANT,
+
+    // The slot's thread is running.
+    WORKER_SLOT_RUNNING,
+
+    // The slot's thread has exited (or is about to) and has to be joined.
+    WORKER_SLOT_EXITED,
+} worker_slot_state_t;
+
+// A place for a worker thread. Its index is the one shown in the worker's log messages.
+//
+// A retired worker's slot is reused by the next thread the pool spawns.
+struct worker_slot {
+    executor_thread_pool_t *executor;
+    size_t idx;
+    // the CPU the slot's threads are pinned to, or -1 if they aren't
+    int cpu;
+    // the node whose queues the slot's threads take tasks from first
+    size_t node;
+    // the number of tasks the slot's threads have taken, which decides the order they look into
+    // the lanes in (see `executor_lane_order`); only used by the slot's thread
+    size_t turn;
+    pthread_t thread;
+    // only accessed with `mtx` locked
+    worker_slot_state_t state;
+
+    // The load counters, only updated by the slot's thread and only if the pool is adaptive.
+    // They keep growing across the threads that occupy the slot.
+
+    // the total time the tasks taken by the slot's threads have spent in the queue
+    atomic_uint_least64_t wait_ns;
+    // the total time the slot's threads have spent running tasks
+    atomic_uint_least64_t busy_ns;
+    // the number of tasks the slot's threads have taken
+    atomic_size_t taken;
+
+    // the values of the counters at the supervisor's last tick
+    uint64_t seen_wait_ns;
+    uint64_t seen_busy_ns;
+    size_t seen_taken;
+};
+
+// The queue of a lane.
+typedef struct {
+    // where the tasks are queued without allocating or locking
+    mpmc_task_t tasks;
+    // where the tasks go when `tasks` is full; only accessed with the pool's `mtx` locked
+    ring_task_t overflow;
+    // the length of `overflow`, readable without locking the mutex
+    atomic_size_t overflow_len;
+} thread_pool_queue_t;
+
+// The queues of the workers running on a NUMA node.
+typedef struct {
+    // indexed by `executor_lane_t`
+    thread_pool_queue_t queues[EXECUTOR_LANE_COUNT];
+
+    // the node's workers sleep on `cond`
+    pthread_cond_t cond;
+    // the number of the node's workers that are about to sleep or sleeping on `cond`
+    atomic_size_t idle_count;
+    // the number of the node's idle workers that have been signaled but have not woken up yet
+    atomic_size_t waking;
+} thread_pool_node_t;
+
 struct executor_thread_pool {
     executor_t executor;
 
     char const *pool_name;
-    size_t size;
-    vec_pthread_t threads;
-
+    size_t min_size;
+    size_t max_size;
+    worker_slot_t *slots;
+    // whether the pool changes its size with the load
+    bool adaptive;
+
+    // guards the overflow lists, the callback, the slots, and the state changes; the workers sleep
+    // on their node's `cond`
     pthread_mutex_t mtx;
-    pthread_cond_t cond;
-    thread_pool_state_t state;
-    dlist_task_t tasks;
+    // only modified with `mtx` locked
+    _Atomic thread_pool_state_t state;
+    // the number of submissions that have checked `state` but not yet queued their task
+    atomic_size_t submitting;
+    // a single node unless the workers are pinned
+    thread_pool_node_t *nodes;
+    size_t node_count;
+    // the node the next task submitted from the outside goes to
+    atomic_size_t next_node;
     executor_thread_pool_on_error_cb_t on_error;
+
+    // the number of slots with a running thread; only modified with `mtx` locked
+    size_t live_count;
+    // the number of idle workers asked to exit; only accessed with `mtx` locked
+    size_t retiring;
+
+    // The supervisor thread only runs if the pool is adaptive.
+    // It sleeps on `supervisor_cond`, which uses the monotonic clock.
+    pthread_t supervisor;
+    bool has_supervisor;
+    pthread_cond_t supervisor_cond;
+    // the number of consecutive overloaded and underloaded ticks; only used by the supervisor
+    size_t grow_streak;
+    size_t shrink_streak;
+
+    // makes sure the threads are only joined once
+    pthread_mutex_t join_mtx;
+    bool joined;
 };
 
 static void worker_thread_log_hook(log_level_t level) {
@@ -50,129 +194,744 @@ static void worker_thread_log_hook(log_level_t level) {
         current_pool_name, current_thread_idx, log_prefix_for_level(level));
 }
 
+static void supervisor_thread_log_hook(log_level_t level) {
+    fprintf(stderr, "[Thread pool %s/supervisor] %s: ",
+        current_pool_name, log_prefix_for_level(level));
+}
+
+static uint64_t thread_pool_now_ns(void) {
+    struct timespec now;
+    error_assert(error_wrap("Could not read the monotonic clock", error_from_posix(
+        wrapper_clock_gettime(CLOCK_MONOTONIC, &now))));
+
+    return (uint64_t) now.tv_sec * 1000000000 + (uint64_t) now.tv_nsec;
+}
+
 static void executor_thread_pool_await_termination(executor_thread_pool_t *self) {
-    for (size_t i = 0; i < vec_pthread_len(&self->threads); ++i) {
-        pthread_t thread_id = *vec_pthread_get(&self->threads, i);
-        pthread_join(thread_id, NULL);
+    assert_mutex_lock(&self->join_mtx);
+
+    if (!self->joined) {
+        // once the supervisor has exited, nobody spawns or reaps the workers anymore
+        if (self->has_supervisor) {
+            pthread_join(self->supervisor, NULL);
+        }
+
+        for (size_t i = 0; i < self->max_size; ++i) {
+            worker_slot_t *slot = &self->slots[i];
+
+            assert_mutex_lock(&self->mtx);
+            bool occupied = slot->state != WORKER_SLOT_VACANT;
+            assert_mutex_unlock(&self->mtx);
+
+            if (!occupied) {
+                continue;
+            }
+
+            pthread_join(slot->thread, NULL);
+
+            assert_mutex_lock(&self->mtx);
+            slot->state = WORKER_SLOT_VACANT;
+            assert_mutex_unlock(&self->mtx);
+        }
+
+        self->joined = true;
     }
+
+    assert_mutex_unlock(&self->join_mtx);
 }
 
-static void *worker_thread(void *data) {
-    executor_thread_pool_t *ex = data;
+static bool executor_thread_pool_has_tasks(executor_thread_pool_t *self) {
+    for (size_t i = 0; i < self->node_count; ++i) {
+        for (size_t lane = 0; lane < EXECUTOR_LANE_COUNT; ++lane) {
+            thread_pool_queue_t *queue = &self->nodes[i].queues[lane];
 
-    assert_mutex_lock(&ex->mtx);
+            if (mpmc_task_len(&queue->tasks) > 0 || atomic_load(&queue->overflow_len) > 0) {
+                return true;
+            }
+        }
+    }
 
-    while (ex->state == THREAD_POOL_STARTING) {
-        assert_cond_wait(&ex->cond, &ex->mtx);
+    return false;
+}
+
+static bool executor_thread_pool_take_from(
+    executor_thread_pool_t *self,
+    thread_pool_queue_t *queue,
+    queued_task_t *result
+) {
+    if (mpmc_task_pop(&queue->tasks, result)) {
+        return true;
     }
 
-    for (size_t i = 0; i < vec_pthread_len(&ex->threads); ++i) {
-        if (pthread_equal(*vec_pthread_get(&ex->threads, i), pthread_self())) {
-            current_thread_idx = i;
+    if (atomic_load(&queue->overflow_len) == 0) {
+        return false;
+    }
 
-            break;
+    assert_mutex_lock(&self->mtx);
+    bool found = ring_task_len(&queue->overflow) > 0;
+
+    if (found) {
+        *result = *ring_task_get(&queue->overflow, 0);
+        ring_task_pop_front(&queue->overflow);
+        atomic_fetch_sub(&queue->overflow_len, 1);
+    }
+
+    assert_mutex_unlock(&self->mtx);
+
+    return found;
+}
+
+// Takes a task, going through the lanes in the order given by the worker's turn.
+//
+// In each lane, the worker looks into its own node first and only then steals from the other
+// nodes: an urgent task on a remote node still runs before a less urgent local one.
+static bool executor_thread_pool_take(
+    executor_thread_pool_t *self,
+    worker_slot_t *slot,
+    queued_task_t *result
+) {
+    executor_lane_t order[EXECUTOR_LANE_COUNT];
+    executor_lane_order(slot->turn, order);
+
+    for (size_t i = 0; i < EXECUTOR_LANE_COUNT; ++i) {
+        for (size_t j = 0; j < self->node_count; ++j) {
+            thread_pool_node_t *node = &self->nodes[(slot->node + j) % self->node_count];
+
+            if (executor_thread_pool_take_from(self, &node->queues[order[i]], result)) {
+                ++slot->turn;
+
+                return true;
+            }
         }
     }
 
+    return false;
+}
+
+// Waits until there may be a task to run.
+//
+// Returns `false` if the worker should exit: either the executor has been shut down and has no
+// more tasks, or the worker has been retired.
+static bool executor_thread_pool_wait(executor_thread_pool_t *self, worker_slot_t *slot) {
+    thread_pool_node_t *node = &self->nodes[slot->node];
+
+    assert_mutex_lock(&self->mtx);
+    atomic_fetch_add(&node->idle_count, 1);
+    // pairs with the fence in `executor_thread_pool_submit_to_node`: either the submitter sees us
+    // idle, or we see its task
+    atomic_thread_fence(memory_order_seq_cst);
+
+    while (atomic_load(&self->state) == THREAD_POOL_RUNNING
+            && !executor_thread_pool_has_tasks(self)
+            && self->retiring == 0) {
+        assert_cond_wait(&node->cond, &self->mtx);
+
+        if (atomic_load(&node->waking) > 0) {
+            atomic_fetch_sub(&node->waking, 1);
+        }
+    }
+
+    atomic_fetch_sub(&node->idle_count, 1);
+
+    bool result = true;
+
+    if (atomic_load(&self->state) != THREAD_POOL_RUNNING) {
+        // the submissions that have passed the check before the shutdown are still let through
+        result = atomic_load(&self->submitting) > 0 || executor_thread_pool_has_tasks(self);
+    } else if (self->retiring > 0 && !executor_thread_pool_has_tasks(self)) {
+        --self->retiring;
+        result = false;
+    }
+
+    assert_mutex_unlock(&self->mtx);
+
+    return result;
+}
+
+static void worker_run_task(worker_slot_t *slot, queued_task_t queued) {
+    executor_thread_pool_t *ex = slot->executor;
+    task_t task = queued.task;
+    uint64_t started_ns = 0;
+
+    if (ex->adaptive) {
+        started_ns = thread_pool_now_ns();
+        uint64_t wait_ns = started_ns > queued.submitted_ns ? started_ns - queued.submitted_ns : 0;
+
+        // the slot's thread is the only writer
+        atomic_store_explicit(&slot->wait_ns,
+            atomic_load_explicit(&slot->wait_ns, memory_order_relaxed) + wait_ns,
+            memory_order_relaxed);
+        atomic_store_explicit(&slot->taken,
+            atomic_load_explicit(&slot->taken, memory_order_relaxed) + 1,
+            memory_order_relaxed);
+    }
+
+    log_printf(LOG_DEBUG, "Got a task from the queue");
+    error_t *err = task.cb(task.data);
+
+    log_printf(LOG_DEBUG, "Task finished");
+
+    if (ex->adaptive) {
+        atomic_store_explicit(&slot->busy_ns,
+            atomic_load_explicit(&slot->busy_ns, memory_order_relaxed)
+                + (thread_pool_now_ns() - started_ns),
+            memory_order_relaxed);
+    }
+
+    if (err) {
+        assert_mutex_lock(&ex->mtx);
+        executor_thread_pool_on_error_cb_t on_error = ex->on_error;
+        assert_mutex_unlock(&ex->mtx);
+
+        if (on_error != NULL) {
+            err = error_wrap("The executor's on_error callback has returned an error",
+                on_error(ex, err, task));
+        }
+    }
+
+    if (err) {
+        string_t buf;
+
+        if (string_new(&buf) == COMMON_ERROR_CODE_OK) {
+            error_format(err, ERROR_VERBOSITY_SOURCE_CHAIN | ERROR_VERBOSITY_BACKTRACE, &buf);
+            log_abort("A task submitted to an executor `%s` has failed: %s",
+                ex->pool_name,
+                string_as_cptr(&buf)
+            );
+            string_free(&buf);
+        } else {
+            log_abort(
+                "A task submitted to an executor `%s` has failed (could not render the error message)",
+                ex->pool_name
+            );
+        }
+    }
+}
+
+static void *worker_thread(void *data) {
+    worker_slot_t *slot = data;
+    executor_thread_pool_t *ex = slot->executor;
+
+    assert_mutex_lock(&ex->mtx);
+
+    while (ex->state == THREAD_POOL_STARTING) {
+        assert_cond_wait(&ex->nodes[slot->node].cond, &ex->mtx);
+    }
+
+    assert_mutex_unlock(&ex->mtx);
+
+    current_thread_idx = slot->idx;
     current_pool_name = ex->pool_name;
+    current_slot = slot;
     log_hook = worker_thread_log_hook;
 
     while (true) {
-        while (ex->state == THREAD_POOL_RUNNING && dlist_task_len(&ex->tasks) == 0) {
-            assert_cond_wait(&ex->cond, &ex->mtx);
+        queued_task_t queued;
+
+        if (!executor_thread_pool_take(ex, slot, &queued)) {
+            if (!executor_thread_pool_wait(ex, slot)) {
+                break;
+            }
+
+            continue;
         }
 
-        if (ex->state != THREAD_POOL_RUNNING && dlist_task_len(&ex->tasks) == 0) {
+        worker_run_task(slot, queued);
+    }
+
+    log_printf(LOG_DEBUG, "A child thread is exiting");
+
+    // the thread is joined by whoever sees the slot exited; nothing is touched after this point
+    assert_mutex_lock(&ex->mtx);
+    slot->state = WORKER_SLOT_EXITED;
+    --ex->live_count;
+    assert_mutex_unlock(&ex->mtx);
+
+    return NULL;
+}
+
+// Spawns a worker in a vacant slot. Must be called with `mtx` locked.
+static error_t *executor_thread_pool_spawn(executor_thread_pool_t *self) {
+    error_t *err = NULL;
+
+    worker_slot_t *slot = NULL;
+
+    for (size_t i = 0; i < self->max_size; ++i) {
+        if (self->slots[i].state == WORKER_SLOT_VACANT) {
+            slot = &self->slots[i];
+
             break;
         }
+    }
 
-        log_printf(LOG_DEBUG, "dlist_task_len = %zu", dlist_task_len(&ex->tasks));
-        task_t task = dlist_task_remove(&ex->tasks, dlist_task_head_mut(&ex->tasks));
-        log_printf(LOG_DEBUG, "Got a task from the queue");
-        log_printf(LOG_DEBUG, "dlist_task_len = %zu", dlist_task_len(&ex->tasks));
+    assert(slot != NULL);
 
-        assert_mutex_unlock(&ex->mtx);
-        error_t *err = task.cb(task.data);
+    pthread_attr_t attr;
+    bool pinned = slot->cpu >= 0;
 
-        log_printf(LOG_DEBUG, "Task finished");
+    if (pinned) {
+        err = error_wrap("Could not pin a worker thread to its CPU", error_from_errno(
+            topology_attr_init_pinned(&attr, slot->cpu)));
+        if (err) return err;
+    }
 
-        if (err) {
-            assert_mutex_lock(&ex->mtx);
-            executor_thread_pool_on_error_cb_t on_error = ex->on_error;
-            assert_mutex_unlock(&ex->mtx);
+    err = error_wrap("Could not spawn a worker thread", error_from_errno(
+        pthread_create(&slot->thread, pinned ? &attr : NULL, worker_thread, slot)));
 
-            if (on_error != NULL) {
-                err = error_wrap("The executor's on_error callback has returned an error",
-                    on_error(ex, err, task));
-            }
+    if (pinned) {
+        pthread_attr_destroy(&attr);
+    }
+
+    if (err) return err;
+
+    slot->state = WORKER_SLOT_RUNNING;
+    ++self->live_count;
+
+    return err;
+}
+
+// Joins the workers that have exited. Must be called with `mtx` locked.
+static void executor_thread_pool_reap(executor_thread_pool_t *self) {
+    for (size_t i = 0; i < self->max_size; ++i) {
+        worker_slot_t *slot = &self->slots[i];
+
+        if (slot->state == WORKER_SLOT_EXITED) {
+            // an exited worker no longer needs the mutex, so this can't deadlock
+            pthread_join(slot->thread, NULL);
+            slot->state = WORKER_SLOT_VACANT;
         }
+    }
+}
+
+// Wakes up all the workers, e.g., to let them see the state has changed.
+// Must be called with `mtx` locked.
+static void executor_thread_pool_wake_all(executor_thread_pool_t *self) {
+    for (size_t i = 0; i < self->node_count; ++i) {
+        pthread_cond_broadcast(&self->nodes[i].cond);
+    }
+}
+
+// Lets an idle worker know it should retire. Must be called with `mtx` locked.
+static void executor_thread_pool_signal_retiring(executor_thread_pool_t *self) {
+    // if nobody is idle right now, the next worker to become idle retires
+    for (size_t i = 0; i < self->node_count; ++i) {
+        if (atomic_load(&self->nodes[i].idle_count) > 0) {
+            pthread_cond_signal(&self->nodes[i].cond);
+
+            return;
+        }
+    }
+}
+
+// Decides whether the pool should grow or shrink, based on the load since the last tick.
+// Must be called with `mtx` locked.
+static void executor_thread_pool_adjust(executor_thread_pool_t *self, uint64_t elapsed_ns) {
+    uint64_t wait_ns = 0;
+    uint64_t busy_ns = 0;
+    size_t taken = 0;
+
+    for (size_t i = 0; i < self->max_size; ++i) {
+        worker_slot_t *slot = &self->slots[i];
+        uint64_t slot_wait_ns = atomic_load_explicit(&slot->wait_ns, memory_order_relaxed);
+        uint64_t slot_busy_ns = atomic_load_explicit(&slot->busy_ns, memory_order_relaxed);
+        size_t slot_taken = atomic_load_explicit(&slot->taken, memory_order_relaxed);
+
+        wait_ns += slot_wait_ns - slot->seen_wait_ns;
+        busy_ns += slot_busy_ns - slot->seen_busy_ns;
+        taken += slot_taken - slot->seen_taken;
+
+        slot->seen_wait_ns = slot_wait_ns;
+        slot->seen_busy_ns = slot_busy_ns;
+        slot->seen_taken = slot_taken;
+    }
+
+    // if the workers haven't taken anything while there were tasks, they're all stuck: the delay
+    // is at least as long as the tick
+    bool stalled = taken == 0 && executor_thread_pool_has_tasks(self);
+    uint64_t delay_ns = stalled ? elapsed_ns : taken > 0 ? wait_ns / taken : 0;
+    size_t size = self->live_count - self->retiring;
+
+    // whether the load would still fit comfortably if there was one thread fewer
+    bool underused = size > 1
+        && busy_ns * 100 < elapsed_ns * (size - 1) * THREAD_POOL_SHRINK_UTILIZATION;
+
+    if (delay_ns > (uint64_t) THREAD_POOL_GROW_DELAY_US * 1000) {
+        ++self->grow_streak;
+        self->shrink_streak = 0;
+    } else if (delay_ns < (uint64_t) THREAD_POOL_SHRINK_DELAY_US * 1000 && underused) {
+        ++self->shrink_streak;
+        self->grow_streak = 0;
+    } else {
+        self->grow_streak = 0;
+        self->shrink_streak = 0;
+    }
+
+    if (self->grow_streak >= THREAD_POOL_GROW_TICKS && size < self->max_size) {
+        if (self->retiring > 0) {
+            // nobody has picked up the request yet
+            --self->retiring;
+        } else {
+            error_t *err = executor_thread_pool_spawn(self);
 
-        if (err) {
-            string_t buf;
-
-            if (string_new(&buf) == COMMON_ERROR_CODE_OK) {
-                error_format(err, ERROR_VERBOSITY_SOURCE_CHAIN | ERROR_VERBOSITY_BACKTRACE, &buf);
-                log_abort("A task submitted to an executor `%s` has failed: %s",
-                    ex->pool_name,
-                    string_as_cptr(&buf)
-                );
-                string_free(&buf);
-            } else {
-                log_abort(
-                    "A task submitted to an executor `%s` has failed (could not render the error message)",
-                    ex->pool_name
-                );
+            if (err) {
+                error_log_free(&err, LOG_WARN, ERROR_VERBOSITY_SOURCE_CHAIN);
+
+                return;
             }
         }
 
-        assert_mutex_lock(&ex->mtx);
+        log_printf(LOG_INFO, "The mean queue delay is %" PRIu64 " us; growing to %zu threads",
+            delay_ns / 1000, size + 1);
+    } else if (self->shrink_streak >= THREAD_POOL_SHRINK_TICKS && size > self->min_size) {
+        self->shrink_streak = THREAD_POOL_SHRINK_TICKS - THREAD_POOL_RETIRE_INTERVAL_TICKS;
+        ++self->retiring;
+        executor_thread_pool_signal_retiring(self);
+
+        log_printf(LOG_INFO, "The pool is underused; shrinking to %zu threads", size - 1);
+    }
+}
+
+static void *supervisor_thread(void *data) {
+    executor_thread_pool_t *ex = data;
+
+    current_pool_name = ex->pool_name;
+    log_hook = supervisor_thread_log_hook;
+
+    uint64_t last_tick_ns = thread_pool_now_ns();
+
+    assert_mutex_lock(&ex->mtx);
+
+    while (ex->state == THREAD_POOL_RUNNING) {
+        uint64_t deadline_ns = last_tick_ns + (uint64_t) THREAD_POOL_TICK_MS * 1000000;
+        struct timespec deadline = {
+            .tv_sec = (time_t) (deadline_ns / 1000000000),
+            .tv_nsec = (long) (deadline_ns % 1000000000),
+        };
+
+        int ret = pthread_cond_timedwait(&ex->supervisor_cond, &ex->mtx, &deadline);
+
+        if (ret != ETIMEDOUT) {
+            error_assert(error_wrap("Could not wait on a condition variable", error_from_errno(
+                ret)));
+
+            continue;
+        }
+
+        if (ex->state != THREAD_POOL_RUNNING) {
+            break;
+        }
+
+        uint64_t now_ns = thread_pool_now_ns();
+        executor_thread_pool_reap(ex);
+        executor_thread_pool_adjust(ex, now_ns - last_tick_ns);
+        last_tick_ns = now_ns;
     }
 
     assert_mutex_unlock(&ex->mtx);
-    log_printf(LOG_DEBUG, "A child thread is exiting");
 
     return NULL;
 }
 
+static void thread_pool_node_free(thread_pool_node_t *self) {
+    for (size_t lane = 0; lane < EXECUTOR_LANE_COUNT; ++lane) {
+        ring_task_free(&self->queues[lane].overflow);
+        mpmc_task_free(&self->queues[lane].tasks);
+    }
+
+    pthread_cond_destroy(&self->cond);
+}
+
+static error_t *thread_pool_node_init(thread_pool_node_t *self) {
+    error_t *err = NULL;
+
+    size_t lane = 0;
+
+    for (; lane < EXECUTOR_LANE_COUNT; ++lane) {
+        thread_pool_queue_t *queue = &self->queues[lane];
+
+        err = error_wrap("Could not allocate memory for the task queue", error_from_common(
+            mpmc_task_init(&queue->tasks, THREAD_POOL_QUEUE_CAPACITY)));
+        if (err) goto queue_init_fail;
+
+        queue->overflow = ring_task_new();
+        atomic_init(&queue->overflow_len, 0);
+    }
+
+    err = error_wrap("Could initialize a condition variable", error_from_errno(
+        pthread_cond_init(&self->cond, NULL)));
+    if (err) goto cond_init_fail;
+
+    atomic_init(&self->idle_count, 0);
+    atomic_init(&self->waking, 0);
+
+    return err;
+
+cond_init_fail:
+queue_init_fail:
+    while (lane > 0) {
+        mpmc_task_free(&self->queues[--lane].tasks);
+    }
+
+    return err;
+}
+
+static void executor_thread_pool_nodes_free(thread_pool_node_t *nodes, size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+        thread_pool_node_free(&nodes[i]);
+    }
+
+    free(nodes);
+}
+
+static error_t *executor_thread_pool_nodes_new(size_t count, thread_pool_node_t **result) {
+    error_t *err = NULL;
+
+    thread_pool_node_t *nodes = calloc(count, sizeof(thread_pool_node_t));
+    err = error_wrap("Could not allocate memory for the task queues", OK_IF(nodes != NULL));
+    if (err) return err;
+
+    size_t initialized = 0;
+
+    for (; initialized < count; ++initialized) {
+        err = thread_pool_node_init(&nodes[initialized]);
+        if (err) break;
+    }
+
+    if (err) {
+        executor_thread_pool_nodes_free(nodes, initialized);
+
+        return err;
+    }
+
+    *result = nodes;
+
+    return err;
+}
+
+// Returns the index in `cpus` of the `n`-th CPU of the node `node`, wrapping around its CPUs.
+static size_t topology_nth_cpu_of_node(
+    topology_cpu_t const *cpus,
+    size_t cpu_count,
+    size_t node,
+    size_t n
+) {
+    size_t start = 0;
+
+    while (cpus[start].node != node) {
+        ++start;
+    }
+
+    size_t end = start;
+
+    while (end < cpu_count && cpus[end].node == node) {
+        ++end;
+    }
+
+    return start + n % (end - start);
+}
+
+// Assigns a CPU and a node to every slot according to the placement policy, and counts the nodes.
+//
+// Only the nodes the slots end up on get a queue, and they are numbered densely.
+static error_t *executor_thread_pool_place(
+    executor_thread_pool_t *self,
+    executor_thread_pool_placement_t const *placement
+) {
+    error_t *err = NULL;
+
+    if (placement->policy == THREAD_POOL_PLACEMENT_NONE) {
+        for (size_t i = 0; i < self->max_size; ++i) {
+            self->slots[i].cpu = -1;
+            self->slots[i].node = 0;
+        }
+
+        self->node_count = 1;
+
+        return err;
+    }
+
+    assert(placement->policy != THREAD_POOL_PLACEMENT_CPU_LIST || placement->cpu_count > 0);
+
+    topology_cpu_t *cpus = NULL;
+    size_t cpu_count = 0;
+    err = error_wrap("Could not find out which CPUs the workers can run on", error_from_errno(
+        topology_list_cpus(&cpus, &cpu_count)));
+    if (err) goto list_fail;
+
+    err = error_wrap("The process is not allowed to run on any CPU", OK_IF(cpu_count > 0));
+    if (err) goto no_cpus;
+
+    size_t system_node_count = cpus[cpu_count - 1].node + 1;
+    // the queue assigned to each of the system's nodes, or `SIZE_MAX` if no slot is there
+    size_t *node_queues = malloc(system_node_count * sizeof(size_t));
+    err = error_wrap("Could not allocate memory for the executor", OK_IF(node_queues != NULL));
+    if (err) goto node_queues_alloc_fail;
+
+    for (size_t i = 0; i < system_node_count; ++i) {
+        node_queues[i] = SIZE_MAX;
+    }
+
+    self->node_count = 0;
+
+    for (size_t i = 0; i < self->max_size; ++i) {
+        size_t cpu_idx = 0;
+
+        switch (placement->policy) {
+        case THREAD_POOL_PLACEMENT_NONE:
+        case THREAD_POOL_PLACEMENT_COMPACT:
+            cpu_idx = i % cpu_count;
+
+            break;
+
+        case THREAD_POOL_PLACEMENT_SCATTER:
+            cpu_idx = topology_nth_cpu_of_node(
+                cpus, cpu_count, i % system_node_count, i / system_node_count);
+
+            break;
+
+        case THREAD_POOL_PLACEMENT_CPU_LIST: {
+            int cpu = placement->cpus[i % placement->cpu_count];
+
+            for (cpu_idx = 0; cpu_idx < cpu_count && cpus[cpu_idx].cpu != cpu; ++cpu_idx) {}
+
+            err = error_wrap("The placement lists a CPU the workers are not allowed to run on",
+                OK_IF(cpu_idx < cpu_count));
+
+            break;
+        }
+        }
+
+        if (err) break;
+
+        size_t *queue = &node_queues[cpus[cpu_idx].node];
+
+        if (*queue == SIZE_MAX) {
+            *queue = self->node_count++;
+        }
+
+        self->slots[i].cpu = cpus[cpu_idx].cpu;
+        self->slots[i].node = *queue;
+    }
+
+    free(node_queues);
+
+node_queues_alloc_fail:
+no_cpus:
+    free(cpus);
+
+list_fail:
+    return err;
+}
+
 static void executor_thread_pool_free(executor_thread_pool_t *self) {
     assert_mutex_lock(&self->mtx);
     self->state = THREAD_POOL_STOPPING;
-    pthread_cond_broadcast(&self->cond);
+    executor_thread_pool_wake_all(self);
+    pthread_cond_broadcast(&self->supervisor_cond);
     assert_mutex_unlock(&self->mtx);
 
     executor_thread_pool_await_termination(self);
 
-    dlist_task_free(&self->tasks);
-    pthread_cond_destroy(&self->cond);
+    executor_thread_pool_nodes_free(self->nodes, self->node_count);
+    pthread_mutex_destroy(&self->join_mtx);
+    pthread_cond_destroy(&self->supervisor_cond);
     pthread_mutex_destroy(&self->mtx);
-    vec_pthread_free(&self->threads);
+    free(self->slots);
 }
 
-static executor_submission_t executor_thread_pool_submit(
+// Picks the node to queue a task on. Must be called with `submitting` incremented.
+static size_t executor_thread_pool_pick_node(executor_thread_pool_t *self, size_t node) {
+    if (node < self->node_count) {
+        return node;
+    }
+
+    if (self->node_count == 1) {
+        return 0;
+    }
+
+    // a worker's tasks are likely to use the data it has just touched
+    if (current_slot != NULL && current_slot->executor == self) {
+        return current_slot->node;
+    }
+
+    return atomic_fetch_add_explicit(&self->next_node, 1, memory_order_relaxed) % self->node_count;
+}
+
+// Wakes up an idle worker, preferably one on the node `preferred`.
+static void executor_thread_pool_wake_one(executor_thread_pool_t *self, size_t preferred) {
+    // wake up somebody out there, but just one, and only if nobody is being woken up already
+    for (size_t i = 0; i < self->node_count; ++i) {
+        thread_pool_node_t *node = &self->nodes[(preferred + i) % self->node_count];
+
+        if (atomic_load(&node->idle_count) <= atomic_load(&node->waking)) {
+            continue;
+        }
+
+        assert_mutex_lock(&self->mtx);
+        bool woken = atomic_load(&node->idle_count) > atomic_load(&node->waking);
+
+        if (woken) {
+            atomic_fetch_add(&node->waking, 1);
+            pthread_cond_signal(&node->cond);
+        }
+
+        assert_mutex_unlock(&self->mtx);
+
+        if (woken) {
+            return;
+        }
+    }
+}
+
+static executor_submission_t executor_thread_pool_submit_to_node(
     executor_thread_pool_t *self,
-    task_t task
+    task_t task,
+    size_t node_idx
 ) {
+    assert(task.lane < EXECUTOR_LANE_COUNT);
+
     error_t *err = NULL;
 
-    assert_mutex_lock(&self->mtx);
+    atomic_fetch_add(&self->submitting, 1);
 
-    if (self->state != THREAD_POOL_RUNNING) {
-        assert_mutex_unlock(&self->mtx);
+    if (atomic_load(&self->state) != THREAD_POOL_RUNNING) {
+        atomic_fetch_sub(&self->submitting, 1);
 
         return EXECUTOR_DROPPED;
     }
 
-    dlist_task_node_t *node = NULL;
-    err = error_wrap("Could not add a task to the queue", error_from_common(
-        dlist_task_append(&self->tasks, task, &node)));
-    executor_thread_pool_on_error_cb_t on_error = self->on_error;
+    queued_task_t queued = {
+        .task = task,
+        .submitted_ns = self->adaptive ? thread_pool_now_ns() : 0,
+    };
+
+    node_idx = executor_thread_pool_pick_node(self, node_idx);
+    thread_pool_queue_t *queue = &self->nodes[node_idx].queues[task.lane];
+
+    // once the tasks have spilled over, the new ones go after them until the list is drained
+    bool pushed = atomic_load(&queue->overflow_len) == 0 && mpmc_task_push(&queue->tasks, queued);
+    executor_thread_pool_on_error_cb_t on_error = NULL;
+
+    if (!pushed) {
+        assert_mutex_lock(&self->mtx);
+        err = error_wrap("Could not add a task to the queue", error_from_common(
+            ring_task_push(&queue->overflow, queued)));
 
-    if (!err && dlist_task_len(&self->tasks) == 1) {
-        // the queue was empty; wake up somebody out there
-        pthread_cond_signal(&self->cond);
+        if (!err) {
+            atomic_fetch_add(&queue->overflow_len, 1);
+        }
+
+        on_error = self->on_error;
+        assert_mutex_unlock(&self->mtx);
     }
 
-    assert_mutex_unlock(&self->mtx);
+    atomic_thread_fence(memory_order_seq_cst);
+
+    if (!err) {
+        executor_thread_pool_wake_one(self, node_idx);
+    }
+
+    atomic_fetch_sub(&self->submitting, 1);
 
     if (err && on_error != NULL) {
         err = error_wrap("The executor's on_error callback has returned an error",
@@ -183,17 +942,34 @@ static executor_submission_t executor_thread_pool_submit(
 
         assert_mutex_lock(&self->mtx);
         self->state = THREAD_POOL_STOPPING;
-        pthread_cond_broadcast(&self->cond);
+        executor_thread_pool_wake_all(self);
+        pthread_cond_broadcast(&self->supervisor_cond);
         assert_mutex_unlock(&self->mtx);
     }
 
     return EXECUTOR_SUBMITTED;
 }
 
+static executor_submission_t executor_thread_pool_submit(
+    executor_thread_pool_t *self,
+    task_t task
+) {
+    return executor_thread_pool_submit_to_node(self, task, EXECUTOR_ANY_NODE);
+}
+
+static size_t executor_thread_pool_current_node(executor_thread_pool_t *self) {
+    if (current_slot != NULL && current_slot->executor == self) {
+        return current_slot->node;
+    }
+
+    return EXECUTOR_ANY_NODE;
+}
+
 static void executor_thread_pool_shutdown(executor_thread_pool_t *self) {
     assert_mutex_lock(&self->mtx);
     self->state = THREAD_POOL_STOPPING;
-    pthread_cond_broadcast(&self->cond);
+    executor_thread_pool_wake_all(self);
+    pthread_cond_broadcast(&self->supervisor_cond);
     assert_mutex_unlock(&self->mtx);
 }
 
@@ -203,14 +979,39 @@ static executor_vtable_t const executor_thread_pool_vtable = {
     .shutdown = (executor_vtable_shutdown_t) executor_thread_pool_shutdown,
     .await_termination =
         (executor_vtable_await_termination_t) executor_thread_pool_await_termination,
+    .submit_to_node = (executor_vtable_submit_to_node_t) executor_thread_pool_submit_to_node,
+    .current_node = (executor_vtable_current_node_t) executor_thread_pool_current_node,
 };
 
+static error_t *supervisor_cond_init(pthread_cond_t *cond) {
+    error_t *err = NULL;
+
+    pthread_condattr_t attr;
+    err = error_wrap("Could not initialize condition variable attributes", error_from_errno(
+        pthread_condattr_init(&attr)));
+    if (err) goto attr_init_fail;
+
+    err = error_wrap("Could not make a condition variable use the monotonic clock",
+        error_from_errno(pthread_condattr_setclock(&attr, CLOCK_MONOTONIC)));
+    if (err) goto setclock_fail;
+
+    err = error_wrap("Could initialize a condition variable", error_from_errno(
+        pthread_cond_init(cond, &attr)));
+
+setclock_fail:
+    pthread_condattr_destroy(&attr);
+
+attr_init_fail:
+    return err;
+}
+
 error_t *executor_thread_pool_new(
     char const *pool_name,
-    size_t size,
+    executor_thread_pool_config_t const *config,
     executor_thread_pool_t **result
 ) {
-    assert(size > 0);
+    assert(config->min_size > 0);
+    assert(config->max_size >= config->min_size);
 
     error_t *err = NULL;
 
@@ -219,12 +1020,27 @@ error_t *executor_thread_pool_new(
     if (err) goto calloc_fail;
 
     self->pool_name = pool_name;
-    self->size = size;
-    self->threads = vec_pthread_new();
+    self->min_size = config->min_size;
+    self->max_size = config->max_size;
+    self->adaptive = config->min_size < config->max_size;
+
+    self->slots = calloc(self->max_size, sizeof(worker_slot_t));
+    err = error_wrap("Could not allocate memory for the executor", OK_IF(self->slots != NULL));
+    if (err) goto slots_alloc_fail;
+
+    for (size_t i = 0; i < self->max_size; ++i) {
+        worker_slot_t *slot = &self->slots[i];
+        slot->executor = self;
+        slot->idx = i;
+        slot->state = WORKER_SLOT_VACANT;
+        atomic_init(&slot->wait_ns, 0);
+        atomic_init(&slot->busy_ns, 0);
+        atomic_init(&slot->taken, 0);
+        slot->turn = 0;
+    }
 
-    err = error_wrap("Could not allocate memory for the executor", error_from_common(
-        vec_pthread_resize(&self->threads, self->size)));
-    if (err) goto resize_fail;
+    err = executor_thread_pool_place(self, &config->placement);
+    if (err) goto place_fail;
 
     pthread_mutexattr_t mtx_attr;
     err = error_wrap("Could not initialize mutex attributes", error_from_errno(
@@ -236,36 +1052,48 @@ error_t *executor_thread_pool_new(
     pthread_mutexattr_destroy(&mtx_attr);
     if (err) goto mtx_init_fail;
 
-    err = error_wrap("Could initialize a condition variable", error_from_errno(
-        pthread_cond_init(&self->cond, NULL)));
-    if (err) goto cond_init_fail;
+    err = supervisor_cond_init(&self->supervisor_cond);
+    if (err) goto supervisor_cond_init_fail;
 
-    self->state = THREAD_POOL_STARTING;
-    self->tasks = dlist_task_new();
+    err = error_wrap("Could initialize a mutex", error_from_errno(
+        pthread_mutex_init(&self->join_mtx, NULL)));
+    if (err) goto join_mtx_init_fail;
+
+    err = executor_thread_pool_nodes_new(self->node_count, &self->nodes);
+    if (err) goto nodes_new_fail;
+
+    atomic_init(&self->state, THREAD_POOL_STARTING);
+    atomic_init(&self->submitting, 0);
+    atomic_init(&self->next_node, 0);
     self->on_error = NULL;
+    self->live_count = 0;
+    self->retiring = 0;
+    self->has_supervisor = false;
+    self->grow_streak = 0;
+    self->shrink_streak = 0;
+    self->joined = false;
 
     executor_init(&self->executor, &executor_thread_pool_vtable);
     assert_mutex_lock(&self->mtx);
 
-    for (size_t i = 0; i < self->size; ++i) {
-        pthread_t thread_id;
-        err = error_wrap("Could not spawn a worker thread", error_from_errno(
-            pthread_create(&thread_id, NULL, worker_thread, self)));
-
-        // since we have already resized the vector, no allocation, and hence failure, can occur
-        error_assert(error_from_common(
-            vec_pthread_push(&self->threads, thread_id)));
-
+    for (size_t i = 0; i < self->min_size; ++i) {
+        err = executor_thread_pool_spawn(self);
         if (err) break;
     }
 
+    if (!err && self->adaptive) {
+        err = error_wrap("Could not spawn the supervisor thread", error_from_errno(
+            pthread_create(&self->supervisor, NULL, supervisor_thread, self)));
+        self->has_supervisor = !err;
+    }
+
     if (err) {
         self->state = THREAD_POOL_STOPPING;
     } else {
         self->state = THREAD_POOL_RUNNING;
     }
 
-    pthread_cond_broadcast(&self->cond);
+    executor_thread_pool_wake_all(self);
 
     assert_mutex_unlock(&self->mtx);
 
@@ -281,14 +1109,21 @@ error_t *executor_thread_pool_new(
 
     return err;
 
-cond_init_fail:
+nodes_new_fail:
+    pthread_mutex_destroy(&self->join_mtx);
+
+join_mtx_init_fail:
+    pthread_cond_destroy(&self->supervisor_cond);
+
+supervisor_cond_init_fail:
     pthread_mutex_destroy(&self->mtx);
 
 mtx_init_fail:
 mtx_attr_init_fail:
-resize_fail:
-    vec_pthread_free(&self->threads);
+place_fail:
+    free(self->slots);
 
+slots_alloc_fail:
     free(self);
 
 calloc_fail:
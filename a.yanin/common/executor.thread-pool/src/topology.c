@@ -0,0 +1,167 @@
+// CPU affinity is a Linux extension
+#define _GNU_SOURCE
+
+#include "topology.h"
+
+#include <common/config.h>
+#include <errno.h>
+
+#ifdef COMMON_AFFINITY_ENABLED
+#include <dirent.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Marks the CPUs listed in a node's `cpulist` file (e.g., `0-3,8-11`) as belonging to `node`.
+static void topology_read_cpulist(FILE *file, int node, int *nodes) {
+    int first = 0;
+
+    while (fscanf(file, "%d", &first) == 1) {
+        int last = first;
+        int next = fgetc(file);
+
+        if (next == '-') {
+            if (fscanf(file, "%d", &last) != 1) {
+                return;
+            }
+
+            next = fgetc(file);
+        }
+
+        for (int cpu = first; cpu <= last && cpu < CPU_SETSIZE; ++cpu) {
+            if (cpu >= 0) {
+                nodes[cpu] = node;
+            }
+        }
+
+        if (next != ',') {
+            return;
+        }
+    }
+}
+
+// Fills in the node of every CPU from sysfs. The CPUs that aren't found stay on node 0.
+static void topology_read_nodes(int *nodes) {
+    DIR *dir = opendir("/sys/devices/system/node");
+
+    if (dir == NULL) {
+        return;
+    }
+
+    struct dirent *entry = NULL;
+
+    while ((entry = readdir(dir)) != NULL) {
+        int node = 0;
+        char tail = 0;
+
+        if (sscanf(entry->d_name, "node%d%c", &node, &tail) != 1 || node < 0) {
+            continue;
+        }
+
+        char path[64];
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+        FILE *file = fopen(path, "r");
+
+        if (file == NULL) {
+            continue;
+        }
+
+        topology_read_cpulist(file, node, nodes);
+        fclose(file);
+    }
+
+    closedir(dir);
+}
+
+int topology_list_cpus(topology_cpu_t **result, size_t *count) {
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+        return errno;
+    }
+
+    int *nodes = calloc(CPU_SETSIZE, sizeof(int));
+
+    if (nodes == NULL) {
+        return ENOMEM;
+    }
+
+    topology_read_nodes(nodes);
+
+    size_t cpu_count = (size_t) CPU_COUNT(&allowed);
+    topology_cpu_t *cpus = malloc((cpu_count > 0 ? cpu_count : 1) * sizeof(topology_cpu_t));
+
+    if (cpus == NULL) {
+        free(nodes);
+
+        return ENOMEM;
+    }
+
+    // walking the nodes in order yields the CPUs sorted by node, then by number; the node numbers
+    // may have gaps, so they're renumbered along the way
+    size_t filled = 0;
+    size_t node_idx = 0;
+
+    for (int node = 0; filled < cpu_count; ++node) {
+        bool seen = false;
+
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+            if (nodes[cpu] != node || !CPU_ISSET(cpu, &allowed)) {
+                continue;
+            }
+
+            cpus[filled++] = (topology_cpu_t) {
+                .cpu = cpu,
+                .node = node_idx,
+            };
+            seen = true;
+        }
+
+        if (seen) {
+            ++node_idx;
+        }
+    }
+
+    free(nodes);
+    *result = cpus;
+    *count = cpu_count;
+
+    return 0;
+}
+
+int topology_attr_init_pinned(pthread_attr_t *attr, int cpu) {
+    if (cpu < 0 || cpu >= CPU_SETSIZE) {
+        return EINVAL;
+    }
+
+    int ret = pthread_attr_init(attr);
+
+    if (ret != 0) {
+        return ret;
+    }
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    ret = pthread_attr_setaffinity_np(attr, sizeof(set), &set);
+
+    if (ret != 0) {
+        pthread_attr_destroy(attr);
+    }
+
+    return ret;
+}
+
+#else
+
+int topology_list_cpus(topology_cpu_t **, size_t *) {
+    return ENOSYS;
+}
+
+int topology_attr_init_pinned(pthread_attr_t *, int) {
+    return ENOSYS;
+}
+
+#endif
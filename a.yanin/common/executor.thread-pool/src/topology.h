@@ -0,0 +1,24 @@
+#pragma once
+
+#include <stddef.h>
+
+#include <pthread.h>
+
+// A CPU the process is allowed to run on.
+typedef struct {
+    int cpu;
+    // the index of the CPU's NUMA node among the nodes the process can run on
+    size_t node;
+} topology_cpu_t;
+
+// Lists the CPUs the process is allowed to run on, ordered by NUMA node and then by CPU number.
+//
+// If the system does not expose its NUMA topology, all CPUs are reported to be on node 0.
+// The list is allocated with `malloc`. Returns an errno value on failure, or `ENOSYS` if CPU
+// affinity is not supported on this platform.
+int topology_list_cpus(topology_cpu_t **result, size_t *count);
+
+// Initializes thread attributes that pin a new thread to the CPU `cpu`.
+//
+// Returns an errno value on failure, or `ENOSYS` if CPU affinity is not supported on this platform.
+int topology_attr_init_pinned(pthread_attr_t *attr, int cpu);
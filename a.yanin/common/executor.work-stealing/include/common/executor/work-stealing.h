@@ -0,0 +1,42 @@
+#pragma once
+
+#include <common/executor/executor.h>
+
+// A multi-threaded executor with a fixed-size thread pool and per-worker task queues.
+//
+// A task submitted by a worker goes to that worker's deque, from which it takes the tasks in LIFO
+// order.
+// A task submitted from outside the pool goes to the inbox of one of the workers, chosen in
+// round-robin order.
+// An inbox is a bounded lock-free queue, and only takes a lock once it overflows.
+// A worker that runs out of its own tasks steals them from the others, starting from a random one,
+// and only goes to sleep if there is nothing to steal.
+//
+// Each lane has its own deques and inboxes. A worker looks through the lanes in the order given by
+// `executor_lane_order`, stealing a more urgent task before taking a less urgent one of its own.
+//
+// Each submission wakes up at most one sleeping worker.
+typedef struct executor_work_stealing executor_work_stealing_t;
+
+typedef error_t *(*executor_work_stealing_on_error_cb_t)(
+    executor_work_stealing_t *self,
+    error_t *err,
+    task_t task
+);
+
+// Creates a new work-stealing executor with `size` worker threads.
+//
+// The threads are spawn immediately; if any thread fails to start, an error is returned.
+error_t *executor_work_stealing_new(
+    char const *pool_name,
+    size_t size,
+    executor_work_stealing_t **result
+);
+
+// Sets the callback to invoke when a task submitted to the executor returns an error.
+//
+// If `on_error` is `NULL`, which is the default, such an error aborts the process.
+void executor_work_stealing_on_error(
+    executor_work_stealing_t *self,
+    executor_work_stealing_on_error_cb_t on_error
+);
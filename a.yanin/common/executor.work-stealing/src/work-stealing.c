@@ -0,0 +1,800 @@
+#include <common/executor/work-stealing.h>
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <common/error-codes/adapter.h>
+
+#include "util.h"
+
+#define VEC_ELEMENT_TYPE pthread_t
+#define VEC_LABEL pthread
+#define VEC_CONFIG (COLLECTION_DECLARE | COLLECTION_DEFINE | COLLECTION_STATIC)
+#include <common/collections/vec.h>
+
+#define RING_ELEMENT_TYPE task_t
+#define RING_LABEL task
+#define RING_CONFIG (COLLECTION_DECLARE | COLLECTION_DEFINE | COLLECTION_STATIC)
+#include <common/collections/ring.h>
+
+#define MPMC_ELEMENT_TYPE task_t
+#define MPMC_LABEL task
+#define MPMC_CONFIG (COLLECTION_DECLARE | COLLECTION_DEFINE | COLLECTION_STATIC)
+#include <common/collections/mpmc.h>
+
+enum {
+    // The initial capacity of a worker's deque. Must be a power of two.
+    DEQUE_INITIAL_CAPACITY = 256,
+
+    // The number of tasks a worker's inbox holds before they start to spill into the overflow.
+    INBOX_CAPACITY = 1024,
+};
+
+// A slot of a deque.
+//
+// A thief may read a slot while its owner is overwriting it.
+// The thief then fails to claim the task and discards what it has read, but the fields still have
+// to be atomic for the read to be well-defined.
+typedef struct {
+    _Atomic(task_cb_t) cb;
+    _Atomic(void *) data;
+} deque_slot_t;
+
+typedef struct deque_array deque_array_t;
+
+// The circular buffer of a deque.
+struct deque_array {
+    // the buffer this one has replaced
+    //
+    // A thief may still be reading from it, so it's only freed along with the deque.
+    deque_array_t *retired;
+    // the capacity minus one
+    int64_t mask;
+    deque_slot_t slots[];
+};
+
+// A Chase-Lev work-stealing deque.
+//
+// Only the owner pushes and pops tasks at the bottom, while any thread can steal them from the top.
+typedef struct {
+    _Atomic int64_t top;
+    _Atomic int64_t bottom;
+    _Atomic(deque_array_t *) array;
+} deque_t;
+
+// The tasks of a worker in a lane.
+typedef struct {
+    deque_t deque;
+
+    // the tasks submitted to the worker from outside the pool
+    mpmc_task_t inbox;
+    // where the tasks go when `inbox` is full; guarded by the worker's `overflow_mtx`
+    ring_task_t overflow;
+    // the length of `overflow`, readable without locking the mutex
+    atomic_size_t overflow_len;
+} worker_lane_t;
+
+typedef struct worker worker_t;
+
+struct worker {
+    executor_work_stealing_t *executor;
+    size_t idx;
+
+    // indexed by `executor_lane_t`
+    worker_lane_t lanes[EXECUTOR_LANE_COUNT];
+    // guards the overflows of all the lanes
+    pthread_mutex_t overflow_mtx;
+
+    // set by the worker before it goes to sleep, and cleared by whoever takes it upon themselves to
+    // wake it up
+    atomic_bool parked;
+    pthread_mutex_t park_mtx;
+    pthread_cond_t park_cond;
+    // a wake-up is pending; guarded by `park_mtx`
+    bool notified;
+
+    // the state of the random generator that picks the victims; only used by the worker itself
+    uint64_t rng;
+    // the number of tasks the worker has taken, which decides the order it looks into the lanes in
+    // (see `executor_lane_order`); only used by the worker itself
+    size_t turn;
+};
+
+struct executor_work_stealing {
+    executor_t executor;
+
+    char const *pool_name;
+    size_t size;
+    worker_t *workers;
+    vec_pthread_t threads;
+
+    atomic_bool stopping;
+    // the number of submissions that have checked `stopping` but not yet queued their task
+    atomic_size_t submitting;
+    // the number of workers with the `parked` flag set
+    atomic_size_t parked_count;
+    // the worker whose inbox takes the next task submitted from outside the pool
+    atomic_size_t next_inbox;
+    _Atomic(executor_work_stealing_on_error_cb_t) on_error;
+
+    pthread_mutex_t join_mtx;
+    // guarded by `join_mtx`
+    bool joined;
+};
+
+static thread_local worker_t *current_worker = NULL;
+
+static error_t *deque_init(deque_t *self) {
+    deque_array_t *array = malloc(
+        sizeof(deque_array_t) + DEQUE_INITIAL_CAPACITY * sizeof(deque_slot_t));
+    error_t *err = error_wrap("Could not allocate memory for a task deque", OK_IF(array != NULL));
+    if (err) return err;
+
+    array->retired = NULL;
+    array->mask = DEQUE_INITIAL_CAPACITY - 1;
+    atomic_init(&self->top, 0);
+    atomic_init(&self->bottom, 0);
+    atomic_init(&self->array, array);
+
+    return err;
+}
+
+static void deque_free(deque_t *self) {
+    deque_array_t *array = atomic_load_explicit(&self->array, memory_order_relaxed);
+
+    while (array != NULL) {
+        deque_array_t *retired = array->retired;
+        free(array);
+        array = retired;
+    }
+}
+
+static task_t deque_slot_load(deque_slot_t *slot) {
+    return (task_t) {
+        .cb = atomic_load_explicit(&slot->cb, memory_order_relaxed),
+        .data = atomic_load_explicit(&slot->data, memory_order_relaxed),
+    };
+}
+
+static void deque_slot_store(deque_slot_t *slot, task_t task) {
+    atomic_store_explicit(&slot->cb, task.cb, memory_order_relaxed);
+    atomic_store_explicit(&slot->data, task.data, memory_order_relaxed);
+}
+
+// Returns the number of tasks in the deque, which may be stale by the time it's used.
+static size_t deque_len(deque_t *self) {
+    int64_t top = atomic_load_explicit(&self->top, memory_order_acquire);
+    int64_t bottom = atomic_load_explicit(&self->bottom, memory_order_acquire);
+
+    return bottom > top ? (size_t) (bottom - top) : 0;
+}
+
+// Replaces the buffer of a full deque with one twice as large. Only called by the owner.
+static error_t *deque_grow(deque_t *self, int64_t top, int64_t bottom, deque_array_t **array) {
+    deque_array_t *old = *array;
+    int64_t capacity = (old->mask + 1) * 2;
+
+    deque_array_t *grown = malloc(
+        sizeof(deque_array_t) + (size_t) capacity * sizeof(deque_slot_t));
+    error_t *err = error_wrap("Could not allocate memory for a task deque", OK_IF(grown != NULL));
+    if (err) return err;
+
+    grown->retired = old;
+    grown->mask = capacity - 1;
+
+    for (int64_t i = top; i < bottom; ++i) {
+        deque_slot_store(
+            &grown->slots[i & grown->mask], deque_slot_load(&old->slots[i & old->mask]));
+    }
+
+    atomic_store_explicit(&self->array, grown, memory_order_release);
+    *array = grown;
+
+    return err;
+}
+
+// Adds a task to the bottom of the deque. Only called by the owner.
+static error_t *deque_push(deque_t *self, task_t task) {
+    error_t *err = NULL;
+
+    int64_t bottom = atomic_load_explicit(&self->bottom, memory_order_relaxed);
+    int64_t top = atomic_load_explicit(&self->top, memory_order_acquire);
+    deque_array_t *array = atomic_load_explicit(&self->array, memory_order_relaxed);
+
+    if (bottom - top > array->mask) {
+        err = deque_grow(self, top, bottom, &array);
+        if (err) return err;
+    }
+
+    deque_slot_store(&array->slots[bottom & array->mask], task);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&self->bottom, bottom + 1, memory_order_relaxed);
+
+    return err;
+}
+
+// Takes the most recently pushed task. Only called by the owner.
+static bool deque_pop(deque_t *self, task_t *result) {
+    int64_t bottom = atomic_load_explicit(&self->bottom, memory_order_relaxed) - 1;
+    deque_array_t *array = atomic_load_explicit(&self->array, memory_order_relaxed);
+    atomic_store_explicit(&self->bottom, bottom, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    int64_t top = atomic_load_explicit(&self->top, memory_order_relaxed);
+
+    if (top > bottom) {
+        atomic_store_explicit(&self->bottom, bottom + 1, memory_order_relaxed);
+
+        return false;
+    }
+
+    *result = deque_slot_load(&array->slots[bottom & array->mask]);
+
+    if (top < bottom) {
+        return true;
+    }
+
+    // this is the last task, and a thief may be after it as well
+    bool taken = atomic_compare_exchange_strong_explicit(
+        &self->top, &top, top + 1, memory_order_seq_cst, memory_order_relaxed);
+    atomic_store_explicit(&self->bottom, bottom + 1, memory_order_relaxed);
+
+    return taken;
+}
+
+// Takes the least recently pushed task.
+//
+// Can be called from any thread.
+// Returns `false` if the deque is empty or another thread has claimed the task first.
+static bool deque_steal(deque_t *self, task_t *result) {
+    int64_t top = atomic_load_explicit(&self->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    int64_t bottom = atomic_load_explicit(&self->bottom, memory_order_acquire);
+
+    if (top >= bottom) {
+        return false;
+    }
+
+    deque_array_t *array = atomic_load_explicit(&self->array, memory_order_acquire);
+    *result = deque_slot_load(&array->slots[top & array->mask]);
+
+    return atomic_compare_exchange_strong_explicit(
+        &self->top, &top, top + 1, memory_order_seq_cst, memory_order_relaxed);
+}
+
+static error_t *worker_inbox_push(worker_t *self, task_t task) {
+    worker_lane_t *lane = &self->lanes[task.lane];
+
+    // once the tasks have spilled over, the new ones go after them until the overflow is drained
+    if (atomic_load(&lane->overflow_len) == 0 && mpmc_task_push(&lane->inbox, task)) {
+        return NULL;
+    }
+
+    assert_mutex_lock(&self->overflow_mtx);
+    error_t *err = error_wrap("Could not add a task to the queue", error_from_common(
+        ring_task_push(&lane->overflow, task)));
+
+    if (!err) {
+        atomic_fetch_add(&lane->overflow_len, 1);
+    }
+
+    assert_mutex_unlock(&self->overflow_mtx);
+
+    return err;
+}
+
+static bool worker_inbox_pop(worker_t *self, executor_lane_t lane_idx, task_t *result) {
+    worker_lane_t *lane = &self->lanes[lane_idx];
+
+    if (mpmc_task_pop(&lane->inbox, result)) {
+        return true;
+    }
+
+    if (atomic_load_explicit(&lane->overflow_len, memory_order_acquire) == 0) {
+        return false;
+    }
+
+    assert_mutex_lock(&self->overflow_mtx);
+    bool found = ring_task_len(&lane->overflow) > 0;
+
+    if (found) {
+        *result = *ring_task_get(&lane->overflow, 0);
+        ring_task_pop_front(&lane->overflow);
+        atomic_fetch_sub(&lane->overflow_len, 1);
+    }
+
+    assert_mutex_unlock(&self->overflow_mtx);
+
+    return found;
+}
+
+// Returns whether the worker has no tasks in any lane, either in its deque or in its inbox.
+static bool worker_is_idle(worker_t *self) {
+    for (size_t i = 0; i < EXECUTOR_LANE_COUNT; ++i) {
+        worker_lane_t *lane = &self->lanes[i];
+
+        if (deque_len(&lane->deque) > 0 || mpmc_task_len(&lane->inbox) > 0
+                || atomic_load(&lane->overflow_len) > 0) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// A xorshift generator: the victims don't need to be picked any more carefully than that.
+static size_t worker_random(worker_t *self) {
+    uint64_t x = self->rng;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    self->rng = x;
+
+    return (size_t) x;
+}
+
+static bool worker_find_task_in_lane(worker_t *self, executor_lane_t lane, task_t *result) {
+    if (deque_pop(&self->lanes[lane].deque, result) || worker_inbox_pop(self, lane, result)) {
+        return true;
+    }
+
+    executor_work_stealing_t *ex = self->executor;
+    size_t start = worker_random(self) % ex->size;
+
+    for (size_t i = 0; i < ex->size; ++i) {
+        worker_t *victim = &ex->workers[(start + i) % ex->size];
+
+        if (victim == self) {
+            continue;
+        }
+
+        if (deque_steal(&victim->lanes[lane].deque, result)
+                || worker_inbox_pop(victim, lane, result)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Looks for a task in the lanes in the order given by the worker's turn.
+//
+// A more urgent task is stolen from another worker before a less urgent one is taken locally.
+static bool worker_find_task(worker_t *self, task_t *result) {
+    executor_lane_t order[EXECUTOR_LANE_COUNT];
+    executor_lane_order(self->turn, order);
+
+    for (size_t i = 0; i < EXECUTOR_LANE_COUNT; ++i) {
+        if (worker_find_task_in_lane(self, order[i], result)) {
+            // the deque slots don't store the lane
+            result->lane = order[i];
+            ++self->turn;
+
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static bool executor_work_stealing_has_work(executor_work_stealing_t *self) {
+    for (size_t i = 0; i < self->size; ++i) {
+        if (!worker_is_idle(&self->workers[i])) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void worker_notify(worker_t *self) {
+    assert_mutex_lock(&self->park_mtx);
+    self->notified = true;
+    pthread_cond_signal(&self->park_cond);
+    assert_mutex_unlock(&self->park_mtx);
+}
+
+// Wakes up the worker if it's asleep or about to be.
+static bool worker_unpark(worker_t *self) {
+    bool parked = true;
+
+    if (!atomic_compare_exchange_strong(&self->parked, &parked, false)) {
+        return false;
+    }
+
+    atomic_fetch_sub(&self->executor->parked_count, 1);
+    worker_notify(self);
+
+    return true;
+}
+
+// Wakes up a single sleeping worker, trying `preferred` first (unless `NULL`).
+//
+// Must be called after the task has been queued.
+static void executor_work_stealing_wake_one(executor_work_stealing_t *self, worker_t *preferred) {
+    // pairs with the fence in `worker_park`: either the worker sees the task, or we see the worker
+    atomic_thread_fence(memory_order_seq_cst);
+
+    if (atomic_load(&self->parked_count) == 0) {
+        return;
+    }
+
+    if (preferred != NULL && worker_unpark(preferred)) {
+        return;
+    }
+
+    size_t start = current_worker != NULL ? current_worker->idx + 1 : 0;
+
+    for (size_t i = 0; i < self->size; ++i) {
+        if (worker_unpark(&self->workers[(start + i) % self->size])) {
+            return;
+        }
+    }
+}
+
+static void worker_park(worker_t *self) {
+    executor_work_stealing_t *ex = self->executor;
+
+    atomic_store(&self->parked, true);
+    atomic_fetch_add(&ex->parked_count, 1);
+    atomic_thread_fence(memory_order_seq_cst);
+
+    // a task queued before the flag was set could have missed it
+    if (!atomic_load(&ex->stopping) && !executor_work_stealing_has_work(ex)) {
+        assert_mutex_lock(&self->park_mtx);
+
+        while (!self->notified) {
+            assert_cond_wait(&self->park_cond, &self->park_mtx);
+        }
+
+        self->notified = false;
+        assert_mutex_unlock(&self->park_mtx);
+    }
+
+    // unless whoever has woken us up has already cleared the flag
+    bool parked = true;
+
+    if (atomic_compare_exchange_strong(&self->parked, &parked, false)) {
+        atomic_fetch_sub(&ex->parked_count, 1);
+    }
+}
+
+static void worker_thread_log_hook(log_level_t level) {
+    fprintf(stderr, "[Work-stealing pool %s/%zu] %s: ",
+        current_worker->executor->pool_name, current_worker->idx, log_prefix_for_level(level));
+}
+
+static void worker_run(worker_t *self, task_t task) {
+    executor_work_stealing_t *ex = self->executor;
+    error_t *err = task.cb(task.data);
+
+    if (err) {
+        executor_work_stealing_on_error_cb_t on_error = atomic_load(&ex->on_error);
+
+        if (on_error != NULL) {
+            err = error_wrap("The executor's on_error callback has returned an error",
+                on_error(ex, err, task));
+        }
+    }
+
+    if (err) {
+        string_t buf;
+
+        if (string_new(&buf) == COMMON_ERROR_CODE_OK) {
+            error_format(err, ERROR_VERBOSITY_SOURCE_CHAIN | ERROR_VERBOSITY_BACKTRACE, &buf);
+            log_abort("A task submitted to an executor `%s` has failed: %s",
+                ex->pool_name,
+                string_as_cptr(&buf)
+            );
+            string_free(&buf);
+        } else {
+            log_abort(
+                "A task submitted to an executor `%s` has failed (could not render the error message)",
+                ex->pool_name
+            );
+        }
+    }
+}
+
+static void *worker_thread(void *data) {
+    worker_t *self = data;
+    executor_work_stealing_t *ex = self->executor;
+
+    current_worker = self;
+    log_hook = worker_thread_log_hook;
+
+    while (true) {
+        task_t task;
+
+        if (worker_find_task(self, &task)) {
+            worker_run(self, task);
+
+            continue;
+        }
+
+        // the submissions that have passed the check before the shutdown are still let through
+        if (atomic_load(&ex->stopping) && atomic_load(&ex->submitting) == 0
+                && !executor_work_stealing_has_work(ex)) {
+            break;
+        }
+
+        worker_park(self);
+    }
+
+    log_printf(LOG_DEBUG, "A child thread is exiting");
+    current_worker = NULL;
+
+    return NULL;
+}
+
+static void executor_work_stealing_shutdown(executor_work_stealing_t *self) {
+    atomic_store(&self->stopping, true);
+
+    for (size_t i = 0; i < self->size; ++i) {
+        worker_notify(&self->workers[i]);
+    }
+}
+
+static void executor_work_stealing_await_termination(executor_work_stealing_t *self) {
+    assert_mutex_lock(&self->join_mtx);
+
+    if (!self->joined) {
+        for (size_t i = 0; i < vec_pthread_len(&self->threads); ++i) {
+            pthread_join(*vec_pthread_get(&self->threads, i), NULL);
+        }
+
+        self->joined = true;
+    }
+
+    assert_mutex_unlock(&self->join_mtx);
+}
+
+static void worker_lane_free(worker_lane_t *self) {
+    ring_task_free(&self->overflow);
+    mpmc_task_free(&self->inbox);
+    deque_free(&self->deque);
+}
+
+static void worker_free(worker_t *self) {
+    pthread_cond_destroy(&self->park_cond);
+    pthread_mutex_destroy(&self->park_mtx);
+    pthread_mutex_destroy(&self->overflow_mtx);
+
+    for (size_t i = 0; i < EXECUTOR_LANE_COUNT; ++i) {
+        worker_lane_free(&self->lanes[i]);
+    }
+}
+
+static void executor_work_stealing_free(executor_work_stealing_t *self) {
+    executor_work_stealing_shutdown(self);
+    executor_work_stealing_await_termination(self);
+
+    for (size_t i = 0; i < self->size; ++i) {
+        worker_free(&self->workers[i]);
+    }
+
+    free(self->workers);
+    pthread_mutex_destroy(&self->join_mtx);
+    vec_pthread_free(&self->threads);
+}
+
+static executor_submission_t executor_work_stealing_submit(
+    executor_work_stealing_t *self,
+    task_t task
+) {
+    assert(task.lane < EXECUTOR_LANE_COUNT);
+
+    error_t *err = NULL;
+
+    atomic_fetch_add(&self->submitting, 1);
+
+    if (atomic_load(&self->stopping)) {
+        atomic_fetch_sub(&self->submitting, 1);
+
+        return EXECUTOR_DROPPED;
+    }
+
+    worker_t *worker = current_worker;
+
+    if (worker != NULL && worker->executor == self) {
+        err = deque_push(&worker->lanes[task.lane].deque, task);
+
+        // the submitter itself is busy: somebody else should pick the task up
+        worker = NULL;
+    } else {
+        size_t idx = atomic_fetch_add_explicit(&self->next_inbox, 1, memory_order_relaxed);
+        worker = &self->workers[idx % self->size];
+        err = worker_inbox_push(worker, task);
+    }
+
+    if (!err) {
+        executor_work_stealing_wake_one(self, worker);
+    }
+
+    atomic_fetch_sub(&self->submitting, 1);
+
+    executor_work_stealing_on_error_cb_t on_error = atomic_load(&self->on_error);
+
+    if (err && on_error != NULL) {
+        err = error_wrap("The executor's on_error callback has returned an error",
+            on_error(self, err, task));
+
+        error_log_free(&err, LOG_ERR, ERROR_VERBOSITY_BACKTRACE | ERROR_VERBOSITY_SOURCE_CHAIN);
+        log_printf(LOG_ERR, "Shutting down the executor");
+        executor_work_stealing_shutdown(self);
+    }
+
+    return EXECUTOR_SUBMITTED;
+}
+
+static executor_vtable_t const executor_work_stealing_vtable = {
+    .free = (executor_vtable_free_t) executor_work_stealing_free,
+    .submit = (executor_vtable_submit_t) executor_work_stealing_submit,
+    .shutdown = (executor_vtable_shutdown_t) executor_work_stealing_shutdown,
+    .await_termination =
+        (executor_vtable_await_termination_t) executor_work_stealing_await_termination,
+};
+
+static error_t *worker_lane_init(worker_lane_t *self) {
+    error_t *err = NULL;
+
+    self->overflow = ring_task_new();
+    atomic_init(&self->overflow_len, 0);
+
+    err = deque_init(&self->deque);
+    if (err) goto deque_init_fail;
+
+    err = error_wrap("Could not allocate memory for the inbox", error_from_common(
+        mpmc_task_init(&self->inbox, INBOX_CAPACITY)));
+    if (err) goto inbox_init_fail;
+
+    return err;
+
+inbox_init_fail:
+    deque_free(&self->deque);
+
+deque_init_fail:
+    return err;
+}
+
+static error_t *worker_init(worker_t *self, executor_work_stealing_t *executor, size_t idx) {
+    error_t *err = NULL;
+
+    self->executor = executor;
+    self->idx = idx;
+    // the generator must not start from zero
+    self->rng = (idx + 1) * 0x9e3779b97f4a7c15;
+    self->turn = 0;
+    atomic_init(&self->parked, false);
+    self->notified = false;
+
+    size_t lanes_initialized = 0;
+
+    for (; lanes_initialized < EXECUTOR_LANE_COUNT; ++lanes_initialized) {
+        err = worker_lane_init(&self->lanes[lanes_initialized]);
+        if (err) goto lane_init_fail;
+    }
+
+    err = error_wrap("Could initialize a mutex", error_from_errno(
+        pthread_mutex_init(&self->overflow_mtx, NULL)));
+    if (err) goto overflow_mtx_init_fail;
+
+    err = error_wrap("Could initialize a mutex", error_from_errno(
+        pthread_mutex_init(&self->park_mtx, NULL)));
+    if (err) goto park_mtx_init_fail;
+
+    err = error_wrap("Could initialize a condition variable", error_from_errno(
+        pthread_cond_init(&self->park_cond, NULL)));
+    if (err) goto park_cond_init_fail;
+
+    return err;
+
+park_cond_init_fail:
+    pthread_mutex_destroy(&self->park_mtx);
+
+park_mtx_init_fail:
+    pthread_mutex_destroy(&self->overflow_mtx);
+
+overflow_mtx_init_fail:
+lane_init_fail:
+    while (lanes_initialized > 0) {
+        worker_lane_free(&self->lanes[--lanes_initialized]);
+    }
+
+    return err;
+}
+
+error_t *executor_work_stealing_new(
+    char const *pool_name,
+    size_t size,
+    executor_work_stealing_t **result
+) {
+    assert(size > 0);
+
+    error_t *err = NULL;
+
+    executor_work_stealing_t *self = calloc(1, sizeof(executor_work_stealing_t));
+    err = error_wrap("Could not allocate memory for the executor", OK_IF(self != NULL));
+    if (err) goto calloc_fail;
+
+    self->pool_name = pool_name;
+    self->size = size;
+    self->threads = vec_pthread_new();
+    atomic_init(&self->stopping, false);
+    atomic_init(&self->submitting, 0);
+    atomic_init(&self->parked_count, 0);
+    atomic_init(&self->next_inbox, 0);
+    atomic_init(&self->on_error, NULL);
+    self->joined = false;
+
+    err = error_wrap("Could not allocate memory for the executor", error_from_common(
+        vec_pthread_resize(&self->threads, self->size)));
+    if (err) goto resize_fail;
+
+    self->workers = calloc(size, sizeof(worker_t));
+    err = error_wrap("Could not allocate memory for the executor", OK_IF(self->workers != NULL));
+    if (err) goto workers_calloc_fail;
+
+    err = error_wrap("Could initialize a mutex", error_from_errno(
+        pthread_mutex_init(&self->join_mtx, NULL)));
+    if (err) goto join_mtx_init_fail;
+
+    size_t initialized = 0;
+
+    for (; initialized < size; ++initialized) {
+        err = worker_init(&self->workers[initialized], self, initialized);
+        if (err) goto worker_init_fail;
+    }
+
+    executor_init(&self->executor, &executor_work_stealing_vtable);
+
+    for (size_t i = 0; i < self->size; ++i) {
+        pthread_t thread_id;
+        err = error_wrap("Could not spawn a worker thread", error_from_errno(
+            pthread_create(&thread_id, NULL, worker_thread, &self->workers[i])));
+        if (err) break;
+
+        // since we have already resized the vector, no allocation, and hence failure, can occur
+        error_assert(error_from_common(
+            vec_pthread_push(&self->threads, thread_id)));
+    }
+
+    if (!err) {
+        *result = self;
+
+        return err;
+    }
+
+    // everything below is a failure scenario
+
+    executor_free(&self->executor);
+
+    return err;
+
+worker_init_fail:
+    while (initialized > 0) {
+        worker_free(&self->workers[--initialized]);
+    }
+
+    pthread_mutex_destroy(&self->join_mtx);
+
+join_mtx_init_fail:
+    free(self->workers);
+
+workers_calloc_fail:
+resize_fail:
+    vec_pthread_free(&self->threads);
+
+    free(self);
+
+calloc_fail:
+    return err;
+}
+
+void executor_work_stealing_on_error(
+    executor_work_stealing_t *self,
+    executor_work_stealing_on_error_cb_t on_error
+) {
+    atomic_store(&self->on_error, on_error);
+}
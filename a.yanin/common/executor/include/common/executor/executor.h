@@ -1,5 +1,8 @@
 #pragma once
 
+#include <stddef.h>
+#include <stdint.h>
+
 #include <common/error.h>
 
 // Represents the result of task submission.
@@ -13,9 +16,33 @@ typedef enum {
 
 typedef error_t *(*task_cb_t)(void *data);
 
+// A node hint meaning that the task can run anywhere.
+#define EXECUTOR_ANY_NODE SIZE_MAX
+
+// The lane a task is queued in.
+//
+// The executors that support lanes run the tasks of a more urgent lane first, but every few turns
+// let a less urgent lane go first (see `executor_lane_order`), so that a steady stream of urgent
+// tasks doesn't starve the rest. The other executors ignore the lanes.
+typedef enum {
+    // Anything that is neither latency-critical nor deferrable. This is the default.
+    EXECUTOR_LANE_NORMAL,
+
+    // Latency-critical I/O, such as pushing the bytes already available to the clients.
+    EXECUTOR_LANE_CRITICAL,
+
+    // The work that can wait, such as eviction, snapshotting, or prefetching.
+    EXECUTOR_LANE_BACKGROUND,
+} executor_lane_t;
+
+// The number of lanes.
+#define EXECUTOR_LANE_COUNT 3
+
 typedef struct {
     task_cb_t cb;
     void *data;
+    // the lane to queue the task in; left zero-initialized, it's `EXECUTOR_LANE_NORMAL`
+    executor_lane_t lane;
 } task_t;
 
 typedef struct executor executor_t;
@@ -24,6 +51,12 @@ typedef void (*executor_vtable_free_t)(executor_t *self);
 typedef executor_submission_t (*executor_vtable_submit_t)(executor_t *self, task_t task);
 typedef void (*executor_vtable_shutdown_t)(executor_t *self);
 typedef void (*executor_vtable_await_termination_t)(executor_t *self);
+typedef executor_submission_t (*executor_vtable_submit_to_node_t)(
+    executor_t *self,
+    task_t task,
+    size_t node
+);
+typedef size_t (*executor_vtable_current_node_t)(executor_t *self);
 
 typedef struct {
     // Frees the resources associated with the executor implementation.
@@ -41,6 +74,17 @@ typedef struct {
 
     // Blocks the currents thread until the last task finishes executing.
     executor_vtable_await_termination_t await_termination;
+
+    // Submits a task, preferring the workers on the given NUMA node.
+    //
+    // This vtable entry can be `NULL` if the executor does not group its workers by node.
+    executor_vtable_submit_to_node_t submit_to_node;
+
+    // Returns the NUMA node of the calling thread if it's one of the executor's workers, or
+    // `EXECUTOR_ANY_NODE` otherwise.
+    //
+    // This vtable entry can be `NULL` if the executor does not group its workers by node.
+    executor_vtable_current_node_t current_node;
 } executor_vtable_t;
 
 // An abstract executor struct included in concrete executor implementations.
@@ -63,6 +107,27 @@ void executor_free(executor_t *self);
 // Dispatches to the `submit` method of the executor vtable.
 executor_submission_t executor_submit(executor_t *self, task_t task);
 
+// Submits a task to the executor, preferring the workers on the NUMA node `node`.
+//
+// Dispatches to the `submit_to_node` method of the executor vtable.
+// If the executor does not support it, or `node` is `EXECUTOR_ANY_NODE`, falls back to `submit`.
+executor_submission_t executor_submit_to_node(executor_t *self, task_t task, size_t node);
+
+// Returns the NUMA node the calling thread runs on, if it's one of the executor's workers.
+//
+// Dispatches to the `current_node` method of the executor vtable.
+// If the executor does not support it, returns `EXECUTOR_ANY_NODE`.
+size_t executor_current_node(executor_t *self);
+
+// Fills `order` with the lanes in the order a worker should look for its `turn`-th task in.
+//
+// The lanes usually go from the most urgent to the least urgent one.
+// However, the normal lane goes first every 4th turn and the background lane every 16th, which
+// guarantees them that share of the turns while they have tasks.
+//
+// `order` must have room for `EXECUTOR_LANE_COUNT` lanes.
+void executor_lane_order(size_t turn, executor_lane_t *order);
+
 // Shuts down the executor.
 //
 // Dispatches to the `shutdown` method of the executor vtable.
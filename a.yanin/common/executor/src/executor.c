@@ -17,6 +17,55 @@ executor_submission_t executor_submit(executor_t *self, task_t task) {
     return self->vtable->submit(self, task);
 }
 
+executor_submission_t executor_submit_to_node(executor_t *self, task_t task, size_t node) {
+    if (node == EXECUTOR_ANY_NODE || self->vtable->submit_to_node == NULL) {
+        return self->vtable->submit(self, task);
+    }
+
+    return self->vtable->submit_to_node(self, task, node);
+}
+
+size_t executor_current_node(executor_t *self) {
+    if (self->vtable->current_node == NULL) {
+        return EXECUTOR_ANY_NODE;
+    }
+
+    return self->vtable->current_node(self);
+}
+
+enum {
+    // the normal lane goes first every this many turns
+    EXECUTOR_NORMAL_LANE_PERIOD = 4,
+
+    // the background lane goes first every this many turns
+    EXECUTOR_BACKGROUND_LANE_PERIOD = 16,
+};
+
+void executor_lane_order(size_t turn, executor_lane_t *order) {
+    static executor_lane_t const by_urgency[EXECUTOR_LANE_COUNT] = {
+        EXECUTOR_LANE_CRITICAL,
+        EXECUTOR_LANE_NORMAL,
+        EXECUTOR_LANE_BACKGROUND,
+    };
+
+    executor_lane_t first = EXECUTOR_LANE_CRITICAL;
+
+    if (turn % EXECUTOR_BACKGROUND_LANE_PERIOD == EXECUTOR_BACKGROUND_LANE_PERIOD - 1) {
+        first = EXECUTOR_LANE_BACKGROUND;
+    } else if (turn % EXECUTOR_NORMAL_LANE_PERIOD == EXECUTOR_NORMAL_LANE_PERIOD - 1) {
+        first = EXECUTOR_LANE_NORMAL;
+    }
+
+    size_t len = 0;
+    order[len++] = first;
+
+    for (size_t i = 0; i < EXECUTOR_LANE_COUNT; ++i) {
+        if (by_urgency[i] != first) {
+            order[len++] = by_urgency[i];
+        }
+    }
+}
+
 void executor_shutdown(executor_t *self) {
     self->vtable->shutdown(self);
 }
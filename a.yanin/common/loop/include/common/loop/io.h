@@ -2,7 +2,20 @@
 
 #include <stddef.h>
 
+enum {
+    // The size of the buffers the handlers read the received data into.
+    LOOP_READ_BUFFER_SIZE = 16384,
+};
+
 typedef struct {
     char const *base;
     size_t len;
 } slice_t;
+
+// Gives back a read buffer whose ownership has been taken from a handler (see
+// `tcp_take_read_buffer` and `pipe_take_read_buffer`).
+//
+// The buffer is kept for reuse by the calling thread, so it does not need to be the one that has
+// read into it.
+// Can be called from any thread.
+void loop_read_buffer_release(char *buf);
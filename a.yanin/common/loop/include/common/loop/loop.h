@@ -2,6 +2,7 @@
 
 #include <stdatomic.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 #ifndef COMMON_PTHREADS_DISABLED
 #include <pthread.h>
@@ -26,6 +27,11 @@ typedef arc_handler_t *arc_handler_ptr_t;
 #define VEC_CONFIG (COLLECTION_DECLARE)
 #include <common/collections/vec.h>
 
+#define DLIST_LABEL handler
+#define DLIST_ELEMENT_TYPE arc_handler_ptr_t
+#define DLIST_CONFIG (COLLECTION_DECLARE)
+#include <common/collections/dlist.h>
+
 #define VEC_LABEL pollfd
 #define VEC_ELEMENT_TYPE struct pollfd
 #define VEC_CONFIG (COLLECTION_DECLARE)
@@ -45,6 +51,8 @@ typedef enum {
     LOOP_WRITE = POLLOUT,
     LOOP_ERR = POLLERR,
     LOOP_HUP = POLLHUP,
+    // the handler's timer has expired (see `handler_set_deadline`); never reported by poll(2)
+    LOOP_TIMEOUT = 1 << 16,
 
     LOOP_ALL_IN = LOOP_READ | LOOP_WRITE,
     LOOP_ALL = LOOP_READ | LOOP_WRITE | POLLERR | POLLHUP,
@@ -56,6 +64,32 @@ typedef enum {
     LOOP_HANDLER_UNREGISTERED,
 } loop_handler_status_t;
 
+// The mechanism the loop uses to wait for I/O events.
+typedef enum {
+    // epoll if available, poll otherwise
+    LOOP_BACKEND_DEFAULT,
+    LOOP_BACKEND_POLL,
+    LOOP_BACKEND_EPOLL,
+    // waits with io_uring poll requests, while the handlers still do their own reads and writes;
+    // falls back to the default backend if io_uring is not available
+    LOOP_BACKEND_IO_URING,
+} loop_backend_t;
+
+// An entry of a loop's timer wheel.
+typedef struct loop_timer loop_timer_t;
+
+struct loop_timer {
+    loop_timer_t *prev;
+    loop_timer_t *next;
+    // the time (see `loop_time_ms`) the timer expires at
+    uint64_t expiry;
+    // the position in the wheel
+    uint8_t level;
+    uint8_t slot;
+    // set while the timer is in the wheel
+    bool armed;
+};
+
 typedef void (*handler_vtable_free_t)(handler_t *self);
 typedef error_t *(*handler_vtable_process_t)(handler_t *self, loop_t *loop, poll_flags_t events);
 typedef error_t *(*handler_vtable_on_error_t)(handler_t *self, loop_t *loop, error_t *error);
@@ -76,6 +110,12 @@ typedef struct {
     // This vtable entry can be `NULL`, in which case all errors cause the
     // handler to be unregistered whichout aborting the loop.
     handler_vtable_on_error_t on_error;
+
+    // The executor lane the handler's tasks are queued in, unless changed with
+    // `handler_set_lane`.
+    //
+    // If left zero-initialized, the tasks go to `EXECUTOR_LANE_NORMAL`.
+    executor_lane_t lane;
 } handler_vtable_t;
 
 // The base struct of an event handler.
@@ -104,6 +144,12 @@ struct handler {
     // still registered
     bool passive;
     atomic_bool force;
+    // the time the handler's timer expires at, or 0 if it's not set
+    _Atomic uint64_t deadline;
+    // the executor's NUMA node the handler last ran on, where its next task is submitted to
+    _Atomic size_t last_node;
+    // the executor lane the handler's tasks are queued in
+    _Atomic executor_lane_t lane;
 
     // the following fields are protected by `mtx`
 #ifndef COMMON_PTHREADS_DISABLED
@@ -111,11 +157,36 @@ struct handler {
 #endif
     poll_flags_t current_flags;
     poll_flags_t pending_flags;
+
+    // the following fields are managed by the loop the handler is registered in
+    dlist_handler_node_t *loop_node;
+    // set while the handler is queued for the loop to re-examine
+    // (protected by the loop's lock)
+    bool dirty;
+    handler_t *dirty_next;
+    // set while the handler is in the current iteration's list of handlers to run
+    bool scheduled;
+    size_t scheduled_pos;
+    // the backend's bookkeeping
+    size_t backend_pos;
+    bool armed;
+    poll_flags_t armed_flags;
+    // the entry in the loop's timer wheel; may expire earlier than `deadline`
+    loop_timer_t timer;
 };
 
 // Create a new instance of `loop_t`.
+//
+// Equivalent to `loop_new_with_backend(executor, LOOP_BACKEND_DEFAULT, result)`.
 error_t *loop_new(executor_t *executor, loop_t **result);
 
+// Create a new instance of `loop_t` that waits for I/O events using `backend`.
+//
+// The backend keeps the interest list across iterations: a handler's fd is only re-registered
+// when its event mask changes or after it has been processed.
+// Fails if `backend` is not supported on this system.
+error_t *loop_new_with_backend(executor_t *executor, loop_backend_t backend, loop_t **result);
+
 // Frees the resources allocated by `self`.
 //
 // The loop must have been stopped.
@@ -146,6 +217,11 @@ void loop_stop(loop_t *self);
 // Forcibly interrupts the next (or the current) iteration of the loop.
 void loop_interrupt(loop_t *self);
 
+// Returns the current time in milliseconds, as used by the loop timers.
+//
+// The clock is monotonic and never returns 0.
+uint64_t loop_time_ms(void);
+
 // Initializes the `handle_t` struct.
 //
 // Must be called by handler implementations during their initialization.
@@ -164,6 +240,7 @@ void handler_free(handler_t *self);
 //
 // If this is called during an iteration of the loop, its unregistration is
 // deferred until the end of the iteration.
+// The loop is interrupted to pick up the change.
 // If it had any pending events, the handle will still process them during the
 // iteration.
 //
@@ -184,6 +261,9 @@ poll_flags_t handler_pending_mask(handler_t const *self);
 
 // Set the event mask to be applied on the next iteration of the loop.
 //
+// Returns the previous value.
+// The loop is only interrupted if the mask has actually changed.
+//
 // This method must be called from a synchronized context.
 poll_flags_t handler_set_pending_mask(handler_t *self, poll_flags_t flags);
 
@@ -211,6 +291,36 @@ int handler_fd(handler_t const *self);
 // regardless of whether it has any I/O events pending.
 void handler_force(handler_t *self);
 
+// Sets the handler's timer to expire at `deadline` (see `loop_time_ms`).
+//
+// Once the deadline passes, the handler's process method is called with `LOOP_TIMEOUT` among the
+// events, the same way it is for I/O events, and the timer is cleared.
+// A handler has a single timer: setting it again replaces the previous deadline, and setting it
+// to 0 cancels it.
+// The loop waits for events no longer than until the earliest deadline of its handlers.
+//
+// Postponing a timer doesn't interrupt the loop, so this is cheap to call on every transfer.
+//
+// This function can be called from any context.
+void handler_set_deadline(handler_t *self, uint64_t deadline);
+
+// Sets the handler's timer to expire `timeout_ms` milliseconds from now.
+//
+// See `handler_set_deadline`.
+void handler_set_timeout(handler_t *self, uint64_t timeout_ms);
+
+// Returns the time the handler's timer expires at, or 0 if it's not set.
+uint64_t handler_deadline(handler_t const *self);
+
+// Sets the executor lane the handler's future tasks are queued in, overriding the one its vtable
+// declares.
+//
+// This is useful for handlers whose urgency changes over their lifetime, e.g., a connection that
+// becomes latency-critical once it's established.
+//
+// This function can be called from any context.
+void handler_set_lane(handler_t *self, executor_lane_t lane);
+
 // Returns the custom data associated with this handler.
 //
 // The default value is `NULL`.
@@ -54,6 +54,11 @@ void pipe_read(pipe_handler_rd_t *self, pipe_on_read_cb_t on_read, pipe_rd_on_er
 // The `eof` flag is set before the last call to the `on_read` callback.
 bool pipe_is_eof(pipe_handler_rd_t const *self);
 
+// Takes the ownership of the buffer backing the slice passed to the running `on_read` callback.
+//
+// See `tcp_take_read_buffer` for details.
+char *pipe_take_read_buffer(pipe_handler_rd_t *self);
+
 // Creates a new request to write to the pipe.
 //
 // The request is added to the queue.
@@ -87,12 +87,35 @@ typedef error_t *(*tcp_on_write_error_cb_t)(
     size_t written_count
 );
 
+// The kinds of timeouts a TCP handler can enforce (see `tcp_set_timeout`).
+typedef enum {
+    // a read has been requested with `tcp_read`, but no data has been received
+    TCP_TIMEOUT_READ,
+    // write requests are queued or the connection is being established, but no data has been sent
+    TCP_TIMEOUT_WRITE,
+    // no data has been sent or received
+    TCP_TIMEOUT_IDLE,
+
+    TCP_TIMEOUT_COUNT,
+} tcp_timeout_t;
+
+// Called when one of the handler's timeouts expires.
+typedef error_t *(*tcp_on_timeout_cb_t)(
+    loop_t *loop,
+    tcp_handler_t *handler,
+    tcp_timeout_t timeout
+);
+
 // Allocates a new `tcp_handler_server_t`, creates a socket for it to manage, and binds it to the
 // given address.
+//
+// If `reuse_port` is set, other sockets may bind to the same address as long as they set it too;
+// the kernel then distributes the incoming connections among them.
 error_t *tcp_server_new(
     struct sockaddr *addr,
     socklen_t addrlen,
     bool reuse_addr,
+    bool reuse_port,
     tcp_handler_server_t **result
 );
 
@@ -138,6 +161,17 @@ void tcp_read(tcp_handler_t *self, tcp_on_read_cb_t on_read, tcp_on_read_error_c
 // The `eof` flag is set before the last call to the `on_read` callback.
 bool tcp_is_eof(tcp_handler_t const *self);
 
+// Takes the ownership of the buffer backing the slice passed to the running `on_read` callback.
+//
+// The slice stays valid after the callback returns, and the buffer, which is
+// `LOOP_READ_BUFFER_SIZE` bytes long, must be given back with `loop_read_buffer_release` once it's
+// no longer needed.
+// This lets the caller keep the received data without copying it.
+//
+// Must only be called from the `on_read` callback.
+// Returns `NULL` if the buffer has already been taken.
+char *tcp_take_read_buffer(tcp_handler_t *self);
+
 // Creates a new request to write to the socket.
 //
 // The request is added to the queue.
@@ -160,6 +194,25 @@ error_t *tcp_write(
     tcp_on_write_error_cb_t on_error
 );
 
+// Relays the data between two connections in both directions until each of the peers has closed
+// its sending end.
+//
+// The data is moved between the sockets through a pair of pipes and never leaves the kernel.
+// A socket isn't read from while the pipe it feeds is full, so a slow receiver holds back the
+// sender.
+// The write requests made before the call are processed first, and the `on_read` callbacks are no
+// longer invoked.
+//
+// Once a handler has relayed its peer's end of stream, its output is shut down.
+// When it's done both ways, it's unregistered.
+// If one of the handlers fails or is freed before that, the other one is unregistered as well.
+//
+// This is only supported on Linux: elsewhere an error is returned.
+//
+// Both handlers must be called from their synchronized contexts, and their connections must be
+// established.
+error_t *tcp_relay(tcp_handler_t *self, tcp_handler_t *peer);
+
 // Shuts down the receiving end of the socket.
 //
 // Once all the already received data is processed, no more calls to the `on_read` callback will be
@@ -191,6 +244,22 @@ void tcp_server_set_on_error(tcp_handler_server_t *self, tcp_server_on_error_cb_
 // Sets a callback for last-resort error handling.
 void tcp_set_on_error(tcp_handler_t *self, tcp_on_error_cb_t on_error);
 
+// Sets the number of milliseconds after which `timeout` expires, or disables it if `timeout_ms` is
+// 0.
+//
+// The time is counted from this call or the last transfer the timeout is concerned with, whichever
+// is later.
+// Once a timeout expires, it's disabled and the `on_timeout` callback is invoked; if there's none,
+// the handler fails with `ETIMEDOUT`.
+//
+// All the timeouts are disabled by default.
+// They're enforced by the loop's timers (see `handler_set_deadline`), so an idle connection is
+// closed even if nothing else happens in the loop.
+void tcp_set_timeout(tcp_handler_t *self, tcp_timeout_t timeout, uint64_t timeout_ms);
+
+// Sets the callback to invoke when a timeout expires.
+void tcp_set_on_timeout(tcp_handler_t *self, tcp_on_timeout_cb_t on_timeout);
+
 // Retrieves the address of the remote peer.
 void tcp_address(tcp_handler_t const *self, struct sockaddr const **addr, socklen_t *len);
 
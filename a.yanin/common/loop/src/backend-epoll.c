@@ -0,0 +1,172 @@
+#include "backend.h"
+
+#ifdef COMMON_EPOLL_ENABLED
+
+#include <stdlib.h>
+
+#include <common/error-codes/adapter.h>
+#include <common/posix/adapter.h>
+
+enum {
+    BACKEND_EPOLL_MAX_EVENTS = 256,
+};
+
+// The epoll(7) backend.
+//
+// The handlers are registered with `EPOLLONESHOT`, so a handler that is being processed never
+// wakes the loop up, and rearming it is a single `epoll_ctl` call.
+typedef struct {
+    backend_t backend;
+    int epfd;
+    struct epoll_event events[BACKEND_EPOLL_MAX_EVENTS];
+} backend_epoll_t;
+
+static uint32_t backend_epoll_events_from_flags(poll_flags_t flags) {
+    uint32_t result = EPOLLONESHOT;
+
+    if (flags & LOOP_READ) {
+        result |= EPOLLIN;
+    }
+
+    if (flags & LOOP_WRITE) {
+        result |= EPOLLOUT;
+    }
+
+    return result;
+}
+
+static poll_flags_t backend_epoll_flags_from_events(uint32_t events) {
+    poll_flags_t result = 0;
+
+    if (events & EPOLLIN) {
+        result |= LOOP_READ;
+    }
+
+    if (events & EPOLLOUT) {
+        result |= LOOP_WRITE;
+    }
+
+    if (events & EPOLLERR) {
+        result |= LOOP_ERR;
+    }
+
+    if (events & EPOLLHUP) {
+        result |= LOOP_HUP;
+    }
+
+    return result;
+}
+
+static void backend_epoll_free(backend_epoll_t *self) {
+    error_t *err = error_from_posix(wrapper_close(self->epfd));
+
+    if (err) {
+        error_log_free(&err, LOG_WARN, ERROR_VERBOSITY_SOURCE_CHAIN | ERROR_VERBOSITY_BACKTRACE);
+    }
+
+    free(self);
+}
+
+static error_t *backend_epoll_add(backend_epoll_t *self, handler_t *handler) {
+    error_t *err = NULL;
+
+    // errors and hang-ups are reported regardless of the event mask
+    struct epoll_event event = {
+        .events = EPOLLONESHOT,
+        .data.ptr = handler,
+    };
+    err = error_wrap("Could not add an fd to the epoll interest list", error_from_posix(
+        wrapper_epoll_ctl(self->epfd, EPOLL_CTL_ADD, handler->fd, &event)));
+    if (err) goto fail;
+
+    handler->armed = false;
+
+fail:
+    return err;
+}
+
+static error_t *backend_epoll_remove(backend_epoll_t *self, handler_t *handler) {
+    handler->armed = false;
+
+    return error_wrap("Could not remove an fd from the epoll interest list", error_from_posix(
+        wrapper_epoll_ctl(self->epfd, EPOLL_CTL_DEL, handler->fd, NULL)));
+}
+
+static error_t *backend_epoll_arm(backend_epoll_t *self, handler_t *handler, poll_flags_t flags) {
+    error_t *err = NULL;
+
+    struct epoll_event event = {
+        .events = backend_epoll_events_from_flags(flags),
+        .data.ptr = handler,
+    };
+    err = error_wrap("Could not modify an fd in the epoll interest list", error_from_posix(
+        wrapper_epoll_ctl(self->epfd, EPOLL_CTL_MOD, handler->fd, &event)));
+    if (err) goto fail;
+
+    handler->armed = true;
+    handler->armed_flags = flags;
+
+fail:
+    return err;
+}
+
+static error_t *backend_epoll_wait(
+    backend_epoll_t *self,
+    int timeout_ms,
+    vec_backend_event_t *events
+) {
+    error_t *err = NULL;
+
+    int event_count = 0;
+    err = error_wrap("Could not await I/O events", error_from_posix(wrapper_epoll_wait(
+        self->epfd, self->events, BACKEND_EPOLL_MAX_EVENTS, timeout_ms, &event_count)));
+    if (err) goto fail;
+
+    for (int i = 0; i < event_count; ++i) {
+        handler_t *handler = self->events[i].data.ptr;
+        err = error_from_common(vec_backend_event_push(events, (backend_event_t) {
+            .handler = handler,
+            .flags = backend_epoll_flags_from_events(self->events[i].events),
+        }));
+        if (err) goto fail;
+
+        handler->armed = false;
+    }
+
+fail:
+    return err;
+}
+
+static backend_vtable_t const backend_epoll_vtable = {
+    .free = (void (*)(backend_t *)) backend_epoll_free,
+    .add = (error_t *(*)(backend_t *, handler_t *)) backend_epoll_add,
+    .remove = (error_t *(*)(backend_t *, handler_t *)) backend_epoll_remove,
+    .arm = (error_t *(*)(backend_t *, handler_t *, poll_flags_t)) backend_epoll_arm,
+    .wait = (error_t *(*)(backend_t *, int, vec_backend_event_t *)) backend_epoll_wait,
+};
+
+error_t *backend_epoll_new(backend_t **result) {
+    error_t *err = NULL;
+
+    backend_epoll_t *self = calloc(1, sizeof(backend_epoll_t));
+    err = error_wrap("Could not allocate memory for the epoll backend", OK_IF(self != NULL));
+    if (err) goto calloc_fail;
+
+    self->backend.vtable = &backend_epoll_vtable;
+
+    err = error_wrap("Could not create an epoll instance", error_from_posix(
+        wrapper_epoll_create(&self->epfd)));
+    if (err) goto epoll_create_fail;
+
+    *result = &self->backend;
+
+    return err;
+
+epoll_create_fail:
+    free(self);
+
+calloc_fail:
+    return err;
+}
+
+#endif
@@ -0,0 +1,618 @@
+// syscall(2) and MAP_POPULATE are not part of POSIX
+#define _DEFAULT_SOURCE
+
+#include "backend.h"
+
+#ifdef COMMON_IO_URING_ENABLED
+
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <common/error-codes/adapter.h>
+#include <common/posix/adapter.h>
+
+enum {
+    BACKEND_IO_URING_ENTRIES = 256,
+};
+
+// the user data of the requests whose completions are of no interest
+#define BACKEND_IO_URING_IGNORED ((uint64_t) 0)
+
+// The user data of the poll requests refer to slots and is never a multiple of 2^32, which is left
+// for the timeout requests.
+#define BACKEND_IO_URING_IS_TIMEOUT(user_data) (((user_data) & UINT32_MAX) == 0)
+
+typedef struct {
+    // `NULL` if the slot is free
+    handler_t *handler;
+    // the user data of the poll request in flight, or `BACKEND_IO_URING_IGNORED`
+    uint64_t user_data;
+    // bumped on every poll request so that stale completions can be told apart
+    uint32_t generation;
+} io_uring_slot_t;
+
+#define VEC_ELEMENT_TYPE io_uring_slot_t
+#define VEC_LABEL io_uring_slot
+#define VEC_CONFIG (COLLECTION_DECLARE | COLLECTION_DEFINE | COLLECTION_STATIC)
+#include <common/collections/vec.h>
+
+#define VEC_ELEMENT_TYPE size_t
+#define VEC_LABEL size
+#define VEC_CONFIG (COLLECTION_DECLARE | COLLECTION_DEFINE | COLLECTION_STATIC)
+#include <common/collections/vec.h>
+
+// The io_uring(7) backend.
+//
+// Only the waiting goes through the ring: the handlers are still readiness-based and do their own
+// non-blocking reads and writes once woken, so no I/O is submitted as ring requests.
+//
+// Arming a handler queues a one-shot `IORING_OP_POLL_ADD` request, which has the same semantics as
+// `EPOLLONESHOT`.
+// The requests queued during an iteration are submitted in a single `io_uring_enter` call that
+// also waits for completions, which are then reaped from the ring in a batch.
+//
+// The kernels that support it take the wait timeout as an argument of that call.
+// The older ones are given a timeout request instead. Only one is kept in flight: it's reused by the
+// later waits that end no earlier, and replaced only when a wait has to end sooner.
+//
+// The handlers are referred to by slots rather than by pointers: a handler may be freed while its
+// poll request is still in flight.
+typedef struct {
+    backend_t backend;
+    int fd;
+
+    void *sq_ring;
+    size_t sq_ring_size;
+    void *cq_ring;
+    size_t cq_ring_size;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+
+    _Atomic unsigned *sq_head;
+    _Atomic unsigned *sq_tail;
+    _Atomic unsigned *sq_flags;
+    unsigned *sq_array;
+    unsigned sq_mask;
+    unsigned sq_entries;
+
+    _Atomic unsigned *cq_head;
+    _Atomic unsigned *cq_tail;
+    struct io_uring_cqe *cqes;
+    unsigned cq_mask;
+
+    vec_io_uring_slot_t slots;
+    vec_size_t free_slots;
+
+    // must outlive the submission of a timeout request
+    struct __kernel_timespec timeout;
+    // whether `io_uring_enter` accepts the timeout as an argument (`IORING_ENTER_EXT_ARG`)
+    bool ext_arg;
+    // the user data of the timeout request in flight, or `BACKEND_IO_URING_IGNORED`
+    uint64_t timeout_user_data;
+    // the time (see `loop_time_ms`) the timeout request in flight expires at
+    uint64_t timeout_deadline;
+    // the sequence number of the last timeout request
+    uint32_t timeout_seq;
+} backend_io_uring_t;
+
+static int io_uring_setup(unsigned entries, struct io_uring_params *params) {
+    return (int) syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int io_uring_enter(
+    int fd,
+    unsigned to_submit,
+    unsigned min_complete,
+    unsigned flags,
+    void const *arg,
+    size_t arg_size
+) {
+    return (int) syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, arg_size);
+}
+
+static uint64_t backend_io_uring_user_data(size_t slot, uint32_t generation) {
+    return ((uint64_t) generation << 32) | (uint64_t) (slot + 1);
+}
+
+// Submits the queued requests and, if `min_complete` is positive, waits for completions.
+//
+// `arg` is passed to the kernel as is; it may be `NULL`.
+static error_t *backend_io_uring_enter_arg(
+    backend_io_uring_t *self,
+    unsigned min_complete,
+    unsigned flags,
+    void const *arg,
+    size_t arg_size
+) {
+    while (true) {
+        // the kernel advances the head as it consumes the entries
+        unsigned to_submit = atomic_load_explicit(self->sq_tail, memory_order_relaxed)
+            - atomic_load_explicit(self->sq_head, memory_order_acquire);
+
+        errno = 0;
+
+        if (io_uring_enter(self->fd, to_submit, min_complete, flags, arg, arg_size) >= 0) {
+            return NULL;
+        }
+
+        switch (errno) {
+        case EINTR:
+            continue;
+
+        case ETIME:
+            // the wait has timed out
+            return NULL;
+
+        case EAGAIN:
+        case EBUSY:
+            // the completion queue is full: the caller reaps it
+            return NULL;
+
+        default:
+            return error_wrap("io_uring_enter(2) failed", error_from_errno(errno));
+        }
+    }
+}
+
+static error_t *backend_io_uring_enter(
+    backend_io_uring_t *self,
+    unsigned min_complete,
+    unsigned flags
+) {
+    return backend_io_uring_enter_arg(self, min_complete, flags, NULL, 0);
+}
+
+static error_t *backend_io_uring_get_sqe(backend_io_uring_t *self, struct io_uring_sqe **result) {
+    error_t *err = NULL;
+
+    unsigned tail = atomic_load_explicit(self->sq_tail, memory_order_relaxed);
+
+    if (tail - atomic_load_explicit(self->sq_head, memory_order_acquire) >= self->sq_entries) {
+        err = backend_io_uring_enter(self, 0, 0);
+        if (err) goto fail;
+
+        err = error_wrap("The io_uring submission queue is full", OK_IF(
+            tail - atomic_load_explicit(self->sq_head, memory_order_acquire) < self->sq_entries));
+        if (err) goto fail;
+    }
+
+    unsigned idx = tail & self->sq_mask;
+    struct io_uring_sqe *sqe = &self->sqes[idx];
+    *sqe = (struct io_uring_sqe) {0};
+    self->sq_array[idx] = idx;
+    *result = sqe;
+
+fail:
+    return err;
+}
+
+// Makes the entry returned by the last call to `backend_io_uring_get_sqe` visible to the kernel.
+static void backend_io_uring_push_sqe(backend_io_uring_t *self) {
+    unsigned tail = atomic_load_explicit(self->sq_tail, memory_order_relaxed);
+    atomic_store_explicit(self->sq_tail, tail + 1, memory_order_release);
+}
+
+static error_t *backend_io_uring_queue_poll_remove(backend_io_uring_t *self, uint64_t user_data) {
+    error_t *err = NULL;
+
+    struct io_uring_sqe *sqe = NULL;
+    err = backend_io_uring_get_sqe(self, &sqe);
+    if (err) goto fail;
+
+    sqe->opcode = IORING_OP_POLL_REMOVE;
+    sqe->fd = -1;
+    sqe->addr = user_data;
+    sqe->user_data = BACKEND_IO_URING_IGNORED;
+    backend_io_uring_push_sqe(self);
+
+fail:
+    return err;
+}
+
+static void backend_io_uring_free(backend_io_uring_t *self) {
+    error_t *err = NULL;
+
+    vec_size_free(&self->free_slots);
+    vec_io_uring_slot_free(&self->slots);
+
+    munmap(self->sqes, self->sqes_size);
+
+    if (self->cq_ring != self->sq_ring) {
+        munmap(self->cq_ring, self->cq_ring_size);
+    }
+
+    munmap(self->sq_ring, self->sq_ring_size);
+
+    err = error_from_posix(wrapper_close(self->fd));
+
+    if (err) {
+        error_log_free(&err, LOG_WARN, ERROR_VERBOSITY_SOURCE_CHAIN | ERROR_VERBOSITY_BACKTRACE);
+    }
+
+    free(self);
+}
+
+static error_t *backend_io_uring_add(backend_io_uring_t *self, handler_t *handler) {
+    error_t *err = NULL;
+
+    io_uring_slot_t slot = {
+        .handler = handler,
+        .user_data = BACKEND_IO_URING_IGNORED,
+        .generation = 0,
+    };
+
+    if (vec_size_len(&self->free_slots) > 0) {
+        size_t pos = *vec_size_get(&self->free_slots, vec_size_len(&self->free_slots) - 1);
+        vec_size_set_len(&self->free_slots, vec_size_len(&self->free_slots) - 1);
+
+        io_uring_slot_t *free_slot = vec_io_uring_slot_get_mut(&self->slots, pos);
+        slot.generation = free_slot->generation;
+        *free_slot = slot;
+        handler->backend_pos = pos;
+    } else {
+        err = error_from_common(vec_io_uring_slot_push(&self->slots, slot));
+        if (err) goto fail;
+
+        handler->backend_pos = vec_io_uring_slot_len(&self->slots) - 1;
+    }
+
+    handler->armed = false;
+
+fail:
+    return err;
+}
+
+static error_t *backend_io_uring_remove(backend_io_uring_t *self, handler_t *handler) {
+    error_t *err = NULL;
+
+    io_uring_slot_t *slot = vec_io_uring_slot_get_mut(&self->slots, handler->backend_pos);
+    uint64_t user_data = slot->user_data;
+
+    err = error_from_common(vec_size_push(&self->free_slots, handler->backend_pos));
+    if (err) goto fail;
+
+    slot->handler = NULL;
+    slot->user_data = BACKEND_IO_URING_IGNORED;
+    ++slot->generation;
+    handler->armed = false;
+
+    // the pending request would keep the file open
+    if (user_data != BACKEND_IO_URING_IGNORED) {
+        err = backend_io_uring_queue_poll_remove(self, user_data);
+        if (err) goto fail;
+    }
+
+fail:
+    return err;
+}
+
+static error_t *backend_io_uring_arm(
+    backend_io_uring_t *self,
+    handler_t *handler,
+    poll_flags_t flags
+) {
+    error_t *err = NULL;
+
+    io_uring_slot_t *slot = vec_io_uring_slot_get_mut(&self->slots, handler->backend_pos);
+
+    if (slot->user_data != BACKEND_IO_URING_IGNORED) {
+        err = backend_io_uring_queue_poll_remove(self, slot->user_data);
+        if (err) goto fail;
+
+        slot->user_data = BACKEND_IO_URING_IGNORED;
+        handler->armed = false;
+    }
+
+    struct io_uring_sqe *sqe = NULL;
+    err = backend_io_uring_get_sqe(self, &sqe);
+    if (err) goto fail;
+
+    ++slot->generation;
+    slot->user_data = backend_io_uring_user_data(handler->backend_pos, slot->generation);
+
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = handler->fd;
+    sqe->poll32_events = (uint32_t) flags;
+    sqe->user_data = slot->user_data;
+    backend_io_uring_push_sqe(self);
+
+    handler->armed = true;
+    handler->armed_flags = flags;
+
+fail:
+    return err;
+}
+
+static error_t *backend_io_uring_reap(backend_io_uring_t *self, vec_backend_event_t *events) {
+    error_t *err = NULL;
+
+    unsigned head = atomic_load_explicit(self->cq_head, memory_order_relaxed);
+    unsigned tail = atomic_load_explicit(self->cq_tail, memory_order_acquire);
+
+    for (; head != tail; ++head) {
+        struct io_uring_cqe const *cqe = &self->cqes[head & self->cq_mask];
+        uint64_t user_data = cqe->user_data;
+
+        if (user_data == BACKEND_IO_URING_IGNORED) {
+            continue;
+        }
+
+        if (BACKEND_IO_URING_IS_TIMEOUT(user_data)) {
+            // the timeout has expired or has been removed
+            if (user_data == self->timeout_user_data) {
+                self->timeout_user_data = BACKEND_IO_URING_IGNORED;
+            }
+
+            continue;
+        }
+
+        size_t pos = (size_t) (user_data & UINT32_MAX) - 1;
+
+        if (pos >= vec_io_uring_slot_len(&self->slots)) {
+            continue;
+        }
+
+        io_uring_slot_t *slot = vec_io_uring_slot_get_mut(&self->slots, pos);
+
+        // the request was cancelled or the slot has been reused since
+        if (slot->user_data != user_data) {
+            continue;
+        }
+
+        poll_flags_t flags = LOOP_ERR;
+
+        if (cqe->res >= 0) {
+            flags = (poll_flags_t) (cqe->res & LOOP_ALL);
+        }
+
+        err = error_from_common(vec_backend_event_push(events, (backend_event_t) {
+            .handler = slot->handler,
+            .flags = flags,
+        }));
+        if (err) goto fail;
+
+        slot->user_data = BACKEND_IO_URING_IGNORED;
+        slot->handler->armed = false;
+    }
+
+fail:
+    atomic_store_explicit(self->cq_head, head, memory_order_release);
+
+    return err;
+}
+
+// Makes sure a timeout request expires no later than in `timeout_ms` milliseconds.
+//
+// The request in flight is kept if it expires in time: removing it would post completions at once,
+// ending the wait right away. An early expiry merely makes the loop wait again.
+static error_t *backend_io_uring_queue_timeout(backend_io_uring_t *self, int timeout_ms) {
+    error_t *err = NULL;
+
+    uint64_t deadline = loop_time_ms() + (uint64_t) timeout_ms;
+    bool pending = self->timeout_user_data != BACKEND_IO_URING_IGNORED;
+
+    // the slack absorbs the rounding between the loop's clock reading and this one
+    if (pending && self->timeout_deadline <= deadline + 1) {
+        return err;
+    }
+
+    struct io_uring_sqe *sqe = NULL;
+
+    if (pending) {
+        err = backend_io_uring_get_sqe(self, &sqe);
+        if (err) goto fail;
+
+        sqe->opcode = IORING_OP_TIMEOUT_REMOVE;
+        sqe->fd = -1;
+        sqe->addr = self->timeout_user_data;
+        sqe->user_data = BACKEND_IO_URING_IGNORED;
+        backend_io_uring_push_sqe(self);
+        self->timeout_user_data = BACKEND_IO_URING_IGNORED;
+    }
+
+    err = backend_io_uring_get_sqe(self, &sqe);
+    if (err) goto fail;
+
+    // zero is skipped, as it would make the user data `BACKEND_IO_URING_IGNORED`
+    if (++self->timeout_seq == 0) {
+        self->timeout_seq = 1;
+    }
+
+    self->timeout_user_data = (uint64_t) self->timeout_seq << 32;
+    self->timeout_deadline = deadline;
+    sqe->opcode = IORING_OP_TIMEOUT;
+    sqe->fd = -1;
+    sqe->addr = (uint64_t) (uintptr_t) &self->timeout;
+    sqe->len = 1;
+    sqe->user_data = self->timeout_user_data;
+    backend_io_uring_push_sqe(self);
+
+fail:
+    return err;
+}
+
+static error_t *backend_io_uring_wait(
+    backend_io_uring_t *self,
+    int timeout_ms,
+    vec_backend_event_t *events
+) {
+    error_t *err = NULL;
+
+    unsigned min_complete = 0;
+    unsigned flags = 0;
+    void const *arg = NULL;
+    size_t arg_size = 0;
+
+    if (timeout_ms != 0) {
+        min_complete = 1;
+        flags |= IORING_ENTER_GETEVENTS;
+    }
+
+    if (timeout_ms > 0) {
+        self->timeout = (struct __kernel_timespec) {
+            .tv_sec = timeout_ms / 1000,
+            .tv_nsec = (long long) (timeout_ms % 1000) * 1000000,
+        };
+    }
+
+#ifdef IORING_FEAT_EXT_ARG
+    struct io_uring_getevents_arg getevents_arg = {
+        .ts = (uint64_t) (uintptr_t) &self->timeout,
+    };
+
+    if (timeout_ms > 0 && self->ext_arg) {
+        flags |= IORING_ENTER_EXT_ARG;
+        arg = &getevents_arg;
+        arg_size = sizeof(getevents_arg);
+    }
+#endif
+
+    // a timeout request left in flight ends an indefinite wait early at worst
+    if (timeout_ms > 0 && arg == NULL) {
+        err = backend_io_uring_queue_timeout(self, timeout_ms);
+        if (err) goto fail;
+    }
+
+    err = error_wrap("Could not await I/O events", backend_io_uring_enter_arg(
+        self, min_complete, flags, arg, arg_size));
+    if (err) goto fail;
+
+    err = backend_io_uring_reap(self, events);
+    if (err) goto fail;
+
+    // the completions that didn't fit in the ring are flushed once there's room
+    if (atomic_load_explicit(self->sq_flags, memory_order_relaxed) & IORING_SQ_CQ_OVERFLOW) {
+        err = error_wrap("Could not flush the io_uring completion queue",
+            backend_io_uring_enter(self, 0, IORING_ENTER_GETEVENTS));
+        if (err) goto fail;
+
+        err = backend_io_uring_reap(self, events);
+        if (err) goto fail;
+    }
+
+fail:
+    return err;
+}
+
+static backend_vtable_t const backend_io_uring_vtable = {
+    .free = (void (*)(backend_t *)) backend_io_uring_free,
+    .add = (error_t *(*)(backend_t *, handler_t *)) backend_io_uring_add,
+    .remove = (error_t *(*)(backend_t *, handler_t *)) backend_io_uring_remove,
+    .arm = (error_t *(*)(backend_t *, handler_t *, poll_flags_t)) backend_io_uring_arm,
+    .wait = (error_t *(*)(backend_t *, int, vec_backend_event_t *)) backend_io_uring_wait,
+};
+
+static error_t *backend_io_uring_map(
+    int fd,
+    size_t size,
+    off_t offset,
+    void **result
+) {
+    void *ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, offset);
+
+    if (ptr == MAP_FAILED) {
+        return error_wrap("Could not map the io_uring rings", error_from_errno(errno));
+    }
+
+    *result = ptr;
+
+    return NULL;
+}
+
+error_t *backend_io_uring_new(backend_t **result) {
+    error_t *err = NULL;
+
+    backend_io_uring_t *self = calloc(1, sizeof(backend_io_uring_t));
+    err = error_wrap("Could not allocate memory for the io_uring backend", OK_IF(self != NULL));
+    if (err) goto calloc_fail;
+
+    struct io_uring_params params = {0};
+    errno = 0;
+    self->fd = io_uring_setup(BACKEND_IO_URING_ENTRIES, &params);
+    err = error_wrap("io_uring_setup(2) failed", error_from_errno(self->fd < 0 ? errno : 0));
+    if (err) goto setup_fail;
+
+    self->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    self->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (self->cq_ring_size > self->sq_ring_size) {
+            self->sq_ring_size = self->cq_ring_size;
+        }
+
+        self->cq_ring_size = self->sq_ring_size;
+    }
+
+    err = backend_io_uring_map(self->fd, self->sq_ring_size, IORING_OFF_SQ_RING, &self->sq_ring);
+    if (err) goto sq_ring_map_fail;
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        self->cq_ring = self->sq_ring;
+    } else {
+        err = backend_io_uring_map(
+            self->fd, self->cq_ring_size, IORING_OFF_CQ_RING, &self->cq_ring);
+        if (err) goto cq_ring_map_fail;
+    }
+
+    self->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    void *sqes = NULL;
+    err = backend_io_uring_map(self->fd, self->sqes_size, IORING_OFF_SQES, &sqes);
+    if (err) goto sqes_map_fail;
+
+    char *sq = self->sq_ring;
+    char *cq = self->cq_ring;
+
+    self->backend.vtable = &backend_io_uring_vtable;
+    self->sqes = sqes;
+    self->sq_head = (_Atomic unsigned *) (sq + params.sq_off.head);
+    self->sq_tail = (_Atomic unsigned *) (sq + params.sq_off.tail);
+    self->sq_flags = (_Atomic unsigned *) (sq + params.sq_off.flags);
+    self->sq_array = (unsigned *) (sq + params.sq_off.array);
+    self->sq_mask = *(unsigned *) (sq + params.sq_off.ring_mask);
+    self->sq_entries = params.sq_entries;
+    self->cq_head = (_Atomic unsigned *) (cq + params.cq_off.head);
+    self->cq_tail = (_Atomic unsigned *) (cq + params.cq_off.tail);
+    self->cqes = (struct io_uring_cqe *) (cq + params.cq_off.cqes);
+    self->cq_mask = *(unsigned *) (cq + params.cq_off.ring_mask);
+    self->slots = vec_io_uring_slot_new();
+    self->free_slots = vec_size_new();
+    self->timeout_user_data = BACKEND_IO_URING_IGNORED;
+    self->timeout_deadline = 0;
+    self->timeout_seq = 0;
+#ifdef IORING_FEAT_EXT_ARG
+    self->ext_arg = (params.features & IORING_FEAT_EXT_ARG) != 0;
+#else
+    self->ext_arg = false;
+#endif
+
+    *result = &self->backend;
+
+    return err;
+
+sqes_map_fail:
+    if (self->cq_ring != self->sq_ring) {
+        munmap(self->cq_ring, self->cq_ring_size);
+    }
+
+cq_ring_map_fail:
+    munmap(self->sq_ring, self->sq_ring_size);
+
+sq_ring_map_fail:
+    close(self->fd);
+
+setup_fail:
+    free(self);
+
+calloc_fail:
+    return err;
+}
+
+#endif
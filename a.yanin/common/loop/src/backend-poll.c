@@ -0,0 +1,151 @@
+#include "backend.h"
+
+#include <stdlib.h>
+
+#include <common/error-codes/adapter.h>
+#include <common/posix/adapter.h>
+
+#define VEC_LABEL handler_ptr
+#define VEC_ELEMENT_TYPE handler_ptr_t
+#define VEC_CONFIG (COLLECTION_DECLARE | COLLECTION_DEFINE | COLLECTION_STATIC)
+#include <common/collections/vec.h>
+
+// The poll(2) backend.
+//
+// The pollfd array persists between iterations; disarmed entries have a negative fd, which makes
+// poll(2) skip them.
+typedef struct {
+    backend_t backend;
+    vec_pollfd_t pollfd;
+    // the handler of each entry in `pollfd`
+    vec_handler_ptr_t handlers;
+} backend_poll_t;
+
+static void backend_poll_free(backend_poll_t *self) {
+    vec_handler_ptr_free(&self->handlers);
+    vec_pollfd_free(&self->pollfd);
+    free(self);
+}
+
+static error_t *backend_poll_add(backend_poll_t *self, handler_t *handler) {
+    error_t *err = NULL;
+
+    err = error_from_common(vec_pollfd_push(&self->pollfd, (struct pollfd) {
+        .fd = -1,
+        .events = 0,
+    }));
+    if (err) goto pollfd_push_fail;
+
+    err = error_from_common(vec_handler_ptr_push(&self->handlers, handler));
+    if (err) goto handlers_push_fail;
+
+    handler->backend_pos = vec_pollfd_len(&self->pollfd) - 1;
+    handler->armed = false;
+
+    return err;
+
+handlers_push_fail:
+    vec_pollfd_set_len(&self->pollfd, vec_pollfd_len(&self->pollfd) - 1);
+
+pollfd_push_fail:
+    return err;
+}
+
+static error_t *backend_poll_remove(backend_poll_t *self, handler_t *handler) {
+    size_t pos = handler->backend_pos;
+    size_t last = vec_pollfd_len(&self->pollfd) - 1;
+
+    // move the last entry into the vacated slot
+    if (pos != last) {
+        handler_t *moved = *vec_handler_ptr_get(&self->handlers, last);
+        *vec_pollfd_get_mut(&self->pollfd, pos) = *vec_pollfd_get(&self->pollfd, last);
+        *vec_handler_ptr_get_mut(&self->handlers, pos) = moved;
+        moved->backend_pos = pos;
+    }
+
+    vec_pollfd_set_len(&self->pollfd, last);
+    vec_handler_ptr_set_len(&self->handlers, last);
+    handler->armed = false;
+
+    return NULL;
+}
+
+static error_t *backend_poll_arm(backend_poll_t *self, handler_t *handler, poll_flags_t flags) {
+    struct pollfd *entry = vec_pollfd_get_mut(&self->pollfd, handler->backend_pos);
+    entry->fd = handler->fd;
+    entry->events = (short) flags;
+    handler->armed = true;
+    handler->armed_flags = flags;
+
+    return NULL;
+}
+
+static error_t *backend_poll_wait(
+    backend_poll_t *self,
+    int timeout_ms,
+    vec_backend_event_t *events
+) {
+    error_t *err = NULL;
+
+    int poll_count = 0;
+    err = error_wrap("Could not await I/O events", error_from_posix(wrapper_poll(
+        vec_pollfd_as_ptr_mut(&self->pollfd),
+        vec_pollfd_len(&self->pollfd),
+        timeout_ms,
+        &poll_count
+    )));
+    if (err) goto fail;
+
+    int examined_active = 0;
+
+    for (size_t i = 0; examined_active < poll_count && i < vec_pollfd_len(&self->pollfd); ++i) {
+        struct pollfd *entry = vec_pollfd_get_mut(&self->pollfd, i);
+
+        if (entry->revents == 0) {
+            continue;
+        }
+
+        error_assert(error_wrap("A file descriptor managed by a handler was closed",
+            OK_IF((entry->revents & POLLNVAL) == 0)));
+
+        ++examined_active;
+        handler_t *handler = *vec_handler_ptr_get(&self->handlers, i);
+        err = error_from_common(vec_backend_event_push(events, (backend_event_t) {
+            .handler = handler,
+            .flags = entry->revents & LOOP_ALL,
+        }));
+        if (err) goto fail;
+
+        entry->fd = -1;
+        entry->revents = 0;
+        handler->armed = false;
+    }
+
+fail:
+    return err;
+}
+
+static backend_vtable_t const backend_poll_vtable = {
+    .free = (void (*)(backend_t *)) backend_poll_free,
+    .add = (error_t *(*)(backend_t *, handler_t *)) backend_poll_add,
+    .remove = (error_t *(*)(backend_t *, handler_t *)) backend_poll_remove,
+    .arm = (error_t *(*)(backend_t *, handler_t *, poll_flags_t)) backend_poll_arm,
+    .wait = (error_t *(*)(backend_t *, int, vec_backend_event_t *)) backend_poll_wait,
+};
+
+error_t *backend_poll_new(backend_t **result) {
+    error_t *err = NULL;
+
+    backend_poll_t *self = calloc(1, sizeof(backend_poll_t));
+    err = error_wrap("Could not allocate memory for the poll backend", OK_IF(self != NULL));
+    if (err) goto calloc_fail;
+
+    self->backend.vtable = &backend_poll_vtable;
+    self->pollfd = vec_pollfd_new();
+    self->handlers = vec_handler_ptr_new();
+
+    *result = &self->backend;
+
+calloc_fail:
+    return err;
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <common/config.h>
+#include <common/error.h>
+
+#include "common/loop/loop.h"
+
+// A mechanism for waiting on the fds of the handlers registered in a loop.
+//
+// The backend keeps its own interest list, which only changes when the loop tells it to.
+// A handler is armed with an event mask and stays armed until an event is reported for it,
+// after which the loop has to arm it again (this matches `EPOLLONESHOT`).
+// Note that errors and hang-ups are reported even if the mask is empty.
+//
+// Only handlers with an fd are ever added to a backend.
+// The backend uses the `backend_pos`, `armed`, and `armed_flags` fields of a handler.
+typedef struct backend backend_t;
+
+typedef handler_t *handler_ptr_t;
+
+typedef struct {
+    handler_t *handler;
+    poll_flags_t flags;
+} backend_event_t;
+
+#define VEC_LABEL backend_event
+#define VEC_ELEMENT_TYPE backend_event_t
+#define VEC_CONFIG (COLLECTION_DECLARE)
+#include <common/collections/vec.h>
+
+typedef struct {
+    void (*free)(backend_t *self);
+
+    // Starts watching the handler's fd. The handler is not armed yet.
+    error_t *(*add)(backend_t *self, handler_t *handler);
+
+    // Stops watching the handler's fd.
+    error_t *(*remove)(backend_t *self, handler_t *handler);
+
+    // Arms the handler with an event mask, replacing the previous one.
+    error_t *(*arm)(backend_t *self, handler_t *handler, poll_flags_t flags);
+
+    // Waits for events and appends them to `events`.
+    //
+    // `timeout_ms` has the same meaning as for poll(2).
+    // The reported handlers are disarmed.
+    error_t *(*wait)(backend_t *self, int timeout_ms, vec_backend_event_t *events);
+} backend_vtable_t;
+
+struct backend {
+    backend_vtable_t const *vtable;
+};
+
+error_t *backend_poll_new(backend_t **result);
+
+#ifdef COMMON_EPOLL_ENABLED
+error_t *backend_epoll_new(backend_t **result);
+#endif
+
+#ifdef COMMON_IO_URING_ENABLED
+// Fails if the kernel does not support io_uring or it is disabled.
+error_t *backend_io_uring_new(backend_t **result);
+#endif
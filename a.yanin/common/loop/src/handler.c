@@ -1,9 +1,11 @@
 #include "common/loop/loop.h"
 
+#include <assert.h>
 #include <stdlib.h>
 
 #include <common/error.h>
 
+#include "loop-internal.h"
 #include "util.h"
 
 void handler_init(handler_t *self, handler_vtable_t const *vtable, int fd) {
@@ -18,8 +20,21 @@ void handler_init(handler_t *self, handler_vtable_t const *vtable, int fd) {
     self->fd = fd;
     self->status = LOOP_HANDLER_READY;
     self->passive = false;
+    self->force = false;
+    self->deadline = 0;
+    self->last_node = EXECUTOR_ANY_NODE;
+    self->lane = vtable->lane;
     self->current_flags = 0;
     self->pending_flags = 0;
+    self->loop_node = NULL;
+    self->dirty = false;
+    self->dirty_next = NULL;
+    self->scheduled = false;
+    self->scheduled_pos = 0;
+    self->backend_pos = 0;
+    self->armed = false;
+    self->armed_flags = 0;
+    self->timer = (loop_timer_t) {0};
 
 #ifndef COMMON_PTHREADS_DISABLED
     pthread_mutexattr_t mtx_attr;
@@ -46,7 +61,11 @@ void handler_free(handler_t *self) {
 }
 
 void handler_unregister(handler_t *handler) {
-    handler->status = LOOP_HANDLER_UNREGISTERED;
+    if (handler->loop != NULL) {
+        loop_handler_unregister(handler->loop, handler);
+    } else {
+        handler->status = LOOP_HANDLER_UNREGISTERED;
+    }
 }
 
 poll_flags_t handler_current_mask(handler_t const *self) {
@@ -58,11 +77,11 @@ poll_flags_t handler_pending_mask(handler_t const *self) {
 }
 
 poll_flags_t handler_set_pending_mask(handler_t *self, poll_flags_t flags) {
-    poll_flags_t prev = flags;
+    poll_flags_t prev = self->pending_flags;
     self->pending_flags = flags;
 
     if (prev != flags && self->loop != NULL) {
-        loop_interrupt(self->loop);
+        loop_handler_changed(self->loop, self);
     }
 
     return prev;
@@ -94,10 +113,34 @@ void handler_force(handler_t *self) {
     self->force = true;
 
     if (self->loop != NULL) {
-        loop_interrupt(self->loop);
+        loop_handler_changed(self->loop, self);
+    }
+}
+
+void handler_set_deadline(handler_t *self, uint64_t deadline) {
+    uint64_t prev = atomic_exchange(&self->deadline, deadline);
+
+    // the loop checks the deadline again when the timer it has expires, which covers postponing
+    // and cancelling
+    if (deadline != 0 && (prev == 0 || deadline < prev) && self->loop != NULL) {
+        loop_handler_changed(self->loop, self);
     }
 }
 
+void handler_set_timeout(handler_t *self, uint64_t timeout_ms) {
+    handler_set_deadline(self, loop_time_ms() + timeout_ms);
+}
+
+uint64_t handler_deadline(handler_t const *self) {
+    return self->deadline;
+}
+
+void handler_set_lane(handler_t *self, executor_lane_t lane) {
+    assert(lane < EXECUTOR_LANE_COUNT);
+
+    self->lane = lane;
+}
+
 void *handler_custom_data(handler_t const *self) {
     return self->custom_data;
 }
@@ -52,112 +52,151 @@ size_t iov_max_size(void) {
     return iov_max;
 }
 
-error_t *io_process_write_req(
+// Returns the total length of the request's slices.
+static size_t write_req_len(write_req_t const *req) {
+    size_t result = 0;
+
+    for (size_t i = 0; i < req->slice_count; ++i) {
+        result += req->slices[i].len;
+    }
+
+    return result;
+}
+
+error_t *io_process_write_reqs(
     void *self,
     loop_t *loop,
     error_t *err,
     io_process_result_t *processed,
     int fd,
-    write_req_t *(*get_req)(void *self),
+    size_t (*req_count)(void *self),
+    write_req_t *(*get_req)(void *self, size_t idx),
+    void (*pop_req)(void *self),
     error_t *(*on_write)(void *self, loop_t *loop, write_req_t *req),
     error_t *(*on_error)(void *self, loop_t *loop, write_req_t *req, error_t *err)
 ) {
-    write_req_t *req = get_req(self);
-    log_printf(LOG_DEBUG, "io_process_write_req(req = %p)", (void *) req);
+    log_printf(LOG_DEBUG, "io_process_write_reqs(count = %zu)", req_count(self));
     *processed = IO_PROCESS_AGAIN;
 
+    vec_iovec_t iov = vec_iovec_new();
+
     if (err) {
         err = error_wrap("A previous write request has failed", err);
 
         goto chained_error;
     }
 
-    size_t first_unfinished_idx = 0;
-    size_t written_count = req->written_count;
-
-    for (; first_unfinished_idx < req->slice_count; ++first_unfinished_idx) {
-        if (written_count < req->slices[first_unfinished_idx].len) {
-            break;
-        }
+    size_t iov_max = iov_max_size();
+    size_t count = req_count(self);
+    // the number of requests from the front whose remaining data has been gathered completely
+    size_t gathered = 0;
+    size_t write_requested = 0;
 
-        written_count -= req->slices[first_unfinished_idx].len;
-    }
+    for (; gathered < count; ++gathered) {
+        write_req_t const *req = get_req(self, gathered);
+        size_t skipped = req->written_count;
+        bool truncated = false;
 
-    size_t iov_max = iov_max_size();
-    size_t iov_size = req->slice_count - first_unfinished_idx;
+        for (size_t i = 0; i < req->slice_count; ++i) {
+            slice_t slice = req->slices[i];
 
-    if (iov_size > iov_max) {
-        iov_size = iov_max;
-    }
+            if (skipped >= slice.len) {
+                skipped -= slice.len;
 
-    vec_iovec_t iov = vec_iovec_new();
-    err = error_from_common(vec_iovec_resize(&iov, iov_size));
-    if (err) goto iov_resize_fail;
+                continue;
+            }
 
-    log_printf(LOG_DEBUG, "iov");
+            if (vec_iovec_len(&iov) == iov_max) {
+                truncated = true;
 
-    size_t write_requested = 0;
+                break;
+            }
 
-    for (size_t i = first_unfinished_idx;
-            i < req->slice_count && vec_iovec_len(&iov) < iov_size;
-            ++i) {
-        slice_t slice = req->slices[i];
-        char const *base = slice.base;
-        size_t len = slice.len;
+            err = error_from_common(vec_iovec_push(&iov, (struct iovec) {
+                .iov_base = (char *) slice.base + skipped,
+                .iov_len = slice.len - skipped,
+            }));
+            if (err) goto iov_push_fail;
 
-        if (i == first_unfinished_idx) {
-            base = base + written_count;
-            len -= written_count;
+            write_requested += slice.len - skipped;
+            skipped = 0;
         }
 
-        if (len == 0) {
-            continue;
+        if (truncated) {
+            break;
         }
+    }
 
-        write_requested += len;
+    log_printf(LOG_DEBUG, "iov: %zu slices of %zu requests", vec_iovec_len(&iov), gathered);
 
-        vec_iovec_push(&iov, (struct iovec) {
-            .iov_base = (char *) base,
-            .iov_len = len,
-        });
+    ssize_t written = 0;
+
+    // the requests may have nothing left to write
+    if (vec_iovec_len(&iov) > 0) {
+        err = error_from_posix(wrapper_writev(
+            fd,
+            vec_iovec_as_ptr(&iov),
+            (int) vec_iovec_len(&iov),
+            &written
+        ));
+        if (err) goto writev_fail;
     }
 
-    ssize_t count = -1;
-    err = error_from_posix(wrapper_writev(
-        fd,
-        vec_iovec_as_ptr(&iov),
-        (int) vec_iovec_len(&iov),
-        &count
-    ));
-    if (err) goto writev_fail;
+    log_printf(LOG_DEBUG, "writev: %zd of %zu bytes", written, write_requested);
+    assert((size_t) written <= write_requested);
 
-    log_printf(LOG_DEBUG, "writev");
-    written_count = req->written_count += (size_t) count;
-    assert(req->written_count <= write_requested);
+    // attribute the written bytes to the requests in order
+    size_t remaining = (size_t) written;
+    size_t finished = 0;
 
-    if (req->written_count == write_requested) {
-        err = on_write(self, loop, req);
-        if (err) goto cb_fail;
+    for (; finished < gathered; ++finished) {
+        write_req_t *req = get_req(self, finished);
+        size_t pending = write_req_len(req) - req->written_count;
 
-        *processed = IO_PROCESS_FINISHED;
-    } else {
-        *processed = IO_PROCESS_PARTIAL;
+        if (remaining < pending) {
+            break;
+        }
+
+        req->written_count += pending;
+        remaining -= pending;
     }
 
-    log_printf(LOG_DEBUG, "processed");
+    if (remaining > 0) {
+        get_req(self, finished)->written_count += remaining;
+    }
 
-cb_fail:
-writev_fail:
+    *processed = (size_t) written == write_requested ? IO_PROCESS_FINISHED : IO_PROCESS_PARTIAL;
     vec_iovec_free(&iov);
 
-iov_resize_fail:
-chained_error:
-    if (err) {
-        log_printf(LOG_DEBUG, "err");
-        err = on_error(self, loop, req, err);
+    // the callbacks may queue more requests, but those go to the back of the queue
+    for (size_t i = 0; i < finished; ++i) {
+        err = on_write(self, loop, get_req(self, 0));
+
+        if (err) {
+            err = on_error(self, loop, get_req(self, 0), err);
+        }
+
+        pop_req(self);
+
+        if (err) {
+            break;
+        }
     }
 
+    log_printf(LOG_DEBUG, "processed %zu requests", finished);
+
+    return err;
+
+writev_fail:
+iov_push_fail:
+chained_error:
+    vec_iovec_free(&iov);
+    log_printf(LOG_DEBUG, "err");
+    err = on_error(self, loop, get_req(self, 0), err);
+
+    // a request is only retried if its failure has been handled
     if (err) {
+        pop_req(self);
         *processed = IO_PROCESS_FINISHED;
     }
 
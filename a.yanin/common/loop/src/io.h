@@ -12,6 +12,12 @@
 
 size_t iov_max_size(void);
 
+// Hands out a buffer of `LOOP_READ_BUFFER_SIZE` bytes to read into.
+//
+// The buffers are taken from a per-thread cache and are not zeroed.
+// Once done with it, the buffer must be given back with `loop_read_buffer_release`.
+error_t *read_buffer_acquire(char **result);
+
 typedef struct {
     slice_t const *slices;
     size_t slice_count;
@@ -24,13 +30,29 @@ typedef enum {
     IO_PROCESS_AGAIN,
 } io_process_result_t;
 
-error_t *io_process_write_req(
+// Writes out the data of the queued write requests, starting from the front of the queue.
+//
+// The remaining slices of as many requests as fit into `iov_max_size()` are gathered into a single
+// writev(2) call.
+// Each request that has been written out completely is passed to `on_write` and then removed from
+// the queue with `pop_req`, in the queue order.
+//
+// If `err` is not `NULL` (the previous request has failed), or if writing fails, the error is
+// passed to `on_error` along with the first request instead.
+// The request is removed from the queue unless `on_error` handles the failure and returns `NULL`,
+// in which case it's kept to be retried.
+//
+// `processed` is set to `IO_PROCESS_PARTIAL` if `fd` has taken only a part of the data,
+// to `IO_PROCESS_AGAIN` if nothing has been attempted, and to `IO_PROCESS_FINISHED` otherwise.
+error_t *io_process_write_reqs(
     void *self,
     loop_t *loop,
     error_t *err,
     io_process_result_t *processed,
     int fd,
-    write_req_t *(*get_req)(void *self),
+    size_t (*req_count)(void *self),
+    write_req_t *(*get_req)(void *self, size_t idx),
+    void (*pop_req)(void *self),
     error_t *(*on_write)(void *self, loop_t *loop, write_req_t *req),
     error_t *(*on_error)(void *self, loop_t *loop, write_req_t *req, error_t *err)
 );
@@ -0,0 +1,15 @@
+#pragma once
+
+#include "common/loop/loop.h"
+
+// Queues `handler` for `self` to re-examine before waiting for events again, and interrupts the
+// loop if necessary.
+//
+// Must be called whenever a change to the handler's state may affect what the loop waits for.
+// This is a no-op once the loop is being freed.
+void loop_handler_changed(loop_t *self, handler_t *handler);
+
+// Marks `handler` as unregistered and queues it for `self` to drop.
+//
+// The handler must not be accessed after this call unless the caller holds a reference to it.
+void loop_handler_unregister(loop_t *self, handler_t *handler);
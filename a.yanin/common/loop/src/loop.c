@@ -1,11 +1,18 @@
 #include "common/loop/loop.h"
 
+#include <limits.h>
 #include <stdatomic.h>
+#include <stddef.h>
+#include <time.h>
 
 #include <common/error-codes/adapter.h>
 #include <common/posix/adapter.h>
+#include <common/posix/time.h>
 
 #include "common/loop/notify.h"
+#include "backend.h"
+#include "loop-internal.h"
+#include "timer-wheel.h"
 #include "util.h"
 
 #define ARC_LABEL handler
@@ -19,6 +26,11 @@
 #define VEC_CONFIG (COLLECTION_DEFINE)
 #include <common/collections/vec.h>
 
+#define DLIST_LABEL handler
+#define DLIST_ELEMENT_TYPE arc_handler_ptr_t
+#define DLIST_CONFIG (COLLECTION_DEFINE)
+#include <common/collections/dlist.h>
+
 #define VEC_LABEL pollfd
 #define VEC_ELEMENT_TYPE struct pollfd
 #define VEC_CONFIG (COLLECTION_DEFINE)
@@ -29,11 +41,10 @@
 #define VEC_CONFIG (COLLECTION_DEFINE)
 #include <common/collections/vec.h>
 
-typedef struct {
-    arc_handler_t *handler;
-    poll_flags_t flags;
-    bool forced;
-} pollfd_meta_t;
+#define VEC_LABEL backend_event
+#define VEC_ELEMENT_TYPE backend_event_t
+#define VEC_CONFIG (COLLECTION_DEFINE)
+#include <common/collections/vec.h>
 
 typedef struct {
     loop_t *loop;
@@ -41,17 +52,27 @@ typedef struct {
     poll_flags_t flags;
 } task_ctx_t;
 
-#define VEC_LABEL pollfd_meta
-#define VEC_ELEMENT_TYPE pollfd_meta_t
-#define VEC_CONFIG (COLLECTION_DECLARE | COLLECTION_DEFINE | COLLECTION_STATIC)
-#include <common/collections/vec.h>
-
 struct loop {
-    vec_handler_t handlers;
+    // the registered handlers in the order of registration
+    dlist_handler_t handlers;
+    // the number of non-passive handlers in `handlers`
+    size_t active_count;
+    backend_t *backend;
+    // the events reported by the backend in the current iteration
+    vec_backend_event_t events;
+    // the handlers to run in the current iteration
+    vec_backend_event_t scheduled;
+    // the timers of the handlers in `handlers`
+    timer_wheel_t timers;
 #ifndef COMMON_PTHREADS_DISABLED
+    // guards `pending_handlers`, `dirty`, `freeing`, and the `dirty` fields of the handlers
     pthread_mutex_t pending_mtx;
 #endif
     vec_handler_t pending_handlers;
+    // the handlers to re-examine, linked through `dirty_next`
+    handler_t *dirty;
+    // set once the loop starts freeing its handlers
+    bool freeing;
 #ifndef COMMON_PTHREADS_DISABLED
     pthread_mutex_t error_mtx;
 #endif
@@ -68,18 +89,73 @@ static error_t *loop_on_notified(loop_t *, notify_t *) {
     return NULL;
 }
 
+static error_t *loop_backend_new(loop_backend_t backend, backend_t **result) {
+    switch (backend) {
+    case LOOP_BACKEND_DEFAULT:
+#ifdef COMMON_EPOLL_ENABLED
+        return backend_epoll_new(result);
+#else
+        return backend_poll_new(result);
+#endif
+
+    case LOOP_BACKEND_POLL:
+        return backend_poll_new(result);
+
+    case LOOP_BACKEND_EPOLL:
+#ifdef COMMON_EPOLL_ENABLED
+        return backend_epoll_new(result);
+#else
+        return error_from_cstr("The epoll backend is not supported on this system", NULL);
+#endif
+
+    case LOOP_BACKEND_IO_URING:
+#ifdef COMMON_IO_URING_ENABLED
+    {
+        error_t *err = backend_io_uring_new(result);
+
+        if (!err) {
+            return err;
+        }
+
+        log_printf(LOG_WARN, "io_uring is not available, falling back to the default backend");
+        error_log_free(&err, LOG_WARN, ERROR_VERBOSITY_SOURCE_CHAIN);
+    }
+#else
+        log_printf(LOG_WARN, "io_uring is not supported on this system, using the default backend");
+#endif
+
+        return loop_backend_new(LOOP_BACKEND_DEFAULT, result);
+    }
+
+    return error_from_cstr("Unknown loop backend", NULL);
+}
+
 error_t *loop_new(executor_t *executor, loop_t **result) {
+    return loop_new_with_backend(executor, LOOP_BACKEND_DEFAULT, result);
+}
+
+error_t *loop_new_with_backend(executor_t *executor, loop_backend_t backend, loop_t **result) {
     error_t *err = NULL;
 
     loop_t *self = calloc(1, sizeof(loop_t));
     err = error_wrap("Could not allocate memory for the loop", OK_IF(self != NULL));
     if (err) goto calloc_fail;
 
-    self->handlers = vec_handler_new();
+    self->handlers = dlist_handler_new();
+    self->active_count = 0;
+    self->events = vec_backend_event_new();
+    self->scheduled = vec_backend_event_new();
     self->pending_handlers = vec_handler_new();
+    self->dirty = NULL;
+    self->freeing = false;
     self->errors = vec_error_new();
     self->executor = executor;
     self->stopped = false;
+    timer_wheel_init(&self->timers, loop_time_ms());
+
+    err = error_wrap("Could not initialize the loop backend",
+        loop_backend_new(backend, &self->backend));
+    if (err) goto backend_fail;
 
     err = error_wrap("Could not initialize the notification mechanism", notify_new(&self->notify));
     if (err) goto notify_fail;
@@ -111,6 +187,9 @@ error_t *loop_new(executor_t *executor, loop_t **result) {
     return err;
 
 notify_fail:
+    self->backend->vtable->free(self->backend);
+
+backend_fail:
     free(self);
 
 calloc_fail:
@@ -121,15 +200,23 @@ void loop_free(loop_t *self) {
     error_assert(error_wrap("The loop must have been stopped",
         OK_IF(!self->started || self->stopped)));
 
+    // the handlers may still be unregistered as the others are freed
+#ifndef COMMON_PTHREADS_DISABLED
+    assert_mutex_lock(&self->pending_mtx);
+#endif
+    self->freeing = true;
+#ifndef COMMON_PTHREADS_DISABLED
+    assert_mutex_unlock(&self->pending_mtx);
+#endif
+
     for (size_t i = 0; i < vec_handler_len(&self->pending_handlers); ++i) {
         arc_handler_free(*vec_handler_get(&self->pending_handlers, i));
     }
 
-    for (size_t ri = 0; ri < vec_handler_len(&self->handlers); ++ri) {
-        size_t i = vec_handler_len(&self->handlers) - ri - 1;
-
-        arc_handler_t *handler = *vec_handler_get(&self->handlers, i);
-        arc_handler_free(handler);
+    for (dlist_handler_node_t *node = dlist_handler_end_mut(&self->handlers); node != NULL;) {
+        dlist_handler_node_t *prev = dlist_handler_prev_mut(node);
+        arc_handler_free(*dlist_handler_get(node));
+        node = prev;
     }
 
     for (size_t i = 0; i < vec_error_len(&self->errors); ++i) {
@@ -141,9 +228,12 @@ void loop_free(loop_t *self) {
     pthread_mutex_destroy(&self->pending_mtx);
 #endif
 
+    self->backend->vtable->free(self->backend);
     vec_error_free(&self->errors);
     vec_handler_free(&self->pending_handlers);
-    vec_handler_free(&self->handlers);
+    vec_backend_event_free(&self->scheduled);
+    vec_backend_event_free(&self->events);
+    dlist_handler_free(&self->handlers);
 
     free(self);
 }
@@ -179,135 +269,289 @@ fail:
     return err;
 }
 
-static error_t *loop_process_registrations(loop_t *self) {
-    error_t *err = NULL;
+// Queues the handler for re-examination.
+//
+// The lock must be held.
+static void loop_queue_handler_unsync(loop_t *self, handler_t *handler) {
+    // the handlers that haven't been added yet are examined as they're added
+    if (self->freeing || handler->loop_node == NULL || handler->dirty) {
+        return;
+    }
+
+    handler->dirty = true;
+    handler->dirty_next = self->dirty;
+
+    // otherwise the loop has already been interrupted
+    if (self->dirty == NULL) {
+        loop_interrupt(self);
+    }
+
+    self->dirty = handler;
+}
+
+void loop_handler_changed(loop_t *self, handler_t *handler) {
+    // the loop re-examines the handler once its task is done anyway
+    if (handler->status == LOOP_HANDLER_QUEUED) {
+        return;
+    }
 
 #ifndef COMMON_PTHREADS_DISABLED
     assert_mutex_lock(&self->pending_mtx);
 #endif
+    loop_queue_handler_unsync(self, handler);
+#ifndef COMMON_PTHREADS_DISABLED
+    assert_mutex_unlock(&self->pending_mtx);
+#endif
+}
 
-    for (size_t i = 0; i < vec_handler_len(&self->pending_handlers); ++i) {
-        arc_handler_t *handler = arc_handler_share(*vec_handler_get(&self->pending_handlers, i));
-        loop_handler_status_t status = arc_handler_get(handler)->status;
-
-        switch (status) {
-        case LOOP_HANDLER_READY:
-            break;
+void loop_handler_unregister(loop_t *self, handler_t *handler) {
+    // the loop may free the handler as soon as it sees the status change,
+    // so both happen under the lock the loop has to take to remove it
+#ifndef COMMON_PTHREADS_DISABLED
+    assert_mutex_lock(&self->pending_mtx);
+#endif
+    loop_handler_status_t prev = atomic_exchange(&handler->status, LOOP_HANDLER_UNREGISTERED);
 
-        case LOOP_HANDLER_QUEUED:
-            log_abort("One of the pending handlers has QUEUED status (already added?)");
+    if (prev != LOOP_HANDLER_QUEUED) {
+        loop_queue_handler_unsync(self, handler);
+    }
+#ifndef COMMON_PTHREADS_DISABLED
+    assert_mutex_unlock(&self->pending_mtx);
+#endif
+}
 
-        case LOOP_HANDLER_UNREGISTERED:
-            // skip this handler
-            arc_handler_free(handler);
+// Adds the handler to the current iteration's run list.
+static error_t *loop_schedule(loop_t *self, handler_t *handler, poll_flags_t flags) {
+    error_t *err = NULL;
 
-            continue;
-        }
+    if (handler->scheduled) {
+        vec_backend_event_get_mut(&self->scheduled, handler->scheduled_pos)->flags |= flags;
 
-        err = error_from_common(vec_handler_push(&self->handlers, handler));
-        if (err) goto push_fail;
+        return err;
     }
 
-push_fail:
-    for (size_t i = 0; i < vec_handler_len(&self->pending_handlers); ++i) {
-        arc_handler_free(*vec_handler_get(&self->pending_handlers, i));
-    }
+    err = error_from_common(vec_backend_event_push(&self->scheduled, (backend_event_t) {
+        .handler = handler,
+        .flags = flags,
+    }));
+    if (err) goto fail;
+
+    handler->scheduled = true;
+    handler->scheduled_pos = vec_backend_event_len(&self->scheduled) - 1;
+
+fail:
+    return err;
+}
+
+// Drops an unregistered handler unless it's still queued for re-examination.
+static error_t *loop_remove_handler(loop_t *self, handler_t *handler) {
+    error_t *err = NULL;
 
-    vec_handler_clear(&self->pending_handlers);
+#ifndef COMMON_PTHREADS_DISABLED
+    assert_mutex_lock(&self->pending_mtx);
+#endif
+    dlist_handler_node_t *node = NULL;
 
+    if (!handler->dirty) {
+        // nobody can queue the handler from now on
+        node = handler->loop_node;
+        handler->loop_node = NULL;
+    }
 #ifndef COMMON_PTHREADS_DISABLED
     assert_mutex_unlock(&self->pending_mtx);
 #endif
 
-    size_t handler_count = vec_handler_len(&self->handlers);
+    if (node == NULL) {
+        return err;
+    }
+
+    if (handler->fd >= 0) {
+        err = error_wrap("Could not stop watching a handler's fd",
+            self->backend->vtable->remove(self->backend, handler));
+    }
 
-    for (size_t j = 0; j < handler_count; ++j) {
-        size_t i = handler_count - j - 1;
-        arc_handler_t *handler = *vec_handler_get(&self->handlers, i);
+    if (handler->timer.armed) {
+        timer_wheel_remove(&self->timers, &handler->timer);
+    }
 
-        if (arc_handler_get(handler)->status == LOOP_HANDLER_UNREGISTERED) {
-            arc_handler_free(handler);
-            vec_handler_remove(&self->handlers, i);
-        }
+    if (!handler->passive) {
+        --self->active_count;
     }
 
+    arc_handler_free(dlist_handler_remove(&self->handlers, node));
+
     return err;
 }
 
-static error_t *loop_prepare_pollfd_process_handler(
-    loop_t *,
-    vec_pollfd_t *pollfd,
-    vec_pollfd_meta_t *meta,
-    arc_handler_t *handler_arc,
-    bool *has_forced_handlers
-) {
+// Puts the handler's timer in the wheel if it may expire earlier than the wheel expects.
+//
+// A postponed deadline is left alone: the timer is moved once the earlier expiry is reached.
+static void loop_update_timer(loop_t *self, handler_t *handler) {
+    uint64_t deadline = handler->deadline;
+    loop_timer_t *timer = &handler->timer;
+
+    if (deadline == 0) {
+        if (timer->armed) {
+            timer_wheel_remove(&self->timers, timer);
+        }
+
+        return;
+    }
+
+    if (timer->armed && timer->expiry <= deadline) {
+        return;
+    }
+
+    if (timer->armed) {
+        timer_wheel_remove(&self->timers, timer);
+    }
+
+    timer_wheel_insert(&self->timers, timer, deadline);
+}
+
+// Brings the backend's view of the handler up to date.
+static error_t *loop_examine_handler(loop_t *self, handler_t *handler) {
     error_t *err = NULL;
-    handler_t *handler = arc_handler_get(handler_arc);
-    handler_lock(handler);
 
+    switch (handler->status) {
+    case LOOP_HANDLER_READY:
+        break;
+
+    case LOOP_HANDLER_QUEUED:
+        return err;
+
+    case LOOP_HANDLER_UNREGISTERED:
+        return loop_remove_handler(self, handler);
+    }
+
+    handler_lock(handler);
     poll_flags_t flags = handler->current_flags = handler->pending_flags & LOOP_ALL_IN;
-    err = error_from_common(vec_pollfd_push(pollfd, (struct pollfd) {
-        .events = (short) flags,
-        .fd = handler->fd,
-    }));
-    if (err) goto pollfd_fail;
+    handler_unlock(handler);
 
-    arc_handler_t *handler_arc_shared = arc_handler_share(handler_arc);
-    bool forced = atomic_exchange(&handler->force, false);
-    err = error_from_common(vec_pollfd_meta_push(meta, (pollfd_meta_t) {
-        .handler = handler_arc_shared,
-        .forced = forced,
-    }));
-    if (err) goto meta_fail;
-    handler_arc_shared = NULL;
+    if (handler->fd >= 0 && (!handler->armed || handler->armed_flags != flags)) {
+        err = self->backend->vtable->arm(self->backend, handler, flags);
+        if (err) goto fail;
+    }
 
-    if (forced) {
-        *has_forced_handlers = true;
+    loop_update_timer(self, handler);
+
+    if (atomic_exchange(&handler->force, false)) {
+        err = loop_schedule(self, handler, 0);
+        if (err) goto fail;
     }
 
-meta_fail:
-    arc_handler_free(handler_arc_shared);
+fail:
+    return err;
+}
 
-pollfd_fail:
-    handler_unlock(handler);
+static error_t *loop_add_handler(loop_t *self, arc_handler_t *arc) {
+    error_t *err = NULL;
+
+    handler_t *handler = arc_handler_get(arc);
+
+    if (handler->status == LOOP_HANDLER_QUEUED) {
+        log_abort("One of the pending handlers has QUEUED status (already added?)");
+    }
+
+    if (handler->fd >= 0) {
+        err = error_wrap("Could not start watching a handler's fd",
+            self->backend->vtable->add(self->backend, handler));
+        if (err) goto add_fail;
+    }
+
+    err = error_from_common(dlist_handler_append(&self->handlers, arc, &handler->loop_node));
+    if (err) goto append_fail;
+
+    if (!handler->passive) {
+        ++self->active_count;
+    }
 
     return err;
+
+append_fail:
+    if (handler->fd >= 0) {
+        err = error_combine(err, self->backend->vtable->remove(self->backend, handler));
+    }
+
+add_fail:
+    return err;
 }
 
-static error_t *loop_prepare_pollfd(
-    loop_t *self,
-    vec_pollfd_t *pollfd,
-    vec_pollfd_meta_t *meta,
-    bool *empty,
-    bool *has_forced_handlers
-) {
+static error_t *loop_process_registrations(loop_t *self) {
     error_t *err = NULL;
 
-    if (self->stopped) {
-        log_printf(LOG_DEBUG, "The loop has been stopped");
-        *empty = true;
+#ifndef COMMON_PTHREADS_DISABLED
+    assert_mutex_lock(&self->pending_mtx);
+#endif
+
+    vec_handler_t pending = self->pending_handlers;
+    self->pending_handlers = vec_handler_new();
+    size_t added_count = 0;
 
-        return err;
+    // the handlers can be queued for re-examination as soon as they're in the list
+    for (; added_count < vec_handler_len(&pending); ++added_count) {
+        err = loop_add_handler(self, *vec_handler_get(&pending, added_count));
+        if (err) break;
+    }
+
+#ifndef COMMON_PTHREADS_DISABLED
+    assert_mutex_unlock(&self->pending_mtx);
+#endif
+
+    for (size_t i = added_count; i < vec_handler_len(&pending); ++i) {
+        arc_handler_free(*vec_handler_get(&pending, i));
     }
 
-    for (size_t i = 0; i < vec_handler_len(&self->handlers); ++i) {
-        arc_handler_t *arc = *vec_handler_get(&self->handlers, i);
-        handler_t *handler = arc_handler_get(arc);
-        loop_handler_status_t status = handler->status;
+    for (size_t i = 0; !err && i < added_count; ++i) {
+        err = loop_examine_handler(self, arc_handler_get(*vec_handler_get(&pending, i)));
+    }
 
-        if (status == LOOP_HANDLER_UNREGISTERED) {
-            continue;
-        }
+    vec_handler_free(&pending);
 
-        if (!handler->passive) {
-            *empty = false;
-        }
+    return err;
+}
 
-        if (status == LOOP_HANDLER_QUEUED) {
-            continue;
-        }
+// Takes the handler off the list of handlers to re-examine that `loop_process_changes` has taken.
+//
+// Returns the next handler in that list.
+static handler_t *loop_take_dirty(loop_t *self, handler_t *handler) {
+    (void) self;
+#ifndef COMMON_PTHREADS_DISABLED
+    assert_mutex_lock(&self->pending_mtx);
+#endif
+
+    handler_t *next = handler->dirty_next;
+    // from now on the handler can be queued again, which overwrites `dirty_next`
+    handler->dirty = false;
+
+#ifndef COMMON_PTHREADS_DISABLED
+    assert_mutex_unlock(&self->pending_mtx);
+#endif
+
+    return next;
+}
+
+static error_t *loop_process_changes(loop_t *self) {
+    error_t *err = NULL;
+
+#ifndef COMMON_PTHREADS_DISABLED
+    assert_mutex_lock(&self->pending_mtx);
+#endif
+
+    // the handlers stay marked dirty until they're reached, so nobody relinks the rest of the list
+    handler_t *dirty = self->dirty;
+    self->dirty = NULL;
+
+#ifndef COMMON_PTHREADS_DISABLED
+    assert_mutex_unlock(&self->pending_mtx);
+#endif
+
+    while (dirty != NULL) {
+        handler_t *handler = dirty;
+        // the handler may be freed by `loop_examine_handler`
+        dirty = loop_take_dirty(self, handler);
 
-        err = loop_prepare_pollfd_process_handler(self, pollfd, meta, arc, has_forced_handlers);
+        err = loop_examine_handler(self, handler);
         if (err) goto fail;
     }
 
@@ -315,56 +559,94 @@ fail:
     return err;
 }
 
-static error_t *loop_poll(
-    loop_t *self,
-    vec_pollfd_t *pollfd,
-    vec_pollfd_meta_t *meta,
-    bool has_forced_handlers
-) {
-    (void) self;
+static error_t *loop_wait(loop_t *self) {
+    error_t *err = NULL;
 
-    // use an infinite timeout for now; later, if we need timers, we'll have to adjust this
     int timeout_ms = -1;
+    uint64_t expiry = timer_wheel_next_expiry(&self->timers);
 
-    if (has_forced_handlers) {
+    if (vec_backend_event_len(&self->scheduled) > 0) {
         timeout_ms = 0;
+    } else if (expiry != UINT64_MAX) {
+        uint64_t now = loop_time_ms();
+
+        if (expiry <= now) {
+            timeout_ms = 0;
+        } else if (expiry - now < INT_MAX) {
+            timeout_ms = (int) (expiry - now);
+        } else {
+            timeout_ms = INT_MAX;
+        }
     }
 
-    int poll_count = 0;
-    error_t *err = error_wrap("Could not await I/O events", error_from_posix(wrapper_poll(
-        vec_pollfd_as_ptr_mut(pollfd),
-        vec_pollfd_len(pollfd),
-        timeout_ms,
-        &poll_count
-    )));
+    vec_backend_event_clear(&self->events);
+    err = self->backend->vtable->wait(self->backend, timeout_ms, &self->events);
     if (err) goto fail;
 
-    int examined_active = 0;
+    for (size_t i = 0; i < vec_backend_event_len(&self->events); ++i) {
+        backend_event_t const *event = vec_backend_event_get(&self->events, i);
+        handler_t *handler = event->handler;
+
+        // the handler is re-examined once its task is done or it's unregistered
+        if (handler->status != LOOP_HANDLER_READY) {
+            continue;
+        }
+
+        poll_flags_t flags = event->flags & (handler->armed_flags | LOOP_HUP | LOOP_ERR);
+
+        if (flags == 0) {
+            // nothing to run the handler for, but it has to be armed again
+            loop_handler_changed(self, handler);
+
+            continue;
+        }
+
+        err = loop_schedule(self, handler, flags);
+        if (err) goto fail;
+    }
+
+fail:
+    return err;
+}
+
+// Schedules the handlers whose deadlines have passed.
+static error_t *loop_expire_timers(loop_t *self) {
+    error_t *err = NULL;
+
+    uint64_t now = loop_time_ms();
+    loop_timer_t *expired = timer_wheel_advance(&self->timers, now);
 
-    for (size_t i = 0; examined_active < poll_count && i < vec_pollfd_len(pollfd); ++i) {
-        struct pollfd const *entry = vec_pollfd_get(pollfd, i);
+    while (expired != NULL) {
+        loop_timer_t *timer = expired;
+        expired = timer->next;
+        timer->next = NULL;
 
-        if (entry->revents == 0) {
+        handler_t *handler = (handler_t *) ((char *) timer - offsetof(handler_t, timer));
+
+        // the handler is re-examined once its task is done or it's unregistered
+        if (err || handler->status != LOOP_HANDLER_READY) {
             continue;
         }
 
-        error_assert(error_wrap("A file descriptor managed by a handler was closed",
-            OK_IF((entry->revents & POLLNVAL) == 0)));
+        uint64_t deadline = handler->deadline;
 
-        pollfd_meta_t *meta_entry = vec_pollfd_meta_get_mut(meta, i);
+        // the deadline may be moved concurrently; it's cleared only if it has been reached
+        while (deadline != 0 && deadline <= now
+                && !atomic_compare_exchange_weak(&handler->deadline, &deadline, 0)) {}
 
-        ++examined_active;
-        poll_flags_t flags = entry->revents & LOOP_ALL;
+        if (deadline == 0) {
+            continue;
+        }
+
+        if (deadline > now) {
+            timer_wheel_insert(&self->timers, timer, deadline);
 
-        handler_t *handler = arc_handler_get(meta_entry->handler);
-        handler_lock(handler);
-        flags &= handler->current_flags | (LOOP_HUP | LOOP_ERR);
-        handler_unlock(handler);
+            continue;
+        }
 
-        meta_entry->flags = flags;
+        err = loop_schedule(self, handler, LOOP_TIMEOUT);
     }
 
-fail:
     return err;
 }
 
@@ -373,6 +655,10 @@ static error_t *loop_handler_task_cb(task_ctx_t *ctx) {
 
     handler_t *handler = arc_handler_get(ctx->handler);
 
+    // only a hint for routing the handler's next task, so no ordering is needed
+    atomic_store_explicit(&handler->last_node, executor_current_node(ctx->loop->executor),
+        memory_order_relaxed);
+
     handler_lock(handler);
     err = handler->vtable->process(handler, ctx->loop, ctx->flags);
     handler_unlock(handler);
@@ -388,11 +674,11 @@ static error_t *loop_handler_task_cb(task_ctx_t *ctx) {
 
     if (err) {
 #ifndef COMMON_PTHREADS_DISABLED
-        assert_mutex_lock(&ctx->loop->pending_mtx);
+        assert_mutex_lock(&ctx->loop->error_mtx);
 #endif
         error_t *push_err = error_from_common(vec_error_push(&ctx->loop->errors, err));
 #ifndef COMMON_PTHREADS_DISABLED
-        assert_mutex_unlock(&ctx->loop->pending_mtx);
+        assert_mutex_unlock(&ctx->loop->error_mtx);
 #endif
 
         if (push_err) {
@@ -408,8 +694,9 @@ static error_t *loop_handler_task_cb(task_ctx_t *ctx) {
         LOOP_HANDLER_READY
     );
 
+    // the notification handler is run on the loop's thread, which re-examines it right away
     if (handler != (handler_t *) ctx->loop->notify) {
-        loop_interrupt(ctx->loop);
+        loop_handler_changed(ctx->loop, handler);
     }
 
     arc_handler_free(ctx->handler);
@@ -418,20 +705,21 @@ static error_t *loop_handler_task_cb(task_ctx_t *ctx) {
     return err;
 }
 
-static error_t *loop_dispatch_task(loop_t *self, pollfd_meta_t *meta_entry) {
+static error_t *loop_dispatch_task(loop_t *self, backend_event_t const *entry) {
     error_t *err = NULL;
 
+    handler_t *handler = entry->handler;
+
     task_ctx_t *ctx = malloc(sizeof(task_ctx_t));
     err = OK_IF(ctx != NULL);
     if (err) goto malloc_fail;
 
     *ctx = (task_ctx_t) {
         .loop = self,
-        .handler = arc_handler_share(meta_entry->handler),
-        .flags = meta_entry->flags,
+        .handler = arc_handler_share(*dlist_handler_get(handler->loop_node)),
+        .flags = entry->flags,
     };
 
-    handler_t *handler = arc_handler_get(meta_entry->handler);
     atomic_compare_exchange_strong(
         &handler->status,
         &(loop_handler_status_t) { LOOP_HANDLER_READY },
@@ -440,11 +728,14 @@ static error_t *loop_dispatch_task(loop_t *self, pollfd_meta_t *meta_entry) {
 
     if (handler == (handler_t *) self->notify) {
         err = loop_handler_task_cb(ctx);
+        err = error_combine(err, loop_examine_handler(self, handler));
     } else {
-        executor_submission_t status = executor_submit(self->executor, (task_t) {
+        // the handler's data is likely still in the caches of the node it last ran on
+        executor_submission_t status = executor_submit_to_node(self->executor, (task_t) {
             .cb = (task_cb_t) loop_handler_task_cb,
             .data = (void *) ctx,
-        });
+            .lane = handler->lane,
+        }, atomic_load_explicit(&handler->last_node, memory_order_relaxed));
 
         switch (status) {
         case EXECUTOR_SUBMITTED:
@@ -466,21 +757,20 @@ malloc_fail:
     return err;
 }
 
-static error_t *loop_submit_tasks(loop_t *self, vec_pollfd_meta_t *meta) {
+static error_t *loop_submit_tasks(loop_t *self) {
     error_t *err = NULL;
 
-    for (size_t i = 0; i < vec_pollfd_meta_len(meta); ++i) {
-        pollfd_meta_t *meta_entry = vec_pollfd_meta_get_mut(meta, i);
+    for (size_t i = 0; i < vec_backend_event_len(&self->scheduled); ++i) {
+        backend_event_t const *entry = vec_backend_event_get(&self->scheduled, i);
+        entry->handler->scheduled = false;
 
-        if (meta_entry->flags == 0 && !meta_entry->forced) {
-            continue;
+        if (!err) {
+            err = loop_dispatch_task(self, entry);
         }
-
-        err = loop_dispatch_task(self, meta_entry);
-        if (err) goto fail;
     }
 
-fail:
+    vec_backend_event_clear(&self->scheduled);
+
     return err;
 }
 
@@ -515,39 +805,32 @@ error_t *loop_run(loop_t *self) {
 
     self->started = true;
 
-    vec_pollfd_t pollfd = vec_pollfd_new();
-    vec_pollfd_meta_t meta = vec_pollfd_meta_new();
-
     log_printf(LOG_DEBUG, "Starting the event loop");
 
     while (true) {
         err = loop_process_registrations(self);
         if (err) goto fail;
 
-        vec_pollfd_clear(&pollfd);
-
-        for (size_t i = 0; i < vec_pollfd_meta_len(&meta); ++i) {
-            arc_handler_free(vec_pollfd_meta_get(&meta, i)->handler);
-        }
-
-        vec_pollfd_meta_clear(&meta);
-
-        bool empty = false;
-        bool has_forced_handlers = false;
-        err = loop_prepare_pollfd(self, &pollfd, &meta, &empty, &has_forced_handlers);
+        err = loop_process_changes(self);
         if (err) goto fail;
 
-        assert(vec_pollfd_len(&pollfd) == vec_pollfd_meta_len(&meta));
+        if (self->stopped) {
+            log_printf(LOG_DEBUG, "The loop has been stopped");
+            break;
+        }
 
-        if (empty) {
+        if (self->active_count == 0) {
             log_printf(LOG_DEBUG, "Shutting down the event loop: 0 active handlers");
             break;
         }
 
-        err = loop_poll(self, &pollfd, &meta, has_forced_handlers);
+        err = loop_wait(self);
+        if (err) goto fail;
+
+        err = loop_expire_timers(self);
         if (err) goto fail;
 
-        err = loop_submit_tasks(self, &meta);
+        err = loop_submit_tasks(self);
         if (err) goto fail;
 
         err = loop_process_task_results(self);
@@ -555,18 +838,24 @@ error_t *loop_run(loop_t *self) {
     }
 
 fail:
-    for (size_t i = 0; i < vec_pollfd_meta_len(&meta); ++i) {
-        arc_handler_t *handler = vec_pollfd_meta_get(&meta, i)->handler;
-        arc_handler_get(handler)->status = LOOP_HANDLER_UNREGISTERED;
-        arc_handler_free(handler);
+    for (size_t i = 0; i < vec_backend_event_len(&self->scheduled); ++i) {
+        vec_backend_event_get(&self->scheduled, i)->handler->scheduled = false;
     }
 
-    vec_pollfd_meta_free(&meta);
-    vec_pollfd_free(&pollfd);
+    vec_backend_event_clear(&self->scheduled);
 
     return err;
 }
 
+uint64_t loop_time_ms(void) {
+    struct timespec now;
+    error_assert(error_wrap("Could not read the monotonic clock", error_from_posix(
+        wrapper_clock_gettime(CLOCK_MONOTONIC, &now))));
+
+    // shifted by one so that 0 can mean "no deadline"
+    return (uint64_t) now.tv_sec * 1000 + (uint64_t) now.tv_nsec / 1000000 + 1;
+}
+
 void loop_stop(loop_t *self) {
     self->stopped = true;
     notify_wakeup(self->notify);
@@ -8,24 +8,20 @@
 #include "io.h"
 #include "src/util.h"
 
-enum {
-    READ_BUFFER_SIZE = 16384,
-};
-
 typedef struct {
     write_req_t write_req;
     pipe_on_write_cb_t on_write;
     pipe_wr_on_error_cb_t on_error;
 } pipe_write_req_t;
 
-#define VEC_ELEMENT_TYPE pipe_write_req_t
-#define VEC_LABEL wrreq
-#define VEC_CONFIG (COLLECTION_DECLARE | COLLECTION_DEFINE | COLLECTION_STATIC)
-#include <common/collections/vec.h>
+#define RING_ELEMENT_TYPE pipe_write_req_t
+#define RING_LABEL wrreq
+#define RING_CONFIG (COLLECTION_DECLARE | COLLECTION_DEFINE | COLLECTION_STATIC)
+#include <common/collections/ring.h>
 
 struct pipe_handler_wr {
     handler_t handler;
-    vec_wrreq_t write_reqs;
+    ring_wrreq_t write_reqs;
     pipe_on_write_cb_t on_write;
     pipe_wr_on_error_cb_t on_error;
 };
@@ -35,6 +31,8 @@ struct pipe_handler_rd {
     pipe_on_read_cb_t on_read;
     pipe_rd_on_error_cb_t on_error;
     bool eof;
+    // the buffer passed to the running `on_read` callback, unless it has been taken
+    char *read_buf;
 };
 
 static void pipe_handler_wr_free(pipe_handler_wr_t *self) {
@@ -44,13 +42,25 @@ static void pipe_handler_wr_free(pipe_handler_wr_t *self) {
         error_log_free(&err, LOG_WARN, ERROR_VERBOSITY_SOURCE_CHAIN | ERROR_VERBOSITY_BACKTRACE);
     }
 
-    vec_wrreq_free(&self->write_reqs);
+    ring_wrreq_free(&self->write_reqs);
+}
+
+static size_t pipe_handler_process_write_req_count(void *self_opaque) {
+    pipe_handler_wr_t *self = self_opaque;
+
+    return ring_wrreq_len(&self->write_reqs);
+}
+
+static write_req_t *pipe_handler_process_write_req_get_req(void *self_opaque, size_t idx) {
+    pipe_handler_wr_t *self = self_opaque;
+
+    return &ring_wrreq_get_mut(&self->write_reqs, idx)->write_req;
 }
 
-static write_req_t *pipe_handler_process_write_req_get_req(void *self_opaque) {
+static void pipe_handler_process_write_req_pop(void *self_opaque) {
     pipe_handler_wr_t *self = self_opaque;
 
-    return &vec_wrreq_get_mut(&self->write_reqs, 0)->write_req;
+    ring_wrreq_pop_front(&self->write_reqs);
 }
 
 static error_t *pipe_handler_process_write_req_on_write(
@@ -84,19 +94,21 @@ static error_t *pipe_handler_process_write_req_on_error(
     }
 }
 
-static error_t *pipe_handler_process_write_req(
+static error_t *pipe_handler_process_write_reqs(
     pipe_handler_wr_t *self,
     loop_t *loop,
     error_t *err,
     io_process_result_t *processed
 ) {
-    return io_process_write_req(
+    return io_process_write_reqs(
         self,
         loop,
         err,
         processed,
         handler_fd(&self->handler),
+        pipe_handler_process_write_req_count,
         pipe_handler_process_write_req_get_req,
+        pipe_handler_process_write_req_pop,
         pipe_handler_process_write_req_on_write,
         pipe_handler_process_write_req_on_error
     );
@@ -109,29 +121,16 @@ static error_t *pipe_handler_wr_process(pipe_handler_wr_t *self, loop_t *loop, p
         return err;
     }
 
-    while (vec_wrreq_len(&self->write_reqs) > 0) {
-        io_process_result_t processed = false;
-        err = pipe_handler_process_write_req(self, loop, err, &processed);
-
-        switch (processed) {
-        case IO_PROCESS_FINISHED:
-            vec_wrreq_remove(&self->write_reqs, 0);
-            [[fallthrough]];
-
-        case IO_PROCESS_PARTIAL:
-            if (!err) {
-                goto out;
-            }
+    while (ring_wrreq_len(&self->write_reqs) > 0) {
+        io_process_result_t processed = IO_PROCESS_AGAIN;
+        err = pipe_handler_process_write_reqs(self, loop, err, &processed);
 
-            [[fallthrough]];
-
-        case IO_PROCESS_AGAIN:
-            continue;
+        if (processed != IO_PROCESS_AGAIN && !err) {
+            break;
         }
     }
 
-out:
-    if (vec_wrreq_len(&self->write_reqs) == 0) {
+    if (ring_wrreq_len(&self->write_reqs) == 0) {
         handler_set_pending_mask(&self->handler, 0);
     }
 
@@ -153,13 +152,13 @@ static error_t *pipe_handler_rd_process(pipe_handler_rd_t *self, loop_t *loop, p
         return err;
     }
 
-    char *buf = calloc(READ_BUFFER_SIZE, 1);
-    err = error_wrap("Could not allocate a buffer for received data", OK_IF(buf != NULL));
-    if (err) goto calloc_fail;
+    char *buf = NULL;
+    err = read_buffer_acquire(&buf);
+    if (err) goto acquire_fail;
 
     int fd = handler_fd(&self->handler);
     ssize_t read_count = -1;
-    err = error_from_posix(wrapper_read(fd, buf, READ_BUFFER_SIZE, &read_count));
+    err = error_from_posix(wrapper_read(fd, buf, LOOP_READ_BUFFER_SIZE, &read_count));
     if (err) goto read_fail;
 
     slice_t slice = {
@@ -171,7 +170,11 @@ static error_t *pipe_handler_rd_process(pipe_handler_rd_t *self, loop_t *loop, p
         self->eof = true;
     }
 
+    self->read_buf = buf;
     err = self->on_read(loop, self, slice);
+    // the callback may have taken the buffer
+    buf = self->read_buf;
+    self->read_buf = NULL;
     if (err) goto cb_fail;
 
     if (self->eof) {
@@ -182,9 +185,9 @@ static error_t *pipe_handler_rd_process(pipe_handler_rd_t *self, loop_t *loop, p
 
 cb_fail:
 read_fail:
-    free(buf);
+    loop_read_buffer_release(buf);
 
-calloc_fail:
+acquire_fail:
     if (err && self->on_error != NULL) {
         err = self->on_error(loop, self, err);
     }
@@ -231,7 +234,7 @@ error_t *pipe_handler_new(pipe_handler_wr_t **writer, pipe_handler_rd_t **reader
     handler_init(&wr->handler, &pipe_handler_wr_vtable, wr_fd);
     handler_init(&rd->handler, &pipe_handler_rd_vtable, rd_fd);
 
-    wr->write_reqs = vec_wrreq_new();
+    wr->write_reqs = ring_wrreq_new();
     wr->on_error = NULL;
     wr->on_write = NULL;
 
@@ -270,6 +273,13 @@ bool pipe_is_eof(pipe_handler_rd_t const *self) {
     return self->eof;
 }
 
+char *pipe_take_read_buffer(pipe_handler_rd_t *self) {
+    char *result = self->read_buf;
+    self->read_buf = NULL;
+
+    return result;
+}
+
 error_t *pipe_write(
     pipe_handler_wr_t *self,
     size_t slice_count,
@@ -277,7 +287,7 @@ error_t *pipe_write(
     pipe_on_write_cb_t on_write,
     pipe_wr_on_error_cb_t on_error
 ) {
-    error_t *err = error_from_common(vec_wrreq_push(&self->write_reqs, (pipe_write_req_t) {
+    error_t *err = error_from_common(ring_wrreq_push(&self->write_reqs, (pipe_write_req_t) {
         .write_req = {
             .slices = slices,
             .slice_count = slice_count,
@@ -0,0 +1,120 @@
+#include "io.h"
+
+#include <stdlib.h>
+
+#ifndef COMMON_PTHREADS_DISABLED
+#include <pthread.h>
+#endif
+
+#include <common/error.h>
+
+enum {
+    // the most released buffers a thread keeps for reuse; the rest are freed
+    READ_BUFFER_CACHE_LIMIT = 32,
+};
+
+// A buffer waiting to be reused.
+// The link is stored in the buffer itself, so releasing a buffer never allocates.
+typedef struct read_buffer_free read_buffer_free_t;
+
+struct read_buffer_free {
+    read_buffer_free_t *next;
+};
+
+typedef struct {
+    read_buffer_free_t *head;
+    size_t count;
+    // the thread is exiting: the buffers released from now on are freed immediately
+    bool closed;
+#ifndef COMMON_PTHREADS_DISABLED
+    // the cache is freed when the thread exits
+    bool registered;
+#endif
+} read_buffer_cache_t;
+
+static thread_local read_buffer_cache_t read_buffer_cache = {0};
+
+#ifndef COMMON_PTHREADS_DISABLED
+static pthread_key_t read_buffer_key;
+static bool read_buffer_key_created = false;
+static pthread_once_t read_buffer_key_once = PTHREAD_ONCE_INIT;
+
+static void read_buffer_cache_on_exit(void *cache_opaque) {
+    read_buffer_cache_t *cache = cache_opaque;
+    cache->closed = true;
+
+    while (cache->head != NULL) {
+        read_buffer_free_t *entry = cache->head;
+        cache->head = entry->next;
+        free(entry);
+    }
+
+    cache->count = 0;
+}
+
+static void read_buffer_key_init(void) {
+    read_buffer_key_created =
+        pthread_key_create(&read_buffer_key, read_buffer_cache_on_exit) == 0;
+}
+
+// Makes sure the buffers kept by the thread are freed when it exits.
+static bool read_buffer_cache_register(read_buffer_cache_t *cache) {
+    if (cache->registered) {
+        return true;
+    }
+
+    error_assert(error_from_errno(pthread_once(&read_buffer_key_once, read_buffer_key_init)));
+
+    if (read_buffer_key_created) {
+        cache->registered = pthread_setspecific(read_buffer_key, cache) == 0;
+    }
+
+    return cache->registered;
+}
+#endif
+
+error_t *read_buffer_acquire(char **result) {
+    error_t *err = NULL;
+    read_buffer_cache_t *cache = &read_buffer_cache;
+
+    if (cache->head != NULL) {
+        read_buffer_free_t *entry = cache->head;
+        cache->head = entry->next;
+        --cache->count;
+        *result = (char *) entry;
+
+        return err;
+    }
+
+    char *buf = malloc(LOOP_READ_BUFFER_SIZE);
+    err = error_wrap("Could not allocate a buffer for received data", OK_IF(buf != NULL));
+    if (err) return err;
+
+    *result = buf;
+
+    return err;
+}
+
+void loop_read_buffer_release(char *buf) {
+    if (buf == NULL) {
+        return;
+    }
+
+    read_buffer_cache_t *cache = &read_buffer_cache;
+    bool keep = !cache->closed && cache->count < READ_BUFFER_CACHE_LIMIT;
+
+#ifndef COMMON_PTHREADS_DISABLED
+    keep = keep && read_buffer_cache_register(cache);
+#endif
+
+    if (!keep) {
+        free(buf);
+
+        return;
+    }
+
+    read_buffer_free_t *entry = (read_buffer_free_t *) buf;
+    entry->next = cache->head;
+    cache->head = entry;
+    ++cache->count;
+}
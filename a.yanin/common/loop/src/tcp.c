@@ -1,7 +1,16 @@
+// for SO_REUSEPORT
+#define _DEFAULT_SOURCE
+
 #include "common/loop/tcp.h"
 
 #include <arpa/inet.h>
+#include <stdatomic.h>
 #include <stdint.h>
+#include <stdlib.h>
+
+#ifndef COMMON_PTHREADS_DISABLED
+#include <pthread.h>
+#endif
 
 #include <netinet/in.h>
 
@@ -9,6 +18,7 @@
 #include <common/posix/adapter.h>
 #include <common/posix/file.h>
 #include <common/posix/io.h>
+#include <common/posix/ipc.h>
 #include <common/posix/proc.h>
 
 #include "common/loop/loop.h"
@@ -16,7 +26,8 @@
 #include "util.h"
 
 enum {
-    READ_BUFFER_SIZE = 16384,
+    // the most data moved by a single splice(2) call while relaying
+    RELAY_SPLICE_SIZE = 65536,
 };
 
 typedef struct {
@@ -25,10 +36,10 @@ typedef struct {
     tcp_on_write_error_cb_t on_error;
 } tcp_write_req_t;
 
-#define VEC_ELEMENT_TYPE tcp_write_req_t
-#define VEC_LABEL wrreq
-#define VEC_CONFIG (COLLECTION_DECLARE | COLLECTION_DEFINE | COLLECTION_STATIC)
-#include <common/collections/vec.h>
+#define RING_ELEMENT_TYPE tcp_write_req_t
+#define RING_LABEL wrreq
+#define RING_CONFIG (COLLECTION_DECLARE | COLLECTION_DEFINE | COLLECTION_STATIC)
+#include <common/collections/ring.h>
 
 typedef enum {
     // connect(2) returned EINPROGRESS
@@ -41,6 +52,31 @@ typedef enum {
     TCP_HANDLER_ESTABLISHED,
 } tcp_handler_state_t;
 
+// One direction of a relay: a pipe with the data received from one socket and not yet sent to the
+// other.
+typedef struct {
+    int rd_fd;
+    int wr_fd;
+    // the number of bytes in the pipe
+    atomic_size_t len;
+    // the receiving socket has reached the end of stream; set after the last bytes are counted
+    atomic_bool eof;
+    // the receiving end has stopped reading until the pipe is drained
+    atomic_bool paused;
+} tcp_relay_pipe_t;
+
+// Shared by the two handlers of a relay, and freed once both of them leave it.
+typedef struct {
+#ifndef COMMON_PTHREADS_DISABLED
+    // guards `ends`
+    pthread_mutex_t mtx;
+#endif
+    // the handlers taking part in the relay, or `NULL` once freed
+    tcp_handler_t *ends[2];
+    // `pipes[i]` carries the data received by `ends[i]`
+    tcp_relay_pipe_t pipes[2];
+} tcp_relay_t;
+
 struct tcp_handler_server {
     handler_t handler;
     tcp_server_on_new_conn_cb_t on_new_conn;
@@ -50,7 +86,7 @@ struct tcp_handler_server {
 
 struct tcp_handler {
     handler_t handler;
-    vec_wrreq_t write_reqs;
+    ring_wrreq_t write_reqs;
     tcp_on_error_cb_t on_error;
     union {
         struct {
@@ -76,6 +112,25 @@ struct tcp_handler {
     bool input_shut;
     bool output_shut;
     bool eof;
+    // the buffer passed to the running `on_read` callback, unless it has been taken
+    char *read_buf;
+
+    // the relay the handler is part of, if any
+    tcp_relay_t *relay;
+    // the index of the handler in `relay->ends`
+    size_t relay_end;
+    // the socket has been switched to non-blocking mode for splicing
+    bool relay_started;
+    // everything has been received from the socket and put in the pipe
+    bool relay_rd_done;
+    // everything the peer has received has been sent, and the output has been shut down
+    bool relay_wr_done;
+
+    // the timeouts in milliseconds, or 0 if disabled
+    uint64_t timeouts[TCP_TIMEOUT_COUNT];
+    // the time each timeout is counted from
+    uint64_t timeouts_since[TCP_TIMEOUT_COUNT];
+    tcp_on_timeout_cb_t on_timeout;
 };
 
 static error_t *get_socket_error(int fd) {
@@ -90,6 +145,67 @@ static error_t *get_socket_error(int fd) {
     return err;
 }
 
+// Restarts the timeouts concerned with a transfer (a bit set of `1 << tcp_timeout_t`).
+static void tcp_client_touch(tcp_handler_t *self, unsigned kinds) {
+    uint64_t now = 0;
+
+    for (size_t i = 0; i < TCP_TIMEOUT_COUNT; ++i) {
+        if ((kinds & (1u << i)) == 0 || self->timeouts[i] == 0) {
+            continue;
+        }
+
+        if (now == 0) {
+            now = loop_time_ms();
+        }
+
+        self->timeouts_since[i] = now;
+    }
+}
+
+// Returns `true` if the timeout is currently counting down.
+static bool tcp_client_timeout_applies(tcp_handler_t const *self, tcp_timeout_t timeout) {
+    if (self->timeouts[timeout] == 0) {
+        return false;
+    }
+
+    switch (timeout) {
+    case TCP_TIMEOUT_READ:
+        return self->state == TCP_HANDLER_ESTABLISHED && self->relay == NULL
+            && self->on_read != NULL && !self->eof && !self->input_shut;
+
+    case TCP_TIMEOUT_WRITE:
+        return self->state == TCP_HANDLER_CONNECTING
+            || (!self->output_shut && ring_wrreq_len(&self->write_reqs) > 0);
+
+    case TCP_TIMEOUT_IDLE:
+        return true;
+
+    case TCP_TIMEOUT_COUNT:
+        break;
+    }
+
+    return false;
+}
+
+// Sets the handler's timer to the earliest of the timeouts.
+static void tcp_client_update_deadline(tcp_handler_t *self) {
+    uint64_t deadline = 0;
+
+    for (size_t i = 0; i < TCP_TIMEOUT_COUNT; ++i) {
+        if (!tcp_client_timeout_applies(self, (tcp_timeout_t) i)) {
+            continue;
+        }
+
+        uint64_t expiry = self->timeouts_since[i] + self->timeouts[i];
+
+        if (deadline == 0 || expiry < deadline) {
+            deadline = expiry;
+        }
+    }
+
+    handler_set_deadline(&self->handler, deadline);
+}
+
 static void tcp_handler_free(handler_t *self) {
     error_t *err = error_wrap("Could not close the socket",
         error_from_posix(wrapper_close(handler_fd(self))));
@@ -138,6 +254,7 @@ error_t *tcp_server_new(
     struct sockaddr *addr,
     socklen_t addrlen,
     bool reuse_addr,
+    bool reuse_port,
     tcp_handler_server_t **result
 ) {
     assert(addr->sa_family == AF_INET || addr->sa_family == AF_INET6);
@@ -158,6 +275,16 @@ error_t *tcp_server_new(
         if (err) goto reuse_addr_fail;
     }
 
+    if (reuse_port) {
+#ifdef SO_REUSEPORT
+        err = error_wrap("Could not set SO_REUSEPORT", error_from_posix(
+            wrapper_setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &(int) { 1 }, sizeof(int))));
+#else
+        err = error_wrap("SO_REUSEPORT is not supported on this platform", OK_IF(false));
+#endif
+        if (err) goto reuse_port_fail;
+    }
+
     err = error_from_posix(wrapper_bind(fd, addr, addrlen));
     if (err) goto bind_fail;
 
@@ -177,6 +304,7 @@ error_t *tcp_server_new(
 
 fcntl_fail:
 bind_fail:
+reuse_port_fail:
 reuse_addr_fail:
     err = error_combine(err, error_from_posix(wrapper_close(fd)));
 
@@ -189,6 +317,12 @@ malloc_fail:
 
 static void client_init(tcp_handler_t *self, int fd);
 
+// Moves an established connection to the critical lane: its I/O is what pushes the bytes to the
+// peers, and it shouldn't wait behind a burst of connections being accepted or set up.
+static void tcp_client_set_established_lane(tcp_handler_t *self) {
+    handler_set_lane(&self->handler, EXECUTOR_LANE_CRITICAL);
+}
+
 error_t *tcp_accept(tcp_handler_server_t *self, tcp_handler_t **result) {
     error_t *err = NULL;
 
@@ -209,6 +343,7 @@ error_t *tcp_accept(tcp_handler_server_t *self, tcp_handler_t **result) {
 
     client_init(client, fd);
     client->state = TCP_HANDLER_ESTABLISHED;
+    tcp_client_set_established_lane(client);
     *result = client;
 
     return err;
@@ -225,8 +360,8 @@ static error_t *tcp_client_drop_write_reqs(tcp_handler_t *self, loop_t *loop) {
 
     error_t *err = NULL;
 
-    for (size_t i = 0; i < vec_wrreq_len(&self->write_reqs); ++i) {
-        tcp_write_req_t const *req = vec_wrreq_get(&self->write_reqs, i);
+    for (size_t i = 0; i < ring_wrreq_len(&self->write_reqs); ++i) {
+        tcp_write_req_t const *req = ring_wrreq_get(&self->write_reqs, i);
 
         if (req->on_error != NULL) {
             err = error_combine(err, req->on_error(loop, self, NULL,
@@ -236,12 +371,84 @@ static error_t *tcp_client_drop_write_reqs(tcp_handler_t *self, loop_t *loop) {
         }
     }
 
-    vec_wrreq_clear(&self->write_reqs);
+    ring_wrreq_clear(&self->write_reqs);
 
     return err;
 }
 
+static void tcp_relay_pipe_close(tcp_relay_pipe_t *pipe) {
+    error_t *err = error_wrap("Could not close a relay pipe", error_combine(
+        error_from_posix(wrapper_close(pipe->rd_fd)),
+        error_from_posix(wrapper_close(pipe->wr_fd))));
+
+    if (err) {
+        error_log_free(&err, LOG_WARN, ERROR_VERBOSITY_SOURCE_CHAIN);
+    }
+}
+
+static void tcp_relay_free(tcp_relay_t *relay) {
+    tcp_relay_pipe_close(&relay->pipes[0]);
+    tcp_relay_pipe_close(&relay->pipes[1]);
+
+#ifndef COMMON_PTHREADS_DISABLED
+    pthread_mutex_destroy(&relay->mtx);
+#endif
+
+    free(relay);
+}
+
+// Forces the handler at the `end` of the relay to be processed, unless it has been freed.
+static void tcp_relay_wake(tcp_relay_t *relay, size_t end) {
+#ifndef COMMON_PTHREADS_DISABLED
+    assert_mutex_lock(&relay->mtx);
+#endif
+
+    if (relay->ends[end] != NULL) {
+        handler_force(&relay->ends[end]->handler);
+    }
+
+#ifndef COMMON_PTHREADS_DISABLED
+    assert_mutex_unlock(&relay->mtx);
+#endif
+}
+
+// Detaches the handler from its relay before it's freed.
+//
+// If the handler hasn't finished its part, the relay is broken, and the peer is unregistered too.
+static void tcp_relay_leave(tcp_handler_t *self) {
+    tcp_relay_t *relay = self->relay;
+
+    if (relay == NULL) {
+        return;
+    }
+
+    self->relay = NULL;
+
+#ifndef COMMON_PTHREADS_DISABLED
+    assert_mutex_lock(&relay->mtx);
+#endif
+
+    relay->ends[self->relay_end] = NULL;
+    tcp_handler_t *peer = relay->ends[1 - self->relay_end];
+
+    if (peer != NULL && !(self->relay_rd_done && self->relay_wr_done)) {
+        log_printf(LOG_DEBUG, "The relay has been broken; dropping the other end");
+        handler_unregister(&peer->handler);
+        handler_force(&peer->handler);
+    }
+
+#ifndef COMMON_PTHREADS_DISABLED
+    assert_mutex_unlock(&relay->mtx);
+#endif
+
+    if (peer == NULL) {
+        tcp_relay_free(relay);
+    }
+}
+
 static void tcp_client_free(tcp_handler_t *self) {
+    tcp_relay_leave(self);
+
     error_t *err = error_wrap("An error has occured while freeing a TCP handler",
         tcp_client_drop_write_reqs(self, handler_loop((handler_t *) self)));
 
@@ -249,7 +456,7 @@ static void tcp_client_free(tcp_handler_t *self) {
         error_log_free(&err, LOG_WARN, ERROR_VERBOSITY_SOURCE_CHAIN | ERROR_VERBOSITY_BACKTRACE);
     }
 
-    vec_wrreq_free(&self->write_reqs);
+    ring_wrreq_free(&self->write_reqs);
     tcp_handler_free(&self->handler);
 }
 
@@ -282,6 +489,7 @@ static error_t *tcp_client_handle_connected(tcp_handler_t *self, loop_t *loop, p
     }
 
     self->state = TCP_HANDLER_ESTABLISHED;
+    tcp_client_set_established_lane(self);
     err = self->on_connect(loop, self);
 
     return err;
@@ -318,26 +526,34 @@ static error_t *tcp_client_handle_connecting(
 static error_t *tcp_client_handle_read(tcp_handler_t *self, loop_t *loop) {
     error_t *err = NULL;
 
-    char *buf = calloc(READ_BUFFER_SIZE, 1);
-    err = error_wrap("Could not allocate a buffer for received data", OK_IF(buf != NULL));
-    if (err) goto calloc_fail;
+    char *buf = NULL;
+    err = read_buffer_acquire(&buf);
+    if (err) goto acquire_fail;
 
     int fd = handler_fd(&self->handler);
     ssize_t read_count = -1;
-    err = error_from_posix(wrapper_read(fd, buf, READ_BUFFER_SIZE, &read_count));
+    err = error_from_posix(wrapper_read(fd, buf, LOOP_READ_BUFFER_SIZE, &read_count));
     if (err) goto read_fail;
 
+    tcp_client_touch(self, 1u << TCP_TIMEOUT_READ | 1u << TCP_TIMEOUT_IDLE);
+
     slice_t slice = {
         .base = buf,
         .len = (size_t) read_count,
     };
 
-    if (self->input_shut && read_count == 0) {
+    // the peer may have only shut down its sending end, which doesn't raise POLLHUP
+    if (read_count == 0) {
         log_printf(LOG_DEBUG, "self->eof = true!");
+        self->input_shut = true;
         self->eof = true;
     }
 
+    self->read_buf = buf;
     err = self->on_read(loop, self, slice);
+    // the callback may have taken the buffer
+    buf = self->read_buf;
+    self->read_buf = NULL;
     if (err) goto cb_fail;
 
     if (self->eof) {
@@ -348,9 +564,9 @@ static error_t *tcp_client_handle_read(tcp_handler_t *self, loop_t *loop) {
 
 cb_fail:
 read_fail:
-    free(buf);
+    loop_read_buffer_release(buf);
 
-calloc_fail:
+acquire_fail:
     if (err && self->on_read_error != NULL) {
         err = self->on_read_error(loop, self, err);
     }
@@ -358,10 +574,22 @@ calloc_fail:
     return err;
 }
 
-static write_req_t *tcp_client_process_write_req_get_req(void *self_opaque) {
+static size_t tcp_client_process_write_req_count(void *self_opaque) {
+    tcp_handler_t *self = self_opaque;
+
+    return ring_wrreq_len(&self->write_reqs);
+}
+
+static write_req_t *tcp_client_process_write_req_get_req(void *self_opaque, size_t idx) {
+    tcp_handler_t *self = self_opaque;
+
+    return &ring_wrreq_get_mut(&self->write_reqs, idx)->write_req;
+}
+
+static void tcp_client_process_write_req_pop(void *self_opaque) {
     tcp_handler_t *self = self_opaque;
 
-    return &vec_wrreq_get_mut(&self->write_reqs, 0)->write_req;
+    ring_wrreq_pop_front(&self->write_reqs);
 }
 
 static error_t *tcp_client_process_write_req_on_write(
@@ -397,19 +625,21 @@ static error_t *tcp_client_process_write_req_on_error(
     }
 }
 
-static error_t *tcp_client_process_write_req(
+static error_t *tcp_client_process_write_reqs(
     tcp_handler_t *self,
     loop_t *loop,
     error_t *err,
     io_process_result_t *processed
 ) {
-    return io_process_write_req(
+    return io_process_write_reqs(
         self,
         loop,
         err,
         processed,
         handler_fd(&self->handler),
+        tcp_client_process_write_req_count,
         tcp_client_process_write_req_get_req,
+        tcp_client_process_write_req_pop,
         tcp_client_process_write_req_on_write,
         tcp_client_process_write_req_on_error
     );
@@ -418,38 +648,24 @@ static error_t *tcp_client_process_write_req(
 static error_t *tcp_client_handle_write(tcp_handler_t *self, loop_t *loop) {
     error_t *err = NULL;
 
-    log_printf(LOG_DEBUG, "Have %zu reqs", vec_wrreq_len(&self->write_reqs));
-
-    while (!self->output_shut && vec_wrreq_len(&self->write_reqs) > 0) {
-        io_process_result_t processed = false;
-        err = tcp_client_process_write_req(self, loop, err, &processed);
+    log_printf(LOG_DEBUG, "Have %zu reqs", ring_wrreq_len(&self->write_reqs));
 
-        switch (processed) {
-        case IO_PROCESS_FINISHED:
-            vec_wrreq_remove(&self->write_reqs, 0);
-            [[fallthrough]];
+    // a single call writes out as many requests as fit into one writev(2); the loop only goes on
+    // to pass a failure down the queue
+    while (!self->output_shut && ring_wrreq_len(&self->write_reqs) > 0) {
+        io_process_result_t processed = IO_PROCESS_AGAIN;
+        err = tcp_client_process_write_reqs(self, loop, err, &processed);
 
-        case IO_PROCESS_PARTIAL:
-            if (!err) {
-                goto out;
-            }
-
-            [[fallthrough]];
-
-        case IO_PROCESS_AGAIN:
-            continue;
+        if (processed == IO_PROCESS_FINISHED || processed == IO_PROCESS_PARTIAL) {
+            tcp_client_touch(self, 1u << TCP_TIMEOUT_WRITE | 1u << TCP_TIMEOUT_IDLE);
         }
 
-        if (processed) {
-            // XXX: this makes it O(n²)
-            // a better choice would be a ring buffer
-            log_printf(LOG_DEBUG, "Processed %p (err = %p)", (void *) vec_wrreq_get(&self->write_reqs, 0)->write_req.slices, (void *) err);
+        if (processed != IO_PROCESS_AGAIN && !err) {
+            break;
         }
     }
 
-out:
-
-    log_printf(LOG_DEBUG, "Now it's %zu reqs", vec_wrreq_len(&self->write_reqs));
+    log_printf(LOG_DEBUG, "Now it's %zu reqs", ring_wrreq_len(&self->write_reqs));
 
     if (self->output_shut) {
         err = error_combine(err, error_wrap(
@@ -458,7 +674,7 @@ out:
         ));
     }
 
-    if (vec_wrreq_len(&self->write_reqs) == 0) {
+    if (ring_wrreq_len(&self->write_reqs) == 0) {
         poll_flags_t flags = handler_pending_mask(&self->handler);
         flags &= ~LOOP_WRITE;
         handler_set_pending_mask(&self->handler, flags);
@@ -467,6 +683,188 @@ out:
     return err;
 }
 
+#ifdef COMMON_SPLICE_ENABLED
+// Returns `true` if the pipe can take more data.
+static error_t *tcp_relay_pipe_has_room(tcp_relay_pipe_t *pipe, bool *result) {
+    if (atomic_load(&pipe->len) == 0) {
+        *result = true;
+
+        return NULL;
+    }
+
+    struct pollfd pollfd = {
+        .fd = pipe->wr_fd,
+        .events = POLLOUT,
+    };
+    int count = 0;
+    error_t *err = error_from_posix(wrapper_poll(&pollfd, 1, 0, &count));
+    *result = count > 0 && (pollfd.revents & POLLOUT);
+
+    return err;
+}
+
+// Moves the received data from the socket to the pipe until either runs out.
+static error_t *tcp_relay_receive(tcp_handler_t *self, tcp_relay_pipe_t *pipe, bool *woken) {
+    while (true) {
+        ssize_t count = 0;
+        posix_err_t status = wrapper_splice(
+            handler_fd(&self->handler),
+            pipe->wr_fd,
+            RELAY_SPLICE_SIZE,
+            &count
+        );
+
+        if (status.errno_code == EAGAIN || status.errno_code == EWOULDBLOCK) {
+            return NULL;
+        }
+
+        error_t *err = error_wrap("Could not receive data to relay", error_from_posix(status));
+        if (err) return err;
+
+        if (count == 0) {
+            self->eof = true;
+            self->relay_rd_done = true;
+            atomic_store(&pipe->eof, true);
+            *woken = true;
+
+            return NULL;
+        }
+
+        // the peer only needs waking if it may have run out of data to send
+        if (atomic_fetch_add(&pipe->len, (size_t) count) == 0) {
+            *woken = true;
+        }
+    }
+}
+
+// Moves the data from the pipe to the socket until the pipe is drained or the socket is full.
+static error_t *tcp_relay_send(tcp_handler_t *self, tcp_relay_pipe_t *pipe, bool *woken) {
+    size_t len = 0;
+
+    while ((len = atomic_load(&pipe->len)) > 0) {
+        ssize_t count = 0;
+        posix_err_t status = wrapper_splice(
+            pipe->rd_fd,
+            handler_fd(&self->handler),
+            len,
+            &count
+        );
+
+        if (status.errno_code == EAGAIN || status.errno_code == EWOULDBLOCK) {
+            break;
+        }
+
+        error_t *err = error_wrap("Could not send relayed data", error_from_posix(status));
+        if (err) return err;
+
+        atomic_fetch_sub(&pipe->len, (size_t) count);
+    }
+
+    // the peer may have paused reading because the pipe was full
+    if (atomic_exchange(&pipe->paused, false)) {
+        *woken = true;
+    }
+
+    return NULL;
+}
+
+static error_t *tcp_relay_process(tcp_handler_t *self, loop_t *loop, poll_flags_t flags) {
+    error_t *err = NULL;
+
+    tcp_relay_t *relay = self->relay;
+    tcp_relay_pipe_t *in = &relay->pipes[self->relay_end];
+    tcp_relay_pipe_t *out = &relay->pipes[1 - self->relay_end];
+    bool woken = false;
+
+    // the data queued before the relay was set up goes first
+    if (ring_wrreq_len(&self->write_reqs) != 0) {
+        if (flags & LOOP_WRITE) {
+            err = tcp_client_handle_write(self, loop);
+            if (err) return err;
+        }
+
+        if (ring_wrreq_len(&self->write_reqs) != 0) {
+            handler_set_pending_mask(&self->handler, LOOP_WRITE);
+
+            return err;
+        }
+    }
+
+    if (!self->relay_started) {
+        // an accepted socket is in blocking mode, and splice(2) would block on it
+        err = error_wrap("Could not switch the socket to non-blocking mode", error_from_posix(
+            wrapper_fcntli(handler_fd(&self->handler), F_SETFL, O_NONBLOCK)));
+        if (err) return err;
+
+        self->relay_started = true;
+    }
+
+    if (!self->relay_rd_done) {
+        err = tcp_relay_receive(self, in, &woken);
+        if (err) return err;
+    }
+
+    if (!self->relay_wr_done) {
+        err = tcp_relay_send(self, out, &woken);
+        if (err) return err;
+
+        // `len` only counts the data received before `eof` is set
+        if (atomic_load(&out->eof) && atomic_load(&out->len) == 0) {
+            tcp_shutdown_output(self);
+            self->relay_wr_done = true;
+        }
+    }
+
+    if (woken) {
+        tcp_relay_wake(relay, 1 - self->relay_end);
+    }
+
+    if ((flags & LOOP_HUP) && !self->relay_wr_done) {
+        // nothing can be sent anymore: the connection has been reset
+        log_printf(LOG_DEBUG, "The relayed connection has hung up");
+        handler_unregister(&self->handler);
+
+        return err;
+    }
+
+    poll_flags_t mask = 0;
+
+    if (!self->relay_rd_done) {
+        bool has_room = false;
+        err = tcp_relay_pipe_has_room(in, &has_room);
+
+        if (!err && !has_room) {
+            // the peer resumes the reading once it drains the pipe, which may just have happened
+            atomic_store(&in->paused, true);
+            err = tcp_relay_pipe_has_room(in, &has_room);
+
+            if (has_room) {
+                atomic_store(&in->paused, false);
+            }
+        }
+
+        if (err) return err;
+
+        if (has_room) {
+            mask |= LOOP_READ;
+        }
+    }
+
+    if (!self->relay_wr_done && atomic_load(&out->len) > 0) {
+        mask |= LOOP_WRITE;
+    }
+
+    handler_set_pending_mask(&self->handler, mask);
+
+    if (self->relay_rd_done && self->relay_wr_done) {
+        log_printf(LOG_DEBUG, "The relay is complete");
+        handler_unregister(&self->handler);
+    }
+
+    return err;
+}
+#endif
+
 static error_t *tcp_client_handle_established(
     tcp_handler_t *self,
     loop_t *loop,
@@ -486,6 +884,16 @@ static error_t *tcp_client_handle_established(
 
     if (err) return err;
 
+#ifdef COMMON_SPLICE_ENABLED
+    if (self->relay != NULL) {
+        if (flags & LOOP_ALL_IN) {
+            tcp_client_touch(self, 1u << TCP_TIMEOUT_IDLE);
+        }
+
+        return tcp_relay_process(self, loop, flags);
+    }
+#endif
+
     if (flags & LOOP_HUP) {
         log_printf(LOG_DEBUG, "got LOOP_HUP");
         self->input_shut = true;
@@ -501,7 +909,7 @@ static error_t *tcp_client_handle_established(
         if (err) return err;
     }
 
-    if (vec_wrreq_len(&self->write_reqs) != 0 && flags & LOOP_WRITE) {
+    if (ring_wrreq_len(&self->write_reqs) != 0 && flags & LOOP_WRITE) {
         err = tcp_client_handle_write(self, loop);
         if (err) return err;
     }
@@ -509,7 +917,36 @@ static error_t *tcp_client_handle_established(
     return err;
 }
 
-static error_t *tcp_client_process(tcp_handler_t *self, loop_t *loop, poll_flags_t flags) {
+// Disables the expired timeouts and reports them.
+static error_t *tcp_client_handle_timeouts(tcp_handler_t *self, loop_t *loop) {
+    error_t *err = NULL;
+
+    uint64_t now = loop_time_ms();
+
+    for (size_t i = 0; !err && i < TCP_TIMEOUT_COUNT; ++i) {
+        if (!tcp_client_timeout_applies(self, (tcp_timeout_t) i)
+                || self->timeouts_since[i] + self->timeouts[i] > now) {
+            continue;
+        }
+
+        self->timeouts[i] = 0;
+
+        if (self->on_timeout != NULL) {
+            err = self->on_timeout(loop, self, (tcp_timeout_t) i);
+        } else if (self->state == TCP_HANDLER_CONNECTING) {
+            // reported like any other connection failure
+            self->state = TCP_HANDLER_FAIL;
+            err = tcp_client_handle_connect_fail(self, loop, error_wrap(
+                "Could not establish the connection in time", error_from_errno(ETIMEDOUT)));
+        } else {
+            err = error_wrap("The connection has timed out", error_from_errno(ETIMEDOUT));
+        }
+    }
+
+    return err;
+}
+
+static error_t *tcp_client_handle_state(tcp_handler_t *self, loop_t *loop, poll_flags_t flags) {
     switch (self->state) {
     case TCP_HANDLER_CONNECTING:
         return tcp_client_handle_connecting(self, loop, flags);
@@ -531,6 +968,19 @@ static error_t *tcp_client_process(tcp_handler_t *self, loop_t *loop, poll_flags
     log_abort("self->state is invalid (%jd)", (intmax_t) self->state);
 }
 
+static error_t *tcp_client_process(tcp_handler_t *self, loop_t *loop, poll_flags_t flags) {
+    error_t *err = tcp_client_handle_state(self, loop, flags);
+
+    // the I/O goes first: whatever it has transferred restarts the timeouts
+    if (!err && (flags & LOOP_TIMEOUT)) {
+        err = tcp_client_handle_timeouts(self, loop);
+    }
+
+    tcp_client_update_deadline(self);
+
+    return err;
+}
+
 static error_t *tcp_client_on_error(tcp_handler_t *self, loop_t *loop, error_t *err) {
     log_printf(LOG_DEBUG, "Handling a client error");
 
@@ -549,7 +999,7 @@ static handler_vtable_t const tcp_client_vtable = {
 
 static void client_init(tcp_handler_t *self, int fd) {
     handler_init(&self->handler, &tcp_client_vtable, fd);
-    self->write_reqs = vec_wrreq_new();
+    self->write_reqs = ring_wrreq_new();
     self->on_error = NULL;
     self->on_connect = NULL;
     self->on_connect_error = NULL;
@@ -558,6 +1008,17 @@ static void client_init(tcp_handler_t *self, int fd) {
     self->input_shut = false;
     self->output_shut = false;
     self->eof = false;
+    self->relay = NULL;
+    self->relay_end = 0;
+    self->relay_started = false;
+    self->relay_rd_done = false;
+    self->relay_wr_done = false;
+    self->on_timeout = NULL;
+
+    for (size_t i = 0; i < TCP_TIMEOUT_COUNT; ++i) {
+        self->timeouts[i] = 0;
+        self->timeouts_since[i] = 0;
+    }
 }
 
 error_t *tcp_connect(
@@ -651,8 +1112,13 @@ listen_fail:
 void tcp_read(tcp_handler_t *self, tcp_on_read_cb_t on_read, tcp_on_read_error_cb_t on_error) {
     assert(self->state == TCP_HANDLER_ESTABLISHED);
 
+    if (self->on_read == NULL && on_read != NULL) {
+        tcp_client_touch(self, 1u << TCP_TIMEOUT_READ);
+    }
+
     self->on_read = on_read;
     self->on_read_error = on_error;
+    tcp_client_update_deadline(self);
     poll_flags_t flags = handler_pending_mask(&self->handler);
 
     if (self->on_read != NULL) {
@@ -668,6 +1134,13 @@ bool tcp_is_eof(tcp_handler_t const *self) {
     return self->eof;
 }
 
+char *tcp_take_read_buffer(tcp_handler_t *self) {
+    char *result = self->read_buf;
+    self->read_buf = NULL;
+
+    return result;
+}
+
 error_t *tcp_write(
     tcp_handler_t *self,
     size_t slice_count,
@@ -682,7 +1155,11 @@ error_t *tcp_write(
     err = error_wrap("The output has been shut down", OK_IF(!self->output_shut));
     if (err) goto fail;
 
-    err = error_from_common(vec_wrreq_push(&self->write_reqs, (tcp_write_req_t) {
+    if (ring_wrreq_len(&self->write_reqs) == 0) {
+        tcp_client_touch(self, 1u << TCP_TIMEOUT_WRITE);
+    }
+
+    err = error_from_common(ring_wrreq_push(&self->write_reqs, (tcp_write_req_t) {
         .write_req = {
             .slices = slices,
             .slice_count = slice_count,
@@ -695,7 +1172,9 @@ error_t *tcp_write(
 
     log_printf(LOG_DEBUG, "Added %p to write_reqs; have %zu of them now",
         (void *) slices,
-        vec_wrreq_len(&self->write_reqs));
+        ring_wrreq_len(&self->write_reqs));
+
+    tcp_client_update_deadline(self);
 
     poll_flags_t flags = handler_pending_mask(&self->handler);
     flags |= LOOP_WRITE;
@@ -705,6 +1184,96 @@ fail:
     return err;
 }
 
+#ifdef COMMON_SPLICE_ENABLED
+static error_t *tcp_relay_pipe_init(tcp_relay_pipe_t *pipe) {
+    error_t *err = NULL;
+
+    err = error_from_posix(wrapper_pipe(&pipe->rd_fd, &pipe->wr_fd));
+    if (err) goto pipe_fail;
+
+    err = error_wrap("Could not switch the read end to non-blocking mode", error_from_posix(
+        wrapper_fcntli(pipe->rd_fd, F_SETFL, O_NONBLOCK)));
+    if (err) goto fcntli_fail;
+
+    err = error_wrap("Could not switch the write end to non-blocking mode", error_from_posix(
+        wrapper_fcntli(pipe->wr_fd, F_SETFL, O_NONBLOCK)));
+    if (err) goto fcntli_fail;
+
+    atomic_init(&pipe->len, 0);
+    atomic_init(&pipe->eof, false);
+    atomic_init(&pipe->paused, false);
+
+    return err;
+
+fcntli_fail:
+    tcp_relay_pipe_close(pipe);
+
+pipe_fail:
+    return error_wrap("Could not create a relay pipe", err);
+}
+#endif
+
+error_t *tcp_relay(tcp_handler_t *self, tcp_handler_t *peer) {
+#ifndef COMMON_SPLICE_ENABLED
+    (void) self;
+    (void) peer;
+
+    return error_from_cstr("Relaying is not supported on this platform", NULL);
+#else
+    assert(self->state == TCP_HANDLER_ESTABLISHED);
+    assert(peer->state == TCP_HANDLER_ESTABLISHED);
+    assert(self->relay == NULL);
+    assert(peer->relay == NULL);
+
+    error_t *err = NULL;
+
+    tcp_relay_t *relay = calloc(1, sizeof(tcp_relay_t));
+    err = error_wrap("Could not allocate memory for the relay", OK_IF(relay != NULL));
+    if (err) goto calloc_fail;
+
+    err = tcp_relay_pipe_init(&relay->pipes[0]);
+    if (err) goto pipe_0_fail;
+
+    err = tcp_relay_pipe_init(&relay->pipes[1]);
+    if (err) goto pipe_1_fail;
+
+#ifndef COMMON_PTHREADS_DISABLED
+    err = error_wrap("Could not create a mutex", error_from_errno(
+        pthread_mutex_init(&relay->mtx, NULL)));
+    if (err) goto mtx_init_fail;
+#endif
+
+    relay->ends[0] = self;
+    relay->ends[1] = peer;
+
+    tcp_handler_t *ends[] = { self, peer };
+
+    for (size_t i = 0; i < 2; ++i) {
+        ends[i]->relay = relay;
+        ends[i]->relay_end = i;
+        ends[i]->on_read = NULL;
+        ends[i]->on_read_error = NULL;
+        handler_force(&ends[i]->handler);
+    }
+
+    return err;
+
+#ifndef COMMON_PTHREADS_DISABLED
+mtx_init_fail:
+    tcp_relay_pipe_close(&relay->pipes[1]);
+#endif
+
+pipe_1_fail:
+    tcp_relay_pipe_close(&relay->pipes[0]);
+
+pipe_0_fail:
+    free(relay);
+
+calloc_fail:
+    return err;
+#endif
+}
+
 void tcp_shutdown_input(tcp_handler_t *self) {
     if (self->input_shut) {
         return;
@@ -752,6 +1321,16 @@ void tcp_set_on_error(tcp_handler_t *self, tcp_on_error_cb_t on_error) {
     self->on_error = on_error;
 }
 
+void tcp_set_timeout(tcp_handler_t *self, tcp_timeout_t timeout, uint64_t timeout_ms) {
+    self->timeouts[timeout] = timeout_ms;
+    tcp_client_touch(self, 1u << timeout);
+    tcp_client_update_deadline(self);
+}
+
+void tcp_set_on_timeout(tcp_handler_t *self, tcp_on_timeout_cb_t on_timeout) {
+    self->on_timeout = on_timeout;
+}
+
 void tcp_address(tcp_handler_t const *self, struct sockaddr const **addr, socklen_t *len) {
     *addr = &self->peer_address.addr;
     *len = self->peer_address.len;
@@ -0,0 +1,212 @@
+#include "timer-wheel.h"
+
+#include <assert.h>
+#include <stddef.h>
+
+// the number of ticks the levels of the wheel cover together
+static uint64_t const TIMER_WHEEL_SPAN = (uint64_t) 1 << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS);
+
+static size_t timer_wheel_slot_of(uint64_t tick, size_t level) {
+    return (tick >> (level * TIMER_WHEEL_BITS)) & (TIMER_WHEEL_SLOTS - 1);
+}
+
+// Returns the index of the lowest set bit. `bits` must not be 0.
+static size_t lowest_bit(uint64_t bits) {
+#if defined(__GNUC__) || defined(__clang__)
+    return (size_t) __builtin_ctzll(bits);
+#else
+    size_t result = 0;
+
+    for (; (bits & 1) == 0; bits >>= 1) {
+        ++result;
+    }
+
+    return result;
+#endif
+}
+
+static void timer_list_push(loop_timer_t **head, loop_timer_t *timer) {
+    timer->prev = NULL;
+    timer->next = *head;
+
+    if (*head != NULL) {
+        (*head)->prev = timer;
+    }
+
+    *head = timer;
+}
+
+// Empties a slot and returns its timers.
+static loop_timer_t *timer_wheel_take_slot(timer_wheel_t *self, size_t level, size_t slot) {
+    loop_timer_t *result = self->slots[level][slot];
+    self->slots[level][slot] = NULL;
+    self->occupied[level] &= ~((uint64_t) 1 << slot);
+
+    return result;
+}
+
+// Puts the timers taken out of a slot back according to the current tick.
+static void timer_wheel_redistribute(timer_wheel_t *self, loop_timer_t *timers) {
+    while (timers != NULL) {
+        loop_timer_t *timer = timers;
+        timers = timer->next;
+
+        timer->armed = false;
+        --self->count;
+        timer_wheel_insert(self, timer, timer->expiry);
+    }
+}
+
+void timer_wheel_init(timer_wheel_t *self, uint64_t now) {
+    *self = (timer_wheel_t) {
+        .now = now,
+        .count = 0,
+        .overflow = NULL,
+    };
+}
+
+void timer_wheel_insert(timer_wheel_t *self, loop_timer_t *timer, uint64_t expiry) {
+    assert(!timer->armed);
+
+    if (expiry < self->now) {
+        expiry = self->now;
+    }
+
+    timer->expiry = expiry;
+    timer->armed = true;
+    ++self->count;
+
+    // the lowest level whose higher-order slots match those of the current tick
+    uint64_t diff = expiry ^ self->now;
+    size_t level = 0;
+
+    while (level < TIMER_WHEEL_LEVELS && (diff >> ((level + 1) * TIMER_WHEEL_BITS)) != 0) {
+        ++level;
+    }
+
+    timer->level = (uint8_t) level;
+
+    if (level == TIMER_WHEEL_LEVELS) {
+        timer->slot = 0;
+        timer_list_push(&self->overflow, timer);
+
+        return;
+    }
+
+    size_t slot = timer_wheel_slot_of(expiry, level);
+    timer->slot = (uint8_t) slot;
+    timer_list_push(&self->slots[level][slot], timer);
+    self->occupied[level] |= (uint64_t) 1 << slot;
+}
+
+void timer_wheel_remove(timer_wheel_t *self, loop_timer_t *timer) {
+    assert(timer->armed);
+
+    bool overflow = timer->level == TIMER_WHEEL_LEVELS;
+    loop_timer_t **head = overflow ? &self->overflow : &self->slots[timer->level][timer->slot];
+
+    if (timer->prev != NULL) {
+        timer->prev->next = timer->next;
+    } else {
+        *head = timer->next;
+    }
+
+    if (timer->next != NULL) {
+        timer->next->prev = timer->prev;
+    }
+
+    if (!overflow && *head == NULL) {
+        self->occupied[timer->level] &= ~((uint64_t) 1 << timer->slot);
+    }
+
+    timer->prev = NULL;
+    timer->next = NULL;
+    timer->armed = false;
+    --self->count;
+}
+
+loop_timer_t *timer_wheel_advance(timer_wheel_t *self, uint64_t now) {
+    loop_timer_t *expired = NULL;
+
+    while (self->now <= now) {
+        if (self->count == 0) {
+            self->now = now + 1;
+
+            break;
+        }
+
+        uint64_t tick = self->now;
+
+        if ((tick & (TIMER_WHEEL_SPAN - 1)) == 0) {
+            loop_timer_t *overflow = self->overflow;
+            self->overflow = NULL;
+            timer_wheel_redistribute(self, overflow);
+        }
+
+        // entering a slot of a higher level moves its timers down, starting from the top
+        for (size_t level = TIMER_WHEEL_LEVELS - 1; level > 0; --level) {
+            uint64_t mask = ((uint64_t) 1 << (level * TIMER_WHEEL_BITS)) - 1;
+
+            if ((tick & mask) == 0) {
+                timer_wheel_redistribute(
+                    self, timer_wheel_take_slot(self, level, timer_wheel_slot_of(tick, level)));
+            }
+        }
+
+        // every timer in the lowest level's slot expires at this very tick
+        loop_timer_t *timers = timer_wheel_take_slot(self, 0, timer_wheel_slot_of(tick, 0));
+
+        while (timers != NULL) {
+            loop_timer_t *timer = timers;
+            timers = timer->next;
+
+            timer->armed = false;
+            timer->prev = NULL;
+            timer->next = expired;
+            expired = timer;
+            --self->count;
+        }
+
+        self->now = tick + 1;
+
+        // skip the empty slots up to the end of the lowest level's round
+        size_t slot = timer_wheel_slot_of(self->now, 0);
+
+        if (slot != 0) {
+            uint64_t pending = self->occupied[0] >> slot;
+            uint64_t next = pending == 0
+                ? (self->now | (TIMER_WHEEL_SLOTS - 1)) + 1
+                : self->now + lowest_bit(pending);
+
+            self->now = next <= now ? next : now + 1;
+        }
+    }
+
+    return expired;
+}
+
+uint64_t timer_wheel_next_expiry(timer_wheel_t const *self) {
+    uint64_t result = UINT64_MAX;
+
+    // a higher level can have an earlier timer if the wheel is yet to enter its slot
+    for (size_t level = 0; level < TIMER_WHEEL_LEVELS; ++level) {
+        size_t shift = level * TIMER_WHEEL_BITS;
+        uint64_t pending = self->occupied[level]
+            & (~(uint64_t) 0 << timer_wheel_slot_of(self->now, level));
+
+        if (pending != 0) {
+            uint64_t round = self->now >> (shift + TIMER_WHEEL_BITS) << (shift + TIMER_WHEEL_BITS);
+            uint64_t start = round | ((uint64_t) lowest_bit(pending) << shift);
+
+            if (start < result) {
+                result = start;
+            }
+        }
+    }
+
+    if (self->overflow != NULL && result == UINT64_MAX) {
+        result = (self->now | (TIMER_WHEEL_SPAN - 1)) + 1;
+    }
+
+    return result;
+}
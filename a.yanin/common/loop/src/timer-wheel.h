@@ -0,0 +1,56 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "common/loop/loop.h"
+
+enum {
+    TIMER_WHEEL_BITS = 6,
+    TIMER_WHEEL_SLOTS = 1 << TIMER_WHEEL_BITS,
+    TIMER_WHEEL_LEVELS = 4,
+};
+
+// A hierarchical timing wheel with a tick of one millisecond.
+//
+// Level `k` has 64 slots, each covering 64^k ticks.
+// A timer is put in the lowest level where its expiry shares the higher-order slots with the
+// current tick, and moves down a level whenever the wheel enters its slot.
+// The timers that are too far in the future for the top level wait in a separate list.
+//
+// Inserting and removing a timer is O(1) and never allocates: the entries are intrusive.
+typedef struct {
+    // the next tick to process: every timer that expires earlier has already been reported
+    uint64_t now;
+    // the number of timers in the wheel
+    size_t count;
+    // bit `i` of `occupied[k]` is set if `slots[k][i]` is not empty
+    uint64_t occupied[TIMER_WHEEL_LEVELS];
+    loop_timer_t *slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+    loop_timer_t *overflow;
+} timer_wheel_t;
+
+void timer_wheel_init(timer_wheel_t *self, uint64_t now);
+
+// Adds `timer` to the wheel.
+//
+// A timer that has already expired is reported on the next call to `timer_wheel_advance`.
+// The timer must not be in the wheel yet.
+void timer_wheel_insert(timer_wheel_t *self, loop_timer_t *timer, uint64_t expiry);
+
+// Takes `timer` out of the wheel.
+//
+// The timer must be in the wheel.
+void timer_wheel_remove(timer_wheel_t *self, loop_timer_t *timer);
+
+// Advances the wheel past the tick `now`.
+//
+// Returns the timers that have expired, linked through their `next` fields.
+// They're no longer in the wheel.
+loop_timer_t *timer_wheel_advance(timer_wheel_t *self, uint64_t now);
+
+// Returns a tick no later than the expiry of any timer in the wheel, or `UINT64_MAX` if it's
+// empty.
+//
+// The result is exact unless the earliest timer is yet to move down to the lowest level, in which
+// case the wheel has to be advanced to the returned tick to tell more.
+uint64_t timer_wheel_next_expiry(timer_wheel_t const *self);
@@ -101,7 +101,7 @@ ARC_STATIC void ARC_NAME(free)(ARC_TYPE *self) {
 ARC_STATIC ARC_TYPE *ARC_NAME(share)(ARC_TYPE *self) {
     if (self == NULL) return NULL;
 
-    size_t ref_count = atomic_fetch_add(&self->ref_count, 1);
+    [[maybe_unused]] size_t ref_count = atomic_fetch_add(&self->ref_count, 1);
     assert(ref_count >= 1);
 
     return self;
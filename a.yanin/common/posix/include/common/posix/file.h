@@ -10,3 +10,6 @@ posix_err_t wrapper_fcntli(int fd, int cmd, int arg);
 posix_err_t wrapper_fstat(int fd, struct stat *statbuf);
 posix_err_t wrapper_lstat(char const *restrict path, struct stat *statbuf);
 posix_err_t wrapper_unlink(char const *path);
+posix_err_t wrapper_rename(char const *old_path, char const *new_path);
+posix_err_t wrapper_mkdir(char const *path, mode_t mode);
+posix_err_t wrapper_ftruncate(int fd, off_t length);
@@ -2,15 +2,22 @@
 
 #include <stdio.h>
 
+#include <common/config.h>
+
 #include <fcntl.h>
 #include <poll.h>
 #include <sys/select.h>
 #include <sys/uio.h>
 #include <unistd.h>
 
+#ifdef COMMON_EPOLL_ENABLED
+#include <sys/epoll.h>
+#endif
+
 #include "common/posix/error.h"
 
 posix_err_t wrapper_open(char const *path, int flags, int *result);
+posix_err_t wrapper_open_mode(char const *path, int flags, mode_t mode, int *result);
 posix_err_t wrapper_openat(int fd, char const *path, int flags, int *result);
 posix_err_t wrapper_close(int fd);
 posix_err_t wrapper_read(int fd, void *buf, size_t count, ssize_t *result);
@@ -28,3 +35,25 @@ posix_err_t wrapper_select(
 );
 posix_err_t wrapper_poll(struct pollfd *fds, nfds_t nfds, int timeout, int *result);
 posix_err_t wrapper_writev(int fd, struct iovec const *iov, int iovcnt, ssize_t *result);
+posix_err_t wrapper_fsync(int fd);
+
+#ifdef COMMON_SPLICE_ENABLED
+// Moves up to `count` bytes from `fd_in` to `fd_out` without copying them to user space.
+//
+// One of the file descriptors must refer to a pipe.
+// The pipe operations never block; the other file descriptor only blocks in blocking mode.
+posix_err_t wrapper_splice(int fd_in, int fd_out, size_t count, ssize_t *result);
+#endif
+
+#ifdef COMMON_EPOLL_ENABLED
+// Creates a new epoll instance with the close-on-exec flag set.
+posix_err_t wrapper_epoll_create(int *result);
+posix_err_t wrapper_epoll_ctl(int epfd, int op, int fd, struct epoll_event *event);
+posix_err_t wrapper_epoll_wait(
+    int epfd,
+    struct epoll_event *events,
+    int maxevents,
+    int timeout,
+    int *result
+);
+#endif
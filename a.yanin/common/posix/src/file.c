@@ -1,6 +1,7 @@
 #include "common/posix/file.h"
 
 #include <assert.h>
+#include <stdio.h>
 
 posix_err_t wrapper_fcntli(int fd, int cmd, int arg) {
     assert(fd >= 0);
@@ -51,3 +52,40 @@ posix_err_t wrapper_unlink(char const *path) {
 
     return make_posix_err_ok();
 }
+
+posix_err_t wrapper_rename(char const *old_path, char const *new_path) {
+    assert(old_path != NULL);
+    assert(new_path != NULL);
+
+    errno = 0;
+
+    if (rename(old_path, new_path) < 0) {
+        return make_posix_err("rename(2) failed");
+    }
+
+    return make_posix_err_ok();
+}
+
+posix_err_t wrapper_mkdir(char const *path, mode_t mode) {
+    assert(path != NULL);
+
+    errno = 0;
+
+    if (mkdir(path, mode) < 0) {
+        return make_posix_err("mkdir(2) failed");
+    }
+
+    return make_posix_err_ok();
+}
+
+posix_err_t wrapper_ftruncate(int fd, off_t length) {
+    assert(fd >= 0);
+
+    errno = 0;
+
+    if (ftruncate(fd, length) < 0) {
+        return make_posix_err("ftruncate(2) failed");
+    }
+
+    return make_posix_err_ok();
+}
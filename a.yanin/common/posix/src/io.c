@@ -1,3 +1,6 @@
+// splice(2) is a Linux extension
+#define _GNU_SOURCE
+
 #include "common/posix/io.h"
 
 #include <assert.h>
@@ -22,6 +25,26 @@ posix_err_t wrapper_open(char const *path, int flags, int *result) {
     return make_posix_err_ok();
 }
 
+posix_err_t wrapper_open_mode(char const *path, int flags, mode_t mode, int *result) {
+    assert(path != NULL);
+    assert(result != NULL);
+
+    int fd = -1;
+
+    do {
+        errno = 0;
+        fd = open(path, flags, mode);
+    } while (fd < 0 && errno == EINTR);
+
+    if (fd < 0) {
+        return make_posix_err("open(2) failed");
+    }
+
+    *result = fd;
+
+    return make_posix_err_ok();
+}
+
 posix_err_t wrapper_openat(int fd, char const *path, int flags, int *result) {
     assert(fd >= 0 || fd == AT_FDCWD);
     assert(path != NULL);
@@ -213,3 +236,99 @@ posix_err_t wrapper_writev(int fd, struct iovec const *iov, int iovcnt, ssize_t
 
     return make_posix_err_ok();
 }
+
+posix_err_t wrapper_fsync(int fd) {
+    assert(fd >= 0);
+
+    errno = 0;
+
+    if (fsync(fd) < 0) {
+        return make_posix_err("fsync(2) failed");
+    }
+
+    return make_posix_err_ok();
+}
+
+#ifdef COMMON_SPLICE_ENABLED
+posix_err_t wrapper_splice(int fd_in, int fd_out, size_t count, ssize_t *result) {
+    assert(result != NULL);
+    assert(fd_in >= 0);
+    assert(fd_out >= 0);
+
+    ssize_t return_value = -1;
+
+    do {
+        errno = 0;
+        return_value = splice(
+            fd_in, NULL,
+            fd_out, NULL,
+            count,
+            SPLICE_F_MOVE | SPLICE_F_NONBLOCK
+        );
+    } while (return_value < 0 && errno == EINTR);
+
+    if (return_value < 0) {
+        return make_posix_err("splice(2) failed");
+    }
+
+    *result = return_value;
+
+    return make_posix_err_ok();
+}
+#endif
+
+#ifdef COMMON_EPOLL_ENABLED
+posix_err_t wrapper_epoll_create(int *result) {
+    assert(result != NULL);
+
+    errno = 0;
+    int fd = epoll_create1(EPOLL_CLOEXEC);
+
+    if (fd < 0) {
+        return make_posix_err("epoll_create1(2) failed");
+    }
+
+    *result = fd;
+
+    return make_posix_err_ok();
+}
+
+posix_err_t wrapper_epoll_ctl(int epfd, int op, int fd, struct epoll_event *event) {
+    assert(epfd >= 0);
+    assert(fd >= 0);
+
+    errno = 0;
+
+    if (epoll_ctl(epfd, op, fd, event) < 0) {
+        return make_posix_err("epoll_ctl(2) failed");
+    }
+
+    return make_posix_err_ok();
+}
+
+posix_err_t wrapper_epoll_wait(
+    int epfd,
+    struct epoll_event *events,
+    int maxevents,
+    int timeout,
+    int *result
+) {
+    assert(epfd >= 0);
+    assert(result != NULL);
+
+    int return_value;
+
+    do {
+        errno = 0;
+        return_value = epoll_wait(epfd, events, maxevents, timeout);
+    } while (return_value < 0 && errno == EINTR);
+
+    if (return_value < 0) {
+        return make_posix_err("epoll_wait(2) failed");
+    }
+
+    *result = return_value;
+
+    return make_posix_err_ok();
+}
+#endif
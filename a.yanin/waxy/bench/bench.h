@@ -0,0 +1,87 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#include <common/error.h>
+#include <common/loop/io.h>
+#include <common/loop/loop.h>
+
+#include "cache.h"
+#include "url.h"
+
+// How long the entries stored by the benchmarks stay fresh, in seconds.
+#define BENCH_FRESHNESS 3600
+
+[[maybe_unused]]
+static inline uint64_t now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t) now.tv_sec * 1000000000 + (uint64_t) now.tv_nsec;
+}
+
+// Builds the url of the `key`-th object.
+[[maybe_unused]]
+static inline void bench_url(size_t key, url_t *result) {
+    char buf[64];
+    int len = snprintf(buf, sizeof(buf), "http://bench.invalid/%zu", key);
+    bool fatal = false;
+
+    *result = (url_t) {0};
+    error_assert(error_wrap("Could not parse a benchmark url", url_parse((slice_t) {
+        .base = buf,
+        .len = (size_t) len,
+    }, result, &fatal)));
+}
+
+typedef struct {
+    cache_rd_t *rd;
+    // `NULL` on a hit
+    cache_wr_t *wr;
+} bench_fetch_t;
+
+[[maybe_unused]]
+static error_t *bench_on_hit(void *data, cache_rd_t *rd) {
+    *(bench_fetch_t *) data = (bench_fetch_t) {
+        .rd = rd,
+    };
+
+    return NULL;
+}
+
+[[maybe_unused]]
+static error_t *bench_on_miss(void *data, cache_rd_t *rd, cache_wr_t *wr) {
+    *(bench_fetch_t *) data = (bench_fetch_t) {
+        .rd = rd,
+        .wr = wr,
+    };
+
+    return NULL;
+}
+
+// Fetches the entry for `url`. Without a disk tier, the cache calls back before returning.
+[[maybe_unused]]
+static inline bench_fetch_t bench_fetch(cache_t *cache, url_t const *url) {
+    bench_fetch_t result = {0};
+    error_assert(error_wrap("Could not fetch a cache entry", cache_fetch(
+        cache, url, bench_on_hit, bench_on_miss, &result)));
+
+    return result;
+}
+
+// Completes a miss with `body` and commits it, the way a fresh cacheable response would be.
+//
+// Frees both handles.
+[[maybe_unused]]
+static inline void bench_fill(bench_fetch_t fetch, slice_t body) {
+    error_assert(error_wrap("Could not write a cache entry", cache_wr_write(fetch.wr, body)));
+    error_assert(error_wrap("Could not set the freshness", cache_wr_set_freshness(
+        fetch.wr, time(NULL) + BENCH_FRESHNESS, (slice_t) {0}, (slice_t) {0})));
+    cache_wr_complete(fetch.wr);
+    error_assert(error_wrap("Could not commit a cache entry", cache_wr_commit(
+        fetch.wr, body.len)));
+    cache_wr_free(fetch.wr);
+    handler_free((handler_t *) fetch.rd);
+}
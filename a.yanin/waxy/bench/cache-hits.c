@@ -0,0 +1,160 @@
+// Measures how the cache hit throughput scales with the number of threads fetching from it.
+//
+// Usage: cache-hits [<shards>] [<operations>]
+//
+// The cache is filled with small objects, which the threads then fetch and read at random, from
+// 1, 2, 4, ..., 32 threads; these stand in for the executor's workers (`WAXY_THREAD_POOL_SIZE`).
+// The LRU policy is used, since its hits lock their shard exclusively, as every hit used to lock
+// the whole cache: a single shard shows how that scaled.
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <common/log/log.h>
+
+#include "bench.h"
+#include "cache.h"
+#include "url.h"
+
+enum {
+    DEFAULT_SHARD_COUNT = 16,
+    DEFAULT_OPERATION_COUNT = 1 << 20,
+    MAX_THREAD_COUNT = 32,
+    OBJECT_COUNT = 4096,
+    OBJECT_SIZE = 4096,
+};
+
+typedef struct {
+    cache_t *cache;
+    url_t const *urls;
+    size_t operation_count;
+    uint64_t seed;
+    size_t misses;
+} worker_t;
+
+static void *worker_run(void *data) {
+    worker_t *worker = data;
+    uint64_t state = worker->seed;
+    char buf[OBJECT_SIZE];
+
+    for (size_t i = 0; i < worker->operation_count; ++i) {
+        // xorshift64
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+
+        bench_fetch_t fetch = bench_fetch(worker->cache, &worker->urls[state % OBJECT_COUNT]);
+
+        if (fetch.wr != NULL) {
+            ++worker->misses;
+            cache_wr_free(fetch.wr);
+            handler_free((handler_t *) fetch.rd);
+
+            continue;
+        }
+
+        bool eof = false;
+
+        while (!eof && cache_rd_read(fetch.rd, buf, sizeof(buf), &eof) > 0) {}
+
+        handler_free((handler_t *) fetch.rd);
+    }
+
+    return NULL;
+}
+
+static void bench_run(cache_t *cache, url_t const *urls, size_t thread_count, size_t op_count) {
+    worker_t workers[MAX_THREAD_COUNT];
+    pthread_t threads[MAX_THREAD_COUNT];
+    uint64_t start = now_ns();
+
+    for (size_t i = 0; i < thread_count; ++i) {
+        workers[i] = (worker_t) {
+            .cache = cache,
+            .urls = urls,
+            .operation_count = op_count / thread_count,
+            .seed = 0x9e3779b97f4a7c15 * (i + 1),
+        };
+
+        if (pthread_create(&threads[i], NULL, worker_run, &workers[i]) != 0) {
+            abort();
+        }
+    }
+
+    size_t misses = 0;
+
+    for (size_t i = 0; i < thread_count; ++i) {
+        pthread_join(threads[i], NULL);
+        misses += workers[i].misses;
+    }
+
+    double elapsed = (double) (now_ns() - start) / 1e9;
+    size_t total = op_count / thread_count * thread_count;
+
+    printf("%7zu %12.0f %8zu\n", thread_count, (double) total / elapsed, misses);
+}
+
+int main(int argc, char **argv) {
+    error_t *err = NULL;
+
+    if (argc > 3) {
+        fputs("Usage: cache-hits [<shards>] [<operations>]\n", stderr);
+
+        return 1;
+    }
+
+    size_t shard_count = argc > 1 ? strtoull(argv[1], NULL, 10) : DEFAULT_SHARD_COUNT;
+    size_t op_count = argc > 2 ? strtoull(argv[2], NULL, 10) : DEFAULT_OPERATION_COUNT;
+
+    log_set_level(LOG_WARN);
+
+    cache_config_t config = {
+        // ample room for every object in any shard, so that nothing is evicted
+        .size_limit = (size_t) OBJECT_COUNT * 64 * 1024,
+        .shard_count = shard_count,
+        .policy = CACHE_POLICY_LRU,
+        .admission = CACHE_ADMISSION_ALWAYS,
+    };
+    cache_t *cache = NULL;
+    err = cache_new(&config, &cache);
+    if (err) goto new_fail;
+
+    static url_t urls[OBJECT_COUNT];
+    static char body[OBJECT_SIZE];
+    memset(body, 'x', sizeof(body));
+
+    for (size_t i = 0; i < OBJECT_COUNT; ++i) {
+        bench_url(i, &urls[i]);
+        bench_fill(bench_fetch(cache, &urls[i]), (slice_t) {
+            .base = body,
+            .len = sizeof(body),
+        });
+    }
+
+    printf("%zu shards, %d objects of %d bytes, %zu fetches per run\n",
+        config.shard_count, OBJECT_COUNT, OBJECT_SIZE, op_count);
+    printf("%7s %12s %8s\n", "threads", "hits/s", "misses");
+
+    for (size_t thread_count = 1; thread_count <= MAX_THREAD_COUNT; thread_count *= 2) {
+        bench_run(cache, urls, thread_count, op_count);
+    }
+
+    cache_free(cache);
+
+    for (size_t i = 0; i < OBJECT_COUNT; ++i) {
+        string_free(&urls[i].buf);
+    }
+
+new_fail:
+    if (err) {
+        error_log_free(&err, LOG_ERR, ERROR_VERBOSITY_SOURCE_CHAIN);
+
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,307 @@
+// Measures how fast many readers can serve a single cached object.
+//
+// Usage: cache-readers <copy|spans> [<object size, KiB>] [<reads>]
+//
+// Each thread repeatedly fetches the object and writes all of it to a pipe, either by copying it out
+// of the cache in 16 KiB steps into freshly allocated buffers, as the clients used to, or by passing
+// the views of the cache chunks to writev(2) directly, as they do now. A separate thread drains the
+// pipe, so the kernel copies every byte served once, as it would into a socket buffer, and the
+// difference between the two is the cost of the copies in user space. The benchmark reports the
+// served bytes per second and how many bytes were copied in user space per byte served.
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <common/log/log.h>
+#include <common/posix/adapter.h>
+#include <common/posix/ipc.h>
+
+#include "bench.h"
+#include "cache.h"
+#include "url.h"
+
+enum {
+    DEFAULT_OBJECT_SIZE_KIB = 4096,
+    DEFAULT_READ_COUNT = 4096,
+    MAX_THREAD_COUNT = 32,
+    // the size of the buffers the copying readers allocate, as the clients used to
+    COPY_STEP = 16 * 1024,
+    // the most spans written at once, as in the clients
+    MAX_SPAN_COUNT = 64,
+    // the most bytes written at once, as in the clients
+    MAX_WRITE_SIZE = 4 * 1024 * 1024,
+    // the size of the buffer the pipe is drained into
+    DRAIN_SIZE = 64 * 1024,
+};
+
+typedef struct {
+    cache_t *cache;
+    url_t const *url;
+    bool copy;
+    int fd;
+    size_t read_count;
+    size_t served;
+    size_t copied;
+} worker_t;
+
+typedef struct {
+    int fd;
+    size_t drained;
+} drain_t;
+
+static void *drain_run(void *data) {
+    drain_t *drain = data;
+    static char buf[DRAIN_SIZE];
+
+    while (true) {
+        ssize_t size = read(drain->fd, buf, sizeof(buf));
+
+        if (size < 0) {
+            abort();
+        }
+
+        if (size == 0) {
+            break;
+        }
+
+        drain->drained += (size_t) size;
+    }
+
+    return NULL;
+}
+
+static void serve_copy(worker_t *worker, cache_rd_t *rd) {
+    bool eof = false;
+
+    while (!eof) {
+        char *buf = malloc(COPY_STEP);
+
+        if (buf == NULL) {
+            abort();
+        }
+
+        size_t size = cache_rd_read(rd, buf, COPY_STEP, &eof);
+        worker->copied += size;
+
+        if (size > 0 && write(worker->fd, buf, size) != (ssize_t) size) {
+            abort();
+        }
+
+        worker->served += size;
+        free(buf);
+
+        if (size == 0) {
+            break;
+        }
+    }
+}
+
+static void serve_spans(worker_t *worker, cache_rd_t *rd) {
+    bool eof = false;
+    cache_span_t spans[MAX_SPAN_COUNT];
+    struct iovec iov[MAX_SPAN_COUNT];
+
+    while (!eof) {
+        size_t count = cache_rd_read_spans(rd, MAX_SPAN_COUNT, spans, MAX_WRITE_SIZE, &eof);
+        size_t size = 0;
+
+        for (size_t i = 0; i < count; ++i) {
+            iov[i] = (struct iovec) {
+                .iov_base = (void *) spans[i].slice.base,
+                .iov_len = spans[i].slice.len,
+            };
+            size += spans[i].slice.len;
+        }
+
+        if (count > 0 && writev(worker->fd, iov, (int) count) != (ssize_t) size) {
+            abort();
+        }
+
+        worker->served += size;
+
+        for (size_t i = 0; i < count; ++i) {
+            cache_span_release(&spans[i]);
+        }
+
+        if (count == 0) {
+            break;
+        }
+    }
+}
+
+static void *worker_run(void *data) {
+    worker_t *worker = data;
+
+    for (size_t i = 0; i < worker->read_count; ++i) {
+        bench_fetch_t fetch = bench_fetch(worker->cache, worker->url);
+
+        if (fetch.wr != NULL) {
+            abort();
+        }
+
+        if (worker->copy) {
+            serve_copy(worker, fetch.rd);
+        } else {
+            serve_spans(worker, fetch.rd);
+        }
+
+        handler_free((handler_t *) fetch.rd);
+    }
+
+    return NULL;
+}
+
+static error_t *bench_run(
+    cache_t *cache,
+    url_t const *url,
+    bool copy,
+    size_t thread_count,
+    size_t read_count
+) {
+    error_t *err = NULL;
+
+    int rd_fd = -1;
+    int wr_fd = -1;
+    err = error_wrap("Could not create a pipe", error_from_posix(wrapper_pipe(&rd_fd, &wr_fd)));
+    if (err) goto pipe_fail;
+
+    worker_t workers[MAX_THREAD_COUNT];
+    pthread_t threads[MAX_THREAD_COUNT];
+    drain_t drain = { .fd = rd_fd };
+    pthread_t drain_thread;
+    uint64_t start = now_ns();
+
+    if (pthread_create(&drain_thread, NULL, drain_run, &drain) != 0) {
+        abort();
+    }
+
+    for (size_t i = 0; i < thread_count; ++i) {
+        workers[i] = (worker_t) {
+            .cache = cache,
+            .url = url,
+            .copy = copy,
+            .fd = wr_fd,
+            .read_count = read_count / thread_count,
+        };
+
+        if (pthread_create(&threads[i], NULL, worker_run, &workers[i]) != 0) {
+            abort();
+        }
+    }
+
+    size_t served = 0;
+    size_t copied = 0;
+
+    for (size_t i = 0; i < thread_count; ++i) {
+        pthread_join(threads[i], NULL);
+        served += workers[i].served;
+        copied += workers[i].copied;
+    }
+
+    // the end of the pipe lets the drain finish, and the run only ends when every byte is read
+    close(wr_fd);
+    pthread_join(drain_thread, NULL);
+
+    if (drain.drained != served) {
+        abort();
+    }
+
+    double elapsed = (double) (now_ns() - start) / 1e9;
+
+    printf("%7zu %10.2f %16.2f\n",
+        thread_count,
+        (double) served / elapsed / 1e9,
+        served > 0 ? (double) copied / (double) served : 0.0);
+
+    close(rd_fd);
+
+pipe_fail:
+    return err;
+}
+
+static void print_usage(void) {
+    fputs("Usage: cache-readers <copy|spans> [<object size, KiB>] [<reads>]\n", stderr);
+}
+
+int main(int argc, char **argv) {
+    error_t *err = NULL;
+
+    if (argc < 2 || argc > 4) {
+        print_usage();
+
+        return 1;
+    }
+
+    bool copy = false;
+
+    if (strcmp(argv[1], "copy") == 0) {
+        copy = true;
+    } else if (strcmp(argv[1], "spans") != 0) {
+        print_usage();
+
+        return 1;
+    }
+
+    size_t object_size = (argc > 2 ? strtoull(argv[2], NULL, 10) : DEFAULT_OBJECT_SIZE_KIB) * 1024;
+    size_t read_count = argc > 3 ? strtoull(argv[3], NULL, 10) : DEFAULT_READ_COUNT;
+
+    if (object_size == 0) {
+        fputs("The object size must be positive\n", stderr);
+
+        return 1;
+    }
+
+    log_set_level(LOG_WARN);
+
+    cache_config_t config = {
+        .size_limit = 2 * object_size,
+        .shard_count = 1,
+        .policy = CACHE_POLICY_LRU,
+        .admission = CACHE_ADMISSION_ALWAYS,
+    };
+    cache_t *cache = NULL;
+    err = cache_new(&config, &cache);
+    if (err) goto new_fail;
+
+    char *body = malloc(object_size);
+
+    if (body == NULL) {
+        abort();
+    }
+
+    memset(body, 'x', object_size);
+
+    url_t url;
+    bench_url(0, &url);
+    bench_fill(bench_fetch(cache, &url), (slice_t) {
+        .base = body,
+        .len = object_size,
+    });
+    free(body);
+
+    printf("%s, an object of %zu KiB, %zu reads per run\n",
+        copy ? "copying" : "spans", object_size / 1024, read_count);
+    printf("%7s %10s %16s\n", "threads", "GB/s", "copied / served");
+
+    for (size_t thread_count = 1; thread_count <= MAX_THREAD_COUNT; thread_count *= 2) {
+        err = bench_run(cache, &url, copy, thread_count, read_count);
+        if (err) break;
+    }
+
+    string_free(&url.buf);
+    cache_free(cache);
+
+new_fail:
+    if (err) {
+        error_log_free(&err, LOG_ERR, ERROR_VERBOSITY_SOURCE_CHAIN);
+
+        return 1;
+    }
+
+    return 0;
+}
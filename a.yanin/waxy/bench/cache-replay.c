@@ -0,0 +1,246 @@
+// Replays a synthetic request trace against the cache and reports the hit ratio and the throughput
+// of an eviction policy.
+//
+// Usage: cache-replay <lru|clock|s3-fifo> [<always|tinylfu>] [<requests>]
+//
+// The trace draws most of the requests from a Zipf distribution over a fixed set of objects, while
+// every fifth one asks for an object that is never requested again, as a scan or a crawler would.
+// The cache only has room for a tenth of the popular objects. The same trace is replayed from 1, 2,
+// 4, and 8 threads, each time on an empty cache; a miss stores the object, like the proxy would.
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <common/log/log.h>
+
+#include "bench.h"
+#include "cache.h"
+#include "url.h"
+
+enum {
+    DEFAULT_REQUEST_COUNT = 1 << 20,
+    MAX_THREAD_COUNT = 8,
+    // the number of objects the Zipf-distributed requests ask for
+    POPULAR_COUNT = 1 << 16,
+    // one in this many requests is for an object requested only once
+    ONE_HIT_PERIOD = 5,
+    OBJECT_SIZE = 4096,
+    SHARD_COUNT = 16,
+};
+
+typedef struct {
+    cache_t *cache;
+    size_t const *trace;
+    size_t request_count;
+    size_t thread_idx;
+    size_t thread_count;
+    size_t hits;
+} worker_t;
+
+static char body[OBJECT_SIZE];
+
+static uint64_t xorshift64(uint64_t *state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+
+    return *state;
+}
+
+// Generates the trace: the keys below `POPULAR_COUNT` are the popular objects, the rest are unique.
+static size_t *trace_new(size_t request_count) {
+    double *cdf = malloc(POPULAR_COUNT * sizeof(double));
+    size_t *trace = malloc(request_count * sizeof(size_t));
+
+    if (cdf == NULL || trace == NULL) {
+        abort();
+    }
+
+    double sum = 0;
+
+    for (size_t i = 0; i < POPULAR_COUNT; ++i) {
+        // the classic Zipf distribution, close to the skew seen in web traces
+        sum += 1 / (double) (i + 1);
+        cdf[i] = sum;
+    }
+
+    uint64_t state = 0x2545f4914f6cdd1d;
+    size_t next_unique = POPULAR_COUNT;
+
+    for (size_t i = 0; i < request_count; ++i) {
+        if (i % ONE_HIT_PERIOD == ONE_HIT_PERIOD - 1) {
+            trace[i] = next_unique++;
+
+            continue;
+        }
+
+        double target = (double) (xorshift64(&state) >> 11) / (double) (UINT64_C(1) << 53) * sum;
+        size_t lo = 0;
+        size_t hi = POPULAR_COUNT - 1;
+
+        while (lo < hi) {
+            size_t mid = lo + (hi - lo) / 2;
+
+            if (cdf[mid] < target) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+
+        trace[i] = lo;
+    }
+
+    free(cdf);
+
+    return trace;
+}
+
+static void *worker_run(void *data) {
+    worker_t *worker = data;
+    char buf[OBJECT_SIZE];
+
+    for (size_t i = worker->thread_idx; i < worker->request_count; i += worker->thread_count) {
+        url_t url;
+        bench_url(worker->trace[i], &url);
+        bench_fetch_t fetch = bench_fetch(worker->cache, &url);
+
+        if (fetch.wr != NULL) {
+            bench_fill(fetch, (slice_t) {
+                .base = body,
+                .len = sizeof(body),
+            });
+        } else {
+            ++worker->hits;
+            bool eof = false;
+
+            while (!eof && cache_rd_read(fetch.rd, buf, sizeof(buf), &eof) > 0) {}
+
+            handler_free((handler_t *) fetch.rd);
+        }
+
+        string_free(&url.buf);
+    }
+
+    return NULL;
+}
+
+static error_t *bench_run(
+    cache_config_t const *config,
+    size_t const *trace,
+    size_t request_count,
+    size_t thread_count
+) {
+    error_t *err = NULL;
+
+    cache_t *cache = NULL;
+    err = cache_new(config, &cache);
+    if (err) goto new_fail;
+
+    worker_t workers[MAX_THREAD_COUNT];
+    pthread_t threads[MAX_THREAD_COUNT];
+    uint64_t start = now_ns();
+
+    for (size_t i = 0; i < thread_count; ++i) {
+        workers[i] = (worker_t) {
+            .cache = cache,
+            .trace = trace,
+            .request_count = request_count,
+            .thread_idx = i,
+            .thread_count = thread_count,
+        };
+
+        if (pthread_create(&threads[i], NULL, worker_run, &workers[i]) != 0) {
+            abort();
+        }
+    }
+
+    size_t hits = 0;
+
+    for (size_t i = 0; i < thread_count; ++i) {
+        pthread_join(threads[i], NULL);
+        hits += workers[i].hits;
+    }
+
+    double elapsed = (double) (now_ns() - start) / 1e9;
+
+    printf("%7zu %10.2f %12.0f\n",
+        thread_count,
+        100.0 * (double) hits / (double) request_count,
+        (double) request_count / elapsed);
+
+    cache_free(cache);
+
+new_fail:
+    return err;
+}
+
+static void print_usage(void) {
+    fputs("Usage: cache-replay <lru|clock|s3-fifo> [<always|tinylfu>] [<requests>]\n", stderr);
+}
+
+int main(int argc, char **argv) {
+    error_t *err = NULL;
+
+    if (argc < 2 || argc > 4) {
+        print_usage();
+
+        return 1;
+    }
+
+    cache_config_t config = {
+        .size_limit = (size_t) POPULAR_COUNT / 10 * OBJECT_SIZE,
+        .shard_count = SHARD_COUNT,
+        .admission = CACHE_ADMISSION_ALWAYS,
+    };
+
+    if (strcmp(argv[1], "lru") == 0) {
+        config.policy = CACHE_POLICY_LRU;
+    } else if (strcmp(argv[1], "clock") == 0) {
+        config.policy = CACHE_POLICY_CLOCK;
+    } else if (strcmp(argv[1], "s3-fifo") == 0) {
+        config.policy = CACHE_POLICY_S3_FIFO;
+    } else {
+        print_usage();
+
+        return 1;
+    }
+
+    char const *admission = argc > 2 ? argv[2] : "always";
+
+    if (strcmp(admission, "tinylfu") == 0) {
+        config.admission = CACHE_ADMISSION_TINYLFU;
+    } else if (strcmp(admission, "always") != 0) {
+        print_usage();
+
+        return 1;
+    }
+
+    size_t request_count = argc > 3 ? strtoull(argv[3], NULL, 10) : DEFAULT_REQUEST_COUNT;
+
+    log_set_level(LOG_WARN);
+    memset(body, 'x', sizeof(body));
+    size_t *trace = trace_new(request_count);
+
+    printf("%s eviction, %s admission, %zu requests, room for %d of %d popular objects\n",
+        argv[1], admission, request_count, POPULAR_COUNT / 10, POPULAR_COUNT);
+    printf("%7s %10s %12s\n", "threads", "hits, %", "requests/s");
+
+    for (size_t thread_count = 1; thread_count <= MAX_THREAD_COUNT; thread_count *= 2) {
+        err = bench_run(&config, trace, request_count, thread_count);
+        if (err) break;
+    }
+
+    free(trace);
+
+    if (err) {
+        error_log_free(&err, LOG_ERR, ERROR_VERBOSITY_SOURCE_CHAIN);
+
+        return 1;
+    }
+
+    return 0;
+}
@@ -9,11 +9,43 @@
 #include <common/error-codes/adapter.h>
 #include <common/loop/loop.h>
 
+#include "disk.h"
+#include "http.h"
+#include "sketch.h"
 #include "util.h"
 
+enum {
+    // The capacity of a body chunk allocated by `cache_wr_write`.
+    CACHE_CHUNK_SIZE = 64 * 1024,
+
+    // The shortest slice `cache_wr_adopt` keeps as a chunk of its own rather than copies.
+    CACHE_ADOPT_MIN_SIZE = 8 * 1024,
+
+    // The size after which a disk cache segment is sealed.
+    CACHE_DISK_SEGMENT_SIZE = 64 * 1024 * 1024,
+};
+
 typedef url_t const *url_ptr_t;
 
+// A piece of an entry body.
+//
+// Bytes are only ever appended to a chunk, and the bytes that have been published to the readers
+// (see `cache_chunk_slot_t`) are never modified afterwards.
+// This allows the readers to copy out the data without holding the entry lock as long as they keep
+// a reference to the chunk.
+//
+// The data is either stored inline or borrowed from elsewhere (e.g., a disk cache mapping), in
+// which case `release` is called when the chunk is freed.
+typedef struct {
+    char *data;
+    size_t capacity;
+    cache_release_cb_t release;
+    void *release_data;
+    char storage[];
+} cache_chunk_t;
+
 static void cache_entry_free(cache_entry_t *self);
+static void cache_chunk_free(cache_chunk_t *self);
 
 #define ARC_ELEMENT_TYPE cache_entry_t
 #define ARC_LABEL entry
@@ -23,6 +55,24 @@ static void cache_entry_free(cache_entry_t *self);
 
 typedef arc_entry_t *arc_entry_ptr_t;
 
+#define ARC_ELEMENT_TYPE cache_chunk_t
+#define ARC_LABEL chunk
+#define ARC_FREE_CB cache_chunk_free
+#define ARC_CONFIG (COLLECTION_DECLARE | COLLECTION_DEFINE | COLLECTION_STATIC)
+#include <common/memory/arc.h>
+
+typedef struct {
+    arc_chunk_t *chunk;
+
+    // the number of bytes in the chunk visible to the readers
+    size_t len;
+} cache_chunk_slot_t;
+
+#define VEC_ELEMENT_TYPE cache_chunk_slot_t
+#define VEC_LABEL chunk
+#define VEC_CONFIG (COLLECTION_DECLARE | COLLECTION_DEFINE | COLLECTION_STATIC)
+#include <common/collections/vec.h>
+
 #define DLIST_ELEMENT_TYPE arc_entry_ptr_t
 #define DLIST_LABEL entry
 #define DLIST_CONFIG (COLLECTION_DECLARE | COLLECTION_DEFINE | COLLECTION_STATIC)
@@ -37,6 +87,27 @@ typedef dlist_entry_node_t *dlist_entry_node_ptr_t;
 #include <common/collections/hash.h>
 #include <common/collections/hash/byte_hasher.h>
 
+// S3-FIFO's ghost queue remembers the hashes of recently evicted urls.
+#define DLIST_ELEMENT_TYPE size_t
+#define DLIST_LABEL ghost
+#define DLIST_CONFIG (COLLECTION_DECLARE | COLLECTION_DEFINE | COLLECTION_STATIC)
+#include <common/collections/dlist.h>
+
+typedef dlist_ghost_node_t *dlist_ghost_node_ptr_t;
+
+#define HASH_KEY_TYPE size_t
+#define HASH_VALUE_TYPE dlist_ghost_node_ptr_t
+#define HASH_LABEL ghost
+#define HASH_CONFIG (COLLECTION_DECLARE | COLLECTION_DEFINE | COLLECTION_STATIC)
+#include <common/collections/hash.h>
+
+#ifndef WAXY_PTHREADS_DISABLED
+#define VEC_ELEMENT_TYPE arc_entry_ptr_t
+#define VEC_LABEL loading
+#define VEC_CONFIG (COLLECTION_DECLARE | COLLECTION_DEFINE | COLLECTION_STATIC)
+#include <common/collections/vec.h>
+#endif
+
 typedef cache_rd_t *cache_rd_ptr_t;
 
 #define VEC_ELEMENT_TYPE cache_rd_ptr_t
@@ -84,6 +155,39 @@ static byte_hasher_config_t const url_hasher_config_secondary = {
     .hash = (void (*)(void const *, byte_hasher_state_t *)) url_hash,
 };
 
+// Selects a shard for an url.
+//
+// A separate seed keeps the shard choice independent from the bucket choice within the shard.
+static byte_hasher_config_t const url_hasher_config_shard = {
+    .seed = 71,
+    .hash = (void (*)(void const *, byte_hasher_state_t *)) url_hash,
+};
+
+// The ghost queue stores url hashes computed with this config.
+static byte_hasher_config_t const url_hasher_config_ghost = {
+    .seed = 19,
+    .hash = (void (*)(void const *, byte_hasher_state_t *)) url_hash,
+};
+
+// The admission filter's frequency sketch is indexed by url hashes computed with this config.
+static byte_hasher_config_t const url_hasher_config_sketch = {
+    .seed = 53,
+    .hash = (void (*)(void const *, byte_hasher_state_t *)) url_hash,
+};
+
+static size_t ghost_hash_primary(size_t const *hash, void *) {
+    return *hash;
+}
+
+static size_t ghost_hash_secondary(size_t const *hash, void *) {
+    // an odd step visits every slot of a power-of-two table
+    return (*hash >> 17) | 1;
+}
+
+static bool ghost_eq(size_t const *lhs, size_t const *rhs) {
+    return *lhs == *rhs;
+}
+
 static size_t url_ptr_hash_primary(url_t const *const *ptr, void *data) {
     return byte_hasher(*ptr, data);
 }
@@ -106,36 +210,111 @@ static bool url_ptr_eq(url_t const *const *lhs, url_t const *const *rhs) {
     return url_eq(*lhs, *rhs);
 }
 
+typedef enum {
+    // LRU and CLOCK only use the first queue, which is S3-FIFO's small queue.
+    CACHE_QUEUE_SMALL,
+    CACHE_QUEUE_MAIN,
+    CACHE_QUEUE_COUNT,
+} cache_queue_t;
+
+enum {
+    // S3-FIFO keeps about 10% of the entries in the small queue.
+    CACHE_SMALL_QUEUE_RATIO = 10,
+    // S3-FIFO's access counters saturate at this value.
+    CACHE_FREQ_MAX = 3,
+    // S3-FIFO's ghost queue remembers at least this many evicted urls.
+    CACHE_GHOST_MIN_LEN = 64,
+    // The number of counters per row of a shard's frequency sketch.
+    CACHE_SKETCH_WIDTH = 4096,
+};
+
+typedef struct cache_policy_vtable cache_policy_vtable_t;
+
 // an `url_t *` is mapped to a `dlist_entry_node_t` via `map`
-// the `dlist_entry_node` stores an `arc_entry_t`
+// the `dlist_entry_node` stores an `arc_entry_t` and is part of one of the `queues`
 // the `arc_entry_t` owns the `url_t`
 //
 // invariant: an url is present in the map iff there is exactly one `dlist_entry_node_t` that points
 // to a `cache_entry_t` with that url.
-struct cache {
+//
+// Each shard is an independent cache with its own share of the size budget.
+// The eviction policy decides how the entries are arranged in the queues.
+//
+// `lock` is held exclusively to modify the map or the queues.
+// If the policy allows it, a hit only holds it in the shared mode.
+typedef struct {
 #ifndef WAXY_PTHREADS_DISABLED
-    pthread_mutex_t mtx;
+    pthread_rwlock_t lock;
+    // the uncommitted entries the urls missing from memory are being loaded into from the disk tier;
+    // the other fetches of these urls read them instead of loading the records again
+    vec_loading_t loading;
 #endif
+    cache_policy_vtable_t const *policy;
     hash_entry_t map;
-    dlist_entry_t entries;
+    dlist_entry_t queues[CACHE_QUEUE_COUNT];
+    // CLOCK's hand; NULL means the head of the queue
+    dlist_entry_node_t *hand;
+    // S3-FIFO's ghost queue: a FIFO of url hashes and an index into it
+    dlist_ghost_t ghosts;
+    hash_ghost_t ghost_map;
+    // the TinyLFU admission filter; NULL if every entry is admitted
+    frequency_sketch_t *sketch;
+    // the second tier shared by all the shards; NULL if there is none
+    disk_t *disk;
     size_t size_limit;
     atomic_size_t current_size;
+} cache_shard_t;
+
+// The urls are distributed among the shards by their hash, so requests for different resources
+// rarely contend for the same lock.
+//
+// The entries evicted from memory are spilled to the disk tier, if there is one, and are loaded
+// back on a miss.
+struct cache {
+    disk_t *disk;
+    size_t shard_count;
+    cache_shard_t shards[];
 };
 
+// The body is stored as a sequence of chunks.
+// Only the write handle appends to `chunks` (and fills the unpublished part of the tail chunk), so
+// it can inspect them without locking; publishing the data requires holding `mtx`.
 struct cache_entry {
 #ifndef WAXY_PTHREADS_DISABLED
     pthread_mutex_t mtx;
 #endif
     url_t url;
     vec_rd_t handles;
-    string_t buf;
-    cache_t *cache;
+    vec_chunk_t chunks;
+    size_t size;
+    cache_shard_t *shard;
     cache_entry_state_t state;
     bool committed;
+    // whether the entry was admitted without knowing its final size
+    bool provisional;
+    // the size of a provisional entry when its admission was last checked
+    size_t checked_size;
+    // whether the body has been stored in the disk tier; the record may have been reclaimed since
+    bool on_disk;
+
+    // the time until which the entry can be served without revalidation
+    time_t fresh_until;
+    // `etag_len` bytes of the ETag followed by `last_modified_len` bytes of the Last-Modified value
+    // of the response; NULL if it had neither
+    char *validators;
+    size_t etag_len;
+    size_t last_modified_len;
+
+    // the queue of the shard containing the entry (guarded by the shard lock)
+    cache_queue_t queue;
+    // the reference bit for CLOCK and the access counter for S3-FIFO
+    atomic_uint freq;
 };
 
 struct cache_wr {
     arc_entry_t *entry;
+    // the entry being revalidated, if any
+    arc_entry_t *stale;
 };
 
 struct cache_rd {
@@ -144,280 +323,1216 @@ struct cache_rd {
     cache_on_read_cb_t on_read;
     cache_on_update_cb_t on_update;
     size_t count;
+    // the read cursor: the index of the current chunk and the offset within it
+    //
+    // The offset may point past the end of the chunk after a seek, in which case the cursor is
+    // moved forward as the chunks are filled.
+    size_t chunk_idx;
+    size_t chunk_offset;
     cache_entry_state_t last_state;
     bool registered;
+    // set from any context: the entry updates are left unprocessed until it's cleared
+    atomic_bool paused;
 };
 
-error_t *cache_new(size_t size_limit, cache_t **result) {
-    error_t *err = NULL;
-
-    cache_t *self = calloc(1, sizeof(cache_t));
-    err = error_wrap("Could not allocate memory for the cache", OK_IF(self != NULL));
-    if (err) goto calloc_fail;
+// An eviction policy.
+//
+// All the methods except `on_hit` are called with the shard lock held exclusively.
+// `on_hit` is called with the lock held in the shared mode unless `exclusive_hit` is set.
+struct cache_policy_vtable {
+    bool exclusive_hit;
 
-#ifndef WAXY_PTHREADS_DISABLED
-    pthread_mutexattr_t mtx_attr;
-    err = error_wrap("Could not initialize mutex attributes", error_from_errno(
-        pthread_mutexattr_init(&mtx_attr)));
-    if (err) goto mtx_attr_init_fail;
+    // Records an access to the entry.
+    void (*on_hit)(cache_shard_t *shard, dlist_entry_node_t *node);
 
-    err = error_wrap("Could not initialize a mutex", error_from_errno(
-        pthread_mutex_init(&self->mtx, &mtx_attr)));
-    pthread_mutexattr_destroy(&mtx_attr);
-    if (err) goto mtx_init_fail;
-#endif
+    // Adds a newly committed entry to one of the queues.
+    error_t *(*insert)(cache_shard_t *shard, arc_entry_t *arc, dlist_entry_node_t **result);
 
-    err = error_from_common(hash_entry_new(
-        url_ptr_primary_hasher, url_ptr_secondary_hasher,
-        url_ptr_eq, &self->map
-    ));
-    if (err) goto hash_new_fail;
+    // Prepares for the removal of the node from its queue.
+    void (*on_remove)(cache_shard_t *shard, dlist_entry_node_t *node);
 
-    self->entries = dlist_entry_new();
-    self->size_limit = size_limit;
-    self->current_size = 0;
+    // Chooses an entry to evict, possibly rearranging the queues.
+    //
+    // Returns NULL if the shard is empty.
+    dlist_entry_node_t *(*pick_victim)(cache_shard_t *shard);
 
-    *result = self;
+    // Returns the entry to be considered for eviction next without modifying anything.
+    //
+    // Returns NULL if the shard is empty.
+    dlist_entry_node_t *(*peek_victim)(cache_shard_t *shard);
+};
 
-    return err;
+static cache_entry_t *cache_node_entry(dlist_entry_node_t *node) {
+    return arc_entry_get(*dlist_entry_get_mut(node));
+}
 
-hash_new_fail:
-#ifndef WAXY_PTHREADS_DISABLED
-    pthread_mutex_destroy(&self->mtx);
+static error_t *cache_shard_push_unsync(
+    cache_shard_t *self,
+    cache_queue_t queue,
+    arc_entry_t *arc,
+    dlist_entry_node_t **result
+) {
+    error_t *err = error_wrap("Could not register the entry in the cache", error_from_common(
+        dlist_entry_append(&self->queues[queue], arc, result)));
+    if (err) return err;
 
-mtx_init_fail:
-mtx_attr_init_fail:
-#endif
-    free(self);
+    arc_entry_get(arc)->queue = queue;
 
-calloc_fail:
     return err;
 }
 
-void cache_free(cache_t *self) {
-    hash_entry_free(&self->map);
+// Moves the node to the tail of the queue, which may be the one it's already in.
+static void cache_shard_requeue_unsync(
+    cache_shard_t *self,
+    dlist_entry_node_t *node,
+    cache_queue_t queue
+) {
+    cache_entry_t *entry = cache_node_entry(node);
 
-    for (dlist_entry_node_t *node = dlist_entry_head_mut(&self->entries);
-            node != NULL;
-            node = dlist_entry_next_mut(node)) {
-        arc_entry_t *arc = *dlist_entry_get_mut(node);
-        arc_entry_free(arc);
+    if (entry->queue == queue) {
+        dlist_entry_move_before(&self->queues[queue], node, NULL);
+    } else {
+        dlist_entry_t plucked = dlist_entry_pluck(&self->queues[entry->queue], node);
+        dlist_entry_concat(&self->queues[queue], plucked);
+        entry->queue = queue;
     }
+}
 
-    dlist_entry_free(&self->entries);
-
-#ifndef WAXY_PTHREADS_DISABLED
-    error_assert(error_from_errno(pthread_mutex_destroy(&self->mtx)));
-#endif
+static void cache_policy_noop_on_remove(cache_shard_t *, dlist_entry_node_t *) {}
 
-    free(self);
+static error_t *cache_policy_fifo_insert(
+    cache_shard_t *shard,
+    arc_entry_t *arc,
+    dlist_entry_node_t **result
+) {
+    return cache_shard_push_unsync(shard, CACHE_QUEUE_SMALL, arc, result);
 }
 
-static error_t *cache_entry_new_rd(arc_entry_t *arc, cache_rd_t **result);
-static error_t *cache_entry_new_rd_unsync(arc_entry_t *arc, cache_rd_t **result);
-
-// Removes an entry pointed to by `node` from the cache.
-//
-// Returns its last recorded size.
-static size_t cache_remove_entry_unsync(cache_t *self, dlist_entry_node_t *node) {
-    arc_entry_t *arc = dlist_entry_remove(&self->entries, node);
-    cache_entry_t *entry = arc_entry_get(arc);
+// LRU: the queue is kept in the order of recency, which requires moving the node on every hit.
 
-    // this ensures cache_wr_write doesn't update self->current_size anymore
-#ifndef WAXY_PTHREADS_DISABLED
-    assert_mutex_lock(&entry->mtx);
-#endif
-    entry->cache = NULL;
-    size_t size = string_len(&entry->buf);
-#ifndef WAXY_PTHREADS_DISABLED
-    assert_mutex_unlock(&entry->mtx);
-#endif
+static void cache_policy_lru_on_hit(cache_shard_t *shard, dlist_entry_node_t *node) {
+    cache_shard_requeue_unsync(shard, node, CACHE_QUEUE_SMALL);
+}
 
-    dlist_entry_node_t *removed_node = NULL;
-    // only fails if the key was not found -- our invariant ensures this can't happen
-    error_assert(error_from_common(
-        hash_entry_remove(&self->map, &(url_t const *) { &entry->url }, NULL, &removed_node)));
+static dlist_entry_node_t *cache_policy_lru_pick_victim(cache_shard_t *shard) {
+    return dlist_entry_head_mut(&shard->queues[CACHE_QUEUE_SMALL]);
+}
 
-    arc_entry_free(arc);
+static cache_policy_vtable_t const cache_policy_lru_vtable = {
+    .exclusive_hit = true,
+    .on_hit = cache_policy_lru_on_hit,
+    .insert = cache_policy_fifo_insert,
+    .on_remove = cache_policy_noop_on_remove,
+    .pick_victim = cache_policy_lru_pick_victim,
+    .peek_victim = cache_policy_lru_pick_victim,
+};
 
-    assert(size <= self->current_size);
-    assert(node == removed_node);
+// CLOCK: a hit sets the reference bit; the hand sweeps the queue, clearing the bits, and evicts the
+// first entry without one.
 
-    self->current_size -= size;
+static void cache_policy_clock_on_hit(cache_shard_t *, dlist_entry_node_t *node) {
+    atomic_store_explicit(&cache_node_entry(node)->freq, 1, memory_order_relaxed);
+}
 
-    return size;
+static void cache_policy_clock_on_remove(cache_shard_t *shard, dlist_entry_node_t *node) {
+    if (shard->hand == node) {
+        shard->hand = dlist_entry_next_mut(node);
+    }
 }
 
-static void cache_evict_if_necessary_unsync(cache_t *self) {
-    while (self->current_size > self->size_limit) {
-        dlist_entry_node_t *head = dlist_entry_head_mut(&self->entries);
+static dlist_entry_node_t *cache_policy_clock_pick_victim(cache_shard_t *shard) {
+    dlist_entry_t *queue = &shard->queues[CACHE_QUEUE_SMALL];
 
-        if (head == NULL) {
-            break;
+    // after a full sweep all the bits are cleared, so this terminates in at most two rounds
+    while (dlist_entry_len(queue) > 0) {
+        dlist_entry_node_t *node = shard->hand;
+
+        if (node == NULL) {
+            node = dlist_entry_head_mut(queue);
         }
 
-        cache_remove_entry_unsync(self, head);
+        shard->hand = dlist_entry_next_mut(node);
+
+        if (atomic_exchange_explicit(&cache_node_entry(node)->freq, 0, memory_order_relaxed) == 0) {
+            return node;
+        }
     }
-}
 
-static error_t *cache_create_entry_unsync(
-    cache_t *self,
-    url_t const *url,
-    cache_rd_t **result_rd,
-    cache_wr_t **result_wr
-) {
-    error_t *err = NULL;
+    return NULL;
+}
 
-    cache_entry_t *entry = calloc(1, sizeof(cache_entry_t));
-    err = error_wrap("Could not allocate an entry", OK_IF(entry != NULL));
-    if (err) goto entry_calloc_fail;
+// Follows the sweep of `cache_policy_clock_pick_victim` without clearing the reference bits.
+static dlist_entry_node_t *cache_policy_clock_peek_victim(cache_shard_t *shard) {
+    dlist_entry_t *queue = &shard->queues[CACHE_QUEUE_SMALL];
+    dlist_entry_node_t *start = shard->hand;
 
-    cache_wr_t *wr = calloc(1, sizeof(cache_wr_t));
-    err = error_wrap("Could not allocate a write handle", OK_IF(wr != NULL));
-    if (err) goto wr_calloc_fail;
+    if (start == NULL) {
+        start = dlist_entry_head_mut(queue);
+    }
 
-#ifndef WAXY_PTHREADS_DISABLED
-    pthread_mutexattr_t mtx_attr;
-    err = error_wrap("Could not initialize mutex attributes", error_from_errno(
-        pthread_mutexattr_init(&mtx_attr)));
-    if (err) goto mtxattr_init_fail;
+    if (start == NULL) {
+        return NULL;
+    }
 
-    err = error_wrap("Could not initialize a mutex", error_from_errno(
-        pthread_mutex_init(&entry->mtx, &mtx_attr)));
-    pthread_mutexattr_destroy(&mtx_attr);
-    if (err) goto mtx_init_fail;
-#endif
+    dlist_entry_node_t *node = start;
 
-    err = error_wrap("Could not copy the URL", url_copy(url, &entry->url));
-    if (err) goto url_copy_fail;
+    do {
+        if (atomic_load_explicit(&cache_node_entry(node)->freq, memory_order_relaxed) == 0) {
+            return node;
+        }
 
-    entry->handles = vec_rd_new();
+        node = dlist_entry_next_mut(node);
 
-    err = error_wrap("Could not create a buffer", error_from_common(
-        string_new(&entry->buf)));
-    if (err) goto string_new_fail;
+        if (node == NULL) {
+            node = dlist_entry_head_mut(queue);
+        }
+    } while (node != start);
 
-    entry->cache = self;
-    entry->state = CACHE_ENTRY_PARTIAL;
-    entry->committed = false;
+    // every bit is set: the sweep clears them all and comes back to where it has started
+    return start;
+}
 
-    arc_entry_t *arc = arc_entry_new(entry);
-    err = error_wrap("Could not allocate an entry", OK_IF(arc != NULL));
-    if (err) goto arc_new_fail;
+static cache_policy_vtable_t const cache_policy_clock_vtable = {
+    .exclusive_hit = false,
+    .on_hit = cache_policy_clock_on_hit,
+    .insert = cache_policy_fifo_insert,
+    .on_remove = cache_policy_clock_on_remove,
+    .pick_victim = cache_policy_clock_pick_victim,
+    .peek_victim = cache_policy_clock_peek_victim,
+};
 
-    cache_rd_t *rd = NULL;
-    err = cache_entry_new_rd(arc_entry_share(arc), &rd);
-    if (err) goto new_rd_fail;
+// S3-FIFO: new entries go to the small queue; the ones accessed while there are promoted to the
+// main queue, and the rest are evicted early, leaving their hashes in the ghost queue.
+// An entry whose url is found in the ghost queue is inserted to the main queue directly.
+// The main queue is a FIFO with reinsertion of the entries that have been accessed.
 
-    wr->entry = arc_entry_share(arc);
+static void cache_policy_s3_fifo_on_hit(cache_shard_t *, dlist_entry_node_t *node) {
+    atomic_uint *freq = &cache_node_entry(node)->freq;
+    unsigned int value = atomic_load_explicit(freq, memory_order_relaxed);
 
-    *result_rd = rd;
-    *result_wr = wr;
-    arc_entry_free(arc);
+    // losing a concurrent increment is harmless
+    if (value < CACHE_FREQ_MAX) {
+        atomic_store_explicit(freq, value + 1, memory_order_relaxed);
+    }
+}
 
-    return err;
+static size_t cache_shard_ghost_hash(cache_entry_t const *entry) {
+    return byte_hasher(&entry->url, (void *) &url_hasher_config_ghost);
+}
 
-new_rd_fail:
-    arc_entry_free(arc);
+static void cache_shard_ghost_pop_unsync(cache_shard_t *self) {
+    dlist_ghost_node_t *head = dlist_ghost_head_mut(&self->ghosts);
+    size_t hash = *dlist_ghost_get_mut(head);
 
-    return err;
+    error_assert(error_from_common(hash_ghost_remove(&self->ghost_map, &hash, NULL, NULL)));
+    dlist_ghost_remove(&self->ghosts, head);
+}
 
-arc_new_fail:
-    string_free(&entry->buf);
+// Remembers the evicted entry's url.
+//
+// The ghost queue is best-effort, so allocation failures are ignored.
+static void cache_shard_ghost_push_unsync(cache_shard_t *self, cache_entry_t const *entry) {
+    size_t hash = cache_shard_ghost_hash(entry);
 
-string_new_fail:
-    vec_rd_free(&entry->handles);
-    string_free(&entry->url.buf);
+    if (hash_ghost_get_mut(&self->ghost_map, &hash) != NULL) {
+        return;
+    }
 
-url_copy_fail:
-#ifndef WAXY_PTHREADS_DISABLED
-    error_assert(error_from_errno(pthread_mutex_destroy(&entry->mtx)));
+    dlist_ghost_node_t *node = NULL;
 
-mtx_init_fail:
-mtxattr_init_fail:
-#endif
-    free(wr);
+    if (dlist_ghost_append(&self->ghosts, hash, &node) != COMMON_ERROR_CODE_OK) {
+        return;
+    }
 
-wr_calloc_fail:
-    free(entry);
+    if (hash_ghost_insert(&self->ghost_map, hash, node) != COMMON_ERROR_CODE_OK) {
+        dlist_ghost_remove(&self->ghosts, node);
 
-entry_calloc_fail:
-    return err;
-}
+        return;
+    }
 
-static error_t *cache_create_handle_unsync(
-    cache_t *self,
-    dlist_entry_node_t *node,
-    url_t const *url,
-    cache_rd_t **result_rd,
-    cache_wr_t **result_wr
-) {
-    error_t *err = NULL;
+    size_t capacity = dlist_entry_len(&self->queues[CACHE_QUEUE_SMALL])
+        + dlist_entry_len(&self->queues[CACHE_QUEUE_MAIN]);
 
-    arc_entry_t *arc = *dlist_entry_get_mut(node);
-    cache_entry_t *entry = arc_entry_get(arc);
-#ifndef WAXY_PTHREADS_DISABLED
-    assert_mutex_lock(&entry->mtx);
-#endif
+    if (capacity < CACHE_GHOST_MIN_LEN) {
+        capacity = CACHE_GHOST_MIN_LEN;
+    }
 
-    if (entry->state == CACHE_ENTRY_INVALID) {
-#ifndef WAXY_PTHREADS_DISABLED
-        assert_mutex_unlock(&entry->mtx);
-#endif
+    while (dlist_ghost_len(&self->ghosts) > capacity) {
+        cache_shard_ghost_pop_unsync(self);
+    }
+}
 
-        cache_evict_if_necessary_unsync(self);
+// Removes the url from the ghost queue.
+//
+// Returns whether it was there.
+static bool cache_shard_ghost_take_unsync(cache_shard_t *self, cache_entry_t const *entry) {
+    size_t hash = cache_shard_ghost_hash(entry);
+    dlist_ghost_node_t *node = NULL;
 
-        return cache_create_entry_unsync(self, url, result_rd, result_wr);
+    if (hash_ghost_remove(&self->ghost_map, &hash, NULL, &node) != COMMON_ERROR_CODE_OK) {
+        return false;
     }
 
-    cache_rd_t *rd = NULL;
-    err = cache_entry_new_rd_unsync(arc_entry_share(arc), &rd);
-#ifndef WAXY_PTHREADS_DISABLED
-    assert_mutex_unlock(&entry->mtx);
-#endif
-    if (err) goto new_rd_fail;
-
-    dlist_entry_move_before(&self->entries, node, NULL);
+    dlist_ghost_remove(&self->ghosts, node);
 
-    *result_rd = rd;
-    *result_wr = NULL;
+    return true;
+}
 
-    return err;
+static error_t *cache_policy_s3_fifo_insert(
+    cache_shard_t *shard,
+    arc_entry_t *arc,
+    dlist_entry_node_t **result
+) {
+    cache_queue_t queue = cache_shard_ghost_take_unsync(shard, arc_entry_get(arc))
+        ? CACHE_QUEUE_MAIN
+        : CACHE_QUEUE_SMALL;
 
-new_rd_fail:
-    return err;
+    return cache_shard_push_unsync(shard, queue, arc, result);
 }
 
-error_t *cache_fetch(
-    cache_t *self,
-    url_t const *url,
-    cache_on_hit_cb_t on_hit,
-    cache_on_miss_cb_t on_miss,
-    void *data
-) {
-    error_t *err = NULL;
+static dlist_entry_node_t *cache_policy_s3_fifo_pick_victim(cache_shard_t *shard) {
+    dlist_entry_t *small = &shard->queues[CACHE_QUEUE_SMALL];
+    dlist_entry_t *main = &shard->queues[CACHE_QUEUE_MAIN];
 
-#ifndef WAXY_PTHREADS_DISABLED
-    assert_mutex_lock(&self->mtx);
-#endif
+    while (true) {
+        size_t small_len = dlist_entry_len(small);
+        size_t main_len = dlist_entry_len(main);
 
-    dlist_entry_node_t **ptr = hash_entry_get_mut(&self->map, &url);
-    cache_rd_t *rd = NULL;
-    cache_wr_t *wr = NULL;
+        if (small_len == 0 && main_len == 0) {
+            return NULL;
+        }
 
-    if (ptr == NULL) {
-        cache_evict_if_necessary_unsync(self);
+        bool small_overflows = small_len * CACHE_SMALL_QUEUE_RATIO >= small_len + main_len;
 
-        err = cache_create_entry_unsync(self, url, &rd, &wr);
-    } else {
-        err = cache_create_handle_unsync(self, *ptr, url, &rd, &wr);
-    }
+        if (small_len > 0 && (small_overflows || main_len == 0)) {
+            dlist_entry_node_t *node = dlist_entry_head_mut(small);
+            cache_entry_t *entry = cache_node_entry(node);
 
-#ifndef WAXY_PTHREADS_DISABLED
-    assert_mutex_unlock(&self->mtx);
-#endif
+            if (atomic_exchange_explicit(&entry->freq, 0, memory_order_relaxed) > 0) {
+                cache_shard_requeue_unsync(shard, node, CACHE_QUEUE_MAIN);
 
-    if (err) goto create_fail;
+                continue;
+            }
+
+            cache_shard_ghost_push_unsync(shard, entry);
+
+            return node;
+        }
+
+        dlist_entry_node_t *node = dlist_entry_head_mut(main);
+        atomic_uint *freq = &cache_node_entry(node)->freq;
+        unsigned int value = atomic_load_explicit(freq, memory_order_relaxed);
+
+        if (value == 0) {
+            return node;
+        }
+
+        atomic_store_explicit(freq, value - 1, memory_order_relaxed);
+        cache_shard_requeue_unsync(shard, node, CACHE_QUEUE_MAIN);
+    }
+}
+
+// Follows `cache_policy_s3_fifo_pick_victim` without promoting or requeueing anything.
+//
+// The entries the small queue would promote go to the tail of the main queue with a zero counter,
+// and the main queue's entries come back with their counters decremented, in the same order, on
+// every round. So the victim is the first main entry without accesses, or else the first promoted
+// entry, or else the first main entry with the fewest accesses.
+static dlist_entry_node_t *cache_policy_s3_fifo_peek_victim(cache_shard_t *shard) {
+    dlist_entry_t *small = &shard->queues[CACHE_QUEUE_SMALL];
+    dlist_entry_t *main = &shard->queues[CACHE_QUEUE_MAIN];
+    size_t small_len = dlist_entry_len(small);
+    size_t main_len = dlist_entry_len(main);
+    dlist_entry_node_t *node = dlist_entry_head_mut(small);
+    dlist_entry_node_t *first_promoted = NULL;
+
+    while (small_len > 0
+            && (small_len * CACHE_SMALL_QUEUE_RATIO >= small_len + main_len || main_len == 0)) {
+        if (atomic_load_explicit(&cache_node_entry(node)->freq, memory_order_relaxed) == 0) {
+            return node;
+        }
+
+        if (first_promoted == NULL) {
+            first_promoted = node;
+        }
+
+        node = dlist_entry_next_mut(node);
+        --small_len;
+        ++main_len;
+    }
+
+    dlist_entry_node_t *victim = first_promoted;
+    unsigned int victim_freq = 0;
+
+    for (node = dlist_entry_head_mut(main); node != NULL; node = dlist_entry_next_mut(node)) {
+        unsigned int value =
+            atomic_load_explicit(&cache_node_entry(node)->freq, memory_order_relaxed);
+
+        if (value == 0) {
+            return node;
+        }
+
+        if (first_promoted == NULL && (victim == NULL || value < victim_freq)) {
+            victim = node;
+            victim_freq = value;
+        }
+    }
+
+    return victim;
+}
+
+static cache_policy_vtable_t const cache_policy_s3_fifo_vtable = {
+    .exclusive_hit = false,
+    .on_hit = cache_policy_s3_fifo_on_hit,
+    .insert = cache_policy_s3_fifo_insert,
+    .on_remove = cache_policy_noop_on_remove,
+    .pick_victim = cache_policy_s3_fifo_pick_victim,
+    .peek_victim = cache_policy_s3_fifo_peek_victim,
+};
+
+static cache_policy_vtable_t const *cache_policy_vtable(cache_policy_t policy) {
+    switch (policy) {
+    case CACHE_POLICY_LRU:
+        return &cache_policy_lru_vtable;
+
+    case CACHE_POLICY_CLOCK:
+        return &cache_policy_clock_vtable;
+
+    case CACHE_POLICY_S3_FIFO:
+        return &cache_policy_s3_fifo_vtable;
+    }
+
+    abort();
+}
+
+static error_t *cache_shard_init(
+    cache_shard_t *self,
+    cache_config_t const *config,
+    disk_t *disk,
+    size_t size_limit
+) {
+    error_t *err = NULL;
+
+#ifndef WAXY_PTHREADS_DISABLED
+    err = error_wrap("Could not initialize a read-write lock", error_from_errno(
+        pthread_rwlock_init(&self->lock, NULL)));
+    if (err) goto lock_init_fail;
+
+    self->loading = vec_loading_new();
+#endif
+
+    err = error_from_common(hash_entry_new(
+        url_ptr_primary_hasher, url_ptr_secondary_hasher,
+        url_ptr_eq, &self->map
+    ));
+    if (err) goto hash_new_fail;
+
+    err = error_from_common(hash_ghost_new(
+        (hash_ghost_hasher_data_t) { .hasher = ghost_hash_primary },
+        (hash_ghost_hasher_data_t) { .hasher = ghost_hash_secondary },
+        ghost_eq, &self->ghost_map
+    ));
+    if (err) goto ghost_map_new_fail;
+
+    self->sketch = NULL;
+
+    if (config->admission == CACHE_ADMISSION_TINYLFU) {
+        err = frequency_sketch_new(CACHE_SKETCH_WIDTH, &self->sketch);
+        if (err) goto sketch_new_fail;
+    }
+
+    self->policy = cache_policy_vtable(config->policy);
+
+    for (size_t i = 0; i < CACHE_QUEUE_COUNT; ++i) {
+        self->queues[i] = dlist_entry_new();
+    }
+
+    self->hand = NULL;
+    self->disk = disk;
+    self->ghosts = dlist_ghost_new();
+    self->size_limit = size_limit;
+    self->current_size = 0;
+
+    return err;
+
+sketch_new_fail:
+    hash_ghost_free(&self->ghost_map);
+
+ghost_map_new_fail:
+    hash_entry_free(&self->map);
+
+hash_new_fail:
+#ifndef WAXY_PTHREADS_DISABLED
+    vec_loading_free(&self->loading);
+    pthread_rwlock_destroy(&self->lock);
+
+lock_init_fail:
+#endif
+    return err;
+}
+
+static void cache_shard_destroy(cache_shard_t *self) {
+    hash_entry_free(&self->map);
+    hash_ghost_free(&self->ghost_map);
+    dlist_ghost_free(&self->ghosts);
+    frequency_sketch_free(self->sketch);
+
+    for (size_t i = 0; i < CACHE_QUEUE_COUNT; ++i) {
+        for (dlist_entry_node_t *node = dlist_entry_head_mut(&self->queues[i]);
+                node != NULL;
+                node = dlist_entry_next_mut(node)) {
+            arc_entry_t *arc = *dlist_entry_get_mut(node);
+            arc_entry_free(arc);
+        }
+
+        dlist_entry_free(&self->queues[i]);
+    }
+
+#ifndef WAXY_PTHREADS_DISABLED
+    // the loads are over by now: every fetch has returned
+    assert(vec_loading_len(&self->loading) == 0);
+    vec_loading_free(&self->loading);
+    error_assert(error_from_errno(pthread_rwlock_destroy(&self->lock)));
+#endif
+}
+
+error_t *cache_new(cache_config_t const *config, cache_t **result) {
+    error_t *err = NULL;
+
+    size_t shard_count = config->shard_count;
+
+    if (shard_count == 0) {
+        shard_count = 1;
+    }
+
+    cache_t *self = calloc(1, sizeof(cache_t) + shard_count * sizeof(cache_shard_t));
+    err = error_wrap("Could not allocate memory for the cache", OK_IF(self != NULL));
+    if (err) goto calloc_fail;
+
+    self->disk = NULL;
+
+    if (config->disk_path != NULL) {
+        err = error_wrap("Could not open the disk cache", disk_new(&(disk_config_t) {
+            .path = config->disk_path,
+            .size_limit = config->disk_size_limit,
+            .segment_size = CACHE_DISK_SEGMENT_SIZE,
+        }, &self->disk));
+        if (err) goto disk_new_fail;
+    }
+
+    self->shard_count = shard_count;
+    size_t i = 0;
+
+    for (; i < shard_count; ++i) {
+        err = cache_shard_init(
+            &self->shards[i], config, self->disk, config->size_limit / shard_count);
+        if (err) goto shard_init_fail;
+    }
+
+    *result = self;
+
+    return err;
+
+shard_init_fail:
+    while (i-- > 0) {
+        cache_shard_destroy(&self->shards[i]);
+    }
+
+    disk_free(self->disk);
+
+disk_new_fail:
+    free(self);
+
+calloc_fail:
+    return err;
+}
+
+static void cache_shard_spill_unsync(cache_shard_t *self, cache_entry_t *entry);
+
+static bool cache_shard_snapshot_entry(
+    url_ptr_t const *,
+    dlist_entry_node_ptr_t const *node,
+    void *data
+) {
+    cache_shard_spill_unsync(data, cache_node_entry(*node));
+
+    return false;
+}
+
+// Writes all the complete entries to the disk tier so that they survive a restart.
+static void cache_snapshot(cache_t *self) {
+    size_t count = 0;
+
+    for (size_t i = 0; i < self->shard_count; ++i) {
+        cache_shard_t *shard = &self->shards[i];
+        hash_entry_for_each(&shard->map, cache_shard_snapshot_entry, shard);
+        count += hash_entry_len(&shard->map);
+    }
+
+    log_printf(LOG_INFO, "Saving up to %zu cache entries to the disk cache", count);
+}
+
+void cache_free(cache_t *self) {
+    if (self->disk != NULL) {
+        cache_snapshot(self);
+    }
+
+    for (size_t i = 0; i < self->shard_count; ++i) {
+        cache_shard_destroy(&self->shards[i]);
+    }
+
+    // the pending spills hold their own references to the chunks, so they are still completed
+    disk_free(self->disk);
+    free(self);
+}
+
+static slice_t cache_url_key(url_t const *url) {
+    return (slice_t) {
+        .base = string_as_cptr(&url->buf),
+        .len = string_len(&url->buf),
+    };
+}
+
+static size_t cache_sketch_hash(url_t const *url) {
+    return byte_hasher(url, (void *) &url_hasher_config_sketch);
+}
+
+// Decides whether a new entry for the url may displace the next eviction victim.
+//
+// The shard lock must be held exclusively.
+static bool cache_shard_admit_unsync(cache_shard_t *self, url_t const *url, size_t size) {
+    if (self->sketch == NULL || self->current_size + size <= self->size_limit) {
+        return true;
+    }
+
+    dlist_entry_node_t *victim = self->policy->peek_victim(self);
+
+    if (victim == NULL) {
+        return true;
+    }
+
+    unsigned int candidate_freq = frequency_sketch_estimate(self->sketch, cache_sketch_hash(url));
+    unsigned int victim_freq = frequency_sketch_estimate(
+        self->sketch,
+        cache_sketch_hash(&cache_node_entry(victim)->url)
+    );
+
+    return candidate_freq > victim_freq;
+}
+
+static cache_shard_t *cache_get_shard(cache_t *self, url_t const *url) {
+    if (self->shard_count == 1) {
+        return &self->shards[0];
+    }
+
+    return &self->shards[byte_hasher(url, (void *) &url_hasher_config_shard) % self->shard_count];
+}
+
+static error_t *cache_entry_new_rd(arc_entry_t *arc, cache_rd_t **result);
+static error_t *cache_entry_new_rd_unsync(arc_entry_t *arc, cache_rd_t **result);
+
+// Removes an entry pointed to by `node` from the cache.
+//
+// Returns its last recorded size.
+static size_t cache_remove_entry_unsync(cache_shard_t *self, dlist_entry_node_t *node) {
+    self->policy->on_remove(self, node);
+    cache_entry_t *entry = cache_node_entry(node);
+    arc_entry_t *arc = dlist_entry_remove(&self->queues[entry->queue], node);
+
+    // this ensures cache_wr_write doesn't update self->current_size anymore
+#ifndef WAXY_PTHREADS_DISABLED
+    assert_mutex_lock(&entry->mtx);
+#endif
+    entry->shard = NULL;
+    size_t size = entry->size;
+#ifndef WAXY_PTHREADS_DISABLED
+    assert_mutex_unlock(&entry->mtx);
+#endif
+
+    dlist_entry_node_t *removed_node = NULL;
+    // only fails if the key was not found -- our invariant ensures this can't happen
+    error_assert(error_from_common(
+        hash_entry_remove(&self->map, &(url_t const *) { &entry->url }, NULL, &removed_node)));
+
+    arc_entry_free(arc);
+
+    assert(size <= self->current_size);
+    assert(node == removed_node);
+
+    self->current_size -= size;
+
+    return size;
+}
+
+// References to the chunks of an entry being written to the disk tier.
+typedef struct {
+    size_t count;
+    arc_chunk_t *chunks[];
+} cache_spill_t;
+
+static void cache_spill_free(cache_spill_t *self) {
+    for (size_t i = 0; i < self->count; ++i) {
+        arc_chunk_free(self->chunks[i]);
+    }
+
+    free(self);
+}
+
+// Schedules a complete entry to be written to the disk tier.
+//
+// The disk tier is best-effort, so the failures are only logged.
+static void cache_shard_spill_unsync(cache_shard_t *self, cache_entry_t *entry) {
+    error_t *err = NULL;
+
+    if (self->disk == NULL) {
+        return;
+    }
+
+#ifndef WAXY_PTHREADS_DISABLED
+    assert_mutex_lock(&entry->mtx);
+#endif
+
+    if (entry->state != CACHE_ENTRY_COMPLETE) {
+        goto skip;
+    }
+
+    // the record may have been reclaimed since, in which case the entry has to be written anew
+    if (entry->on_disk && disk_contains(self->disk, cache_url_key(&entry->url))) {
+        goto skip;
+    }
+
+    size_t count = vec_chunk_len(&entry->chunks);
+    cache_spill_t *spill = malloc(sizeof(cache_spill_t) + count * sizeof(arc_chunk_t *));
+    err = error_wrap("Could not allocate memory", OK_IF(spill != NULL));
+    if (err) goto spill_malloc_fail;
+
+    struct iovec *iov = calloc(count == 0 ? 1 : count, sizeof(struct iovec));
+    err = error_wrap("Could not allocate memory", OK_IF(iov != NULL));
+    if (err) goto iov_calloc_fail;
+
+    for (size_t i = 0; i < count; ++i) {
+        cache_chunk_slot_t const *slot = vec_chunk_get(&entry->chunks, i);
+        spill->chunks[i] = arc_chunk_share(slot->chunk);
+        iov[i] = (struct iovec) {
+            .iov_base = arc_chunk_get(slot->chunk)->data,
+            .iov_len = slot->len,
+        };
+    }
+
+    spill->count = count;
+    entry->on_disk = true;
+
+#ifndef WAXY_PTHREADS_DISABLED
+    assert_mutex_unlock(&entry->mtx);
+#endif
+
+    err = disk_store(
+        self->disk,
+        cache_url_key(&entry->url),
+        iov,
+        count,
+        (disk_release_cb_t) cache_spill_free,
+        spill
+    );
+    free(iov);
+
+    if (err) {
+        cache_spill_free(spill);
+    }
+
+    goto done;
+
+iov_calloc_fail:
+    free(spill);
+
+spill_malloc_fail:
+skip:
+#ifndef WAXY_PTHREADS_DISABLED
+    assert_mutex_unlock(&entry->mtx);
+#endif
+
+done:
+    if (err) {
+        err = error_wrap("Could not spill an entry to the disk cache", err);
+        error_log_free(&err, LOG_WARN, ERROR_VERBOSITY_SOURCE_CHAIN);
+    }
+}
+
+static void cache_evict_if_necessary_unsync(cache_shard_t *self) {
+    while (self->current_size > self->size_limit) {
+        dlist_entry_node_t *victim = self->policy->pick_victim(self);
+
+        if (victim == NULL) {
+            break;
+        }
+
+        cache_shard_spill_unsync(self, cache_node_entry(victim));
+        cache_remove_entry_unsync(self, victim);
+    }
+}
+
+// Creates a new uncommitted entry along with a read and a write handle for it.
+//
+// `stale` is the entry being revalidated, if any.
+// The reference is taken over on success.
+//
+// `result_rd` may be `NULL` if no read handle is needed.
+static error_t *cache_create_entry_unsync(
+    cache_shard_t *self,
+    url_t const *url,
+    arc_entry_t *stale,
+    cache_rd_t **result_rd,
+    cache_wr_t **result_wr
+) {
+    error_t *err = NULL;
+
+    cache_entry_t *entry = calloc(1, sizeof(cache_entry_t));
+    err = error_wrap("Could not allocate an entry", OK_IF(entry != NULL));
+    if (err) goto entry_calloc_fail;
+
+    cache_wr_t *wr = calloc(1, sizeof(cache_wr_t));
+    err = error_wrap("Could not allocate a write handle", OK_IF(wr != NULL));
+    if (err) goto wr_calloc_fail;
+
+#ifndef WAXY_PTHREADS_DISABLED
+    pthread_mutexattr_t mtx_attr;
+    err = error_wrap("Could not initialize mutex attributes", error_from_errno(
+        pthread_mutexattr_init(&mtx_attr)));
+    if (err) goto mtxattr_init_fail;
+
+    err = error_wrap("Could not initialize a mutex", error_from_errno(
+        pthread_mutex_init(&entry->mtx, &mtx_attr)));
+    pthread_mutexattr_destroy(&mtx_attr);
+    if (err) goto mtx_init_fail;
+#endif
+
+    err = error_wrap("Could not copy the URL", url_copy(url, &entry->url));
+    if (err) goto url_copy_fail;
+
+    entry->handles = vec_rd_new();
+    entry->chunks = vec_chunk_new();
+    entry->size = 0;
+    entry->shard = self;
+    entry->state = CACHE_ENTRY_PARTIAL;
+    entry->committed = false;
+    entry->provisional = false;
+    entry->checked_size = 0;
+    entry->on_disk = false;
+    entry->fresh_until = 0;
+    entry->validators = NULL;
+    entry->etag_len = 0;
+    entry->last_modified_len = 0;
+    entry->queue = CACHE_QUEUE_SMALL;
+    entry->freq = 0;
+
+    arc_entry_t *arc = arc_entry_new(entry);
+    err = error_wrap("Could not allocate an entry", OK_IF(arc != NULL));
+    if (err) goto arc_new_fail;
+
+    if (result_rd != NULL) {
+        err = cache_entry_new_rd(arc_entry_share(arc), result_rd);
+        if (err) goto new_rd_fail;
+    }
+
+    wr->entry = arc_entry_share(arc);
+    wr->stale = stale;
+
+    *result_wr = wr;
+    arc_entry_free(arc);
+
+    return err;
+
+new_rd_fail:
+    arc_entry_free(arc);
+    free(wr);
+
+    return err;
+
+arc_new_fail:
+    vec_rd_free(&entry->handles);
+    string_free(&entry->url.buf);
+
+url_copy_fail:
+#ifndef WAXY_PTHREADS_DISABLED
+    error_assert(error_from_errno(pthread_mutex_destroy(&entry->mtx)));
+
+mtx_init_fail:
+mtxattr_init_fail:
+#endif
+    free(wr);
+
+wr_calloc_fail:
+    free(entry);
+
+entry_calloc_fail:
+    return err;
+}
+
+// Creates a read handle for the entry, unless it has been invalidated or has gone stale.
+//
+// An entry that is still being written is considered fresh: its response has just been received.
+//
+// `node` is the node of the entry in the shard or `NULL` if the entry is not committed.
+//
+// The shard lock must be held, in the shared mode at least if the policy allows it.
+static error_t *cache_hit_unsync(
+    cache_shard_t *self,
+    arc_entry_t *arc,
+    dlist_entry_node_t *node,
+    time_t now,
+    cache_rd_t **result_rd,
+    bool *hit
+) {
+    error_t *err = NULL;
+
+    cache_entry_t *entry = arc_entry_get(arc);
+#ifndef WAXY_PTHREADS_DISABLED
+    assert_mutex_lock(&entry->mtx);
+#endif
+
+    if (entry->state == CACHE_ENTRY_INVALID
+            || (entry->state == CACHE_ENTRY_COMPLETE && entry->fresh_until <= now)) {
+#ifndef WAXY_PTHREADS_DISABLED
+        assert_mutex_unlock(&entry->mtx);
+#endif
+        *hit = false;
+
+        return err;
+    }
+
+    cache_rd_t *rd = NULL;
+    err = cache_entry_new_rd_unsync(arc_entry_share(arc), &rd);
+#ifndef WAXY_PTHREADS_DISABLED
+    assert_mutex_unlock(&entry->mtx);
+#endif
+    if (err) goto new_rd_fail;
+
+    if (node != NULL) {
+        self->policy->on_hit(self, node);
+    }
+
+    *result_rd = rd;
+    *hit = true;
+
+    return err;
+
+new_rd_fail:
+    return err;
+}
+
+// Returns a new reference to the entry if it can be revalidated instead of being fetched anew.
+static arc_entry_t *cache_entry_revalidation_base(arc_entry_t *arc) {
+    cache_entry_t *entry = arc_entry_get(arc);
+#ifndef WAXY_PTHREADS_DISABLED
+    assert_mutex_lock(&entry->mtx);
+#endif
+
+    bool revalidatable = entry->state == CACHE_ENTRY_COMPLETE && entry->validators != NULL;
+
+#ifndef WAXY_PTHREADS_DISABLED
+    assert_mutex_unlock(&entry->mtx);
+#endif
+
+    return revalidatable ? arc_entry_share(arc) : NULL;
+}
+
+static error_t *cache_shard_load(
+    cache_shard_t *self,
+    url_t const *url,
+    time_t now,
+    arc_entry_t **result
+);
+static error_t *cache_commit_unsync(cache_shard_t *shard, arc_entry_t *arc, size_t expected_size);
+
+// Creates a read handle for the entry if it's fresh, or a new entry to fetch the resource into
+// otherwise.
+//
+// `arc` may be `NULL` if there is no entry at all.
+// `node` is the node of the entry in the shard or `NULL` if the entry is not committed.
+//
+// The shard lock must be held exclusively.
+static error_t *cache_create_handle_unsync(
+    cache_shard_t *self,
+    arc_entry_t *arc,
+    dlist_entry_node_t *node,
+    url_t const *url,
+    time_t now,
+    cache_rd_t **result_rd,
+    cache_wr_t **result_wr
+) {
+    error_t *err = NULL;
+
+    bool hit = false;
+
+    if (arc != NULL) {
+        err = cache_hit_unsync(self, arc, node, now, result_rd, &hit);
+        if (err) return err;
+    }
+
+    if (hit) {
+        *result_wr = NULL;
+
+        return err;
+    }
+
+    arc_entry_t *stale = arc != NULL ? cache_entry_revalidation_base(arc) : NULL;
+    cache_evict_if_necessary_unsync(self);
+
+    err = cache_create_entry_unsync(self, url, stale, result_rd, result_wr);
+
+    if (err) {
+        arc_entry_free(stale);
+    }
+
+    return err;
+}
+
+#ifndef WAXY_PTHREADS_DISABLED
+
+// Returns the entry the url is being loaded into from the disk tier, or `NULL` if it isn't.
+//
+// The shard lock must be held exclusively.
+static arc_entry_t *cache_shard_find_loading_unsync(cache_shard_t *self, url_t const *url) {
+    for (size_t i = 0; i < vec_loading_len(&self->loading); ++i) {
+        arc_entry_t *arc = *vec_loading_get(&self->loading, i);
+
+        if (url_eq(&arc_entry_get(arc)->url, url)) {
+            return arc;
+        }
+    }
+
+    return NULL;
+}
+
+// Lets the other fetches of the entry's url read it while it's being loaded from the disk tier.
+//
+// The shard lock must be held exclusively.
+static void cache_shard_begin_load_unsync(cache_shard_t *self, arc_entry_t *arc) {
+    arc_entry_t *shared = arc_entry_share(arc);
+
+    // if this fails, the concurrent fetches load the record on their own, which is only wasteful
+    if (vec_loading_push(&self->loading, shared) != COMMON_ERROR_CODE_OK) {
+        arc_entry_free(shared);
+    }
+}
+
+// Undoes `cache_shard_begin_load_unsync` once the load is over.
+//
+// The shard lock must be held exclusively.
+static void cache_shard_end_load_unsync(cache_shard_t *self, arc_entry_t *arc) {
+    for (size_t i = 0; i < vec_loading_len(&self->loading); ++i) {
+        if (*vec_loading_get(&self->loading, i) == arc) {
+            vec_loading_remove(&self->loading, i);
+            arc_entry_free(arc);
+
+            break;
+        }
+    }
+}
+
+#endif
+
+// Fills the entry being written by `wr` with the body and the metadata of an entry loaded from the
+// disk tier, and commits it.
+//
+// The shard lock must be held exclusively.
+static error_t *cache_shard_fill_loaded_unsync(
+    cache_shard_t *self,
+    cache_wr_t *wr,
+    arc_entry_t *loaded
+) {
+    error_t *err = NULL;
+
+    // the loaded entry is only known to this fetch, so it can be read without locking
+    time_t fresh_until = arc_entry_get(loaded)->fresh_until;
+    wr->stale = arc_entry_share(loaded);
+
+    slice_t etag;
+    slice_t last_modified;
+    cache_wr_revalidation(wr, &etag, &last_modified);
+
+    err = cache_wr_set_freshness(wr, fresh_until, etag, last_modified);
+    if (err) return err;
+
+    err = cache_wr_reuse_stale(wr, fresh_until);
+    if (err) return err;
+
+    cache_evict_if_necessary_unsync(self);
+    cache_entry_t *entry = arc_entry_get(wr->entry);
+
+#ifndef WAXY_PTHREADS_DISABLED
+    assert_mutex_lock(&entry->mtx);
+#endif
+
+    // the record is still there, so the entry need not be written out again once evicted
+    entry->on_disk = true;
+
+    // even if the entry can't be committed, it can still be served to the fetches reading it
+    error_t *commit_err = cache_commit_unsync(self, wr->entry, entry->size);
+
+#ifndef WAXY_PTHREADS_DISABLED
+    assert_mutex_unlock(&entry->mtx);
+#endif
+
+    if (commit_err) {
+        commit_err = error_wrap("Could not commit an entry loaded from the disk cache",
+            commit_err);
+        error_log_free(&commit_err, LOG_WARN, ERROR_VERBOSITY_SOURCE_CHAIN);
+    }
+
+    return err;
+}
+
+// Creates a handle for the url like `cache_create_handle_unsync`, locking the shard exclusively.
+//
+// If the url is missing from memory but has a record in the disk tier, a new entry is created for
+// it first, and the record is loaded with the shard unlocked, as verifying it takes a while.
+// In the meantime, the other fetches of the url are given read handles for the new entry instead
+// of waiting for the load.
+// The entry is then filled from the record if it's fresh; otherwise this fetch is a miss, and the
+// write handle it returns fills the entry for all of them.
+static error_t *cache_shard_fetch(
+    cache_shard_t *self,
+    url_t const *url,
+    time_t now,
+    cache_rd_t **result_rd,
+    cache_wr_t **result_wr
+) {
+    error_t *err = NULL;
+
+#ifndef WAXY_PTHREADS_DISABLED
+    assert_rwlock_wrlock(&self->lock);
+#endif
+
+    dlist_entry_node_t **ptr = hash_entry_get_mut(&self->map, &url);
+
+    if (ptr != NULL) {
+        err = cache_create_handle_unsync(
+            self,
+            *dlist_entry_get_mut(*ptr),
+            *ptr,
+            url,
+            now,
+            result_rd,
+            result_wr
+        );
+
+        goto done;
+    }
+
+#ifndef WAXY_PTHREADS_DISABLED
+    arc_entry_t *loading = cache_shard_find_loading_unsync(self, url);
+
+    if (loading != NULL) {
+        *result_wr = NULL;
+        err = cache_entry_new_rd(arc_entry_share(loading), result_rd);
+
+        goto done;
+    }
+#endif
+
+    if (self->disk == NULL || !disk_contains(self->disk, cache_url_key(url))) {
+        err = cache_create_handle_unsync(self, NULL, NULL, url, now, result_rd, result_wr);
+
+        goto done;
+    }
+
+    cache_rd_t *rd = NULL;
+    cache_wr_t *wr = NULL;
+    err = cache_create_entry_unsync(self, url, NULL, &rd, &wr);
+    if (err) goto create_fail;
+
+#ifndef WAXY_PTHREADS_DISABLED
+    cache_shard_begin_load_unsync(self, wr->entry);
+    assert_rwlock_unlock(&self->lock);
+#endif
+
+    arc_entry_t *loaded = NULL;
+    err = cache_shard_load(self, url, now, &loaded);
+
+#ifndef WAXY_PTHREADS_DISABLED
+    assert_rwlock_wrlock(&self->lock);
+    cache_shard_end_load_unsync(self, wr->entry);
+#endif
+
+    if (err) goto load_fail;
+
+    // the record has just been parsed, so the entry is complete and can be read without locking
+    if (loaded != NULL && arc_entry_get(loaded)->fresh_until > now) {
+        err = cache_shard_fill_loaded_unsync(self, wr, loaded);
+        if (err) goto fill_fail;
+
+        cache_wr_free(wr);
+        wr = NULL;
+    } else if (loaded != NULL) {
+        wr->stale = cache_entry_revalidation_base(loaded);
+    }
+
+    arc_entry_free(loaded);
+    *result_rd = rd;
+    *result_wr = wr;
+
+    goto done;
+
+fill_fail:
+    arc_entry_free(loaded);
+
+load_fail:
+    // the fetches reading the entry see it invalidated
+    handler_free((handler_t *) rd);
+    cache_wr_free(wr);
+
+create_fail:
+done:
+#ifndef WAXY_PTHREADS_DISABLED
+    assert_rwlock_unlock(&self->lock);
+#endif
+
+    return err;
+}
+
+error_t *cache_fetch(
+    cache_t *self,
+    url_t const *url,
+    cache_on_hit_cb_t on_hit,
+    cache_on_miss_cb_t on_miss,
+    void *data
+) {
+    error_t *err = NULL;
+
+    cache_shard_t *shard = cache_get_shard(self, url);
+    cache_rd_t *rd = NULL;
+    cache_wr_t *wr = NULL;
+    bool hit = false;
+    time_t now = time(NULL);
+
+    if (shard->sketch != NULL) {
+        frequency_sketch_record(shard->sketch, cache_sketch_hash(url));
+    }
+
+    // try the fast path first: if the entry is there, readers don't have to exclude each other
+    if (!shard->policy->exclusive_hit) {
+#ifndef WAXY_PTHREADS_DISABLED
+        assert_rwlock_rdlock(&shard->lock);
+#endif
+
+        dlist_entry_node_t **ptr = hash_entry_get_mut(&shard->map, &url);
+
+        if (ptr != NULL) {
+            err = cache_hit_unsync(shard, *dlist_entry_get_mut(*ptr), *ptr, now, &rd, &hit);
+        }
+
+#ifndef WAXY_PTHREADS_DISABLED
+        assert_rwlock_unlock(&shard->lock);
+#endif
+
+        if (err) goto create_fail;
+    }
+
+    if (!hit) {
+        err = cache_shard_fetch(shard, url, now, &rd, &wr);
+        if (err) goto create_fail;
+    }
 
     if (wr != NULL) {
         err = on_miss(data, rd, wr);
@@ -457,13 +1572,18 @@ static void rd_free(cache_rd_t *self) {
 static error_t *rd_process(cache_rd_t *self, loop_t *loop, poll_flags_t) {
     error_t *err = NULL;
 
+    if (atomic_load(&self->paused)) {
+        // picked up again once resumed
+        return err;
+    }
+
     arc_entry_t *arc = self->entry;
     cache_entry_t *entry = arc_entry_get(arc);
 #ifndef WAXY_PTHREADS_DISABLED
     assert_mutex_lock(&entry->mtx);
 #endif
 
-    size_t new_len = string_len(&entry->buf);
+    size_t new_len = entry->size;
     cache_entry_state_t state = entry->state;
 
 #ifndef WAXY_PTHREADS_DISABLED
@@ -499,6 +1619,8 @@ static handler_vtable_t const rd_vtable = {
     .free = (handler_vtable_free_t) rd_free,
     .on_error = NULL,
     .process = (handler_vtable_process_t) rd_process,
+    // a reader pushes the cached bytes to its client
+    .lane = EXECUTOR_LANE_CRITICAL,
 };
 
 // the arc is owned
@@ -516,8 +1638,11 @@ static error_t *cache_entry_new_rd_unsync(arc_entry_t *arc, cache_rd_t **result)
     rd->on_read = NULL;
     rd->on_update = NULL;
     rd->count = 0;
+    rd->chunk_idx = 0;
+    rd->chunk_offset = 0;
     rd->last_state = -1;
     rd->registered = false;
+    rd->paused = false;
 
     log_printf(LOG_DEBUG, "Registering the newly created rd_handle");
     err = error_wrap("Could not register the created handle", error_from_common(
@@ -526,7 +1651,7 @@ static error_t *cache_entry_new_rd_unsync(arc_entry_t *arc, cache_rd_t **result)
 
     rd->registered = true;
 
-    if (string_len(&entry->buf) > 0) {
+    if (entry->size > 0) {
         handler_force(&rd->handler);
     }
 
@@ -556,116 +1681,511 @@ static error_t *cache_entry_new_rd(arc_entry_t *arc, cache_rd_t **result) {
 
     err = cache_entry_new_rd_unsync(arc_entry_share(arc), result);
 
-#ifndef WAXY_PTHREADS_DISABLED
-    assert_mutex_unlock(&entry->mtx);
-#endif
-    arc_entry_free(arc);
+#ifndef WAXY_PTHREADS_DISABLED
+    assert_mutex_unlock(&entry->mtx);
+#endif
+    arc_entry_free(arc);
+
+    return err;
+}
+
+static void cache_entry_free(cache_entry_t *self) {
+#ifndef WAXY_PTHREADS_DISABLED
+    pthread_mutex_destroy(&self->mtx);
+#endif
+    string_free(&self->url.buf);
+    vec_rd_free(&self->handles);
+    free(self->validators);
+
+    for (size_t i = 0; i < vec_chunk_len(&self->chunks); ++i) {
+        arc_chunk_free(vec_chunk_get(&self->chunks, i)->chunk);
+    }
+
+    vec_chunk_free(&self->chunks);
+    self->state = CACHE_ENTRY_INVALID;
+    free(self);
+}
+
+static void cache_entry_wake_unsync(cache_entry_t *entry) {
+    for (size_t i = 0; i < vec_rd_len(&entry->handles); ++i) {
+        cache_rd_t *handle = *vec_rd_get_mut(&entry->handles, i);
+        log_printf(LOG_DEBUG, "Waking up %p", (void *) handle);
+        handler_force(&handle->handler);
+    }
+}
+
+static void cache_entry_set_state_unsync(cache_entry_t *entry, cache_entry_state_t state) {
+    if (entry->state == state) {
+        return;
+    }
+
+    if (entry->state == CACHE_ENTRY_INVALID) {
+        log_printf(
+            LOG_WARN,
+            "Tried to change the state of an invalidated cache entry to %d",
+            state
+        );
+
+        return;
+    }
+
+    entry->state = state;
+    cache_entry_wake_unsync(entry);
+}
+
+void cache_rd_set_on_read(cache_rd_t *self, cache_on_read_cb_t on_read) {
+    self->on_read = on_read;
+}
+
+void cache_rd_set_on_update(cache_rd_t *self, cache_on_update_cb_t on_update) {
+    self->on_update = on_update;
+}
+
+// Shares the chunk the read cursor points to, moving the cursor past the exhausted chunks.
+//
+// Returns the number of bytes that can be read from the chunk starting at `self->chunk_offset`.
+// If the reader has caught up with the writer, returns 0 and leaves `*result` untouched.
+static size_t cache_rd_acquire_chunk_unsync(
+    cache_rd_t *self,
+    cache_entry_t const *entry,
+    arc_chunk_t **result
+) {
+    size_t chunk_count = vec_chunk_len(&entry->chunks);
+
+    while (self->chunk_idx < chunk_count) {
+        cache_chunk_slot_t const *slot = vec_chunk_get(&entry->chunks, self->chunk_idx);
+
+        if (self->chunk_offset < slot->len) {
+            *result = arc_chunk_share(slot->chunk);
+
+            return slot->len - self->chunk_offset;
+        }
+
+        if (self->chunk_idx + 1 == chunk_count) {
+            // the tail chunk may still receive more data
+            break;
+        }
+
+        // the length of a chunk other than the tail one is final
+        self->chunk_offset -= slot->len;
+        ++self->chunk_idx;
+    }
+
+    return 0;
+}
+
+size_t cache_rd_read(cache_rd_t *self, char *buf, size_t size, bool *eof) {
+    arc_entry_t *arc = self->entry;
+    cache_entry_t *entry = arc_entry_get(arc);
+    size_t total = 0;
+
+    while (true) {
+#ifndef WAXY_PTHREADS_DISABLED
+        assert_mutex_lock(&entry->mtx);
+#endif
+
+        arc_chunk_t *chunk = NULL;
+        size_t available = 0;
+
+        if (total < size) {
+            available = cache_rd_acquire_chunk_unsync(self, entry, &chunk);
+        }
+
+        if (available == 0) {
+            if (entry->state != CACHE_ENTRY_PARTIAL && self->count >= entry->size) {
+                *eof = true;
+            }
+
+#ifndef WAXY_PTHREADS_DISABLED
+            assert_mutex_unlock(&entry->mtx);
+#endif
+
+            break;
+        }
+
+#ifndef WAXY_PTHREADS_DISABLED
+        assert_mutex_unlock(&entry->mtx);
+#endif
+
+        // the published bytes are immutable, and the reference keeps the chunk alive
+        if (available > size - total) {
+            available = size - total;
+        }
+
+        memcpy(buf + total, arc_chunk_get(chunk)->data + self->chunk_offset, available);
+        arc_chunk_free(chunk);
+
+        self->chunk_offset += available;
+        self->count += available;
+        total += available;
+    }
+
+    return total;
+}
+
+size_t cache_rd_read_spans(
+    cache_rd_t *self,
+    size_t max_count,
+    cache_span_t spans[static max_count],
+    size_t size,
+    bool *eof
+) {
+    cache_entry_t *entry = arc_entry_get(self->entry);
+    size_t count = 0;
+    size_t total = 0;
+
+#ifndef WAXY_PTHREADS_DISABLED
+    assert_mutex_lock(&entry->mtx);
+#endif
+
+    // only the references are taken here, so the lock is held for the whole batch
+    while (count < max_count && total < size) {
+        arc_chunk_t *chunk = NULL;
+        size_t available = cache_rd_acquire_chunk_unsync(self, entry, &chunk);
+
+        if (available == 0) {
+            break;
+        }
+
+        if (available > size - total) {
+            available = size - total;
+        }
+
+        spans[count++] = (cache_span_t) {
+            .slice = {
+                .base = arc_chunk_get(chunk)->data + self->chunk_offset,
+                .len = available,
+            },
+            .storage = chunk,
+        };
+
+        self->chunk_offset += available;
+        self->count += available;
+        total += available;
+    }
+
+    if (entry->state != CACHE_ENTRY_PARTIAL && self->count >= entry->size) {
+        *eof = true;
+    }
+
+#ifndef WAXY_PTHREADS_DISABLED
+    assert_mutex_unlock(&entry->mtx);
+#endif
+
+    return count;
+}
+
+void cache_rd_seek(cache_rd_t *self, size_t offset) {
+    // the cursor is moved to the right chunk by the next read
+    self->count = offset;
+    self->chunk_idx = 0;
+    self->chunk_offset = offset;
+
+    handler_force(&self->handler);
+}
+
+void cache_rd_set_paused(cache_rd_t *self, bool paused) {
+    atomic_store(&self->paused, paused);
+
+    if (!paused) {
+        handler_force(&self->handler);
+    }
+}
+
+void cache_span_release(cache_span_t *self) {
+    arc_chunk_free(self->storage);
+    self->storage = NULL;
+}
+
+void cache_wr_free(cache_wr_t *self) {
+    if (self == NULL) return;
+
+    arc_entry_t *arc = self->entry;
+    cache_entry_t *entry = arc_entry_get(arc);
+#ifndef WAXY_PTHREADS_DISABLED
+    assert_mutex_lock(&entry->mtx);
+#endif
+
+    if (entry->state == CACHE_ENTRY_PARTIAL) {
+        cache_entry_set_state_unsync(entry, CACHE_ENTRY_INVALID);
+    }
+
+#ifndef WAXY_PTHREADS_DISABLED
+    assert_mutex_unlock(&entry->mtx);
+#endif
+    arc_entry_free(arc);
+    arc_entry_free(self->stale);
+    free(self);
+}
+
+static void cache_chunk_free(cache_chunk_t *self) {
+    if (self->release != NULL) {
+        self->release(self->release_data);
+    }
+
+    free(self);
+}
+
+static error_t *cache_chunk_new(arc_chunk_t **result) {
+    error_t *err = NULL;
+
+    cache_chunk_t *chunk = malloc(sizeof(cache_chunk_t) + CACHE_CHUNK_SIZE);
+    err = error_wrap("Could not allocate a chunk", OK_IF(chunk != NULL));
+    if (err) goto malloc_fail;
+
+    chunk->data = chunk->storage;
+    chunk->capacity = CACHE_CHUNK_SIZE;
+    chunk->release = NULL;
+    chunk->release_data = NULL;
+
+    arc_chunk_t *arc = arc_chunk_new(chunk);
+    err = error_wrap("Could not allocate a chunk", OK_IF(arc != NULL));
+    if (err) goto arc_new_fail;
+
+    *result = arc;
+
+    return err;
+
+arc_new_fail:
+    free(chunk);
+
+malloc_fail:
+    return err;
+}
+
+// Wraps borrowed data into a chunk.
+//
+// `release(release_data)` is called once the chunk is freed, or immediately if this fails.
+static error_t *cache_chunk_wrap(
+    char *data,
+    size_t len,
+    cache_release_cb_t release,
+    void *release_data,
+    arc_chunk_t **result
+) {
+    error_t *err = NULL;
+
+    cache_chunk_t *chunk = malloc(sizeof(cache_chunk_t));
+    err = error_wrap("Could not allocate a chunk", OK_IF(chunk != NULL));
+    if (err) goto malloc_fail;
+
+    chunk->data = data;
+    chunk->capacity = len;
+    chunk->release = release;
+    chunk->release_data = release_data;
+
+    arc_chunk_t *arc = arc_chunk_new(chunk);
+    err = error_wrap("Could not allocate a chunk", OK_IF(arc != NULL));
+    if (err) goto arc_new_fail;
+
+    *result = arc;
+
+    return err;
+
+arc_new_fail:
+    free(chunk);
+
+malloc_fail:
+    release(release_data);
 
     return err;
 }
 
-static void cache_entry_free(cache_entry_t *self) {
-#ifndef WAXY_PTHREADS_DISABLED
-    pthread_mutex_destroy(&self->mtx);
-#endif
-    string_free(&self->url.buf);
-    vec_rd_free(&self->handles);
-    string_free(&self->buf);
-    self->state = CACHE_ENTRY_INVALID;
-    free(self);
-}
+// Makes sure `additional` slots can be pushed to `chunks` without failing.
+static error_t *cache_chunks_reserve(vec_chunk_t *chunks, size_t additional) {
+    size_t required = vec_chunk_len(chunks) + additional;
+    size_t capacity = vec_chunk_capacity(chunks);
 
-static void cache_entry_wake_unsync(cache_entry_t *entry) {
-    for (size_t i = 0; i < vec_rd_len(&entry->handles); ++i) {
-        cache_rd_t *handle = *vec_rd_get_mut(&entry->handles, i);
-        log_printf(LOG_DEBUG, "Waking up %p", (void *) handle);
-        handler_force(&handle->handler);
+    if (required <= capacity) {
+        return NULL;
     }
-}
 
-static void cache_entry_set_state_unsync(cache_entry_t *entry, cache_entry_state_t state) {
-    if (entry->state == state) {
-        return;
+    if (capacity * 2 > required) {
+        required = capacity * 2;
     }
 
-    if (entry->state == CACHE_ENTRY_INVALID) {
-        log_printf(
-            LOG_WARN,
-            "Tried to change the state of an invalidated cache entry to %d",
-            state
-        );
+    return error_wrap("Could not allocate memory for the chunk list", error_from_common(
+        vec_chunk_resize(chunks, required)));
+}
 
-        return;
+// Accounts for `len` bytes appended to the entry.
+//
+// Returns the shard that has to judge the entry again (see `cache_shard_readmit`), or `NULL`.
+// The entry lock must be held.
+static cache_shard_t *cache_entry_grow_unsync(cache_entry_t *entry, size_t len) {
+    entry->size += len;
+    cache_shard_t *shard = entry->shard;
+
+    if (shard == NULL || !entry->committed) {
+        return NULL;
     }
 
-    entry->state = state;
-    cache_entry_wake_unsync(entry);
-}
+    size_t current_size = atomic_fetch_add(&shard->current_size, len) + len;
 
-void cache_rd_set_on_read(cache_rd_t *self, cache_on_read_cb_t on_read) {
-    self->on_read = on_read;
-}
+    // checking once per chunk is enough to catch the entry before it displaces much
+    if (!entry->provisional
+            || current_size <= shard->size_limit
+            || entry->size - entry->checked_size < CACHE_CHUNK_SIZE) {
+        return NULL;
+    }
 
-void cache_rd_set_on_update(cache_rd_t *self, cache_on_update_cb_t on_update) {
-    self->on_update = on_update;
+    entry->checked_size = entry->size;
+
+    return shard;
 }
 
-size_t cache_rd_read(cache_rd_t *self, char *buf, size_t size, bool *eof) {
-    arc_entry_t *arc = self->entry;
-    cache_entry_t *entry = arc_entry_get(arc);
+// Runs the admission check again for an entry of unknown size that has outgrown the shard's budget.
+//
+// If it loses to the next eviction victim, the entry is dropped from the cache before anything is
+// evicted to make room for it. The existing handles can still use it.
+static void cache_shard_readmit(cache_shard_t *self, cache_entry_t *entry) {
 #ifndef WAXY_PTHREADS_DISABLED
-    assert_mutex_lock(&entry->mtx);
+    assert_rwlock_wrlock(&self->lock);
 #endif
 
-    size_t unread_count = string_len(&entry->buf) - self->count;
+    dlist_entry_node_t **ptr = hash_entry_get_mut(&self->map, &(url_t const *) { &entry->url });
 
-    if (size > unread_count) {
-        size = unread_count;
+    // the entry may have been evicted or replaced in the meantime
+    if (ptr == NULL || cache_node_entry(*ptr) != entry) {
+        goto done;
     }
 
-    memcpy(buf, string_as_cptr(&entry->buf) + self->count, size);
-    self->count += size;
+    dlist_entry_node_t *victim = self->policy->peek_victim(self);
 
-    if (entry->state != CACHE_ENTRY_PARTIAL && self->count >= string_len(&entry->buf)) {
-        *eof = true;
+    if (victim != NULL && victim != *ptr && !cache_shard_admit_unsync(self, &entry->url, 0)) {
+        log_printf(LOG_DEBUG, "The entry has outgrown its admission and was dropped from the cache");
+        cache_remove_entry_unsync(self, *ptr);
     }
 
+done:
 #ifndef WAXY_PTHREADS_DISABLED
-    assert_mutex_unlock(&entry->mtx);
+    assert_rwlock_unlock(&self->lock);
 #endif
-
-    return size;
 }
 
-void cache_wr_free(cache_wr_t *self) {
-    if (self == NULL) return;
+error_t *cache_wr_write(cache_wr_t *self, slice_t slice) {
+    error_t *err = NULL;
+    cache_shard_t *readmit_shard = NULL;
+
+    if (slice.len == 0) {
+        return err;
+    }
 
     arc_entry_t *arc = self->entry;
     cache_entry_t *entry = arc_entry_get(arc);
+
+    // Nobody but us modifies `entry->chunks`, and the readers never look past the published length
+    // of a chunk.
+    // Thus the data can be copied without holding the lock, which is only necessary to publish it.
+    size_t chunk_count = vec_chunk_len(&entry->chunks);
+    size_t tail_count = 0;
+
+    if (chunk_count > 0) {
+        cache_chunk_slot_t const *tail = vec_chunk_get(&entry->chunks, chunk_count - 1);
+        cache_chunk_t *chunk = arc_chunk_get(tail->chunk);
+        tail_count = chunk->capacity - tail->len;
+
+        if (tail_count > slice.len) {
+            tail_count = slice.len;
+        }
+
+        memcpy(chunk->data + tail->len, slice.base, tail_count);
+    }
+
+    size_t remaining = slice.len - tail_count;
+    vec_chunk_t fresh = vec_chunk_new();
+    err = cache_chunks_reserve(&fresh, (remaining + CACHE_CHUNK_SIZE - 1) / CACHE_CHUNK_SIZE);
+    if (err) goto fresh_reserve_fail;
+
+    for (size_t offset = tail_count; offset < slice.len; offset += CACHE_CHUNK_SIZE) {
+        size_t len = slice.len - offset;
+
+        if (len > CACHE_CHUNK_SIZE) {
+            len = CACHE_CHUNK_SIZE;
+        }
+
+        arc_chunk_t *chunk = NULL;
+        err = cache_chunk_new(&chunk);
+        if (err) goto chunk_new_fail;
+
+        memcpy(arc_chunk_get(chunk)->data, slice.base + offset, len);
+
+        // the capacity has been reserved above
+        error_assert(error_from_common(vec_chunk_push(&fresh, (cache_chunk_slot_t) {
+            .chunk = chunk,
+            .len = len,
+        })));
+    }
+
 #ifndef WAXY_PTHREADS_DISABLED
     assert_mutex_lock(&entry->mtx);
 #endif
 
-    if (entry->state == CACHE_ENTRY_PARTIAL) {
-        cache_entry_set_state_unsync(entry, CACHE_ENTRY_INVALID);
+    err = error_wrap("Writing to a complete entry", OK_IF(entry->state != CACHE_ENTRY_COMPLETE));
+    if (err) goto complete_fail;
+
+    err = cache_chunks_reserve(&entry->chunks, vec_chunk_len(&fresh));
+    if (err) goto reserve_fail;
+
+    if (tail_count > 0) {
+        vec_chunk_get_mut(&entry->chunks, chunk_count - 1)->len += tail_count;
+    }
+
+    for (size_t i = 0; i < vec_chunk_len(&fresh); ++i) {
+        error_assert(error_from_common(
+            vec_chunk_push(&entry->chunks, *vec_chunk_get(&fresh, i))));
     }
 
+    vec_chunk_clear(&fresh);
+    readmit_shard = cache_entry_grow_unsync(entry, slice.len);
+    cache_entry_wake_unsync(entry);
+
+reserve_fail:
+complete_fail:
 #ifndef WAXY_PTHREADS_DISABLED
     assert_mutex_unlock(&entry->mtx);
 #endif
-    arc_entry_free(arc);
-    free(self);
+
+    if (readmit_shard != NULL) {
+        cache_shard_readmit(readmit_shard, entry);
+    }
+
+chunk_new_fail:
+    for (size_t i = 0; i < vec_chunk_len(&fresh); ++i) {
+        arc_chunk_free(vec_chunk_get(&fresh, i)->chunk);
+    }
+
+fresh_reserve_fail:
+    vec_chunk_free(&fresh);
+
+    return err;
 }
 
-error_t *cache_wr_write(cache_wr_t *self, slice_t slice) {
+error_t *cache_wr_adopt(
+    cache_wr_t *self,
+    slice_t slice,
+    cache_release_cb_t release,
+    void *release_data
+) {
     error_t *err = NULL;
+    cache_shard_t *readmit_shard = NULL;
+
+    // a short slice would pin much more memory than it holds
+    if (slice.len < CACHE_ADOPT_MIN_SIZE) {
+        err = cache_wr_write(self, slice);
+        release(release_data);
 
-    if (slice.len == 0) {
         return err;
     }
 
     arc_entry_t *arc = self->entry;
     cache_entry_t *entry = arc_entry_get(arc);
+
+    // the chunk is full from the start, so nothing is ever appended to the borrowed memory
+    arc_chunk_t *chunk = NULL;
+    err = cache_chunk_wrap((char *) slice.base, slice.len, release, release_data, &chunk);
+    if (err) goto wrap_fail;
+
 #ifndef WAXY_PTHREADS_DISABLED
     assert_mutex_lock(&entry->mtx);
 #endif
@@ -673,23 +2193,30 @@ error_t *cache_wr_write(cache_wr_t *self, slice_t slice) {
     err = error_wrap("Writing to a complete entry", OK_IF(entry->state != CACHE_ENTRY_COMPLETE));
     if (err) goto complete_fail;
 
-    err = error_from_common(string_append_slice(&entry->buf, slice.base, slice.len));
-    if (err) goto append_fail;
-
-    cache_t *cache = entry->cache;
-
-    if (cache != NULL && entry->committed) {
-        atomic_fetch_add(&cache->current_size, slice.len);
-    }
+    err = cache_chunks_reserve(&entry->chunks, 1);
+    if (err) goto reserve_fail;
 
+    error_assert(error_from_common(vec_chunk_push(&entry->chunks, (cache_chunk_slot_t) {
+        .chunk = chunk,
+        .len = slice.len,
+    })));
+    chunk = NULL;
+    readmit_shard = cache_entry_grow_unsync(entry, slice.len);
     cache_entry_wake_unsync(entry);
 
-append_fail:
+reserve_fail:
 complete_fail:
 #ifndef WAXY_PTHREADS_DISABLED
     assert_mutex_unlock(&entry->mtx);
 #endif
 
+    if (readmit_shard != NULL) {
+        cache_shard_readmit(readmit_shard, entry);
+    }
+
+    arc_chunk_free(chunk);
+
+wrap_fail:
     return err;
 }
 
@@ -707,30 +2234,16 @@ void cache_wr_complete(cache_wr_t *self) {
 #endif
 }
 
-error_t *cache_wr_commit(cache_wr_t *self) {
+// Commits the entry to its shard.
+//
+// Both the entry lock and the shard lock (exclusively) must be held.
+static error_t *cache_commit_unsync(cache_shard_t *shard, arc_entry_t *arc, size_t expected_size) {
     error_t *err = NULL;
 
-    arc_entry_t *arc = self->entry;
     cache_entry_t *entry = arc_entry_get(arc);
-#ifndef WAXY_PTHREADS_DISABLED
-    assert_mutex_lock(&entry->mtx);
-#endif
-
-    if (entry->committed) {
-        goto committed;
-    }
-
-    cache_t *cache = entry->cache;
-    assert(cache != NULL);
-
-    // There are no references to this entry in the cache yet.
-    // Therefore, the cache can't possibly be able to lock entry->mtx, which would cause a deadlock.
-#ifndef WAXY_PTHREADS_DISABLED
-    assert_mutex_lock(&cache->mtx);
-#endif
 
     dlist_entry_node_t **stored_node_ptr = hash_entry_get_mut(
-        &cache->map,
+        &shard->map,
         &(url_t const *) { &entry->url }
     );
 
@@ -739,48 +2252,85 @@ error_t *cache_wr_commit(cache_wr_t *self) {
         arc_entry_t *stored_arc = *dlist_entry_get_mut(stored_node);
         cache_entry_t *stored_entry = arc_entry_get(stored_arc);
 
-        // deadlock-safe for the same reason as above: nobody knows about us yet
+        // deadlock-safe: nobody knows about the entry being committed yet
 #ifndef WAXY_PTHREADS_DISABLED
         assert_mutex_lock(&stored_entry->mtx);
 #endif
-        size_t stored_size = string_len(&stored_entry->buf);
+        size_t stored_size = stored_entry->size;
 #ifndef WAXY_PTHREADS_DISABLED
         assert_mutex_unlock(&stored_entry->mtx);
 #endif
 
-        if (stored_size < string_len(&entry->buf)) {
-            goto success;
+        if (stored_size < entry->size) {
+            return err;
         }
 
-        cache_remove_entry_unsync(cache, stored_node);
+        cache_remove_entry_unsync(shard, stored_node);
+    } else if (!cache_shard_admit_unsync(
+            shard,
+            &entry->url,
+            expected_size == CACHE_SIZE_UNKNOWN || expected_size < entry->size
+                ? entry->size
+                : expected_size)) {
+        log_printf(LOG_DEBUG, "The entry was not admitted to the cache");
+
+        return err;
     }
 
     dlist_entry_node_t *node = NULL;
     arc_entry_t *arc_shared = arc_entry_share(arc);
-    err = error_wrap("Could not register the entry in the cache", error_from_common(
-        dlist_entry_append(&cache->entries, arc_shared, &node)));
-    if (err) goto dlist_append_fail;
+    err = shard->policy->insert(shard, arc_shared, &node);
+    if (err) goto insert_fail;
 
     arc_shared = NULL;
 
     err = error_wrap("Could not bind the URL to the entry", error_from_common(
-        hash_entry_insert(&cache->map, &entry->url, node)));
+        hash_entry_insert(&shard->map, &entry->url, node)));
     if (err) goto hash_insert_fail;
 
-    cache->current_size += string_len(&entry->buf);
+    shard->current_size += entry->size;
     entry->committed = true;
+    entry->provisional = expected_size == CACHE_SIZE_UNKNOWN;
+    entry->checked_size = entry->size;
 
-    goto success;
+    return err;
 
 hash_insert_fail:
-    arc_shared = dlist_entry_remove(&cache->entries, node);
+    shard->policy->on_remove(shard, node);
+    arc_shared = dlist_entry_remove(&shard->queues[entry->queue], node);
 
-dlist_append_fail:
+insert_fail:
     arc_entry_free(arc_shared);
 
-success:
+    return err;
+}
+
+error_t *cache_wr_commit(cache_wr_t *self, size_t expected_size) {
+    error_t *err = NULL;
+
+    arc_entry_t *arc = self->entry;
+    cache_entry_t *entry = arc_entry_get(arc);
+#ifndef WAXY_PTHREADS_DISABLED
+    assert_mutex_lock(&entry->mtx);
+#endif
+
+    if (entry->committed) {
+        goto committed;
+    }
+
+    cache_shard_t *shard = entry->shard;
+    assert(shard != NULL);
+
+    // There are no references to this entry in the cache yet.
+    // Therefore, the shard can't possibly be able to lock entry->mtx, which would cause a deadlock.
+#ifndef WAXY_PTHREADS_DISABLED
+    assert_rwlock_wrlock(&shard->lock);
+#endif
+
+    err = cache_commit_unsync(shard, arc, expected_size);
+
 #ifndef WAXY_PTHREADS_DISABLED
-    assert_mutex_unlock(&cache->mtx);
+    assert_rwlock_unlock(&shard->lock);
 #endif
 
 committed:
@@ -794,3 +2344,243 @@ committed:
 url_t const *cache_wr_url(cache_wr_t const *self) {
     return &arc_entry_get(self->entry)->url;
 }
+
+// The entry lock must be held.
+static error_t *cache_entry_set_freshness_unsync(
+    cache_entry_t *entry,
+    time_t fresh_until,
+    slice_t etag,
+    slice_t last_modified
+) {
+    error_t *err = NULL;
+
+    char *validators = NULL;
+
+    if (etag.len + last_modified.len > 0) {
+        validators = malloc(etag.len + last_modified.len);
+        err = error_wrap("Could not allocate the validators", OK_IF(validators != NULL));
+        if (err) goto malloc_fail;
+
+        // an absent validator may have a null base, which memcpy does not accept
+        if (etag.len > 0) {
+            memcpy(validators, etag.base, etag.len);
+        }
+
+        if (last_modified.len > 0) {
+            memcpy(validators + etag.len, last_modified.base, last_modified.len);
+        }
+    }
+
+    free(entry->validators);
+    entry->validators = validators;
+    entry->etag_len = etag.len;
+    entry->last_modified_len = last_modified.len;
+    entry->fresh_until = fresh_until;
+
+malloc_fail:
+    return err;
+}
+
+error_t *cache_wr_set_freshness(
+    cache_wr_t *self,
+    time_t fresh_until,
+    slice_t etag,
+    slice_t last_modified
+) {
+    error_t *err = NULL;
+
+    cache_entry_t *entry = arc_entry_get(self->entry);
+#ifndef WAXY_PTHREADS_DISABLED
+    assert_mutex_lock(&entry->mtx);
+#endif
+
+    err = cache_entry_set_freshness_unsync(entry, fresh_until, etag, last_modified);
+
+#ifndef WAXY_PTHREADS_DISABLED
+    assert_mutex_unlock(&entry->mtx);
+#endif
+
+    return err;
+}
+
+bool cache_wr_revalidation(cache_wr_t const *self, slice_t *etag, slice_t *last_modified) {
+    if (self->stale == NULL) {
+        return false;
+    }
+
+    // the validators of a complete entry are never modified
+    cache_entry_t const *stale = arc_entry_get(self->stale);
+
+    *etag = (slice_t) { .base = stale->validators, .len = stale->etag_len };
+    *last_modified = (slice_t) {
+        .base = stale->validators + stale->etag_len,
+        .len = stale->last_modified_len,
+    };
+
+    return true;
+}
+
+error_t *cache_wr_reuse_stale(cache_wr_t *self, time_t fresh_until) {
+    error_t *err = NULL;
+
+    err = error_wrap("The entry is not being revalidated", OK_IF(self->stale != NULL));
+    if (err) goto not_revalidating;
+
+    cache_entry_t *stale = arc_entry_get(self->stale);
+    vec_chunk_t chunks = vec_chunk_new();
+
+    // the stale entry may be read concurrently, so take the references under its lock and publish
+    // them under ours to avoid nesting the locks
+#ifndef WAXY_PTHREADS_DISABLED
+    assert_mutex_lock(&stale->mtx);
+#endif
+
+    err = cache_chunks_reserve(&chunks, vec_chunk_len(&stale->chunks));
+
+    if (!err) {
+        for (size_t i = 0; i < vec_chunk_len(&stale->chunks); ++i) {
+            cache_chunk_slot_t slot = *vec_chunk_get(&stale->chunks, i);
+            slot.chunk = arc_chunk_share(slot.chunk);
+            error_assert(error_from_common(vec_chunk_push(&chunks, slot)));
+        }
+
+        // the entry stays in the shard, so the later fetches can hit it again
+        stale->fresh_until = fresh_until;
+    }
+
+    size_t size = stale->size;
+
+#ifndef WAXY_PTHREADS_DISABLED
+    assert_mutex_unlock(&stale->mtx);
+#endif
+
+    if (err) goto stale_reserve_fail;
+
+    cache_entry_t *entry = arc_entry_get(self->entry);
+#ifndef WAXY_PTHREADS_DISABLED
+    assert_mutex_lock(&entry->mtx);
+#endif
+
+    err = error_wrap("Reusing the stale entry after writing to the new one",
+        OK_IF(entry->size == 0));
+    if (err) goto written_fail;
+
+    err = cache_chunks_reserve(&entry->chunks, vec_chunk_len(&chunks));
+    if (err) goto reserve_fail;
+
+    for (size_t i = 0; i < vec_chunk_len(&chunks); ++i) {
+        error_assert(error_from_common(
+            vec_chunk_push(&entry->chunks, *vec_chunk_get(&chunks, i))));
+    }
+
+    vec_chunk_clear(&chunks);
+    entry->size = size;
+    entry->fresh_until = fresh_until;
+    cache_entry_set_state_unsync(entry, CACHE_ENTRY_COMPLETE);
+
+reserve_fail:
+written_fail:
+#ifndef WAXY_PTHREADS_DISABLED
+    assert_mutex_unlock(&entry->mtx);
+#endif
+
+stale_reserve_fail:
+    for (size_t i = 0; i < vec_chunk_len(&chunks); ++i) {
+        arc_chunk_free(vec_chunk_get(&chunks, i)->chunk);
+    }
+
+    vec_chunk_free(&chunks);
+
+not_revalidating:
+    return err;
+}
+
+// Looks the url up in the disk tier and, if it's there, promotes it to a new uncommitted entry
+// backed by the mapped record.
+//
+// The freshness of the entry is derived from the stored response headers.
+// Sets `*result` to a reference to the entry, or `NULL` if it's not in the disk tier.
+//
+// Verifying the record pages it in, so the shard lock must not be held.
+static error_t *cache_shard_load(
+    cache_shard_t *self,
+    url_t const *url,
+    time_t now,
+    arc_entry_t **result
+) {
+    error_t *err = NULL;
+
+    *result = NULL;
+
+    disk_mapping_t *mapping = NULL;
+    err = disk_load(self->disk, cache_url_key(url), &mapping);
+
+    if (err) {
+        // the disk tier is best-effort, so this is just a miss
+        err = error_wrap("Could not load an entry from the disk cache", err);
+        error_log_free(&err, LOG_WARN, ERROR_VERBOSITY_SOURCE_CHAIN);
+    }
+
+    if (mapping == NULL) goto load_fail;
+
+    slice_t data = disk_mapping_data(mapping);
+    arc_chunk_t *chunk = NULL;
+    err = cache_chunk_wrap(
+        (char *) data.base,
+        data.len,
+        (cache_release_cb_t) disk_mapping_free,
+        mapping,
+        &chunk
+    );
+    if (err) goto wrap_fail;
+
+    cache_wr_t *wr = NULL;
+    err = cache_create_entry_unsync(self, url, NULL, NULL, &wr);
+    if (err) goto create_fail;
+
+    arc_entry_t *arc = wr->entry;
+    cache_entry_t *entry = arc_entry_get(arc);
+
+#ifndef WAXY_PTHREADS_DISABLED
+    assert_mutex_lock(&entry->mtx);
+#endif
+
+    err = cache_chunks_reserve(&entry->chunks, 1);
+
+    if (!err) {
+        error_assert(error_from_common(vec_chunk_push(&entry->chunks, (cache_chunk_slot_t) {
+            .chunk = chunk,
+            .len = data.len,
+        })));
+        chunk = NULL;
+
+        entry->size = data.len;
+        entry->on_disk = true;
+        cache_entry_set_state_unsync(entry, CACHE_ENTRY_COMPLETE);
+
+        http_cache_info_t info;
+
+        // a record without parseable headers is kept, but always refetched
+        if (http_cache_info_from_response(data, now, &info)) {
+            err = cache_entry_set_freshness_unsync(entry, info.fresh_until, info.etag,
+                info.last_modified);
+        }
+    }
+
+#ifndef WAXY_PTHREADS_DISABLED
+    assert_mutex_unlock(&entry->mtx);
+#endif
+
+    if (!err) {
+        *result = arc_entry_share(arc);
+    }
+
+    cache_wr_free(wr);
+
+create_fail:
+    arc_chunk_free(chunk);
+
+wrap_fail:
+load_fail:
+    return err;
+}
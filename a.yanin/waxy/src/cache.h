@@ -1,5 +1,8 @@
 #pragma once
 
+#include <stdint.h>
+#include <time.h>
+
 #include "url.h"
 
 #include <common/error.h>
@@ -12,9 +15,62 @@ typedef enum {
     CACHE_ENTRY_INVALID,
 } cache_entry_state_t;
 
-// An in-memory asynchronous LRU streaming HTTP cache.
+// An asynchronous streaming HTTP cache.
+//
+// The cache is split into several independently locked shards, each managing its own share of the
+// size budget.
+//
+// The entries are kept in memory, optionally backed by a disk tier for the evicted ones.
 typedef struct cache cache_t;
 
+// An eviction policy.
+typedef enum {
+    // Evicts the least recently used entry.
+    //
+    // Every hit reorders the entries and therefore has to lock the shard exclusively.
+    CACHE_POLICY_LRU,
+
+    // Approximates LRU with a reference bit per entry.
+    CACHE_POLICY_CLOCK,
+
+    // Filters out one-hit wonders with a small FIFO queue before admitting entries to the main one.
+    CACHE_POLICY_S3_FIFO,
+} cache_policy_t;
+
+// An admission policy, which decides whether a committed entry is retained.
+typedef enum {
+    // Every committed entry is retained.
+    CACHE_ADMISSION_ALWAYS,
+
+    // Once the shard is full, a new entry is only retained if its url has been requested more
+    // often recently than the url of the entry it would displace.
+    CACHE_ADMISSION_TINYLFU,
+} cache_admission_t;
+
+// The expected size of an entry whose final size isn't known in advance.
+#define CACHE_SIZE_UNKNOWN SIZE_MAX
+
+typedef struct {
+    // The total size of the entries the cache retains, in bytes.
+    size_t size_limit;
+
+    // The number of shards the cache is split into.
+    //
+    // Zero is treated as one.
+    size_t shard_count;
+
+    cache_policy_t policy;
+    cache_admission_t admission;
+
+    // The directory for the disk tier, which stores the entries evicted from memory.
+    //
+    // If `NULL`, the evicted entries are discarded.
+    char const *disk_path;
+
+    // The total size of the disk tier, in bytes.
+    size_t disk_size_limit;
+} cache_config_t;
+
 // An entry in the cache.
 typedef struct cache_entry cache_entry_t;
 
@@ -44,25 +100,39 @@ typedef struct cache_wr cache_wr_t;
 // freed.
 typedef struct cache_rd cache_rd_t;
 
+// A read-only view of a piece of an entry body.
+//
+// The view keeps the memory it points to alive until it's released with `cache_span_release`,
+// even if the entry is evicted in the meantime.
+typedef struct {
+    slice_t slice;
+    void *storage;
+} cache_span_t;
+
 typedef error_t *(*cache_on_hit_cb_t)(void *data, cache_rd_t *rd);
 typedef error_t *(*cache_on_miss_cb_t)(void *data, cache_rd_t *rd, cache_wr_t *wr);
 typedef error_t *(*cache_on_read_cb_t)(cache_rd_t *rd, loop_t *loop);
 typedef error_t *(*cache_on_update_cb_t)(cache_rd_t *rd, loop_t *loop, cache_entry_state_t state);
 
 // Creates a new cache.
-error_t *cache_new(size_t size_limit, cache_t **result);
+error_t *cache_new(cache_config_t const *config, cache_t **result);
 
 // Frees the cache and releases references to all the contained entries.
 //
+// If there is a disk tier, the complete entries are written to it first, so they can be served
+// after a restart.
+//
 // It must be ensured that no cache entries that were part of the cache are alive.
 void cache_free(cache_t *self);
 
 // Fetches an entry from the cache.
 //
-// If an entry is present and valid, the `on_hit` callback is invoked immediately with a newly
-// created read handle provided.
+// If an entry is present, valid and fresh (see `cache_wr_set_freshness`), the `on_hit` callback is
+// invoked immediately with a newly created read handle provided.
 //
 // Otherwise the `on_miss` callback is invoked and a write handle is supplied to it.
+// If the entry is stale but has validators, the write handle can be used to revalidate it (see
+// `cache_wr_revalidation`).
 // Note that in this case the entry must be explicitly committed to the cache once is cacheability
 // is determined.
 // Therefore, if multiple calls to `fetch` happen simultaneously, several new entries may be created
@@ -96,6 +166,38 @@ void cache_rd_set_on_update(cache_rd_t *self, cache_on_update_cb_t on_update);
 // `*eof` is set to `true` if this read has returned the last unread data of a completed entry.
 size_t cache_rd_read(cache_rd_t *self, char *buf, size_t size, bool *eof);
 
+// Like `cache_rd_read`, but instead of copying the data, stores views of up to `size` bytes of it in
+// `spans`.
+//
+// Returns the number of spans stored, at most `max_count`.
+// Each of them must be released with `cache_span_release`.
+size_t cache_rd_read_spans(
+    cache_rd_t *self,
+    size_t max_count,
+    cache_span_t spans[static max_count],
+    size_t size,
+    bool *eof
+);
+
+// Moves the read position to `offset` bytes from the start of the entry.
+//
+// The offset may lie past the data written so far: the handle is then only notified once the entry
+// grows beyond it.
+//
+// This must be called from a synchronized context.
+void cache_rd_seek(cache_rd_t *self, size_t offset);
+
+// Stops or resumes the processing of the entry updates.
+//
+// While the handle is paused, neither callback is invoked; the updates that happen in the meantime
+// are delivered once it's resumed.
+//
+// Unlike the rest of the methods, this may be called from any context.
+void cache_rd_set_paused(cache_rd_t *self, bool paused);
+
+// Releases the reference to the memory the span points to.
+void cache_span_release(cache_span_t *self);
+
 // Frees the write handle.
 //
 // If the entry was not marked as complete, it is invalidated as a result of this call.
@@ -106,6 +208,22 @@ void cache_wr_free(cache_wr_t *self);
 // All the read handles are notified of the newly available data.
 error_t *cache_wr_write(cache_wr_t *self, slice_t slice);
 
+// Called once the cache no longer needs the memory handed over to it.
+typedef void (*cache_release_cb_t)(void *data);
+
+// Appends a slice to the entry buffer like `cache_wr_write`, but takes over the memory it points
+// to instead of copying it.
+//
+// `release(release_data)` is called once the memory is no longer needed, which may happen before
+// this function returns (e.g., if it fails, or if the slice is short enough to be copied instead).
+// The memory must not be modified until then.
+error_t *cache_wr_adopt(
+    cache_wr_t *self,
+    slice_t slice,
+    cache_release_cb_t release,
+    void *release_data
+);
+
 // Marks the associated cache entry as complete.
 //
 // All the read handles are notified of the updated entry state.
@@ -118,8 +236,43 @@ void cache_wr_complete(cache_wr_t *self);
 // If there already is an entry for this resource, it will be replaced if this entry has
 // more written data.
 //
+// Otherwise the admission policy may decline to retain the entry.
+// It can still be written to and read from by the existing handles.
+// The policy judges the entry by `expected_size`, the size it's going to have once complete.
+// If that is `CACHE_SIZE_UNKNOWN`, the entry is judged again each time it grows past the shard's
+// budget, and it's dropped from the cache instead of displacing a more popular entry.
+//
 // After this call new fetches to the resource would return a handle to this entry.
-error_t *cache_wr_commit(cache_wr_t *self);
+error_t *cache_wr_commit(cache_wr_t *self, size_t expected_size);
 
 // Returns the URL associated with the cache entry.
 url_t const *cache_wr_url(cache_wr_t const *self);
+
+// Sets the freshness properties of the associated entry.
+//
+// The entry is served without revalidation until `fresh_until` (seconds since the epoch).
+// The validators are used for the conditional requests once it goes stale; either may be empty.
+// They're copied.
+//
+// By default, a complete entry is stale right away.
+error_t *cache_wr_set_freshness(
+    cache_wr_t *self,
+    time_t fresh_until,
+    slice_t etag,
+    slice_t last_modified
+);
+
+// Checks whether the handle was created to revalidate a stale entry.
+//
+// If so, stores the validators of the stale entry (either may be empty) and returns `true`.
+// The slices stay valid as long as the handle is alive.
+bool cache_wr_revalidation(cache_wr_t const *self, slice_t *etag, slice_t *last_modified);
+
+// Completes the associated entry with the data of the stale one, which has been confirmed to be
+// still valid (e.g., by a `304 Not Modified` response).
+//
+// Both entries are then considered fresh until `fresh_until`.
+// The stale entry stays in the cache, so the associated entry doesn't have to be committed.
+//
+// Nothing must have been written to the associated entry.
+error_t *cache_wr_reuse_stale(cache_wr_t *self, time_t fresh_until);
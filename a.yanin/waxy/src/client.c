@@ -1,6 +1,8 @@
 #include "client.h"
 
 #include <assert.h>
+#include <stdatomic.h>
+#include <stdint.h>
 #include <stdlib.h>
 
 #ifndef WAXY_PTHREADS_DISABLED
@@ -12,6 +14,8 @@
 #include <common/error-codes/adapter.h>
 
 #include "cache.h"
+#include "http.h"
+#include "tunnel.h"
 #include "util.h"
 #include "upstream.h"
 
@@ -21,29 +25,93 @@ enum {
     MAX_HEADERS = 512,
     // have you ever seen an HTTP GET request larger than 16 MiB? me neither.
     MAX_REQUEST_SIZE = 16 * 1024 * 1024,
-    CACHE_BUFFER_SIZE = 4 * 1024 * 1024,
+    // the maximum number of requests waiting behind the one being answered
+    MAX_PIPELINED_REQUESTS = 16,
+    // the maximum amount of data sent to a client in a single write request
+    CACHE_WRITE_SIZE = 4 * 1024 * 1024,
+    // the maximum number of cache chunks referenced by a single write request
+    CACHE_WRITE_SPANS = 64,
+    // the cached response head is expected to fit in this many bytes to be relayed
+    MAX_RESPONSE_HEAD_SIZE = 64 * 1024,
+    // ...and to have at most this many headers
+    MAX_RESPONSE_HEADERS = 256,
+    // the size of the buffer the cached response head is read in
+    RESPONSE_HEAD_READ_SIZE = 4096,
 };
 
+typedef enum {
+    // waiting for the cached response head to determine how to serve the response
+    CLIENT_BODY_HEAD,
+    // the rest of the cache entry is sent after the head
+    CLIENT_BODY_FULL,
+    // a range of the cached response body is sent after a synthesized head
+    CLIENT_BODY_RANGE,
+} client_body_state_t;
+
+typedef cache_rd_t *cache_rd_ptr_t;
+
+#define DLIST_ELEMENT_TYPE cache_rd_ptr_t
+#define DLIST_LABEL rd
+#define DLIST_CONFIG (COLLECTION_DECLARE | COLLECTION_DEFINE | COLLECTION_STATIC)
+#include <common/collections/dlist.h>
+
+typedef struct client_ctx client_ctx_t;
+
 // This struct is owned by the TCP handler (`tcp`).
-// A reference to it is kept as the custom data of `rd`.
-typedef struct {
+// A reference to it is kept by each request in progress.
+struct client_ctx {
 #ifndef WAXY_PTHREADS_DISABLED
+    // guards `tcp`
     pthread_mutex_t mtx;
 #endif
     cache_t *cache;
+    resolver_t *resolver;
+    pool_t *pool;
+    client_config_t const *config;
+    tcp_handler_t *tcp;
+
+    // the following fields are only accessed from the TCP handler's context
+
+    // the received data not yet processed as requests
     string_t buf;
     struct phr_header *headers;
-    tcp_handler_t *tcp;
-    cache_rd_t *rd;
-    bool request_processed;
-} client_ctx_t;
+    // the read handle sending the current response, or `NULL` if there's none;
+    // the handle resets it if it's freed first, as happens when the loop is stopped
+    _Atomic(cache_rd_t *) rd;
+    // the read handles of the pipelined requests waiting for their turn, in order;
+    // they're not registered in the loop until then
+    dlist_rd_t pending;
+    // `false` while the pipeline is full
+    bool reading;
+    // no more requests are accepted: the connection is closed once the responses are sent
+    bool closing;
+    bool closed;
+    // the error response to send before closing the connection, if any
+    slice_t const *farewell;
+    // instead of being closed, the connection is handed over to a tunnel (CONNECT)
+    bool tunnel;
+    string_t tunnel_host;
+    uint16_t tunnel_port;
+
+    // the following fields may be accessed from any context
+
+    // the number of bytes of response data queued for sending
+    atomic_size_t buffered;
+    // the current read handle has been paused until the queue drains
+    atomic_bool throttled;
+};
 
 static void client_ctx_free(client_ctx_t *ctx) {
 #ifndef WAXY_PTHREADS_DISABLED
     pthread_mutex_destroy(&ctx->mtx);
 #endif
 
+    if (ctx->tunnel) {
+        string_free(&ctx->tunnel_host);
+    }
+
     string_free(&ctx->buf);
+    dlist_rd_free(&ctx->pending);
     free(ctx->headers);
     free(ctx);
 }
@@ -54,54 +122,196 @@ static void client_ctx_free(client_ctx_t *ctx) {
 #define ARC_CONFIG (COLLECTION_DECLARE | COLLECTION_DEFINE | COLLECTION_STATIC)
 #include <common/memory/arc.h>
 
-static void client_on_free(handler_t *tcp_handler) {
-    arc_ctx_t *arc = handler_custom_data(tcp_handler);
+// The state of the response to a single request.
+//
+// This struct is owned by the read handle the response is fetched with.
+typedef struct {
+    arc_ctx_t *ctx;
+    int minor_version;
+    // the client wants the connection to persist
+    bool keep_alive;
+    bool has_range;
+    http_range_t range;
+
+    client_body_state_t body_state;
+    // the cached response head read so far; only valid in the `CLIENT_BODY_HEAD` state
+    string_t head;
+    // a response head to send before the entry data
+    string_t prefix;
+    bool has_prefix;
+    // the number of bytes left to send from the entry, or `SIZE_MAX` if unlimited
+    size_t remaining;
+    // the connection has to be closed after the response
+    bool close;
+    // the last write request has been made
+    bool done;
+} client_req_t;
+
+static error_t *client_req_new(
+    arc_ctx_t *arc,
+    int minor_version,
+    bool keep_alive,
+    client_req_t **result
+) {
+    error_t *err = NULL;
+
+    client_req_t *req = calloc(1, sizeof(client_req_t));
+    err = error_wrap("Could not allocate the request state", OK_IF(req != NULL));
+    if (err) goto calloc_fail;
+
+    err = error_wrap("Could not allocate a buffer", error_from_common(string_new(&req->head)));
+    if (err) goto string_new_fail;
+
+    req->ctx = arc_ctx_share(arc);
+    req->minor_version = minor_version;
+    req->keep_alive = keep_alive;
+    req->has_range = false;
+    req->body_state = CLIENT_BODY_HEAD;
+    req->has_prefix = false;
+    req->remaining = SIZE_MAX;
+    req->close = false;
+    req->done = false;
+    *result = req;
+
+    return err;
+
+string_new_fail:
+    free(req);
+
+calloc_fail:
+    return err;
+}
+
+static void client_req_free(client_req_t *req) {
+    if (req->body_state == CLIENT_BODY_HEAD) {
+        string_free(&req->head);
+    }
+
+    if (req->has_prefix) {
+        string_free(&req->prefix);
+    }
+
+    arc_ctx_free(req->ctx);
+    free(req);
+}
+
+// Starts or stops counting down the idle timeout.
+//
+// Must be called from the TCP handler's context.
+static void client_set_idle(client_ctx_t *ctx, bool idle) {
+    uint64_t timeout_ms = idle ? (uint64_t) ctx->config->idle_timeout * 1000 : 0;
+    tcp_set_timeout(ctx->tcp, TCP_TIMEOUT_IDLE, timeout_ms);
+}
+
+// Closes the connection once it's been idle for too long or the client has stopped reading the
+// response.
+static error_t *client_on_timeout(loop_t *, tcp_handler_t *handler, tcp_timeout_t timeout) {
+    char ip[INET6_ADDRSTRLEN] = {0};
+    uint16_t port = 0;
+    tcp_remote_info(handler, ip, &port);
+
+    if (timeout == TCP_TIMEOUT_IDLE) {
+        log_printf(LOG_INFO, "Closing the idle connection from %s:%u", ip, port);
+    } else {
+        log_printf(LOG_INFO, "Closing the connection from %s:%u: the client has stalled", ip, port);
+    }
+
+    handler_unregister((handler_t *) handler);
+
+    return NULL;
+}
+
+// Releases the context once the TCP handler no longer belongs to it.
+static void client_detach(arc_ctx_t *arc) {
     client_ctx_t *ctx = arc_ctx_get(arc);
+
 #ifndef WAXY_PTHREADS_DISABLED
     assert_mutex_lock(&ctx->mtx);
 #endif
 
     ctx->tcp = NULL;
+    cache_rd_t *rd = atomic_exchange(&ctx->rd, NULL);
 
-    if (ctx->rd) {
-        handler_t *rd = (handler_t *) ctx->rd;
-        handler_unregister(rd);
+    // the lock keeps the handle from being freed in the meantime (see `client_on_rd_free`)
+    if (rd != NULL) {
+        handler_unregister((handler_t *) rd);
     }
 
 #ifndef WAXY_PTHREADS_DISABLED
     assert_mutex_unlock(&ctx->mtx);
 #endif
 
+    // the handler is no longer processed, so its context can't be entered concurrently
+
+    // the pipelined requests have never been registered in the loop
+    for (dlist_rd_node_t *node = dlist_rd_head_mut(&ctx->pending);
+            node != NULL;
+            node = dlist_rd_head_mut(&ctx->pending)) {
+        handler_free((handler_t *) dlist_rd_remove(&ctx->pending, node));
+    }
+
     arc_ctx_free(arc);
 }
 
+static void client_on_free(handler_t *tcp_handler) {
+    client_detach(handler_custom_data(tcp_handler));
+}
+
 static void client_on_rd_free(handler_t *rd) {
-    arc_ctx_t *arc = handler_custom_data(rd);
-    client_ctx_t *ctx = arc_ctx_get(arc);
+    client_req_t *req = handler_custom_data(rd);
+    client_ctx_t *ctx = arc_ctx_get(req->ctx);
+
 #ifndef WAXY_PTHREADS_DISABLED
     assert_mutex_lock(&ctx->mtx);
 #endif
 
-    ctx->rd = NULL;
+    cache_rd_t *expected = (cache_rd_t *) rd;
+    atomic_compare_exchange_strong(&ctx->rd, &expected, NULL);
 
 #ifndef WAXY_PTHREADS_DISABLED
     assert_mutex_unlock(&ctx->mtx);
 #endif
 
-    arc_ctx_free(arc);
+    client_req_free(req);
 }
 
 typedef struct {
     arc_ctx_t *ctx;
     loop_t *loop;
+    // the value of the Range header, if the request had one to honor
+    slice_t range;
+    // taken over by the read handle once it's created
+    client_req_t *req;
 } client_cache_ctx_t;
 
+// A write request sending the cache entry data straight from the cache storage.
 typedef struct {
-    // the slice actually points to `buf`
-    slice_t slice;
-    bool eof;
-    char buf[CACHE_BUFFER_SIZE];
-} cache_buf_t;
+    // the first slice points into `prefix` if there is one; the rest point into the memory
+    // referenced by the respective `spans`
+    slice_t slices[CACHE_WRITE_SPANS + 1];
+    cache_span_t spans[CACHE_WRITE_SPANS];
+    size_t span_count;
+    string_t prefix;
+    bool has_prefix;
+    // the total length of the slices
+    size_t size;
+    // this is the last write request of the response
+    bool last;
+    // the connection is closed after the response
+    bool close;
+} cache_write_t;
+
+static void cache_write_free(cache_write_t *self) {
+    for (size_t i = 0; i < self->span_count; ++i) {
+        cache_span_release(&self->spans[i]);
+    }
+
+    if (self->has_prefix) {
+        string_free(&self->prefix);
+    }
+
+    free(self);
+}
 
 static char const bad_request[] =
     "HTTP/1.1 400 Bad Request\r\n"
@@ -129,6 +339,14 @@ static slice_t const method_not_allowed_slice = {
     .len = sizeof(method_not_allowed),
 };
 
+static error_t *client_on_read(loop_t *loop, tcp_handler_t *handler, slice_t slice);
+static error_t *client_handle_requests(
+    arc_ctx_t *arc,
+    loop_t *loop,
+    tcp_handler_t *handler,
+    size_t prev_len
+);
+
 static error_t *client_on_req_err_write(
     loop_t *,
     tcp_handler_t *handler,
@@ -140,30 +358,189 @@ static error_t *client_on_req_err_write(
     return NULL;
 }
 
+// Stops reading requests while the pipeline is full, and resumes once it's not.
+//
+// Must be called from the TCP handler's context.
+static void client_update_reading(client_ctx_t *ctx, tcp_handler_t *handler) {
+    // the data following a CONNECT request is left in the socket for the tunnel
+    bool reading = !ctx->tunnel
+        && (ctx->closing || dlist_rd_len(&ctx->pending) < MAX_PIPELINED_REQUESTS);
+
+    // the end of the stream must not be reported again
+    if (reading != ctx->reading && !tcp_is_eof(handler)) {
+        tcp_read(handler, reading ? client_on_read : NULL, NULL);
+        ctx->reading = reading;
+    }
+}
+
+// Registers the read handle in the loop, letting it send the response.
+//
+// The read handle is taken over.
+//
+// Must be called from the TCP handler's context.
+static error_t *client_activate_rd(client_ctx_t *ctx, loop_t *loop, cache_rd_t *rd) {
+    error_t *err = NULL;
+
+    err = error_wrap("Could not register a cache read handle",
+        loop_register(loop, (handler_t *) rd));
+    if (err) goto fail;
+
+    ctx->rd = rd;
+
+    return err;
+
+fail:
+    handler_free((handler_t *) rd);
+
+    return err;
+}
+
+// Starts sending the response to the next pipelined request, if there is one.
+//
+// Must be called from the TCP handler's context.
+static error_t *client_start_next(client_ctx_t *ctx, loop_t *loop) {
+    assert(ctx->rd == NULL);
+    dlist_rd_node_t *node = dlist_rd_head_mut(&ctx->pending);
+
+    if (node == NULL) {
+        client_set_idle(ctx, true);
+
+        return NULL;
+    }
+
+    return client_activate_rd(ctx, loop, dlist_rd_remove(&ctx->pending, node));
+}
+
+// Closes the connection, sending the error response first if there is one.
+//
+// Must be called from the TCP handler's context once all the responses have been sent.
+static error_t *client_close(client_ctx_t *ctx, tcp_handler_t *handler) {
+    if (ctx->closed) {
+        return NULL;
+    }
+
+    ctx->closed = true;
+
+    if (ctx->farewell == NULL) {
+        handler_unregister((handler_t *) handler);
+
+        return NULL;
+    }
+
+    return error_wrap("Could not send an error response",
+        tcp_write(handler, 1, ctx->farewell, client_on_req_err_write, NULL));
+}
+
+// Hands the connection over to a tunnel once the responses preceding the CONNECT request are sent.
+//
+// The context is released: it must not be used afterwards.
+//
+// Must be called from the TCP handler's context.
+static error_t *client_start_tunnel(arc_ctx_t *arc, loop_t *loop, tcp_handler_t *handler) {
+    error_t *err = NULL;
+
+    client_ctx_t *ctx = arc_ctx_get(arc);
+    slice_t host = {
+        .base = string_as_cptr(&ctx->tunnel_host),
+        .len = string_len(&ctx->tunnel_host),
+    };
+    slice_t buffered = {
+        .base = string_as_cptr(&ctx->buf),
+        .len = string_len(&ctx->buf),
+    };
+
+    err = tunnel_init(handler, host, ctx->tunnel_port, buffered, ctx->resolver, loop);
+
+    if (err) {
+        // the handler still belongs to the context, which is released once it's freed
+        log_printf(LOG_ERR, "Could not open a tunnel; dropping the connection");
+        error_log_free(&err, LOG_ERR, ERROR_VERBOSITY_BACKTRACE | ERROR_VERBOSITY_SOURCE_CHAIN);
+        handler_unregister((handler_t *) handler);
+
+        return err;
+    }
+
+    // an abandoned tunnel is closed like an idle connection
+    client_set_idle(ctx, true);
+    client_detach(arc);
+
+    return err;
+}
+
+// Moves on to the next request once a response has been sent.
+//
+// Must be called from the TCP handler's context.
+static void client_finish_response(loop_t *loop, tcp_handler_t *handler, bool close) {
+    error_t *err = NULL;
+
+    arc_ctx_t *arc = handler_custom_data((handler_t *) handler);
+    client_ctx_t *ctx = arc_ctx_get(arc);
+
+    // the read handle was kept registered until now (see `client_cache_on_read`)
+    handler_unregister((handler_t *) atomic_exchange(&ctx->rd, NULL));
+
+    if (close) {
+        log_printf(LOG_DEBUG, "Closing the connection");
+        ctx->closing = true;
+        ctx->closed = true;
+        tcp_shutdown_input(handler);
+        tcp_shutdown_output(handler);
+        // wait for the end of the stream even if the pipeline was full
+        client_update_reading(ctx, handler);
+
+        return;
+    }
+
+    err = client_start_next(ctx, loop);
+    if (err) goto fail;
+
+    // the pipeline might have been full, leaving some requests in the buffer
+    err = client_handle_requests(arc, loop, handler, 0);
+    if (err) goto fail;
+
+    return;
+
+fail:
+    // the error is not propagated: the write request the callback is invoked for has succeeded
+    log_printf(LOG_ERR, "Could not proceed to the next request; dropping the connection");
+    error_log_free(&err, LOG_ERR, ERROR_VERBOSITY_BACKTRACE | ERROR_VERBOSITY_SOURCE_CHAIN);
+    handler_unregister((handler_t *) handler);
+}
+
 static error_t *client_cache_on_write(
-    loop_t *,
+    loop_t *loop,
     tcp_handler_t *handler,
     size_t slice_count,
     slice_t const slices[static slice_count]
 ) {
-    assert(slice_count == 1);
-
-    // `slices` here is actually a pointer to the `slice` field of `cache_buf_t`.
+    // `slices` here is actually a pointer to the `slices` field of `cache_write_t`.
     // Thus we derive the pointer to the whole allocation.
     // The pointers here point to the same allocation, so if you're a fan of pointer provenance (and
     // you better be!), it's all totally legal.
     // *And* we can cast away the constness because the pointer we initially obtained was not const
     // to begin with.
-    cache_buf_t *buf = (cache_buf_t *)((char *) slices - offsetof(cache_buf_t, slice));
+    cache_write_t *write = (cache_write_t *)((char *) slices - offsetof(cache_write_t, slices));
+    assert(slice_count <= CACHE_WRITE_SPANS + 1);
 
-    if (buf->eof) {
-        log_printf(LOG_DEBUG, "Closing the connection");
-        tcp_shutdown_input(handler);
-        tcp_shutdown_output(handler);
+    bool last = write->last;
+    bool close = write->close;
+
+    client_ctx_t *ctx = arc_ctx_get(handler_custom_data((handler_t *) handler));
+    size_t buffered = atomic_fetch_sub(&ctx->buffered, write->size) - write->size;
+
+    // the throttled read handle is the current one: it can't have made its last write request
+    if (buffered <= ctx->config->buffer_low_watermark
+            && atomic_exchange(&ctx->throttled, false)) {
+        assert(ctx->rd != NULL);
+        cache_rd_set_paused(ctx->rd, false);
     }
 
-    log_printf(LOG_DEBUG, "Freeing the buffer in on_write: %p", (void *) buf);
-    free(buf);
+    log_printf(LOG_DEBUG, "Releasing the write request in on_write: %p", (void *) write);
+    cache_write_free(write);
+
+    if (last) {
+        client_finish_response(loop, handler, close);
+    }
 
     return NULL;
 }
@@ -176,22 +553,272 @@ static error_t *client_cache_on_write_error(
     slice_t const slices[static slice_count],
     size_t
 ) {
-    assert(slice_count == 1);
-
     // see the comment in `client_cache_on_write`
-    cache_buf_t *buf = (cache_buf_t *)((char *) slices - offsetof(cache_buf_t, slice));
-    log_printf(LOG_DEBUG, "Freeing the buffer in on_error: %p", (void *) buf);
-    free(buf);
+    cache_write_t *write = (cache_write_t *)((char *) slices - offsetof(cache_write_t, slices));
+    assert(slice_count <= CACHE_WRITE_SPANS + 1);
+    log_printf(LOG_DEBUG, "Releasing the write request in on_error: %p", (void *) write);
+    cache_write_free(write);
 
     // the tcp handler's generic error handler will free everything
     return err;
 }
 
+static char const *client_connection_header(bool keep_alive) {
+    return keep_alive ? "Connection: keep-alive\r\n" : "Connection: close\r\n";
+}
+
+// Appends the end-to-end headers of the cached response and terminates the head.
+//
+// If `ranged` is set, the headers describing the extent of the body are skipped as well.
+static error_t *client_append_headers(
+    string_t *result,
+    size_t header_count,
+    struct phr_header const *headers,
+    bool ranged
+) {
+    error_t *err = NULL;
+
+    for (size_t i = 0; i < header_count; ++i) {
+        slice_t name = { .base = headers[i].name, .len = headers[i].name_len };
+
+        if (http_is_hop_by_hop(name)) {
+            continue;
+        }
+
+        if (ranged && (http_name_eq(name, "Content-Length")
+                || http_name_eq(name, "Content-Range"))) {
+            continue;
+        }
+
+        err = error_from_common(string_appendf(result, "%.*s: %.*s\r\n",
+            (int) headers[i].name_len, headers[i].name,
+            (int) headers[i].value_len, headers[i].value));
+        if (err) return err;
+    }
+
+    return error_from_common(string_append_slice(result, "\r\n", 2));
+}
+
+// Builds the head of a response relayed in full.
+//
+// The hop-by-hop headers of the cached response are replaced with the ones for this connection.
+static error_t *client_build_head(
+    string_t *result,
+    int status,
+    slice_t msg,
+    size_t header_count,
+    struct phr_header const *headers,
+    bool chunked,
+    bool keep_alive
+) {
+    error_t *err = NULL;
+
+    err = error_from_common(string_sprintf(result,
+        "HTTP/1.1 %d %.*s\r\n"
+        "%s"
+        "%s",
+        status, (int) msg.len, msg.base,
+        chunked ? "Transfer-Encoding: chunked\r\n" : "",
+        client_connection_header(keep_alive)));
+    if (err) goto sprintf_fail;
+
+    err = client_append_headers(result, header_count, headers, false);
+    if (err) goto append_fail;
+
+    return err;
+
+append_fail:
+    string_free(result);
+
+sprintf_fail:
+    return error_wrap("Could not build a response head", err);
+}
+
+// Builds the head of a response carrying the `first..=last` bytes of a `length`-byte body.
+//
+// The end-to-end headers of the cached response are kept.
+static error_t *client_build_range_head(
+    string_t *result,
+    size_t header_count,
+    struct phr_header const *headers,
+    size_t first,
+    size_t last,
+    size_t length,
+    bool keep_alive
+) {
+    error_t *err = NULL;
+
+    err = error_from_common(string_sprintf(result,
+        "HTTP/1.1 206 Partial Content\r\n"
+        "Content-Range: bytes %zu-%zu/%zu\r\n"
+        "Content-Length: %zu\r\n"
+        "%s",
+        first, last, length,
+        last - first + 1,
+        client_connection_header(keep_alive)));
+    if (err) goto sprintf_fail;
+
+    err = client_append_headers(result, header_count, headers, true);
+    if (err) goto append_fail;
+
+    return err;
+
+append_fail:
+    string_free(result);
+
+sprintf_fail:
+    return error_wrap("Could not build a partial response", err);
+}
+
+static error_t *client_build_unsatisfiable_head(string_t *result, size_t length, bool keep_alive) {
+    return error_wrap("Could not build a range error response", error_from_common(
+        string_sprintf(result,
+            "HTTP/1.1 416 Range Not Satisfiable\r\n"
+            SERVER_HEADER
+            "Content-Range: bytes */%zu\r\n"
+            "Content-Length: 0\r\n"
+            "%s"
+            "\r\n",
+            length,
+            client_connection_header(keep_alive))));
+}
+
+// Reads the head of the cached response and decides how to relay it.
+//
+// A full (200) response with a known length is sliced if a range has been requested.
+// Anything else (e.g., a partial response relayed from the origin) is sent in full.
+// A response that can't be parsed is sent as is, and the connection is closed after it.
+static error_t *client_resolve_head(client_req_t *req, cache_rd_t *rd) {
+    error_t *err = NULL;
+
+    char buf[RESPONSE_HEAD_READ_SIZE];
+    struct phr_header headers[MAX_RESPONSE_HEADERS];
+    bool eof = false;
+    size_t read = 0;
+
+    int minor_version = -1;
+    int status = -1;
+    slice_t msg = slice_empty();
+    size_t header_count = 0;
+    int count = -2;
+
+    // the body stays in the cache: only as much is copied as it takes to get the head
+    do {
+        read = cache_rd_read(rd, buf, sizeof(buf), &eof);
+        err = error_wrap("Could not buffer the response head", error_from_common(
+            string_append_slice(&req->head, buf, read)));
+        if (err) return err;
+
+        header_count = MAX_RESPONSE_HEADERS;
+        count = phr_parse_response(
+            string_as_cptr(&req->head), string_len(&req->head),
+            &minor_version,
+            &status,
+            &msg.base, &msg.len,
+            headers,
+            &header_count,
+            0
+        );
+    } while (count == -2 && read > 0 && string_len(&req->head) <= MAX_RESPONSE_HEAD_SIZE);
+
+    if (count == -2 && !eof && string_len(&req->head) <= MAX_RESPONSE_HEAD_SIZE) {
+        // wait for the rest of the head
+        return err;
+    }
+
+    size_t length = 0;
+    size_t first = 0;
+    size_t last = 0;
+
+    if (count < 0) {
+        req->close = true;
+        req->body_state = CLIENT_BODY_FULL;
+        cache_rd_seek(rd, 0);
+    } else if (req->has_range
+            && status == 200
+            && http_content_length(header_count, headers, &length)) {
+        req->close = !req->keep_alive;
+
+        if (!http_range_resolve(&req->range, length, &first, &last)) {
+            err = client_build_unsatisfiable_head(&req->prefix, length, !req->close);
+            if (err) return err;
+
+            req->remaining = 0;
+        } else {
+            err = client_build_range_head(
+                &req->prefix, header_count, headers, first, last, length, !req->close);
+            if (err) return err;
+
+            req->remaining = last - first + 1;
+            cache_rd_seek(rd, (size_t) count + first);
+        }
+
+        req->has_prefix = true;
+        req->body_state = CLIENT_BODY_RANGE;
+    } else {
+        http_framing_t framing;
+        http_framing_init(&framing, status, false, header_count, headers);
+        bool chunked = framing.kind == HTTP_FRAMING_CHUNKED;
+
+        // the client can only tell where the body ends if the connection is closed, or, for an
+        // HTTP/1.0 one, if it has the length
+        req->close = !req->keep_alive
+            || framing.kind == HTTP_FRAMING_CLOSE
+            || (chunked && req->minor_version == 0);
+
+        err = client_build_head(
+            &req->prefix, status, msg, header_count, headers, chunked, !req->close);
+        if (err) return err;
+
+        req->has_prefix = true;
+        req->body_state = CLIENT_BODY_FULL;
+        cache_rd_seek(rd, (size_t) count);
+    }
+
+    string_free(&req->head);
+
+    return err;
+}
+
+// Pauses the read handle while the client has too much data queued.
+//
+// Returns `true` if the handle has been paused; it's resumed by `client_cache_on_write` once the
+// queue drains below the low watermark.
+//
+// Must be called from the read handle's context.
+static bool client_throttle(client_ctx_t *ctx, cache_rd_t *rd) {
+    client_config_t const *config = ctx->config;
+
+    if (atomic_load(&ctx->buffered) < config->buffer_limit) {
+        return false;
+    }
+
+    atomic_store(&ctx->throttled, true);
+    cache_rd_set_paused(rd, true);
+
+    // the queue might have drained before the flag was set, in which case no one is going to resume
+    // the handle: take it back unless `client_cache_on_write` has got there first
+    if (atomic_load(&ctx->buffered) <= config->buffer_low_watermark
+            && atomic_exchange(&ctx->throttled, false)) {
+        cache_rd_set_paused(rd, false);
+
+        return false;
+    }
+
+    return true;
+}
+
 static error_t *client_cache_on_read(cache_rd_t *rd, loop_t *) {
     error_t *err = NULL;
 
-    arc_ctx_t *arc = handler_custom_data((handler_t *) rd);
-    client_ctx_t *ctx = arc_ctx_get(arc);
+    client_req_t *req = handler_custom_data((handler_t *) rd);
+    client_ctx_t *ctx = arc_ctx_get(req->ctx);
+
+    if (req->done) {
+        // waiting for the last write request to complete
+        return err;
+    }
+
 #ifndef WAXY_PTHREADS_DISABLED
     assert_mutex_lock(&ctx->mtx);
 #endif
@@ -207,22 +834,106 @@ static error_t *client_cache_on_read(cache_rd_t *rd, loop_t *) {
         return err;
     }
 
-    cache_buf_t *buf = malloc(sizeof(cache_buf_t));
-    err = error_wrap("Could not allocate a buffer", OK_IF(buf != NULL));
+    if (req->body_state == CLIENT_BODY_HEAD) {
+        err = client_resolve_head(req, rd);
+        if (err) goto malloc_fail;
+
+        if (req->body_state == CLIENT_BODY_HEAD) {
+#ifndef WAXY_PTHREADS_DISABLED
+            assert_mutex_unlock(&ctx->mtx);
+#endif
+
+            return err;
+        }
+    }
+
+    if (client_throttle(ctx, rd)) {
+#ifndef WAXY_PTHREADS_DISABLED
+        assert_mutex_unlock(&ctx->mtx);
+#endif
+
+        return err;
+    }
+
+    cache_write_t *write = malloc(sizeof(cache_write_t));
+    err = error_wrap("Could not allocate a write request", OK_IF(write != NULL));
     if (err) goto malloc_fail;
 
-    log_printf(LOG_DEBUG, "Allocated %p", (void *) buf);
-    buf->slice = (slice_t) {
-        .base = buf->buf,
-        .len = 0,
-    };
-    buf->eof = false;
+    log_printf(LOG_DEBUG, "Allocated %p", (void *) write);
+    // the pending head, if any, is sent along with the first write
+    write->prefix = req->prefix;
+    write->has_prefix = req->has_prefix;
+    req->has_prefix = false;
+
+    bool eof = false;
+    size_t size = req->remaining < CACHE_WRITE_SIZE ? req->remaining : CACHE_WRITE_SIZE;
+    size_t buffered = atomic_load(&ctx->buffered);
+    size_t budget = buffered < ctx->config->buffer_limit
+        ? ctx->config->buffer_limit - buffered
+        : 0;
+
+    // the head alone may exceed the budget, in which case the body waits until it's sent
+    if (write->has_prefix) {
+        budget = string_len(&write->prefix) < budget ? budget - string_len(&write->prefix) : 0;
+    }
+
+    if (budget < size) {
+        size = budget;
+    }
+
+    write->span_count = cache_rd_read_spans(rd, CACHE_WRITE_SPANS, write->spans, size, &eof);
+
+    size_t body_size = 0;
+
+    for (size_t i = 0; i < write->span_count; ++i) {
+        body_size += write->spans[i].slice.len;
+    }
+
+    if (req->remaining != SIZE_MAX) {
+        req->remaining -= body_size;
+    }
+
+    write->size = body_size + (write->has_prefix ? string_len(&write->prefix) : 0);
 
-    size_t count = cache_rd_read(rd, buf->buf, CACHE_BUFFER_SIZE, &buf->eof);
-    buf->slice.len = count;
+    write->last = eof || req->remaining == 0;
+    write->close = write->last && req->close;
+
+    size_t slice_count = 0;
+
+    if (write->has_prefix) {
+        write->slices[slice_count++] = (slice_t) {
+            .base = string_as_cptr(&write->prefix),
+            .len = string_len(&write->prefix),
+        };
+    }
+
+    if (slice_count == 0 && write->span_count == 0 && !write->last) {
+        // nothing to send yet
+        cache_write_free(write);
+
+#ifndef WAXY_PTHREADS_DISABLED
+        assert_mutex_unlock(&ctx->mtx);
+#endif
+
+        return err;
+    }
+
+    for (size_t i = 0; i < write->span_count; ++i) {
+        write->slices[slice_count++] = write->spans[i].slice;
+    }
+
+    // an empty request still has to go through the queue to finish the response after the rest
+    if (slice_count == 0) {
+        write->slices[0] = slice_empty();
+        slice_count = 1;
+    }
+
+    bool done = write->last;
+    // accounted for before the request can possibly complete
+    atomic_fetch_add(&ctx->buffered, write->size);
 
     handler_lock((handler_t *) ctx->tcp);
-    err = tcp_write(ctx->tcp, 1, &buf->slice,
+    err = tcp_write(ctx->tcp, slice_count, write->slices,
         client_cache_on_write, client_cache_on_write_error);
     handler_unlock((handler_t *) ctx->tcp);
     if (err) goto write_fail;
@@ -231,10 +942,19 @@ static error_t *client_cache_on_read(cache_rd_t *rd, loop_t *) {
     assert_mutex_unlock(&ctx->mtx);
 #endif
 
+    if (done) {
+        // the handle is unregistered once the response is sent, which makes way for the next one
+        req->done = true;
+
+        // the rest of the entry, if it's still being written, is of no interest to the client
+        cache_rd_seek(rd, SIZE_MAX);
+    }
+
     return err;
 
 write_fail:
-    free(buf);
+    atomic_fetch_sub(&ctx->buffered, write->size);
+    cache_write_free(write);
 
 malloc_fail:
 #ifndef WAXY_PTHREADS_DISABLED
@@ -254,8 +974,14 @@ malloc_fail:
 static error_t *client_cache_on_update(cache_rd_t *rd, loop_t *, cache_entry_state_t state) {
     error_t *err = NULL;
 
-    arc_ctx_t *arc = handler_custom_data((handler_t *) rd);
-    client_ctx_t *ctx = arc_ctx_get(arc);
+    client_req_t *req = handler_custom_data((handler_t *) rd);
+    client_ctx_t *ctx = arc_ctx_get(req->ctx);
+
+    if (req->done) {
+        // the response has been read in full
+        return err;
+    }
+
 #ifndef WAXY_PTHREADS_DISABLED
     assert_mutex_lock(&ctx->mtx);
 #endif
@@ -302,21 +1028,36 @@ static error_t *client_cache_on_update(cache_rd_t *rd, loop_t *, cache_entry_sta
     abort();
 }
 
+// Attaches the request state to the read handle and puts it in line.
+//
+// The read handle is taken over.
 static error_t *client_launch_cache_rd(client_cache_ctx_t *cache_ctx, cache_rd_t *rd) {
     error_t *err = NULL;
 
-    arc_ctx_t *arc = arc_ctx_share(cache_ctx->ctx);
-    client_ctx_t *ctx = arc_ctx_get(arc);
-
-    loop_t *loop = cache_ctx->loop;
-
-    ctx->rd = rd;
+    client_req_t *req = cache_ctx->req;
+    cache_ctx->req = NULL;
+    client_ctx_t *ctx = arc_ctx_get(req->ctx);
 
-    handler_set_custom_data((handler_t *) rd, arc);
+    handler_set_custom_data((handler_t *) rd, req);
     handler_set_on_free((handler_t *) rd, client_on_rd_free);
     cache_rd_set_on_read(rd, client_cache_on_read);
     cache_rd_set_on_update(rd, client_cache_on_update);
-    err = loop_register(loop, (handler_t *) rd);
+
+    if (ctx->rd == NULL) {
+        assert(dlist_rd_len(&ctx->pending) == 0);
+        client_set_idle(ctx, false);
+
+        return client_activate_rd(ctx, cache_ctx->loop, rd);
+    }
+
+    err = error_wrap("Could not queue a pipelined request", error_from_common(
+        dlist_rd_append(&ctx->pending, rd, NULL)));
+    if (err) goto append_fail;
+
+    return err;
+
+append_fail:
+    handler_free((handler_t *) rd);
 
     return err;
 }
@@ -325,30 +1066,30 @@ static error_t *client_on_cache_hit(void *data, cache_rd_t *rd) {
     error_t *err = NULL;
 
     client_cache_ctx_t *cache_ctx = data;
-    err = client_launch_cache_rd(cache_ctx, rd);
-    if (err) goto fail;
 
     char ip[INET6_ADDRSTRLEN] = {0};
     uint16_t port = 0;
     tcp_remote_info(arc_ctx_get(cache_ctx->ctx)->tcp, ip, &port);
     log_printf(LOG_DEBUG, "Fetched an entry from the cache for %s:%u", ip, port);
 
-fail:
+    err = client_launch_cache_rd(cache_ctx, rd);
+
     return err;
 }
 
 static error_t *client_on_cache_miss(void *data, cache_rd_t *rd, cache_wr_t *wr) {
     error_t *err = NULL;
 
-    bool rd_owned = true;
     client_cache_ctx_t *cache_ctx = data;
-    err = upstream_init(wr, cache_ctx->loop);
+    err = upstream_init(
+        wr,
+        cache_ctx->range,
+        arc_ctx_get(cache_ctx->ctx)->resolver,
+        arc_ctx_get(cache_ctx->ctx)->pool,
+        cache_ctx->loop
+    );
     if (err) goto upstream_init_fail;
 
-    err = client_launch_cache_rd(cache_ctx, rd);
-    if (err) goto rd_launch_fail;
-    rd_owned = false;
-
     char ip[INET6_ADDRSTRLEN] = {0};
     uint16_t port = 0;
     tcp_remote_info(arc_ctx_get(cache_ctx->ctx)->tcp, ip, &port);
@@ -358,19 +1099,47 @@ static error_t *client_on_cache_miss(void *data, cache_rd_t *rd, cache_wr_t *wr)
         ip, port
     );
 
-    return err;
+    // we don't really care if the upstream handler continues should this fail, actually
+    err = client_launch_cache_rd(cache_ctx, rd);
 
-rd_launch_fail:
-    // we don't really care if the upstream handler continues, actually
+    return err;
 
 upstream_init_fail:
-    if (rd_owned) {
-        handler_free((handler_t *) rd);
-    }
+    handler_free((handler_t *) rd);
 
     return err;
 }
 
+// Looks for a single byte range the request asks for.
+//
+// A request with `If-Range` is served in full, as its validator is not checked.
+static bool client_request_range(
+    size_t header_count,
+    struct phr_header const *headers,
+    http_range_t *range,
+    slice_t *value
+) {
+    bool found = false;
+
+    for (size_t i = 0; i < header_count; ++i) {
+        slice_t name = { .base = headers[i].name, .len = headers[i].name_len };
+
+        if (http_name_eq(name, "If-Range")) {
+            return false;
+        }
+
+        if (http_name_eq(name, "Range")) {
+            *value = (slice_t) { .base = headers[i].value, .len = headers[i].value_len };
+            found = http_parse_range(*value, range);
+        }
+    }
+
+    return found;
+}
+
+// Processes a parsed request.
+//
+// A request that can't be served makes the connection close after the preceding responses.
 static error_t *client_process_request(
     arc_ctx_t *arc,
     loop_t *loop,
@@ -378,11 +1147,11 @@ static error_t *client_process_request(
     slice_t method,
     slice_t path,
     int minor_version,
-    bool *unregister
+    size_t header_count
 ) {
     error_t *err = NULL;
-    *unregister = true;
 
+    client_ctx_t *ctx = arc_ctx_get(arc);
     char ip[INET6_ADDRSTRLEN] = {0};
     uint16_t port = 0;
     tcp_remote_info(handler, ip, &port);
@@ -396,6 +1165,38 @@ static error_t *client_process_request(
             ip, port,
             minor_version
         );
+        ctx->closing = true;
+
+        goto fail;
+    }
+
+    bool keep_alive = http_is_persistent(minor_version, header_count, ctx->headers);
+
+    if (!keep_alive) {
+        // this is the last request on the connection
+        ctx->closing = true;
+    }
+
+    if (slice_cmp(method, slice_from_cstr("CONNECT")) == 0) {
+        // whatever follows the request belongs to the tunnel
+        ctx->closing = true;
+
+        slice_t host = slice_empty();
+        uint16_t tunnel_port = 0;
+
+        if (!http_parse_authority(path, &host, &tunnel_port)) {
+            log_printf(LOG_WARN, "A client %s:%u has sent an invalid CONNECT target", ip, port);
+            ctx->farewell = &bad_request_slice;
+
+            goto fail;
+        }
+
+        err = error_wrap("Could not copy the tunnel host", error_from_common(
+            string_from_slice(host.base, host.len, &ctx->tunnel_host)));
+        if (err) goto fail;
+
+        ctx->tunnel = true;
+        ctx->tunnel_port = tunnel_port;
 
         goto fail;
     }
@@ -407,10 +1208,10 @@ static error_t *client_process_request(
             ip, port,
             (int) method.len, method.base
         );
-        err = error_wrap("Could not sent an error response",
-            tcp_write(handler, 1, &method_not_allowed_slice, client_on_req_err_write, NULL));
+        ctx->farewell = &method_not_allowed_slice;
+        ctx->closing = true;
 
-        if (err) goto fail;
+        goto fail;
     }
 
     url_t url = {0};
@@ -437,6 +1238,7 @@ static error_t *client_process_request(
     if (err) {
         log_printf(LOG_WARN, "A client %s:%u has sent an invalid URL", ip, port);
         error_log_free(&err, LOG_WARN, ERROR_VERBOSITY_SHORT);
+        ctx->closing = true;
 
         goto fail;
     }
@@ -444,11 +1246,22 @@ static error_t *client_process_request(
     client_cache_ctx_t cache_ctx = {
         .ctx = arc,
         .loop = loop,
+        .range = slice_empty(),
+        .req = NULL,
     };
-    err = cache_fetch(arc_ctx_get(arc)->cache, &url, client_on_cache_hit, client_on_cache_miss, &cache_ctx);
+
+    err = client_req_new(arc, minor_version, keep_alive, &cache_ctx.req);
     if (err) goto fail;
 
-    *unregister = false;
+    cache_ctx.req->has_range = client_request_range(
+        header_count, ctx->headers, &cache_ctx.req->range, &cache_ctx.range);
+
+    err = cache_fetch(ctx->cache, &url, client_on_cache_hit, client_on_cache_miss, &cache_ctx);
+
+    if (cache_ctx.req != NULL) {
+        // the read handle has not been created
+        client_req_free(cache_ctx.req);
+    }
 
 fail:
     if (url_owned) {
@@ -458,12 +1271,15 @@ fail:
     return err;
 }
 
+// Parses and processes the request at the start of the buffer.
+//
+// Sets `partial` if the buffer doesn't have a complete request yet.
 static error_t *client_handle_http_request(
     arc_ctx_t *arc,
     loop_t *loop,
     tcp_handler_t *handler,
     size_t prev_len,
-    bool eof
+    bool *partial
 ) {
     error_t *err = NULL;
 
@@ -471,32 +1287,6 @@ static error_t *client_handle_http_request(
     char ip[INET6_ADDRSTRLEN] = {0};
     uint16_t port = 0;
     tcp_remote_info(handler, ip, &port);
-    bool unregister = false;
-
-    if (ctx->request_processed) {
-        log_printf(LOG_DEBUG, "the request has been accepted; reading the rest");
-
-        if (eof) {
-            log_printf(LOG_DEBUG, "done doing that");
-            tcp_read(handler, NULL, NULL);
-            handler_unregister((handler_t *) handler);
-        }
-
-        return err;
-    }
-
-    if (string_len(&ctx->buf) > MAX_REQUEST_SIZE) {
-        log_printf(
-            LOG_WARN,
-            "A client %s:%u has sent a request of %zu bytes, which is a bit overboard",
-            ip,
-            port,
-            string_len(&ctx->buf)
-        );
-        unregister = true;
-
-        goto fail;
-    }
 
     slice_t method = slice_empty();
     slice_t path = slice_empty();
@@ -516,42 +1306,85 @@ static error_t *client_handle_http_request(
     );
 
     if (count == -2) {
-        if (eof) {
-            log_printf(LOG_WARN, "A client %s:%u has sent a truncated request", ip, port);
-            unregister = true;
-
-            goto fail;
+        // partial data
+        *partial = true;
+
+        if (string_len(&ctx->buf) > MAX_REQUEST_SIZE) {
+            log_printf(
+                LOG_WARN,
+                "A client %s:%u has sent a request of %zu bytes, which is a bit overboard",
+                ip,
+                port,
+                string_len(&ctx->buf)
+            );
+            ctx->closing = true;
         }
 
-        // partial data
         return err;
     } else if (count == -1) {
         // failure
         log_printf(LOG_WARN, "A client %s:%u has sent an invalid request", ip, port);
-        err = error_wrap("Could not send a bad request response",
-            tcp_write(handler, 1, &bad_request_slice, client_on_req_err_write, NULL));
+        ctx->farewell = &bad_request_slice;
+        ctx->closing = true;
 
-        if (err) {
-            error_log_free(&err, LOG_ERR, ERROR_VERBOSITY_SOURCE_CHAIN | ERROR_VERBOSITY_BACKTRACE);
-            unregister = true;
-        }
-
-        goto fail;
+        return err;
     }
 
     assert(count >= 0);
-    ctx->request_processed = true;
     err = client_process_request(
         arc, loop, handler,
         method, path,
         minor_version,
-        &unregister
+        num_headers
     );
-    if (err) goto fail;
 
-fail:
-    if (unregister) {
-        handler_unregister((handler_t *) handler);
+    // the request has been copied wherever it's needed
+    string_remove_slice(&ctx->buf, 0, (size_t) count);
+
+    return err;
+}
+
+// Processes the buffered requests, as many as the pipeline allows.
+//
+// Must be called from the TCP handler's context.
+static error_t *client_handle_requests(
+    arc_ctx_t *arc,
+    loop_t *loop,
+    tcp_handler_t *handler,
+    size_t prev_len
+) {
+    error_t *err = NULL;
+
+    client_ctx_t *ctx = arc_ctx_get(arc);
+    bool partial = false;
+
+    while (!ctx->closing && !partial && string_len(&ctx->buf) > 0
+            && dlist_rd_len(&ctx->pending) < MAX_PIPELINED_REQUESTS) {
+        err = client_handle_http_request(arc, loop, handler, prev_len, &partial);
+        if (err) return err;
+
+        prev_len = 0;
+    }
+
+    bool full = dlist_rd_len(&ctx->pending) >= MAX_PIPELINED_REQUESTS;
+
+    if (tcp_is_eof(handler) && !full && !ctx->closing) {
+        if (string_len(&ctx->buf) > 0) {
+            char ip[INET6_ADDRSTRLEN] = {0};
+            uint16_t port = 0;
+            tcp_remote_info(handler, ip, &port);
+            log_printf(LOG_WARN, "A client %s:%u has sent a truncated request", ip, port);
+        }
+
+        ctx->closing = true;
+    }
+
+    client_update_reading(ctx, handler);
+
+    if (ctx->closing && ctx->rd == NULL) {
+        err = ctx->tunnel
+            ? client_start_tunnel(arc, loop, handler)
+            : client_close(ctx, handler);
     }
 
     return err;
@@ -575,14 +1408,27 @@ static error_t *client_on_read(loop_t *loop, tcp_handler_t *handler, slice_t sli
     client_ctx_t *ctx = arc_ctx_get(arc);
     size_t prev_len = string_len(&ctx->buf);
 
-    if (!ctx->request_processed) {
+    log_printf(LOG_DEBUG, "a read event on a client socket!");
+
+    if (ctx->closed) {
+        log_printf(LOG_DEBUG, "the connection is being closed; reading the rest");
+
+        // if there's an error response, the connection is closed once it's sent
+        if (tcp_is_eof(handler) && ctx->farewell == NULL) {
+            log_printf(LOG_DEBUG, "done doing that");
+            handler_unregister((handler_t *) handler);
+        }
+
+        return err;
+    }
+
+    if (!ctx->closing) {
         err = error_wrap("Could not append read data to the buffer", error_from_common(
             string_append_slice(&ctx->buf, slice.base, slice.len)));
         if (err) goto append_fail;
     }
 
-    log_printf(LOG_DEBUG, "a read event on a client socket!");
-    err = client_handle_http_request(arc, loop, handler, prev_len, tcp_is_eof(handler));
+    err = client_handle_requests(arc, loop, handler, prev_len);
     if (err) goto handle_fail;
 
 handle_fail:
@@ -590,7 +1436,13 @@ append_fail:
     return err;
 }
 
-error_t *client_init(tcp_handler_t *handler, cache_t *cache) {
+error_t *client_init(
+    tcp_handler_t *handler,
+    cache_t *cache,
+    resolver_t *resolver,
+    pool_t *pool,
+    client_config_t const *config
+) {
     error_t *err = NULL;
 
     client_ctx_t *ctx = calloc(1, sizeof(client_ctx_t));
@@ -598,6 +1450,9 @@ error_t *client_init(tcp_handler_t *handler, cache_t *cache) {
     if (err) goto ctx_calloc_fail;
 
     ctx->cache = cache;
+    ctx->resolver = resolver;
+    ctx->pool = pool;
+    ctx->config = config;
     ctx->headers = calloc(MAX_HEADERS, sizeof(struct phr_header));
     err = error_wrap("Could not allocate the context", OK_IF(ctx->headers != NULL));
     if (err) goto header_calloc_fail;
@@ -607,6 +1462,15 @@ error_t *client_init(tcp_handler_t *handler, cache_t *cache) {
 
     ctx->tcp = handler;
     ctx->rd = NULL;
+    ctx->pending = dlist_rd_new();
+    ctx->reading = true;
+    ctx->closing = false;
+    ctx->closed = false;
+    ctx->farewell = NULL;
+    ctx->tunnel = false;
+    ctx->buffered = 0;
+    ctx->throttled = false;
+    ctx->tunnel_port = 0;
 
 #ifndef WAXY_PTHREADS_DISABLED
     pthread_mutexattr_t mtx_attr;
@@ -626,8 +1490,15 @@ error_t *client_init(tcp_handler_t *handler, cache_t *cache) {
     handler_set_custom_data((handler_t *) handler, arc);
     handler_set_on_free((handler_t *) handler, (handler_on_free_cb_t) client_on_free);
     tcp_set_on_error(handler, client_on_error);
+    tcp_set_on_timeout(handler, client_on_timeout);
     tcp_read(handler, client_on_read, NULL);
 
+    // a client that doesn't read the responses is dropped as well
+    tcp_set_timeout(handler, TCP_TIMEOUT_WRITE, (uint64_t) config->idle_timeout * 1000);
+
+    // the connection is idle until the first request arrives
+    client_set_idle(ctx, true);
+
     return err;
 
 arc_new_fail:
@@ -636,6 +1507,7 @@ arc_new_fail:
 
 mtx_init_fail:
 #endif
+    string_free(&ctx->buf);
 
 string_new_fail:
     free(ctx->headers);
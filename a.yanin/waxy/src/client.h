@@ -1,7 +1,40 @@
 #pragma once
 
+#include <time.h>
+
 #include <common/loop/tcp.h>
 
 #include "cache.h"
+#include "pool.h"
+#include "resolver.h"
+
+// The settings shared by the client connections.
+typedef struct {
+    // The number of seconds a connection can stay idle for.
+    time_t idle_timeout;
+
+    // The maximum number of bytes of response data queued for sending to a client.
+    //
+    // Once a slow client has this much data pending, nothing more is read from the cache for it
+    // until the queue drains to `buffer_low_watermark` bytes, which must be less than the limit.
+    size_t buffer_limit;
+    size_t buffer_low_watermark;
+} client_config_t;
 
-error_t *client_init(tcp_handler_t *handler, cache_t *cache);
+// Serves the requests of the client connected to `handler`.
+//
+// A client connection is persistent: it carries any number of requests, which may be pipelined.
+// The responses are sent strictly in the order of the requests.
+//
+// The connection is closed once it has had no request in progress for longer than the idle
+// timeout, or once it hasn't accepted any response data for as long.
+// The amount of response data buffered for the client is bounded as well (see `client_config_t`).
+//
+// `config` must outlive the handler.
+error_t *client_init(
+    tcp_handler_t *handler,
+    cache_t *cache,
+    resolver_t *resolver,
+    pool_t *pool,
+    client_config_t const *config
+);
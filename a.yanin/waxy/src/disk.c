@@ -0,0 +1,1424 @@
+#include "disk.h"
+
+#include <assert.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef WAXY_PTHREADS_DISABLED
+#include <pthread.h>
+#endif
+
+#include <common/collections/string.h>
+#include <common/error-codes/adapter.h>
+#include <common/log/log.h>
+#include <common/posix/adapter.h>
+#include <common/posix/dir.h>
+#include <common/posix/file.h>
+#include <common/posix/io.h>
+#include <common/posix/mem.h>
+#include <common/posix/proc.h>
+
+#include "util.h"
+
+enum {
+    // "WXY2" in little-endian; bumped whenever the record layout changes
+    DISK_RECORD_MAGIC = 0x32595857,
+    // "WXYI" in little-endian
+    DISK_INDEX_MAGIC = 0x49595857,
+    DISK_INDEX_VERSION = 2,
+    DISK_FILE_MODE = 0644,
+    DISK_DIR_MODE = 0755,
+};
+
+// FNV-1a parameters.
+static uint64_t const DISK_CHECKSUM_BASIS = 0xcbf29ce484222325;
+static uint64_t const DISK_CHECKSUM_PRIME = 0x100000001b3;
+
+// The files are only ever read by the host that wrote them, so the headers are stored in the
+// native byte order.
+
+// Precedes every record in a segment file.
+// The record continues with `key_len` bytes of the key and `body_len` bytes of the body.
+typedef struct {
+    uint32_t magic;
+    uint32_t key_len;
+    uint64_t body_len;
+    // covers the key and the body
+    uint64_t checksum;
+} disk_record_header_t;
+
+// Starts a segment index file, which then lists `count` entries.
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t count;
+    // covers the rest of the file
+    uint64_t checksum;
+} disk_index_header_t;
+
+// An entry of a segment index file, followed by `key_len` bytes of the key.
+typedef struct {
+    // the offset of the record header in the segment file
+    uint64_t offset;
+    uint64_t body_len;
+    uint64_t checksum;
+    uint32_t key_len;
+    uint32_t reserved;
+} disk_index_entry_t;
+
+typedef struct disk_segment disk_segment_t;
+
+typedef struct {
+    string_t key;
+    disk_segment_t *segment;
+    // the offset of the record header in the segment file
+    uint64_t offset;
+    uint64_t body_len;
+    uint64_t checksum;
+} disk_record_t;
+
+typedef disk_record_t *disk_record_ptr_t;
+
+#define VEC_ELEMENT_TYPE disk_record_ptr_t
+#define VEC_LABEL record
+#define VEC_CONFIG (COLLECTION_DECLARE | COLLECTION_DEFINE | COLLECTION_STATIC)
+#include <common/collections/vec.h>
+
+// Some of the records may be superseded by the newer ones with the same key.
+// They are only dropped along with the whole segment.
+struct disk_segment {
+    size_t id;
+    // opened for reading, used to map the records
+    int fd;
+    uint64_t size;
+    vec_record_t records;
+};
+
+typedef disk_segment_t *disk_segment_ptr_t;
+
+#define DLIST_ELEMENT_TYPE disk_segment_ptr_t
+#define DLIST_LABEL segment
+#define DLIST_CONFIG (COLLECTION_DECLARE | COLLECTION_DEFINE | COLLECTION_STATIC)
+#include <common/collections/dlist.h>
+
+// the key slice points to the `key` of the record stored as the value
+#define HASH_KEY_TYPE slice_t
+#define HASH_VALUE_TYPE disk_record_ptr_t
+#define HASH_LABEL record
+#define HASH_CONFIG (COLLECTION_DECLARE | COLLECTION_DEFINE | COLLECTION_STATIC)
+#include <common/collections/hash.h>
+#include <common/collections/hash/byte_hasher.h>
+
+typedef struct {
+    string_t key;
+    struct iovec *iov;
+    size_t iov_count;
+    disk_release_cb_t release;
+    void *data;
+} disk_job_t;
+
+typedef disk_job_t *disk_job_ptr_t;
+
+#define DLIST_ELEMENT_TYPE disk_job_ptr_t
+#define DLIST_LABEL job
+#define DLIST_CONFIG (COLLECTION_DECLARE | COLLECTION_DEFINE | COLLECTION_STATIC)
+#include <common/collections/dlist.h>
+
+// `mtx` guards the index, the segment list and the segments' records and sizes.
+//
+// The last segment in `segments` is the one being appended to.
+// Only the writer (the background thread, or the caller of `disk_store` if there are no threads)
+// writes to the segment files, so it can do the I/O without holding the lock.
+struct disk {
+#ifndef WAXY_PTHREADS_DISABLED
+    pthread_mutex_t mtx;
+    pthread_cond_t cond;
+    pthread_t writer;
+    dlist_job_t jobs;
+    bool stopping;
+#endif
+    string_t path;
+    size_t size_limit;
+    size_t segment_size;
+    size_t page_size;
+    size_t iov_max;
+
+    hash_record_t index;
+    dlist_segment_t segments;
+    uint64_t total_size;
+
+    disk_segment_t *active;
+    // opened for appending to the active segment; only used by the writer
+    int active_fd;
+};
+
+struct disk_mapping {
+    void *addr;
+    size_t len;
+    slice_t data;
+};
+
+static void slice_hash(slice_t const *slice, byte_hasher_state_t *state) {
+    byte_hasher_digest_slice(state, slice->base, slice->len);
+}
+
+static byte_hasher_config_t const slice_hasher_config_primary = {
+    .seed = 83,
+    .hash = (void (*)(void const *, byte_hasher_state_t *)) slice_hash,
+};
+
+static byte_hasher_config_t const slice_hasher_config_secondary = {
+    .seed = 197,
+    .hash = (void (*)(void const *, byte_hasher_state_t *)) slice_hash,
+};
+
+static size_t slice_hash_primary(slice_t const *slice, void *data) {
+    return byte_hasher(slice, data);
+}
+
+static size_t slice_hash_secondary(slice_t const *slice, void *data) {
+    return byte_hasher_secondary(slice, data);
+}
+
+static bool slice_eq(slice_t const *lhs, slice_t const *rhs) {
+    return lhs->len == rhs->len && memcmp(lhs->base, rhs->base, lhs->len) == 0;
+}
+
+static slice_t disk_record_key(disk_record_t const *record) {
+    return (slice_t) {
+        .base = string_as_cptr(&record->key),
+        .len = string_len(&record->key),
+    };
+}
+
+static uint64_t disk_checksum(uint64_t state, char const *data, size_t len) {
+    for (size_t i = 0; i < len; ++i) {
+        state ^= (unsigned char) data[i];
+        state *= DISK_CHECKSUM_PRIME;
+    }
+
+    return state;
+}
+
+static uint64_t disk_record_len(size_t key_len, uint64_t body_len) {
+    return sizeof(disk_record_header_t) + key_len + body_len;
+}
+
+static error_t *disk_segment_path(
+    disk_t const *self,
+    size_t id,
+    char const *extension,
+    string_t *result
+) {
+    return error_wrap("Could not format a segment path", error_from_common(string_sprintf(
+        result, "%s/%08zu.%s", string_as_cptr(&self->path), id, extension)));
+}
+
+static error_t *disk_write_all(int fd, struct iovec *iov, size_t iov_count, size_t iov_max) {
+    error_t *err = NULL;
+
+    while (iov_count > 0) {
+        ssize_t written = 0;
+        err = error_from_posix(wrapper_writev(
+            fd, iov, iov_count < iov_max ? (int) iov_count : (int) iov_max, &written));
+        if (err) return err;
+
+        size_t remaining = (size_t) written;
+
+        while (iov_count > 0 && remaining >= iov->iov_len) {
+            remaining -= iov->iov_len;
+            ++iov;
+            --iov_count;
+        }
+
+        if (iov_count > 0) {
+            iov->iov_base = (char *) iov->iov_base + remaining;
+            iov->iov_len -= remaining;
+        }
+    }
+
+    return err;
+}
+
+static error_t *disk_read_file(char const *path, string_t *result) {
+    error_t *err = NULL;
+
+    int fd = -1;
+    err = error_from_posix(wrapper_open(path, O_RDONLY, &fd));
+    if (err) goto open_fail;
+
+    string_t buf;
+    err = error_from_common(string_new(&buf));
+    if (err) goto string_new_fail;
+
+    while (true) {
+        char chunk[4096];
+        ssize_t count = 0;
+        err = error_from_posix(wrapper_read(fd, chunk, sizeof(chunk), &count));
+        if (err) goto read_fail;
+
+        if (count == 0) {
+            break;
+        }
+
+        err = error_from_common(string_append_slice(&buf, chunk, (size_t) count));
+        if (err) goto read_fail;
+    }
+
+    wrapper_close(fd);
+    *result = buf;
+
+    return err;
+
+read_fail:
+    string_free(&buf);
+
+string_new_fail:
+    wrapper_close(fd);
+
+open_fail:
+    return err;
+}
+
+// Registers a record in the index, superseding the previous one with the same key.
+static error_t *disk_index_record_unsync(disk_t *self, disk_record_t *record) {
+    slice_t key = disk_record_key(record);
+
+    // the stored key points to the old record, so it has to be replaced as well
+    hash_record_remove(&self->index, &key, NULL, NULL);
+
+    return error_from_common(hash_record_insert(&self->index, key, record));
+}
+
+// Adds a record to the segment and registers it in the index.
+//
+// The record is owned by the segment it's pushed to.
+static error_t *disk_add_record_unsync(disk_t *self, disk_segment_t *segment, disk_record_t *record) {
+    error_t *err = NULL;
+
+    err = error_from_common(vec_record_push(&segment->records, record));
+    if (err) return err;
+
+    // the record is still reachable via the segment, so failing here only loses the index entry
+    return disk_index_record_unsync(self, record);
+}
+
+static error_t *disk_record_new(
+    disk_segment_t *segment,
+    slice_t key,
+    uint64_t offset,
+    uint64_t body_len,
+    uint64_t checksum,
+    disk_record_t **result
+) {
+    error_t *err = NULL;
+
+    disk_record_t *record = calloc(1, sizeof(disk_record_t));
+    err = error_wrap("Could not allocate a record", OK_IF(record != NULL));
+    if (err) goto calloc_fail;
+
+    err = error_from_common(string_from_slice(key.base, key.len, &record->key));
+    if (err) goto string_fail;
+
+    record->segment = segment;
+    record->offset = offset;
+    record->body_len = body_len;
+    record->checksum = checksum;
+    *result = record;
+
+    return err;
+
+string_fail:
+    free(record);
+
+calloc_fail:
+    return err;
+}
+
+static void disk_record_free(disk_record_t *record) {
+    string_free(&record->key);
+    free(record);
+}
+
+static error_t *disk_segment_open(disk_t *self, size_t id, disk_segment_t **result) {
+    error_t *err = NULL;
+
+    disk_segment_t *segment = calloc(1, sizeof(disk_segment_t));
+    err = error_wrap("Could not allocate a segment", OK_IF(segment != NULL));
+    if (err) goto calloc_fail;
+
+    string_t path;
+    err = disk_segment_path(self, id, "seg", &path);
+    if (err) goto path_fail;
+
+    err = error_wrap("Could not open a segment file", error_from_posix(
+        wrapper_open_mode(string_as_cptr(&path), O_RDONLY | O_CREAT, DISK_FILE_MODE, &segment->fd)));
+    if (err) goto open_fail;
+
+    struct stat stat;
+    err = error_from_posix(wrapper_fstat(segment->fd, &stat));
+    if (err) goto fstat_fail;
+
+    segment->id = id;
+    segment->size = (uint64_t) stat.st_size;
+    segment->records = vec_record_new();
+    string_free(&path);
+    *result = segment;
+
+    return err;
+
+fstat_fail:
+    wrapper_close(segment->fd);
+
+open_fail:
+    string_free(&path);
+
+path_fail:
+    free(segment);
+
+calloc_fail:
+    return err;
+}
+
+// Frees the segment and its records, optionally deleting the files.
+//
+// The records must not be present in the index.
+static void disk_segment_free(disk_t *self, disk_segment_t *segment, bool unlink) {
+    if (unlink) {
+        static char const *const extensions[] = { "seg", "idx" };
+
+        for (size_t i = 0; i < sizeof(extensions) / sizeof(*extensions); ++i) {
+            string_t path;
+
+            if (disk_segment_path(self, segment->id, extensions[i], &path) == NULL) {
+                wrapper_unlink(string_as_cptr(&path));
+                string_free(&path);
+            }
+        }
+    }
+
+    for (size_t i = 0; i < vec_record_len(&segment->records); ++i) {
+        disk_record_free(*vec_record_get(&segment->records, i));
+    }
+
+    vec_record_free(&segment->records);
+    wrapper_close(segment->fd);
+    free(segment);
+}
+
+// Removes the segment's records from the index.
+static void disk_segment_unindex_unsync(disk_t *self, disk_segment_t *segment) {
+    for (size_t i = 0; i < vec_record_len(&segment->records); ++i) {
+        disk_record_t *record = *vec_record_get(&segment->records, i);
+        slice_t key = disk_record_key(record);
+        disk_record_t **stored = hash_record_get_mut(&self->index, &key);
+
+        if (stored != NULL && *stored == record) {
+            hash_record_remove(&self->index, &key, NULL, NULL);
+        }
+    }
+}
+
+// Deletes the oldest segments until the total size fits the limit.
+static void disk_reclaim_unsync(disk_t *self) {
+    while (self->total_size > self->size_limit && dlist_segment_len(&self->segments) > 1) {
+        dlist_segment_node_t *head = dlist_segment_head_mut(&self->segments);
+        disk_segment_t *segment = *dlist_segment_get_mut(head);
+        assert(segment != self->active);
+
+        log_printf(LOG_DEBUG, "Reclaiming the disk cache segment %zu", segment->id);
+
+        disk_segment_unindex_unsync(self, segment);
+        self->total_size -= segment->size;
+        dlist_segment_remove(&self->segments, head);
+        disk_segment_free(self, segment, true);
+    }
+}
+
+static error_t *disk_write_index(disk_t *self, disk_segment_t *segment) {
+    error_t *err = NULL;
+
+    string_t buf;
+    err = error_from_common(string_new(&buf));
+    if (err) goto string_new_fail;
+
+    size_t count = vec_record_len(&segment->records);
+    disk_index_header_t header = {
+        .magic = DISK_INDEX_MAGIC,
+        .version = DISK_INDEX_VERSION,
+        .count = count,
+        .checksum = 0,
+    };
+
+    // the header is patched once the checksum is known
+    err = error_from_common(string_append_slice(&buf, (char const *) &header, sizeof(header)));
+    if (err) goto append_fail;
+
+    for (size_t i = 0; i < count; ++i) {
+        disk_record_t const *record = *vec_record_get(&segment->records, i);
+        disk_index_entry_t entry = {
+            .offset = record->offset,
+            .body_len = record->body_len,
+            .checksum = record->checksum,
+            .key_len = (uint32_t) string_len(&record->key),
+            .reserved = 0,
+        };
+
+        err = error_from_common(string_append_slice(&buf, (char const *) &entry, sizeof(entry)));
+        if (err) goto append_fail;
+
+        err = error_from_common(string_append(&buf, &record->key));
+        if (err) goto append_fail;
+    }
+
+    header.checksum = disk_checksum(
+        DISK_CHECKSUM_BASIS,
+        string_as_cptr(&buf) + sizeof(header),
+        string_len(&buf) - sizeof(header)
+    );
+    memcpy(string_as_cptr_mut(&buf), &header, sizeof(header));
+
+    string_t path;
+    err = disk_segment_path(self, segment->id, "idx", &path);
+    if (err) goto path_fail;
+
+    string_t tmp_path;
+    err = disk_segment_path(self, segment->id, "idx.tmp", &tmp_path);
+    if (err) goto tmp_path_fail;
+
+    int fd = -1;
+    err = error_from_posix(wrapper_open_mode(
+        string_as_cptr(&tmp_path), O_WRONLY | O_CREAT | O_TRUNC, DISK_FILE_MODE, &fd));
+    if (err) goto open_fail;
+
+    err = disk_write_all(fd, &(struct iovec) {
+        .iov_base = string_as_cptr_mut(&buf),
+        .iov_len = string_len(&buf),
+    }, 1, self->iov_max);
+
+    if (!err) {
+        err = error_from_posix(wrapper_fsync(fd));
+    }
+
+    wrapper_close(fd);
+
+    if (!err) {
+        err = error_from_posix(wrapper_rename(string_as_cptr(&tmp_path), string_as_cptr(&path)));
+    }
+
+    if (err) {
+        wrapper_unlink(string_as_cptr(&tmp_path));
+    }
+
+open_fail:
+    string_free(&tmp_path);
+
+tmp_path_fail:
+    string_free(&path);
+
+path_fail:
+append_fail:
+    string_free(&buf);
+
+string_new_fail:
+    return err;
+}
+
+// Reads the records of a sealed segment from its index file.
+//
+// The records are not added to the index.
+static error_t *disk_load_index(disk_t *self, disk_segment_t *segment) {
+    error_t *err = NULL;
+
+    string_t path;
+    err = disk_segment_path(self, segment->id, "idx", &path);
+    if (err) goto path_fail;
+
+    string_t buf;
+    err = disk_read_file(string_as_cptr(&path), &buf);
+    if (err) goto read_fail;
+
+    char const *pos = string_as_cptr(&buf);
+    char const *end = pos + string_len(&buf);
+
+    disk_index_header_t header;
+    err = error_wrap("The index file is truncated", OK_IF((size_t) (end - pos) >= sizeof(header)));
+    if (err) goto parse_fail;
+
+    memcpy(&header, pos, sizeof(header));
+    pos += sizeof(header);
+
+    err = error_wrap("The index file is malformed", OK_IF(
+        header.magic == DISK_INDEX_MAGIC && header.version == DISK_INDEX_VERSION));
+    if (err) goto parse_fail;
+
+    err = error_wrap("The index file checksum does not match", OK_IF(
+        header.checksum == disk_checksum(DISK_CHECKSUM_BASIS, pos, (size_t) (end - pos))));
+    if (err) goto parse_fail;
+
+    for (uint64_t i = 0; i < header.count; ++i) {
+        disk_index_entry_t entry;
+        err = error_wrap("The index file is truncated",
+            OK_IF((size_t) (end - pos) >= sizeof(entry)));
+        if (err) goto parse_fail;
+
+        memcpy(&entry, pos, sizeof(entry));
+        pos += sizeof(entry);
+
+        err = error_wrap("The index file is truncated",
+            OK_IF((size_t) (end - pos) >= entry.key_len));
+        if (err) goto parse_fail;
+
+        slice_t key = { .base = pos, .len = entry.key_len };
+        pos += entry.key_len;
+
+        err = error_wrap("The index refers past the end of the segment", OK_IF(
+            entry.offset <= segment->size
+                && disk_record_len(entry.key_len, entry.body_len) <= segment->size - entry.offset));
+        if (err) goto parse_fail;
+
+        disk_record_t *record = NULL;
+        err = disk_record_new(
+            segment, key, entry.offset, entry.body_len, entry.checksum, &record);
+        if (err) goto parse_fail;
+
+        err = error_from_common(vec_record_push(&segment->records, record));
+
+        if (err) {
+            disk_record_free(record);
+
+            goto parse_fail;
+        }
+    }
+
+parse_fail:
+    string_free(&buf);
+
+read_fail:
+    string_free(&path);
+
+path_fail:
+    return err;
+}
+
+// Recovers the records of a segment that was not sealed properly by reading the segment itself.
+//
+// The scan stops at the first malformed or corrupted record.
+// The records are not added to the index.
+static error_t *disk_scan_segment(disk_segment_t *segment) {
+    error_t *err = NULL;
+
+    if (segment->size == 0) {
+        return err;
+    }
+
+    void *addr = NULL;
+    err = error_from_posix(wrapper_mmap(
+        NULL, segment->size, PROT_READ, MAP_SHARED, segment->fd, 0, &addr));
+    if (err) goto mmap_fail;
+
+    char const *base = addr;
+    uint64_t offset = 0;
+
+    while (segment->size - offset >= sizeof(disk_record_header_t)) {
+        disk_record_header_t header;
+        memcpy(&header, base + offset, sizeof(header));
+
+        if (header.magic != DISK_RECORD_MAGIC) {
+            break;
+        }
+
+        uint64_t len = disk_record_len(header.key_len, header.body_len);
+
+        if (header.body_len > segment->size || len > segment->size - offset) {
+            break;
+        }
+
+        slice_t key = {
+            .base = base + offset + sizeof(header),
+            .len = header.key_len,
+        };
+
+        // the key and the body are contiguous
+        if (disk_checksum(DISK_CHECKSUM_BASIS, key.base, len - sizeof(header)) != header.checksum) {
+            break;
+        }
+
+        disk_record_t *record = NULL;
+        err = disk_record_new(segment, key, offset, header.body_len, header.checksum, &record);
+        if (err) break;
+
+        err = error_from_common(vec_record_push(&segment->records, record));
+
+        if (err) {
+            disk_record_free(record);
+
+            break;
+        }
+
+        offset += len;
+    }
+
+    if (offset != segment->size) {
+        log_printf(
+            LOG_WARN,
+            "The disk cache segment %zu has %" PRIu64 " bytes of trailing garbage",
+            segment->id, segment->size - offset
+        );
+    }
+
+    wrapper_munmap(addr, segment->size);
+
+mmap_fail:
+    return err;
+}
+
+static int size_cmp(void const *lhs, void const *rhs) {
+    size_t l = *(size_t const *) lhs;
+    size_t r = *(size_t const *) rhs;
+
+    return l < r ? -1 : l > r ? 1 : 0;
+}
+
+#define VEC_ELEMENT_TYPE size_t
+#define VEC_LABEL size
+#define VEC_CONFIG (COLLECTION_DECLARE | COLLECTION_DEFINE | COLLECTION_STATIC)
+#include <common/collections/vec.h>
+
+static error_t *disk_list_segments(disk_t *self, vec_size_t *result) {
+    error_t *err = NULL;
+
+    DIR *dir = NULL;
+    err = error_wrap("Could not open the disk cache directory", error_from_posix(
+        wrapper_opendir(string_as_cptr(&self->path), &dir)));
+    if (err) goto opendir_fail;
+
+    vec_size_t ids = vec_size_new();
+
+    while (true) {
+        struct dirent *dirent = NULL;
+        err = error_from_posix(wrapper_readdir(dir, &dirent));
+        if (err) goto readdir_fail;
+
+        if (dirent == NULL) {
+            break;
+        }
+
+        char *end = NULL;
+        unsigned long long id = strtoull(dirent->d_name, &end, 10);
+
+        if (end == dirent->d_name || strcmp(end, ".seg") != 0) {
+            continue;
+        }
+
+        err = error_from_common(vec_size_push(&ids, (size_t) id));
+        if (err) goto readdir_fail;
+    }
+
+    // an empty vector has no buffer, which qsort must not be given
+    if (vec_size_len(&ids) > 1) {
+        qsort(vec_size_as_ptr_mut(&ids), vec_size_len(&ids), sizeof(size_t), size_cmp);
+    }
+    wrapper_closedir(dir);
+    *result = ids;
+
+    return err;
+
+readdir_fail:
+    vec_size_free(&ids);
+    wrapper_closedir(dir);
+
+opendir_fail:
+    return err;
+}
+
+static void disk_segment_clear_records(disk_segment_t *segment) {
+    for (size_t i = 0; i < vec_record_len(&segment->records); ++i) {
+        disk_record_free(*vec_record_get(&segment->records, i));
+    }
+
+    vec_record_clear(&segment->records);
+}
+
+// Opens a segment left from a previous run and reads its records.
+//
+// A segment without a valid index file is scanned and then sealed.
+// A segment without any intact records is deleted, in which case `*result` is set to `NULL`.
+static error_t *disk_load_segment(disk_t *self, size_t id, disk_segment_t **result) {
+    error_t *err = NULL;
+
+    *result = NULL;
+
+    disk_segment_t *segment = NULL;
+    err = disk_segment_open(self, id, &segment);
+    if (err) return err;
+
+    if (segment->size > 0) {
+        error_t *index_err = disk_load_index(self, segment);
+
+        if (index_err) {
+            error_log_free(&index_err, LOG_DEBUG, ERROR_VERBOSITY_SOURCE_CHAIN);
+            log_printf(LOG_INFO, "Scanning the disk cache segment %zu", id);
+
+            // whatever has been loaded from the index is superseded by the scan results
+            disk_segment_clear_records(segment);
+            err = disk_scan_segment(segment);
+
+            if (!err && vec_record_len(&segment->records) > 0) {
+                // seal it properly so that the next startup doesn't have to scan it again
+                error_t *seal_err = disk_write_index(self, segment);
+
+                if (seal_err) {
+                    error_log_free(&seal_err, LOG_WARN, ERROR_VERBOSITY_SOURCE_CHAIN);
+                }
+            }
+        }
+    }
+
+    if (err) {
+        disk_segment_free(self, segment, false);
+
+        return err;
+    }
+
+    if (vec_record_len(&segment->records) == 0) {
+        // either empty or written in an incompatible format
+        disk_segment_free(self, segment, true);
+
+        return err;
+    }
+
+    *result = segment;
+
+    return err;
+}
+
+// Loads the segments left from the previous runs, oldest first.
+//
+// Each segment is read without holding the lock and only then published, so the records become
+// available to `disk_load` one segment at a time.
+static void disk_load_segments(disk_t *self, size_t *next_id) {
+    error_t *err = NULL;
+
+    *next_id = 0;
+
+    vec_size_t ids;
+    err = disk_list_segments(self, &ids);
+    if (err) goto list_fail;
+
+    for (size_t i = 0; i < vec_size_len(&ids); ++i) {
+        size_t id = *vec_size_get(&ids, i);
+        *next_id = id + 1;
+
+        disk_segment_t *segment = NULL;
+        err = disk_load_segment(self, id, &segment);
+
+        if (!err && segment != NULL) {
+            error_t *index_err = NULL;
+
+#ifndef WAXY_PTHREADS_DISABLED
+            assert_mutex_lock(&self->mtx);
+#endif
+
+            dlist_segment_node_t *node = NULL;
+            err = error_from_common(dlist_segment_append(&self->segments, segment, &node));
+
+            if (!err) {
+                self->total_size += segment->size;
+
+                for (size_t j = 0; j < vec_record_len(&segment->records) && !index_err; ++j) {
+                    index_err = disk_index_record_unsync(
+                        self, *vec_record_get_mut(&segment->records, j));
+                }
+
+                disk_reclaim_unsync(self);
+            }
+
+#ifndef WAXY_PTHREADS_DISABLED
+            assert_mutex_unlock(&self->mtx);
+#endif
+
+            if (err) {
+                disk_segment_free(self, segment, false);
+            }
+
+            if (index_err) {
+                // the records are still owned by the segment, so only the lookups are lost
+                index_err = error_wrap("Could not index a disk cache segment", index_err);
+                error_log_free(&index_err, LOG_WARN, ERROR_VERBOSITY_SOURCE_CHAIN);
+            }
+        }
+
+        if (err) {
+            err = error_wrap("Could not load a disk cache segment", err);
+            error_log_free(&err, LOG_WARN, ERROR_VERBOSITY_SOURCE_CHAIN);
+        }
+    }
+
+    vec_size_free(&ids);
+
+list_fail:
+    if (err) {
+        err = error_wrap("Could not load the disk cache", err);
+        error_log_free(&err, LOG_WARN, ERROR_VERBOSITY_SOURCE_CHAIN);
+    }
+}
+
+// Starts a new segment to append to.
+static error_t *disk_open_active_unsync(disk_t *self, size_t id) {
+    error_t *err = NULL;
+
+    string_t path;
+    err = disk_segment_path(self, id, "seg", &path);
+    if (err) goto path_fail;
+
+    int fd = -1;
+    err = error_wrap("Could not create a segment file", error_from_posix(wrapper_open_mode(
+        string_as_cptr(&path), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, DISK_FILE_MODE, &fd)));
+    if (err) goto open_fail;
+
+    disk_segment_t *segment = NULL;
+    err = disk_segment_open(self, id, &segment);
+    if (err) goto segment_open_fail;
+
+    dlist_segment_node_t *node = NULL;
+    err = error_from_common(dlist_segment_append(&self->segments, segment, &node));
+    if (err) goto append_fail;
+
+    self->active = segment;
+    self->active_fd = fd;
+    string_free(&path);
+
+    return err;
+
+append_fail:
+    disk_segment_free(self, segment, true);
+
+segment_open_fail:
+    wrapper_close(fd);
+
+open_fail:
+    string_free(&path);
+
+path_fail:
+    return err;
+}
+
+// Seals the active segment and starts a new one.
+//
+// Must be called by the writer.
+static error_t *disk_rotate(disk_t *self) {
+    error_t *err = NULL;
+
+    disk_segment_t *sealed = self->active;
+
+    // the writer is the only one modifying the active segment's records
+    err = error_wrap("Could not write a segment index", disk_write_index(self, sealed));
+
+    if (err) {
+        error_log_free(&err, LOG_WARN, ERROR_VERBOSITY_SOURCE_CHAIN);
+    }
+
+    wrapper_close(self->active_fd);
+    self->active_fd = -1;
+
+#ifndef WAXY_PTHREADS_DISABLED
+    assert_mutex_lock(&self->mtx);
+#endif
+
+    self->active = NULL;
+    err = disk_open_active_unsync(self, sealed->id + 1);
+
+#ifndef WAXY_PTHREADS_DISABLED
+    assert_mutex_unlock(&self->mtx);
+#endif
+
+    return err;
+}
+
+static void disk_job_free(disk_job_t *job) {
+    job->release(job->data);
+    string_free(&job->key);
+    free(job->iov);
+    free(job);
+}
+
+static error_t *disk_write_job(disk_t *self, disk_job_t *job) {
+    error_t *err = NULL;
+
+    uint64_t body_len = 0;
+
+    for (size_t i = 0; i < job->iov_count; ++i) {
+        body_len += job->iov[i].iov_len;
+    }
+
+    size_t key_len = string_len(&job->key);
+    uint64_t record_len = disk_record_len(key_len, body_len);
+
+    if (self->active != NULL && self->active->size > 0
+            && self->active->size + record_len > self->segment_size) {
+        err = disk_rotate(self);
+        if (err) return err;
+    }
+
+    err = error_wrap("There is no segment to write to", OK_IF(self->active != NULL));
+    if (err) return err;
+
+    disk_segment_t *segment = self->active;
+    uint64_t offset = segment->size;
+
+    // the header and the key go in front of the body
+    job->iov[1] = (struct iovec) {
+        .iov_base = string_as_cptr_mut(&job->key),
+        .iov_len = key_len,
+    };
+
+    uint64_t checksum = DISK_CHECKSUM_BASIS;
+
+    for (size_t i = 1; i < job->iov_count; ++i) {
+        checksum = disk_checksum(checksum, job->iov[i].iov_base, job->iov[i].iov_len);
+    }
+
+    disk_record_header_t header = {
+        .magic = DISK_RECORD_MAGIC,
+        .key_len = (uint32_t) key_len,
+        .body_len = body_len,
+        .checksum = checksum,
+    };
+    job->iov[0] = (struct iovec) { .iov_base = &header, .iov_len = sizeof(header) };
+
+    err = error_wrap("Could not write a record", disk_write_all(
+        self->active_fd, job->iov, job->iov_count, self->iov_max));
+
+    if (err) {
+        // drop the partially written record so that the segment stays well-formed
+        wrapper_ftruncate(self->active_fd, (off_t) offset);
+
+        return err;
+    }
+
+    disk_record_t *record = NULL;
+    err = disk_record_new(segment, (slice_t) {
+        .base = string_as_cptr(&job->key),
+        .len = key_len,
+    }, offset, body_len, checksum, &record);
+
+#ifndef WAXY_PTHREADS_DISABLED
+    assert_mutex_lock(&self->mtx);
+#endif
+
+    segment->size += record_len;
+    self->total_size += record_len;
+
+    if (!err) {
+        err = disk_add_record_unsync(self, segment, record);
+    }
+
+    disk_reclaim_unsync(self);
+
+#ifndef WAXY_PTHREADS_DISABLED
+    assert_mutex_unlock(&self->mtx);
+#endif
+
+    return err;
+}
+
+static void disk_process_job(disk_t *self, disk_job_t *job) {
+    error_t *err = error_wrap("Could not store an entry in the disk cache",
+        disk_write_job(self, job));
+
+    if (err) {
+        error_log_free(&err, LOG_WARN, ERROR_VERBOSITY_SOURCE_CHAIN);
+    }
+    disk_job_free(job);
+}
+
+// Loads the segments left from the previous runs and starts a new one to append to.
+//
+// Must be called by the writer before it processes any jobs.
+static void disk_start(disk_t *self) {
+    size_t next_id = 0;
+    disk_load_segments(self, &next_id);
+
+#ifndef WAXY_PTHREADS_DISABLED
+    assert_mutex_lock(&self->mtx);
+#endif
+
+    error_t *err = error_wrap("Could not start a disk cache segment",
+        disk_open_active_unsync(self, next_id));
+    disk_reclaim_unsync(self);
+    size_t count = hash_record_len(&self->index);
+    uint64_t total_size = self->total_size;
+
+#ifndef WAXY_PTHREADS_DISABLED
+    assert_mutex_unlock(&self->mtx);
+#endif
+
+    if (err) {
+        // the records already on disk can still be read
+        error_log_free(&err, LOG_WARN, ERROR_VERBOSITY_SOURCE_CHAIN);
+    }
+
+    log_printf(
+        LOG_INFO,
+        "Loaded %zu records (%" PRIu64 " bytes) from the disk cache at %s",
+        count, total_size, string_as_cptr(&self->path)
+    );
+}
+
+#ifndef WAXY_PTHREADS_DISABLED
+static void *disk_writer_thread(void *data) {
+    disk_t *self = data;
+
+    // this may take a while, so the lookups simply miss until the segments are loaded
+    disk_start(self);
+
+    assert_mutex_lock(&self->mtx);
+
+    while (true) {
+        while (dlist_job_len(&self->jobs) == 0 && !self->stopping) {
+            error_assert(error_from_errno(pthread_cond_wait(&self->cond, &self->mtx)));
+        }
+
+        if (dlist_job_len(&self->jobs) == 0) {
+            break;
+        }
+
+        disk_job_t *job = dlist_job_remove(&self->jobs, dlist_job_head_mut(&self->jobs));
+        assert_mutex_unlock(&self->mtx);
+
+        disk_process_job(self, job);
+
+        assert_mutex_lock(&self->mtx);
+    }
+
+    assert_mutex_unlock(&self->mtx);
+
+    return NULL;
+}
+#endif
+
+error_t *disk_new(disk_config_t const *config, disk_t **result) {
+    error_t *err = NULL;
+
+    disk_t *self = calloc(1, sizeof(disk_t));
+    err = error_wrap("Could not allocate memory for the disk cache", OK_IF(self != NULL));
+    if (err) goto calloc_fail;
+
+    err = error_from_common(string_from_cstr(config->path, &self->path));
+    if (err) goto path_fail;
+
+    long page_size = 0;
+    err = error_from_posix(wrapper_sysconf(_SC_PAGESIZE, &page_size));
+    if (err) goto sysconf_fail;
+
+    long iov_max = 0;
+    err = error_from_posix(wrapper_sysconf(_SC_IOV_MAX, &iov_max));
+    if (err) goto sysconf_fail;
+
+    self->page_size = (size_t) page_size;
+    self->iov_max = iov_max > 0 ? (size_t) iov_max : 16;
+    self->size_limit = config->size_limit;
+    self->segment_size = config->segment_size;
+    self->segments = dlist_segment_new();
+    self->total_size = 0;
+    self->active = NULL;
+    self->active_fd = -1;
+
+    posix_err_t mkdir_err = wrapper_mkdir(config->path, DISK_DIR_MODE);
+
+    if (mkdir_err.errno_code == EEXIST) {
+        mkdir_err = make_posix_err_ok();
+    }
+
+    err = error_wrap("Could not create the disk cache directory", error_from_posix(mkdir_err));
+    if (err) goto mkdir_fail;
+
+    err = error_from_common(hash_record_new(
+        (hash_record_hasher_data_t) {
+            .hasher = slice_hash_primary,
+            .opaque_data = (void *) &slice_hasher_config_primary,
+        },
+        (hash_record_hasher_data_t) {
+            .hasher = slice_hash_secondary,
+            .opaque_data = (void *) &slice_hasher_config_secondary,
+        },
+        slice_eq, &self->index
+    ));
+    if (err) goto hash_new_fail;
+
+#ifndef WAXY_PTHREADS_DISABLED
+    self->jobs = dlist_job_new();
+    self->stopping = false;
+
+    err = error_wrap("Could not initialize a mutex", error_from_errno(
+        pthread_mutex_init(&self->mtx, NULL)));
+    if (err) goto mtx_init_fail;
+
+    err = error_wrap("Could not initialize a condition variable", error_from_errno(
+        pthread_cond_init(&self->cond, NULL)));
+    if (err) goto cond_init_fail;
+
+    err = error_wrap("Could not start the disk cache writer thread", error_from_errno(
+        pthread_create(&self->writer, NULL, disk_writer_thread, self)));
+    if (err) goto thread_create_fail;
+#else
+    disk_start(self);
+#endif
+
+    *result = self;
+
+    return err;
+
+#ifndef WAXY_PTHREADS_DISABLED
+thread_create_fail:
+    pthread_cond_destroy(&self->cond);
+
+cond_init_fail:
+    pthread_mutex_destroy(&self->mtx);
+
+mtx_init_fail:
+    hash_record_free(&self->index);
+#endif
+
+hash_new_fail:
+mkdir_fail:
+sysconf_fail:
+    string_free(&self->path);
+
+path_fail:
+    free(self);
+
+calloc_fail:
+    return err;
+}
+
+void disk_free(disk_t *self) {
+    if (self == NULL) return;
+
+#ifndef WAXY_PTHREADS_DISABLED
+    assert_mutex_lock(&self->mtx);
+    self->stopping = true;
+    error_assert(error_from_errno(pthread_cond_signal(&self->cond)));
+    assert_mutex_unlock(&self->mtx);
+
+    error_assert(error_from_errno(pthread_join(self->writer, NULL)));
+    dlist_job_free(&self->jobs);
+    pthread_cond_destroy(&self->cond);
+    pthread_mutex_destroy(&self->mtx);
+#endif
+
+    if (self->active != NULL) {
+        error_t *err = NULL;
+
+        if (self->active->size > 0) {
+            err = error_wrap("Could not write a segment index", disk_write_index(self, self->active));
+        }
+
+        if (err) {
+            error_log_free(&err, LOG_WARN, ERROR_VERBOSITY_SOURCE_CHAIN);
+        }
+
+        wrapper_close(self->active_fd);
+    }
+
+    hash_record_free(&self->index);
+
+    for (dlist_segment_node_t *node = dlist_segment_head_mut(&self->segments);
+            node != NULL;
+            node = dlist_segment_next_mut(node)) {
+        disk_segment_t *segment = *dlist_segment_get_mut(node);
+        disk_segment_free(self, segment, segment->size == 0);
+    }
+
+    dlist_segment_free(&self->segments);
+    string_free(&self->path);
+    free(self);
+}
+
+error_t *disk_store(
+    disk_t *self,
+    slice_t key,
+    struct iovec const *iov,
+    size_t iov_count,
+    disk_release_cb_t release,
+    void *data
+) {
+    error_t *err = NULL;
+
+    disk_job_t *job = calloc(1, sizeof(disk_job_t));
+    err = error_wrap("Could not allocate a disk cache job", OK_IF(job != NULL));
+    if (err) goto calloc_fail;
+
+    // two leading entries are reserved for the record header and the key
+    job->iov = calloc(iov_count + 2, sizeof(struct iovec));
+    err = error_wrap("Could not allocate a disk cache job", OK_IF(job->iov != NULL));
+    if (err) goto iov_calloc_fail;
+
+    err = error_from_common(string_from_slice(key.base, key.len, &job->key));
+    if (err) goto key_fail;
+
+    memcpy(job->iov + 2, iov, iov_count * sizeof(struct iovec));
+    job->iov_count = iov_count + 2;
+    job->release = release;
+    job->data = data;
+
+#ifndef WAXY_PTHREADS_DISABLED
+    assert_mutex_lock(&self->mtx);
+
+    dlist_job_node_t *node = NULL;
+    err = error_from_common(dlist_job_append(&self->jobs, job, &node));
+
+    if (!err) {
+        error_assert(error_from_errno(pthread_cond_signal(&self->cond)));
+    }
+
+    assert_mutex_unlock(&self->mtx);
+    if (err) goto append_fail;
+#else
+    disk_process_job(self, job);
+#endif
+
+    return err;
+
+#ifndef WAXY_PTHREADS_DISABLED
+append_fail:
+    string_free(&job->key);
+#endif
+
+key_fail:
+    free(job->iov);
+
+iov_calloc_fail:
+    free(job);
+
+calloc_fail:
+    return err;
+}
+
+bool disk_contains(disk_t *self, slice_t key) {
+#ifndef WAXY_PTHREADS_DISABLED
+    assert_mutex_lock(&self->mtx);
+#endif
+
+    bool result = hash_record_get_mut(&self->index, &key) != NULL;
+
+#ifndef WAXY_PTHREADS_DISABLED
+    assert_mutex_unlock(&self->mtx);
+#endif
+
+    return result;
+}
+
+error_t *disk_load(disk_t *self, slice_t key, disk_mapping_t **result) {
+    error_t *err = NULL;
+
+#ifndef WAXY_PTHREADS_DISABLED
+    assert_mutex_lock(&self->mtx);
+#endif
+
+    disk_record_t **stored = hash_record_get_mut(&self->index, &key);
+
+    if (stored == NULL) {
+        *result = NULL;
+
+        goto not_found;
+    }
+
+    disk_record_t const *record = *stored;
+    uint64_t checksum = record->checksum;
+
+    disk_mapping_t *mapping = calloc(1, sizeof(disk_mapping_t));
+    err = error_wrap("Could not allocate a mapping", OK_IF(mapping != NULL));
+    if (err) goto calloc_fail;
+
+    // the whole record is mapped so that the header can be verified
+    uint64_t map_offset = record->offset & ~(uint64_t) (self->page_size - 1);
+    size_t lead = (size_t) (record->offset - map_offset);
+    size_t record_len = (size_t) disk_record_len(key.len, record->body_len);
+    mapping->len = lead + record_len;
+
+    err = error_wrap("Could not map a record", error_from_posix(wrapper_mmap(
+        NULL, mapping->len, PROT_READ, MAP_SHARED,
+        record->segment->fd, (off_t) map_offset, &mapping->addr)));
+    if (err) goto mmap_fail;
+
+    char const *base = (char const *) mapping->addr + lead;
+    disk_record_header_t header;
+    memcpy(&header, base, sizeof(header));
+
+    mapping->data = (slice_t) {
+        .base = base + sizeof(header) + key.len,
+        .len = (size_t) record->body_len,
+    };
+
+#ifndef WAXY_PTHREADS_DISABLED
+    // the mapping outlives the segment, so the rest is done without blocking the writer
+    assert_mutex_unlock(&self->mtx);
+#endif
+
+    // this pages the whole record in, which is about to happen anyway when it's served
+    err = error_wrap("The record on disk is corrupted", OK_IF(
+        header.magic == DISK_RECORD_MAGIC
+            && header.key_len == key.len
+            && header.body_len == mapping->data.len
+            && header.checksum == checksum
+            && memcmp(base + sizeof(header), key.base, key.len) == 0
+            && disk_checksum(DISK_CHECKSUM_BASIS, base + sizeof(header), record_len - sizeof(header))
+                == checksum));
+    if (err) goto verify_fail;
+
+    *result = mapping;
+
+    return err;
+
+verify_fail:
+    wrapper_munmap(mapping->addr, mapping->len);
+    free(mapping);
+
+#ifndef WAXY_PTHREADS_DISABLED
+    assert_mutex_lock(&self->mtx);
+#endif
+
+    // drop the record unless it has been superseded or reclaimed in the meantime
+    stored = hash_record_get_mut(&self->index, &key);
+
+    if (stored != NULL && *stored == record && (*stored)->checksum == checksum) {
+        hash_record_remove(&self->index, &key, NULL, NULL);
+    }
+
+#ifndef WAXY_PTHREADS_DISABLED
+    assert_mutex_unlock(&self->mtx);
+#endif
+
+    // a corrupted record is never served; it's reported as missing instead
+    error_log_free(&err, LOG_WARN, ERROR_VERBOSITY_SOURCE_CHAIN);
+    *result = NULL;
+
+    return err;
+
+mmap_fail:
+    free(mapping);
+
+calloc_fail:
+not_found:
+#ifndef WAXY_PTHREADS_DISABLED
+    assert_mutex_unlock(&self->mtx);
+#endif
+
+    return err;
+}
+
+slice_t disk_mapping_data(disk_mapping_t const *self) {
+    return self->data;
+}
+
+void disk_mapping_free(disk_mapping_t *self) {
+    if (self == NULL) return;
+
+    wrapper_munmap(self->addr, self->len);
+    free(self);
+}
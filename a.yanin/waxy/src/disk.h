@@ -0,0 +1,89 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <sys/uio.h>
+
+#include <common/error.h>
+#include <common/loop/io.h>
+
+// A log-structured on-disk store for evicted cache entries.
+//
+// Records are appended to segment files in a directory.
+// Once a segment grows past the configured size, it's sealed: an index file listing its records is
+// written next to it, and a new segment is started.
+// When the total size of the segments exceeds the limit, the oldest segment is deleted along with
+// all the records it holds.
+//
+// On startup the existing segments are loaded from their index files.
+// A segment without an index (e.g., after a crash) is scanned instead, up to the first malformed
+// record.
+// If the threads are available, this is done in the background, and the records become visible as
+// their segments are loaded.
+//
+// Every record and index file carries a checksum, so a corrupted record is skipped rather than
+// served.
+//
+// Records are looked up by a key (the serialized URL) and read through memory mappings.
+typedef struct disk disk_t;
+
+typedef struct {
+    // The directory to store the segments in. It's created if it doesn't exist.
+    char const *path;
+
+    // The total size of the segments, in bytes.
+    size_t size_limit;
+
+    // The size after which a segment is sealed, in bytes.
+    size_t segment_size;
+} disk_config_t;
+
+// A read-only memory mapping of a record body.
+typedef struct disk_mapping disk_mapping_t;
+
+typedef void (*disk_release_cb_t)(void *data);
+
+// Opens the store, loading the segments left from the previous runs.
+error_t *disk_new(disk_config_t const *config, disk_t **result);
+
+// Waits for the pending writes to finish, seals the current segment and frees the store.
+void disk_free(disk_t *self);
+
+// Schedules a record to be appended to the log.
+//
+// If the threads are available, the record is written by a background thread.
+// Otherwise the call blocks until it's written.
+//
+// The key and the `iov` array are copied, but the memory the `iov` entries point to must stay
+// valid until `release(data)` is called, which happens after the write is done (or has failed).
+//
+// If an error is returned, `release` is not called.
+error_t *disk_store(
+    disk_t *self,
+    slice_t key,
+    struct iovec const *iov,
+    size_t iov_count,
+    disk_release_cb_t release,
+    void *data
+);
+
+// Checks whether there is a record with the key.
+//
+// The records that are still waiting to be written are not found, and neither are the ones deleted
+// along with their segments.
+bool disk_contains(disk_t *self, slice_t key);
+
+// Looks up the most recent record with the key and maps its body into memory.
+//
+// The record is verified against its checksum.
+// Sets `*result` to `NULL` if there is no such record or it's corrupted.
+error_t *disk_load(disk_t *self, slice_t key, disk_mapping_t **result);
+
+// Returns the mapped record body.
+slice_t disk_mapping_data(disk_mapping_t const *self);
+
+// Unmaps the record body.
+//
+// The mapping stays valid even if the store is freed or the segment is deleted in the meantime.
+void disk_mapping_free(disk_mapping_t *self);
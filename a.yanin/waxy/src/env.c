@@ -0,0 +1,91 @@
+#include "env.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <common/log/log.h>
+
+static error_t *parse_unsigned_integer(char const *buf, size_t len, unsigned long long *result) {
+    assert(buf != NULL);
+    assert(result != NULL);
+    assert(buf[len] == '\0');
+
+    error_t *err = NULL;
+
+    err = error_wrap("Expected an integer", OK_IF(len != 0));
+    if (err) return err;
+
+    for (char const *c = buf; *c != '\0'; ++c) {
+        if (*c == ' ') {
+            continue;
+        }
+
+        err = error_wrap("Expected a non-negative integer", OK_IF(*c != '-'));
+        if (err) return err;
+
+        break;
+    }
+
+    errno = 0;
+    char *end = NULL;
+    unsigned long long parsed = strtoull(buf, &end, 10);
+
+    if (end != buf + len) {
+        err = error_wrap("The integer was too large", OK_IF(errno != ERANGE));
+        if (err) return err;
+
+        return error_from_cstr("Malformed input: expected an integer", NULL);
+    }
+
+    *result = parsed;
+
+    return err;
+}
+
+error_t *parse_size(char const *buf, size_t len, size_t *result) {
+    assert(buf != NULL);
+    assert(result != NULL);
+    assert(buf[len] == '\0');
+
+    error_t *err = NULL;
+
+    unsigned long long ull_result = 0;
+    err = parse_unsigned_integer(buf, len, &ull_result);
+    if (err) return err;
+
+    err = error_wrap("The integer was too large",
+        OK_IF((uintmax_t) ull_result <= (uintmax_t) SIZE_MAX));
+    if (err) return err;
+
+    *result = ull_result;
+
+    return err;
+}
+
+size_t env_get_positive_size(char const *name, size_t default_value) {
+    char const *env = getenv(name);
+    size_t size = default_value;
+
+    if (env == NULL) {
+        return size;
+    }
+
+    error_t *err = error_wrap("Could not parse the value of the environment variable",
+        parse_size(env, strlen(env), &size));
+
+    if (!err) {
+        err = error_wrap("The value of the environment variable must be positive",
+            OK_IF(size > 0));
+    }
+
+    if (err) {
+        error_log_free(&err, LOG_WARN, ERROR_VERBOSITY_SOURCE_CHAIN);
+        log_printf(LOG_INFO, "%s: defaulting to %zu", name, default_value);
+        size = default_value;
+    }
+
+    return size;
+}
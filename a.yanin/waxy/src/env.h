@@ -0,0 +1,16 @@
+#pragma once
+
+#include <stddef.h>
+
+#include <common/error.h>
+
+// Parses a non-negative decimal integer that fits in `size_t`.
+//
+// `buf[len]` must be a null byte.
+error_t *parse_size(char const *buf, size_t len, size_t *result);
+
+// Reads a positive size from the environment variable `name`.
+//
+// Returns `default_value` if the variable is not set.
+// If the value is malformed, a warning is logged and `default_value` is returned as well.
+size_t env_get_positive_size(char const *name, size_t default_value);
@@ -1,109 +1,217 @@
 #include "executor.h"
 
-#include <assert.h>
 #include <errno.h>
-#include <stdint.h>
+#include <limits.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include <common/executor/thread-pool.h>
+#include <common/executor/work-stealing.h>
+#include <common/log/log.h>
+
+#include "env.h"
 
 enum {
     DEFAULT_THREAD_POOL_SIZE = 4,
+    // the thread pool may grow up to this many times its initial size
+    DEFAULT_THREAD_POOL_GROWTH = 4,
+    // the most CPUs WAXY_THREAD_POOL_PLACEMENT can list
+    MAX_PLACEMENT_CPUS = 1024,
 };
 
-static error_t *parse_unsigned_integer(char const *buf, size_t len, unsigned long long *result) {
-    assert(buf != NULL);
-    assert(result != NULL);
-    assert(buf[len] == '\0');
+typedef enum {
+    EXECUTOR_KIND_WORK_STEALING,
+    EXECUTOR_KIND_THREAD_POOL,
+} executor_kind_t;
+
+static size_t get_thread_pool_size(void) {
+    return env_get_positive_size("WAXY_THREAD_POOL_SIZE", DEFAULT_THREAD_POOL_SIZE);
+}
+
+// Only the thread pool executor can grow; see `create_default_executor`.
+static size_t get_thread_pool_max_size(size_t min_size) {
+    size_t default_value = min_size * DEFAULT_THREAD_POOL_GROWTH;
+    size_t result = env_get_positive_size("WAXY_THREAD_POOL_MAX", default_value);
+
+    if (result < min_size) {
+        log_printf(
+            LOG_WARN,
+            "WAXY_THREAD_POOL_MAX is set to %zu, which is less than the pool size (%zu)",
+            result, min_size
+        );
+        log_printf(LOG_INFO, "Defaulting to %zu", default_value);
 
+        return default_value;
+    }
+
+    return result;
+}
+
+// Parses a list of CPUs like `0,2,4-7`.
+static error_t *parse_cpu_list(char const *str, int *cpus, size_t capacity, size_t *count) {
     error_t *err = NULL;
 
-    err = error_wrap("Expected an integer", OK_IF(len != 0));
-    if (err) return err;
+    char const *c = str;
+    size_t len = 0;
+
+    while (true) {
+        char *end = NULL;
+        errno = 0;
+        long first = strtol(c, &end, 10);
+        err = error_wrap("Expected a CPU number",
+            OK_IF(end != c && errno == 0 && first >= 0 && first <= INT_MAX));
+        if (err) return err;
+
+        long last = first;
+        c = end;
+
+        if (*c == '-') {
+            ++c;
+            errno = 0;
+            last = strtol(c, &end, 10);
+            err = error_wrap("Expected the last CPU of a range",
+                OK_IF(end != c && errno == 0 && last >= first && last <= INT_MAX));
+            if (err) return err;
 
-    for (char const *c = buf; *c != '\0'; ++c) {
-        if (*c == ' ') {
-            continue;
+            c = end;
         }
 
-        err = error_wrap("Expected a non-negative integer", OK_IF(*c != '-'));
-        if (err) return err;
+        for (long cpu = first; cpu <= last; ++cpu) {
+            err = error_wrap("Too many CPUs are listed", OK_IF(len < capacity));
+            if (err) return err;
 
-        break;
-    }
+            cpus[len++] = (int) cpu;
+        }
 
-    errno = 0;
-    char *end = NULL;
-    unsigned long long parsed = strtoull(buf, &end, 10);
+        if (*c == '\0') {
+            break;
+        }
 
-    if (end != buf + len) {
-        err = error_wrap("The integer was too large", OK_IF(errno != ERANGE));
+        err = error_wrap("Expected a comma between the CPUs", OK_IF(*c == ','));
         if (err) return err;
 
-        return error_from_cstr("Malformed input: expected an integer", NULL);
+        ++c;
     }
 
-    *result = parsed;
+    *count = len;
 
     return err;
 }
 
-static error_t *parse_size(char const *buf, size_t len, size_t *result) {
-    assert(buf != NULL);
-    assert(result != NULL);
-    assert(buf[len] == '\0');
+// Reads where the thread pool's workers should run from the environment.
+//
+// Only the thread pool executor pins its workers; see `create_default_executor`.
+//
+// `cpus` holds the parsed CPU list and must have room for `MAX_PLACEMENT_CPUS` entries.
+static executor_thread_pool_placement_t get_thread_pool_placement(int *cpus) {
+    char const *env = getenv("WAXY_THREAD_POOL_PLACEMENT");
+    executor_thread_pool_placement_t result = {
+        .policy = THREAD_POOL_PLACEMENT_NONE,
+    };
+
+    if (env == NULL || strcmp(env, "none") == 0) {
+        return result;
+    } else if (strcmp(env, "compact") == 0) {
+        result.policy = THREAD_POOL_PLACEMENT_COMPACT;
+
+        return result;
+    } else if (strcmp(env, "scatter") == 0) {
+        result.policy = THREAD_POOL_PLACEMENT_SCATTER;
+
+        return result;
+    }
 
-    error_t *err = NULL;
+    size_t cpu_count = 0;
+    error_t *err = error_wrap(
+        "Could not parse WAXY_THREAD_POOL_PLACEMENT "
+            "(expected `none`, `compact`, `scatter`, or a CPU list like `0,2,4-7`)",
+        parse_cpu_list(env, cpus, MAX_PLACEMENT_CPUS, &cpu_count));
 
-    unsigned long long ull_result = 0;
-    err = parse_unsigned_integer(buf, len, &ull_result);
-    if (err) return err;
+    if (err) {
+        error_log_free(&err, LOG_WARN, ERROR_VERBOSITY_SOURCE_CHAIN);
+        log_printf(LOG_INFO, "Defaulting to unpinned threads");
 
-    err = error_wrap("The integer was too large",
-        OK_IF((uintmax_t) ull_result <= (uintmax_t) SIZE_MAX));
-    if (err) return err;
+        return result;
+    }
 
-    *result = ull_result;
+    result.policy = THREAD_POOL_PLACEMENT_CPU_LIST;
+    result.cpus = cpus;
+    result.cpu_count = cpu_count;
 
-    return err;
+    return result;
 }
 
-static size_t get_thread_pool_size(void) {
-    char const *env = getenv("WAXY_THREAD_POOL_SIZE");
-    size_t size = DEFAULT_THREAD_POOL_SIZE;
-
-    if (env != NULL) {
-        error_t *err = error_wrap("Could not parse the value of WAXY_THREAD_POOL_SIZE",
-            parse_size(env, strlen(env), &size));
-
-        if (!err) {
-            err = error_wrap("WAXY_THREAD_POOL_SIZE must be positive", OK_IF(size > 0));
-        }
+static executor_kind_t get_executor_kind(void) {
+    char const *env = getenv("WAXY_EXECUTOR");
 
-        if (err) {
-            error_log_free(&err, LOG_WARN, ERROR_VERBOSITY_SOURCE_CHAIN);
-            log_printf(LOG_INFO, "Defaulting to %d", DEFAULT_THREAD_POOL_SIZE);
-            size = DEFAULT_THREAD_POOL_SIZE;
-        }
+    if (env == NULL || strcmp(env, "work-stealing") == 0) {
+        return EXECUTOR_KIND_WORK_STEALING;
+    } else if (strcmp(env, "thread-pool") == 0) {
+        return EXECUTOR_KIND_THREAD_POOL;
     }
 
-    return size;
+    log_printf(
+        LOG_WARN,
+        "WAXY_EXECUTOR is set to unknown value `%s` (expected `work-stealing` or `thread-pool`)",
+        env
+    );
+    log_printf(LOG_INFO, "Defaulting to the work-stealing executor");
+
+    return EXECUTOR_KIND_WORK_STEALING;
 }
 
 error_t *create_default_executor(executor_t **result) {
     error_t *err = NULL;
 
-    executor_thread_pool_t *executor = NULL;
     size_t thread_pool_size = get_thread_pool_size();
-    err = executor_thread_pool_new("Waxy", thread_pool_size, &executor);
 
-    if (err) {
-        return err;
+    switch (get_executor_kind()) {
+    case EXECUTOR_KIND_WORK_STEALING: {
+        // the work-stealing pool neither grows nor pins its workers
+        if (getenv("WAXY_THREAD_POOL_MAX") != NULL) {
+            log_printf(LOG_WARN, "WAXY_THREAD_POOL_MAX is ignored by the work-stealing executor "
+                "(set WAXY_EXECUTOR=thread-pool to use it)");
+        }
+
+        if (getenv("WAXY_THREAD_POOL_PLACEMENT") != NULL) {
+            log_printf(LOG_WARN, "WAXY_THREAD_POOL_PLACEMENT is ignored by the work-stealing "
+                "executor (set WAXY_EXECUTOR=thread-pool to use it)");
+        }
+
+        executor_work_stealing_t *executor = NULL;
+        err = executor_work_stealing_new("Waxy", thread_pool_size, &executor);
+        if (err) return err;
+
+        log_printf(LOG_INFO, "Started a work-stealing pool with %zu threads", thread_pool_size);
+        *result = (executor_t *) executor;
+
+        break;
     }
 
-    log_printf(LOG_INFO, "Started a thread pool with %zu threads", thread_pool_size);
-    *result = (executor_t *) executor;
+    case EXECUTOR_KIND_THREAD_POOL: {
+        int cpus[MAX_PLACEMENT_CPUS];
+        executor_thread_pool_config_t config = {
+            .min_size = thread_pool_size,
+            .max_size = get_thread_pool_max_size(thread_pool_size),
+            .placement = get_thread_pool_placement(cpus),
+        };
+
+        executor_thread_pool_t *executor = NULL;
+        err = executor_thread_pool_new("Waxy", &config, &executor);
+        if (err) return err;
+
+        log_printf(LOG_INFO, "Started a thread pool with %zu threads (up to %zu)",
+            config.min_size, config.max_size);
+
+        if (config.placement.policy != THREAD_POOL_PLACEMENT_NONE) {
+            log_printf(LOG_INFO, "The worker threads are pinned (%s)",
+                getenv("WAXY_THREAD_POOL_PLACEMENT"));
+        }
+        *result = (executor_t *) executor;
+
+        break;
+    }
+    }
 
     return err;
 }
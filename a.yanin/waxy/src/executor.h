@@ -2,4 +2,13 @@
 
 #include <common/executor/executor.h>
 
+// Creates the executor that runs the blocking tasks, configured from the environment.
+//
+// In the multithreaded build, `WAXY_EXECUTOR` selects between `work-stealing` (the default) and
+// `thread-pool`, and `WAXY_THREAD_POOL_SIZE` sets the number of worker threads for both.
+// `WAXY_THREAD_POOL_MAX` and `WAXY_THREAD_POOL_PLACEMENT` only apply with
+// `WAXY_EXECUTOR=thread-pool`: the work-stealing executor has a fixed set of unpinned workers,
+// so it ignores them and logs a warning if they are set.
+//
+// The single-threaded build ignores all of these and runs the tasks on the calling thread.
 error_t *create_default_executor(executor_t **result);
@@ -0,0 +1,759 @@
+#include "http.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+
+#include "util.h"
+
+enum {
+    // the heuristic freshness lifetime is this fraction of the time since the last modification...
+    HTTP_HEURISTIC_DIVISOR = 10,
+    // ...but no more than a day
+    HTTP_HEURISTIC_MAX = 24 * 60 * 60,
+    // larger delta-seconds values are clamped to this one
+    HTTP_DELTA_SECONDS_MAX = INT32_MAX,
+    HTTP_MAX_HEADERS = 128,
+    // the length of an IMF-fixdate
+    HTTP_DATE_LEN = sizeof("Sun, 06 Nov 1994 08:49:37 GMT") - 1,
+};
+
+// larger byte counts are rejected
+static int64_t const HTTP_SIZE_MAX = INT64_MAX / 2;
+
+typedef struct {
+    bool no_store;
+    bool no_cache;
+    bool has_max_age;
+    bool has_s_maxage;
+    int64_t max_age;
+    int64_t s_maxage;
+} http_cache_control_t;
+
+bool http_name_eq(slice_t name, char const *expected) {
+    size_t len = strlen(expected);
+
+    return name.len == len && strncasecmp(name.base, expected, len) == 0;
+}
+
+static slice_t http_trim(slice_t slice) {
+    while (slice.len > 0 && (slice.base[0] == ' ' || slice.base[0] == '\t')) {
+        ++slice.base;
+        --slice.len;
+    }
+
+    while (slice.len > 0) {
+        char last = slice.base[slice.len - 1];
+
+        if (last != ' ' && last != '\t') {
+            break;
+        }
+
+        --slice.len;
+    }
+
+    return slice;
+}
+
+// Parses a non-empty decimal number, clamping it to `max`.
+static bool http_parse_digits(char const *str, size_t len, int64_t max, int64_t *result) {
+    int64_t value = 0;
+
+    if (len == 0) {
+        return false;
+    }
+
+    for (size_t i = 0; i < len; ++i) {
+        if (str[i] < '0' || str[i] > '9') {
+            return false;
+        }
+
+        if (value < max) {
+            value = value > (max - (str[i] - '0')) / 10 ? max : value * 10 + (str[i] - '0');
+        }
+    }
+
+    *result = value;
+
+    return true;
+}
+
+static bool http_parse_delta_seconds(slice_t value, int64_t *result) {
+    value = http_trim(value);
+
+    return http_parse_digits(value.base, value.len, HTTP_DELTA_SECONDS_MAX, result);
+}
+
+static bool http_parse_size(slice_t value, size_t *result) {
+    int64_t parsed = 0;
+    value = http_trim(value);
+
+    // the bound keeps the arithmetic on the offsets from overflowing
+    if (!http_parse_digits(value.base, value.len, HTTP_SIZE_MAX, &parsed)
+            || parsed == HTTP_SIZE_MAX) {
+        return false;
+    }
+
+    *result = (size_t) parsed;
+
+    return true;
+}
+
+static void http_parse_cache_control(slice_t value, http_cache_control_t *result) {
+    char const *pos = value.base;
+    char const *end = value.base + value.len;
+
+    while (pos < end) {
+        // a directive extends up to the next comma outside of a quoted string
+        char const *start = pos;
+        bool quoted = false;
+
+        for (; pos < end && (quoted || *pos != ','); ++pos) {
+            if (*pos == '"') {
+                quoted = !quoted;
+            }
+        }
+
+        slice_t name = http_trim((slice_t) { .base = start, .len = (size_t) (pos - start) });
+        slice_t arg = slice_empty();
+
+        if (pos < end) {
+            ++pos;
+        }
+
+        char const *eq = memchr(name.base, '=', name.len);
+
+        if (eq != NULL) {
+            arg = http_trim((slice_t) {
+                .base = eq + 1,
+                .len = (size_t) (name.base + name.len - eq - 1),
+            });
+            name = http_trim((slice_t) { .base = name.base, .len = (size_t) (eq - name.base) });
+
+            if (arg.len >= 2 && arg.base[0] == '"' && arg.base[arg.len - 1] == '"') {
+                ++arg.base;
+                arg.len -= 2;
+            }
+        }
+
+        // field-specific `private` and `no-cache` are treated as covering the whole response
+        if (http_name_eq(name, "no-store") || http_name_eq(name, "private")) {
+            result->no_store = true;
+        } else if (http_name_eq(name, "no-cache")) {
+            result->no_cache = true;
+        } else if (http_name_eq(name, "max-age")) {
+            result->has_max_age = http_parse_delta_seconds(arg, &result->max_age);
+        } else if (http_name_eq(name, "s-maxage")) {
+            result->has_s_maxage = http_parse_delta_seconds(arg, &result->s_maxage);
+        }
+    }
+}
+
+void http_cache_info_from_headers(
+    size_t header_count,
+    struct phr_header const *headers,
+    time_t now,
+    http_cache_info_t *result
+) {
+    http_cache_control_t cache_control = {0};
+    bool has_cache_control = false;
+    bool pragma_no_cache = false;
+    bool has_expires = false;
+    bool expires_valid = false;
+    bool has_last_modified = false;
+    time_t date = now;
+    time_t expires = 0;
+    time_t last_modified = 0;
+    int64_t age = 0;
+
+    *result = (http_cache_info_t) {
+        .no_store = false,
+        .fresh_until = now,
+        .etag = slice_empty(),
+        .last_modified = slice_empty(),
+    };
+
+    for (size_t i = 0; i < header_count; ++i) {
+        // continuation lines have an empty name and are never matched
+        slice_t name = { .base = headers[i].name, .len = headers[i].name_len };
+        slice_t value = http_trim((slice_t) {
+            .base = headers[i].value,
+            .len = headers[i].value_len,
+        });
+
+        if (http_name_eq(name, "Cache-Control")) {
+            has_cache_control = true;
+            http_parse_cache_control(value, &cache_control);
+        } else if (http_name_eq(name, "Pragma")) {
+            pragma_no_cache = pragma_no_cache || http_name_eq(value, "no-cache");
+        } else if (http_name_eq(name, "Date")) {
+            time_t parsed = 0;
+
+            if (http_parse_date(value, &parsed)) {
+                date = parsed;
+            }
+        } else if (http_name_eq(name, "Expires")) {
+            has_expires = true;
+            expires_valid = http_parse_date(value, &expires);
+        } else if (http_name_eq(name, "Age")) {
+            if (!http_parse_delta_seconds(value, &age)) {
+                age = 0;
+            }
+        } else if (http_name_eq(name, "ETag")) {
+            result->etag = value;
+        } else if (http_name_eq(name, "Last-Modified")) {
+            result->last_modified = value;
+            has_last_modified = http_parse_date(value, &last_modified);
+        }
+    }
+
+    result->no_store = cache_control.no_store;
+
+    int64_t apparent_age = now > date ? (int64_t) (now - date) : 0;
+    int64_t current_age = apparent_age > age ? apparent_age : age;
+    int64_t lifetime = 0;
+
+    if (cache_control.no_cache || (!has_cache_control && pragma_no_cache)) {
+        lifetime = 0;
+    } else if (cache_control.has_s_maxage) {
+        lifetime = cache_control.s_maxage;
+    } else if (cache_control.has_max_age) {
+        lifetime = cache_control.max_age;
+    } else if (has_expires) {
+        // an invalid date means the response has already expired
+        lifetime = expires_valid && expires > date ? (int64_t) (expires - date) : 0;
+    } else if (has_last_modified && last_modified < date) {
+        lifetime = (int64_t) (date - last_modified) / HTTP_HEURISTIC_DIVISOR;
+
+        if (lifetime > HTTP_HEURISTIC_MAX) {
+            lifetime = HTTP_HEURISTIC_MAX;
+        }
+    }
+
+    result->fresh_until = now + (time_t) (lifetime - current_age);
+}
+
+bool http_cache_info_is_reusable(http_cache_info_t const *info, time_t now) {
+    return info->fresh_until > now || info->etag.len > 0 || info->last_modified.len > 0;
+}
+
+bool http_cache_info_from_response(slice_t response, time_t now, http_cache_info_t *result) {
+    struct phr_header headers[HTTP_MAX_HEADERS];
+    size_t header_count = HTTP_MAX_HEADERS;
+    int minor_version = -1;
+    int status = -1;
+    slice_t msg = slice_empty();
+
+    int count = phr_parse_response(
+        response.base, response.len,
+        &minor_version,
+        &status,
+        &msg.base, &msg.len,
+        headers,
+        &header_count,
+        0
+    );
+
+    if (count < 0) {
+        return false;
+    }
+
+    http_cache_info_from_headers(header_count, headers, now, result);
+
+    return true;
+}
+
+bool http_parse_date(slice_t value, time_t *result) {
+    static char const months[12][4] = {
+        "Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec",
+    };
+
+    if (value.len != HTTP_DATE_LEN) {
+        return false;
+    }
+
+    char const *str = value.base;
+
+    if (str[3] != ',' || str[4] != ' ' || str[7] != ' ' || str[11] != ' ' || str[16] != ' '
+            || str[19] != ':' || str[22] != ':' || memcmp(str + 25, " GMT", 4) != 0) {
+        return false;
+    }
+
+    int64_t day = 0;
+    int64_t year = 0;
+    int64_t hour = 0;
+    int64_t minute = 0;
+    int64_t second = 0;
+
+    if (!http_parse_digits(str + 5, 2, INT64_MAX, &day)
+            || !http_parse_digits(str + 12, 4, INT64_MAX, &year)
+            || !http_parse_digits(str + 17, 2, INT64_MAX, &hour)
+            || !http_parse_digits(str + 20, 2, INT64_MAX, &minute)
+            || !http_parse_digits(str + 23, 2, INT64_MAX, &second)) {
+        return false;
+    }
+
+    int64_t month = 0;
+
+    while (month < 12 && memcmp(str + 8, months[month], 3) != 0) {
+        ++month;
+    }
+
+    // 1-based from now on
+    ++month;
+
+    if (month > 12 || day < 1 || day > 31 || hour > 23 || minute > 59 || second > 60) {
+        return false;
+    }
+
+    // the number of days since the epoch, counting years from March so that leap days come last
+    int64_t y = year - (month <= 2);
+    int64_t era = (y >= 0 ? y : y - 399) / 400;
+    int64_t year_of_era = y - era * 400;
+    int64_t day_of_year = (153 * ((month + 9) % 12) + 2) / 5 + day - 1;
+    int64_t day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+    int64_t days = era * 146097 + day_of_era - 719468;
+
+    *result = (time_t) (days * 86400 + hour * 3600 + minute * 60 + second);
+
+    return true;
+}
+
+bool http_parse_range(slice_t value, http_range_t *result) {
+    slice_t const unit = slice_from_cstr("bytes=");
+    value = http_trim(value);
+
+    if (value.len < unit.len || strncasecmp(value.base, unit.base, unit.len) != 0) {
+        return false;
+    }
+
+    slice_t spec = { .base = value.base + unit.len, .len = value.len - unit.len };
+
+    // multiple ranges are not supported: the whole representation is served instead
+    if (memchr(spec.base, ',', spec.len) != NULL) {
+        return false;
+    }
+
+    char const *dash = memchr(spec.base, '-', spec.len);
+
+    if (dash == NULL) {
+        return false;
+    }
+
+    slice_t first = { .base = spec.base, .len = (size_t) (dash - spec.base) };
+    slice_t last = { .base = dash + 1, .len = (size_t) (spec.base + spec.len - dash - 1) };
+
+    *result = (http_range_t) {
+        .suffix = http_trim(first).len == 0,
+        .first = 0,
+        .last = SIZE_MAX,
+    };
+
+    if (result->suffix) {
+        return http_parse_size(last, &result->last);
+    }
+
+    if (!http_parse_size(first, &result->first)) {
+        return false;
+    }
+
+    if (http_trim(last).len > 0) {
+        return http_parse_size(last, &result->last) && result->last >= result->first;
+    }
+
+    return true;
+}
+
+bool http_range_resolve(http_range_t const *range, size_t length, size_t *first, size_t *last) {
+    if (range->suffix) {
+        if (range->last == 0 || length == 0) {
+            return false;
+        }
+
+        *first = range->last < length ? length - range->last : 0;
+        *last = length - 1;
+
+        return true;
+    }
+
+    if (range->first >= length) {
+        return false;
+    }
+
+    *first = range->first;
+    *last = range->last < length ? range->last : length - 1;
+
+    return true;
+}
+
+bool http_parse_authority(slice_t value, slice_t *host, uint16_t *port) {
+    char const *colon = NULL;
+
+    for (size_t i = value.len; i > 0; --i) {
+        if (value.base[i - 1] == ':') {
+            colon = &value.base[i - 1];
+
+            break;
+        }
+    }
+
+    if (colon == NULL) {
+        return false;
+    }
+
+    slice_t name = { .base = value.base, .len = (size_t) (colon - value.base) };
+    char const *digits = colon + 1;
+    size_t digit_count = (size_t) (value.base + value.len - digits);
+    int64_t parsed = 0;
+
+    if (!http_parse_digits(digits, digit_count, UINT16_MAX + 1, &parsed)
+            || parsed == 0
+            || parsed > UINT16_MAX) {
+        return false;
+    }
+
+    // an IPv6 address is enclosed in brackets
+    if (name.len >= 2 && name.base[0] == '[' && name.base[name.len - 1] == ']') {
+        ++name.base;
+        name.len -= 2;
+    }
+
+    if (name.len == 0) {
+        return false;
+    }
+
+    *host = name;
+    *port = (uint16_t) parsed;
+
+    return true;
+}
+
+bool http_content_length(
+    size_t header_count,
+    struct phr_header const *headers,
+    size_t *result
+) {
+    bool found = false;
+
+    for (size_t i = 0; i < header_count; ++i) {
+        slice_t name = { .base = headers[i].name, .len = headers[i].name_len };
+        slice_t value = { .base = headers[i].value, .len = headers[i].value_len };
+
+        if (http_name_eq(name, "Transfer-Encoding")) {
+            return false;
+        }
+
+        if (http_name_eq(name, "Content-Length")) {
+            size_t length = 0;
+
+            if (!http_parse_size(value, &length) || (found && length != *result)) {
+                return false;
+            }
+
+            *result = length;
+            found = true;
+        }
+    }
+
+    return found;
+}
+
+// Calls `cb` on each element of a comma-separated list until it returns `true`.
+static bool http_list_any(slice_t value, bool (*cb)(slice_t element, void *data), void *data) {
+    char const *pos = value.base;
+    char const *end = value.base + value.len;
+
+    while (pos < end) {
+        char const *comma = memchr(pos, ',', (size_t) (end - pos));
+        char const *next = comma != NULL ? comma : end;
+        slice_t element = http_trim((slice_t) { .base = pos, .len = (size_t) (next - pos) });
+
+        if (element.len > 0 && cb(element, data)) {
+            return true;
+        }
+
+        pos = comma != NULL ? comma + 1 : end;
+    }
+
+    return false;
+}
+
+static bool http_token_eq(slice_t element, void *expected) {
+    return http_name_eq(element, expected);
+}
+
+// Stores the last element of a comma-separated list.
+static bool http_token_store(slice_t element, void *last) {
+    *(slice_t *) last = element;
+
+    return false;
+}
+
+bool http_is_persistent(int minor_version, size_t header_count, struct phr_header const *headers) {
+    bool close = false;
+    bool keep_alive = false;
+
+    for (size_t i = 0; i < header_count; ++i) {
+        slice_t name = { .base = headers[i].name, .len = headers[i].name_len };
+        slice_t value = { .base = headers[i].value, .len = headers[i].value_len };
+
+        if (http_name_eq(name, "Connection")) {
+            close = close || http_list_any(value, http_token_eq, "close");
+            keep_alive = keep_alive || http_list_any(value, http_token_eq, "keep-alive");
+        }
+    }
+
+    // HTTP/1.0 connections are only persistent if explicitly requested
+    return !close && (minor_version >= 1 || keep_alive);
+}
+
+void http_framing_init(
+    http_framing_t *self,
+    int status,
+    bool head,
+    size_t header_count,
+    struct phr_header const *headers
+) {
+    *self = (http_framing_t) {
+        .kind = HTTP_FRAMING_CLOSE,
+        .remaining = 0,
+        .chunk_state = 0,
+        .has_size = false,
+    };
+
+    if (head || (status >= 100 && status < 200) || status == 204 || status == 304) {
+        self->kind = HTTP_FRAMING_NONE;
+
+        return;
+    }
+
+    for (size_t i = 0; i < header_count; ++i) {
+        slice_t name = { .base = headers[i].name, .len = headers[i].name_len };
+        slice_t value = { .base = headers[i].value, .len = headers[i].value_len };
+
+        if (http_name_eq(name, "Transfer-Encoding")) {
+            slice_t last = slice_empty();
+            http_list_any(value, http_token_store, &last);
+
+            // if chunked is not the final coding, the body is delimited by the connection close
+            self->kind = http_name_eq(last, "chunked")
+                ? HTTP_FRAMING_CHUNKED
+                : HTTP_FRAMING_CLOSE;
+
+            return;
+        }
+    }
+
+    if (http_content_length(header_count, headers, &self->remaining)) {
+        self->kind = HTTP_FRAMING_LENGTH;
+    }
+}
+
+typedef enum {
+    // reading the hexadecimal chunk size
+    HTTP_CHUNK_SIZE,
+    // skipping the chunk extensions up to the end of the line
+    HTTP_CHUNK_EXT,
+    HTTP_CHUNK_SIZE_LF,
+    HTTP_CHUNK_DATA,
+    HTTP_CHUNK_DATA_CR,
+    HTTP_CHUNK_DATA_LF,
+    // at the start of a trailer line (or the final empty line)
+    HTTP_CHUNK_TRAILER_START,
+    HTTP_CHUNK_TRAILER,
+    HTTP_CHUNK_END_LF,
+} http_chunk_state_t;
+
+static int http_hex_digit(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+
+    return -1;
+}
+
+static http_framing_status_t http_framing_feed_chunked(
+    http_framing_t *self,
+    slice_t data,
+    size_t *consumed
+) {
+    size_t pos = 0;
+
+    while (pos < data.len) {
+        char c = data.base[pos];
+
+        switch ((http_chunk_state_t) self->chunk_state) {
+        case HTTP_CHUNK_SIZE: {
+            int digit = http_hex_digit(c);
+
+            if (digit >= 0) {
+                if (self->remaining > ((size_t) HTTP_SIZE_MAX >> 4)) {
+                    return HTTP_FRAMING_INVALID;
+                }
+
+                self->remaining = (self->remaining << 4) | (size_t) digit;
+                self->has_size = true;
+                ++pos;
+
+                break;
+            }
+
+            if (!self->has_size) {
+                return HTTP_FRAMING_INVALID;
+            }
+
+            self->chunk_state = HTTP_CHUNK_EXT;
+
+            break;
+        }
+
+        case HTTP_CHUNK_EXT:
+            ++pos;
+
+            if (c == '\r') {
+                self->chunk_state = HTTP_CHUNK_SIZE_LF;
+
+                break;
+            } else if (c != '\n') {
+                break;
+            }
+
+            [[fallthrough]];
+
+        case HTTP_CHUNK_SIZE_LF:
+            if (self->chunk_state == HTTP_CHUNK_SIZE_LF) {
+                if (c != '\n') {
+                    return HTTP_FRAMING_INVALID;
+                }
+
+                ++pos;
+            }
+
+            self->has_size = false;
+            self->chunk_state = self->remaining > 0
+                ? HTTP_CHUNK_DATA
+                : HTTP_CHUNK_TRAILER_START;
+
+            break;
+
+        case HTTP_CHUNK_DATA: {
+            size_t len = data.len - pos < self->remaining ? data.len - pos : self->remaining;
+            pos += len;
+            self->remaining -= len;
+
+            if (self->remaining == 0) {
+                self->chunk_state = HTTP_CHUNK_DATA_CR;
+            }
+
+            break;
+        }
+
+        case HTTP_CHUNK_DATA_CR:
+            ++pos;
+
+            if (c == '\r') {
+                self->chunk_state = HTTP_CHUNK_DATA_LF;
+            } else if (c == '\n') {
+                self->chunk_state = HTTP_CHUNK_SIZE;
+            } else {
+                return HTTP_FRAMING_INVALID;
+            }
+
+            break;
+
+        case HTTP_CHUNK_DATA_LF:
+            if (c != '\n') {
+                return HTTP_FRAMING_INVALID;
+            }
+
+            ++pos;
+            self->chunk_state = HTTP_CHUNK_SIZE;
+
+            break;
+
+        case HTTP_CHUNK_TRAILER_START:
+            ++pos;
+
+            if (c == '\r') {
+                self->chunk_state = HTTP_CHUNK_END_LF;
+            } else if (c == '\n') {
+                *consumed = pos;
+
+                return HTTP_FRAMING_DONE;
+            } else {
+                self->chunk_state = HTTP_CHUNK_TRAILER;
+            }
+
+            break;
+
+        case HTTP_CHUNK_TRAILER:
+            ++pos;
+
+            if (c == '\n') {
+                self->chunk_state = HTTP_CHUNK_TRAILER_START;
+            }
+
+            break;
+
+        case HTTP_CHUNK_END_LF:
+            if (c != '\n') {
+                return HTTP_FRAMING_INVALID;
+            }
+
+            *consumed = pos + 1;
+
+            return HTTP_FRAMING_DONE;
+        }
+    }
+
+    *consumed = pos;
+
+    return HTTP_FRAMING_MORE;
+}
+
+http_framing_status_t http_framing_feed(http_framing_t *self, slice_t data, size_t *consumed) {
+    switch (self->kind) {
+    case HTTP_FRAMING_NONE:
+        *consumed = 0;
+
+        return HTTP_FRAMING_DONE;
+
+    case HTTP_FRAMING_LENGTH:
+        *consumed = data.len < self->remaining ? data.len : self->remaining;
+        self->remaining -= *consumed;
+
+        return self->remaining == 0 ? HTTP_FRAMING_DONE : HTTP_FRAMING_MORE;
+
+    case HTTP_FRAMING_CHUNKED:
+        return http_framing_feed_chunked(self, data, consumed);
+
+    case HTTP_FRAMING_CLOSE:
+        *consumed = data.len;
+
+        return HTTP_FRAMING_MORE;
+    }
+
+    return HTTP_FRAMING_INVALID;
+}
+
+bool http_is_hop_by_hop(slice_t name) {
+    static char const *const names[] = {
+        "Connection",
+        "Keep-Alive",
+        "Proxy-Connection",
+        "Proxy-Authenticate",
+        "Proxy-Authorization",
+        "TE",
+        "Trailer",
+        "Transfer-Encoding",
+        "Upgrade",
+    };
+
+    for (size_t i = 0; i < sizeof(names) / sizeof(*names); ++i) {
+        if (http_name_eq(name, names[i])) {
+            return true;
+        }
+    }
+
+    return false;
+}
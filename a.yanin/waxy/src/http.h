@@ -0,0 +1,154 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <picohttpparser/picohttpparser.h>
+
+#include <common/loop/io.h>
+
+// The properties of an HTTP response that determine how a shared cache may reuse it (RFC 9111).
+typedef struct {
+    // The response must not be stored (`no-store` or `private`).
+    bool no_store;
+
+    // The time (since the epoch) until which the response can be served without revalidation.
+    //
+    // A response that has to be revalidated every time (`no-cache`, or one without any freshness
+    // information) is stale right away.
+    time_t fresh_until;
+
+    // The validators for a conditional request, or empty slices if the response has none.
+    //
+    // These point into the header values.
+    slice_t etag;
+    slice_t last_modified;
+} http_cache_info_t;
+
+// Computes the caching properties of a response from its headers.
+//
+// `now` is the time the response is being evaluated at.
+// The age of the response is derived from its `Date` and `Age` headers, so this also works for
+// responses received long before `now`.
+void http_cache_info_from_headers(
+    size_t header_count,
+    struct phr_header const *headers,
+    time_t now,
+    http_cache_info_t *result
+);
+
+// Checks whether a stored response could ever be reused: it's fresh at `now` or has a validator to
+// revalidate it with.
+bool http_cache_info_is_reusable(http_cache_info_t const *info, time_t now);
+
+// Parses the status line and the headers of a raw response and computes its caching properties.
+//
+// Returns `false` if the response doesn't start with a well-formed header section.
+// The slices in `result` point into `response`.
+bool http_cache_info_from_response(slice_t response, time_t now, http_cache_info_t *result);
+
+// A single byte range requested by a client (RFC 9110, section 14.1.2).
+typedef struct {
+    // The range is `bytes=-N`: the last `last` bytes of the representation.
+    bool suffix;
+
+    size_t first;
+
+    // The last byte position, inclusive, or `SIZE_MAX` if the range is open-ended.
+    size_t last;
+} http_range_t;
+
+// Parses the value of a `Range` header.
+//
+// Returns `false` if it's malformed or requests several ranges, in which case the header should be
+// ignored.
+bool http_parse_range(slice_t value, http_range_t *result);
+
+// Resolves the range against a representation of `length` bytes.
+//
+// Stores the inclusive positions of the first and the last byte to send.
+// Returns `false` if the range is unsatisfiable.
+bool http_range_resolve(http_range_t const *range, size_t length, size_t *first, size_t *last);
+
+// Parses the `host:port` target of a CONNECT request (RFC 9110, section 9.3.6).
+//
+// The port is mandatory. The brackets around an IPv6 address are stripped from `host`, which
+// points into `value`.
+bool http_parse_authority(slice_t value, slice_t *host, uint16_t *port);
+
+// Determines the length of the body from the headers.
+//
+// Returns `false` if it's not delimited by a valid `Content-Length`.
+bool http_content_length(
+    size_t header_count,
+    struct phr_header const *headers,
+    size_t *result
+);
+
+// Determines whether the connection a message was received on can be reused afterwards.
+//
+// `minor_version` is the minor HTTP/1 version of the message.
+bool http_is_persistent(int minor_version, size_t header_count, struct phr_header const *headers);
+
+// The way the end of a response body is determined (RFC 9112, section 6.3).
+typedef enum {
+    // the response has no body
+    HTTP_FRAMING_NONE,
+
+    // the body is `Content-Length` bytes long
+    HTTP_FRAMING_LENGTH,
+
+    // the body uses the chunked transfer coding
+    HTTP_FRAMING_CHUNKED,
+
+    // the body extends until the connection is closed
+    HTTP_FRAMING_CLOSE,
+} http_framing_kind_t;
+
+typedef enum {
+    HTTP_FRAMING_MORE,
+    HTTP_FRAMING_DONE,
+    HTTP_FRAMING_INVALID,
+} http_framing_status_t;
+
+// Tracks the extent of a response body as it's being received.
+//
+// The body itself is left intact: only the boundaries of the chunks are parsed.
+typedef struct {
+    http_framing_kind_t kind;
+
+    // the number of bytes left in the body or the current chunk
+    size_t remaining;
+
+    // the position in the chunked coding
+    int chunk_state;
+    bool has_size;
+} http_framing_t;
+
+// Determines the framing of the response body from the status code and the headers.
+//
+// `head` is `true` if the response is to a `HEAD` request.
+void http_framing_init(
+    http_framing_t *self,
+    int status,
+    bool head,
+    size_t header_count,
+    struct phr_header const *headers
+);
+
+// Consumes the next part of the body.
+//
+// Stores the number of bytes that belong to the body in `consumed`: once the body ends, the rest of
+// the data is not a part of the response.
+http_framing_status_t http_framing_feed(http_framing_t *self, slice_t data, size_t *consumed);
+
+// Checks whether the header only applies to a single connection and must not be forwarded.
+bool http_is_hop_by_hop(slice_t name);
+
+// Compares a header name case-insensitively.
+bool http_name_eq(slice_t name, char const *expected);
+
+// Parses an HTTP date in the preferred format (e.g., `Sun, 06 Nov 1994 08:49:37 GMT`).
+bool http_parse_date(slice_t value, time_t *result);
@@ -5,12 +5,27 @@
 #include <common/log/log.h>
 #include <common/posix/signal.h>
 
+#include "env.h"
 #include "server.h"
 
 enum {
     CACHE_SIZE = 1024 * 1024 * 1024,
+    DEFAULT_CACHE_SHARD_COUNT = 16,
+    DEFAULT_RESOLVER_THREAD_COUNT = 2,
+    // getaddrinfo doesn't report the record TTLs, so these are fixed
+    DEFAULT_DNS_TTL = 60,
+    DEFAULT_DNS_NEGATIVE_TTL = 5,
+    DEFAULT_UPSTREAM_CONNS_PER_HOST = 32,
+    DEFAULT_UPSTREAM_IDLE_PER_HOST = 8,
+    DEFAULT_UPSTREAM_IDLE_TIMEOUT = 30,
+    DEFAULT_UPSTREAM_TIMEOUT = 60,
+    DEFAULT_CLIENT_IDLE_TIMEOUT = 60,
+    DEFAULT_CLIENT_BUFFER_LIMIT = 1024 * 1024,
+    DEFAULT_LOOP_COUNT = 1,
 };
 
+static size_t const DISK_CACHE_SIZE = (size_t) 16 * 1024 * 1024 * 1024;
+
 static _Atomic(server_t *) server_ref = NULL;
 
 static void on_sigint(int) {
@@ -57,6 +72,102 @@ static void set_log_level(void) {
     }
 }
 
+static cache_policy_t get_cache_policy(void) {
+    char const *env = getenv("WAXY_CACHE_POLICY");
+
+    if (env == NULL || strcmp(env, "clock") == 0) {
+        return CACHE_POLICY_CLOCK;
+    } else if (strcmp(env, "lru") == 0) {
+        return CACHE_POLICY_LRU;
+    } else if (strcmp(env, "s3-fifo") == 0) {
+        return CACHE_POLICY_S3_FIFO;
+    }
+
+    log_printf(
+        LOG_WARN,
+        "WAXY_CACHE_POLICY is set to unknown value `%s` (expected `lru`, `clock`, or `s3-fifo`)",
+        env
+    );
+    log_printf(LOG_INFO, "Defaulting to CLOCK");
+
+    return CACHE_POLICY_CLOCK;
+}
+
+static cache_admission_t get_cache_admission(void) {
+    char const *env = getenv("WAXY_CACHE_ADMISSION");
+
+    if (env == NULL || strcmp(env, "always") == 0) {
+        return CACHE_ADMISSION_ALWAYS;
+    } else if (strcmp(env, "tinylfu") == 0) {
+        return CACHE_ADMISSION_TINYLFU;
+    }
+
+    log_printf(
+        LOG_WARN,
+        "WAXY_CACHE_ADMISSION is set to unknown value `%s` (expected `always` or `tinylfu`)",
+        env
+    );
+    log_printf(LOG_INFO, "Defaulting to admitting every entry");
+
+    return CACHE_ADMISSION_ALWAYS;
+}
+
+static size_t get_client_buffer_low_watermark(size_t limit) {
+    size_t default_value = limit / 4;
+    size_t result = env_get_positive_size("WAXY_CLIENT_BUFFER_LOW", default_value);
+
+    if (result >= limit) {
+        log_printf(
+            LOG_WARN,
+            "WAXY_CLIENT_BUFFER_LOW is set to %zu, which is not less than the buffer limit (%zu)",
+            result, limit
+        );
+        log_printf(LOG_INFO, "Defaulting to %zu", default_value);
+
+        return default_value;
+    }
+
+    return result;
+}
+
+static size_t get_loop_count(void) {
+    size_t result = env_get_positive_size("WAXY_LOOPS", DEFAULT_LOOP_COUNT);
+
+#ifdef WAXY_PTHREADS_DISABLED
+    if (result > 1) {
+        log_printf(LOG_WARN, "WAXY_LOOPS is set to %zu, but threads are not available", result);
+        log_printf(LOG_INFO, "Running a single loop");
+
+        return 1;
+    }
+#endif
+
+    return result;
+}
+
+static loop_backend_t get_loop_backend(void) {
+    char const *env = getenv("WAXY_LOOP_BACKEND");
+
+    if (env == NULL) {
+        return LOOP_BACKEND_DEFAULT;
+    } else if (strcmp(env, "poll") == 0) {
+        return LOOP_BACKEND_POLL;
+    } else if (strcmp(env, "epoll") == 0) {
+        return LOOP_BACKEND_EPOLL;
+    } else if (strcmp(env, "io_uring") == 0) {
+        return LOOP_BACKEND_IO_URING;
+    }
+
+    log_printf(
+        LOG_WARN,
+        "WAXY_LOOP_BACKEND is set to unknown value `%s` (expected `poll`, `epoll`, or `io_uring`)",
+        env
+    );
+    log_printf(LOG_INFO, "Defaulting to the best available backend");
+
+    return LOOP_BACKEND_DEFAULT;
+}
+
 int main(int argc, char **argv) {
     error_t *err = NULL;
 
@@ -84,9 +195,47 @@ int main(int argc, char **argv) {
     sigaction(SIGPIPE, &(struct sigaction) { .sa_handler = SIG_IGN }, NULL);
     sigaction(SIGINT, &(struct sigaction) { .sa_handler = on_sigint }, NULL);
 
+    cache_config_t cache_config = {
+        .size_limit = env_get_positive_size("WAXY_CACHE_SIZE", CACHE_SIZE),
+        .shard_count = env_get_positive_size("WAXY_CACHE_SHARDS", DEFAULT_CACHE_SHARD_COUNT),
+        .policy = get_cache_policy(),
+        .admission = get_cache_admission(),
+        .disk_path = getenv("WAXY_CACHE_DIR"),
+        .disk_size_limit = env_get_positive_size("WAXY_DISK_CACHE_SIZE", DISK_CACHE_SIZE),
+    };
+
+    resolver_config_t resolver_config = {
+        .thread_count = env_get_positive_size(
+            "WAXY_RESOLVER_THREADS", DEFAULT_RESOLVER_THREAD_COUNT),
+        .positive_ttl = (time_t) env_get_positive_size("WAXY_DNS_TTL", DEFAULT_DNS_TTL),
+        .negative_ttl = (time_t) env_get_positive_size(
+            "WAXY_DNS_NEGATIVE_TTL", DEFAULT_DNS_NEGATIVE_TTL),
+    };
+
+    pool_config_t pool_config = {
+        .max_per_host = env_get_positive_size(
+            "WAXY_UPSTREAM_CONNS_PER_HOST", DEFAULT_UPSTREAM_CONNS_PER_HOST),
+        .max_idle_per_host = env_get_positive_size(
+            "WAXY_UPSTREAM_IDLE_PER_HOST", DEFAULT_UPSTREAM_IDLE_PER_HOST),
+        .idle_timeout = (time_t) env_get_positive_size(
+            "WAXY_UPSTREAM_IDLE_TIMEOUT", DEFAULT_UPSTREAM_IDLE_TIMEOUT),
+        .io_timeout = (time_t) env_get_positive_size(
+            "WAXY_UPSTREAM_TIMEOUT", DEFAULT_UPSTREAM_TIMEOUT),
+    };
+
+    client_config_t client_config = {
+        .idle_timeout = (time_t) env_get_positive_size(
+            "WAXY_CLIENT_IDLE_TIMEOUT", DEFAULT_CLIENT_IDLE_TIMEOUT),
+        .buffer_limit = env_get_positive_size(
+            "WAXY_CLIENT_BUFFER_LIMIT", DEFAULT_CLIENT_BUFFER_LIMIT),
+    };
+    client_config.buffer_low_watermark = get_client_buffer_low_watermark(
+        client_config.buffer_limit);
+
     log_printf(LOG_INFO, "Starting up...");
     server_t server;
-    err = server_new(port, CACHE_SIZE, &server);
+    err = server_new(port, get_loop_count(), get_loop_backend(), &cache_config, &resolver_config,
+        &pool_config, &client_config, &server);
     if (err) goto server_new_fail;
 
     server_ref = &server;
@@ -0,0 +1,635 @@
+#include "pool.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef WAXY_PTHREADS_DISABLED
+#include <pthread.h>
+#endif
+
+#include <common/collections/string.h>
+#include <common/error-codes/adapter.h>
+#include <common/log/log.h>
+
+#include "util.h"
+
+typedef pool_request_t *pool_request_ptr_t;
+
+#define DLIST_ELEMENT_TYPE pool_request_ptr_t
+#define DLIST_LABEL request
+#define DLIST_CONFIG (COLLECTION_DECLARE | COLLECTION_DEFINE | COLLECTION_STATIC)
+#include <common/collections/dlist.h>
+
+typedef pool_conn_t *pool_conn_ptr_t;
+
+#define DLIST_ELEMENT_TYPE pool_conn_ptr_t
+#define DLIST_LABEL conn
+#define DLIST_CONFIG (COLLECTION_DECLARE | COLLECTION_DEFINE | COLLECTION_STATIC)
+#include <common/collections/dlist.h>
+
+// The connections to a single origin.
+//
+// A host is forgotten once it has no connections and no waiting requests.
+typedef struct {
+    // `host:port`, used as the key in the pool
+    string_t key;
+
+    // the number of connections, busy or idle
+    size_t open_count;
+
+    // the idle connections from the least to the most recently released
+    dlist_conn_t idle;
+
+    // the requests waiting for a connection, in the order of arrival
+    dlist_request_t waiters;
+} pool_host_t;
+
+typedef pool_host_t *pool_host_ptr_t;
+
+// the key slice points to the `key` of the host stored as the value
+#define HASH_KEY_TYPE slice_t
+#define HASH_VALUE_TYPE pool_host_ptr_t
+#define HASH_LABEL host
+#define HASH_CONFIG (COLLECTION_DECLARE | COLLECTION_DEFINE | COLLECTION_STATIC)
+#include <common/collections/hash.h>
+#include <common/collections/hash/byte_hasher.h>
+
+struct pool_conn {
+    pool_t *pool;
+
+    // the origin the connection is counted against, or `NULL` once an idle connection is closed
+    pool_host_t *host;
+    tcp_handler_t *tcp;
+
+    // the node in `host->idle`, only set while the connection is idle
+    dlist_conn_node_t *host_node;
+};
+
+// `mtx` guards everything but the configuration.
+struct pool {
+#ifndef WAXY_PTHREADS_DISABLED
+    pthread_mutex_t mtx;
+#endif
+    pool_config_t config;
+    hash_host_t hosts;
+
+    pool_stats_t stats;
+};
+
+struct pool_request {
+    handler_t handler;
+    pool_t *pool;
+    pool_on_acquired_cb_t on_acquired;
+
+    // the following fields are guarded by the pool lock
+
+    pool_host_t *host;
+    // the node in the list of waiters, or `NULL` once the connection is acquired
+    dlist_request_node_t *node;
+
+    // allocated in advance so that acquiring a new connection can't fail
+    pool_conn_t *spare;
+
+    // accessed by the request handler only
+    bool reported;
+};
+
+static void slice_hash(slice_t const *slice, byte_hasher_state_t *state) {
+    byte_hasher_digest_slice(state, slice->base, slice->len);
+}
+
+static byte_hasher_config_t const slice_hasher_config_primary = {
+    .seed = 61,
+    .hash = (void (*)(void const *, byte_hasher_state_t *)) slice_hash,
+};
+
+static byte_hasher_config_t const slice_hasher_config_secondary = {
+    .seed = 167,
+    .hash = (void (*)(void const *, byte_hasher_state_t *)) slice_hash,
+};
+
+static size_t slice_hash_primary(slice_t const *slice, void *data) {
+    return byte_hasher(slice, data);
+}
+
+static size_t slice_hash_secondary(slice_t const *slice, void *data) {
+    return byte_hasher_secondary(slice, data);
+}
+
+static bool slice_eq(slice_t const *lhs, slice_t const *rhs) {
+    return lhs->len == rhs->len && memcmp(lhs->base, rhs->base, lhs->len) == 0;
+}
+
+static slice_t pool_host_key(pool_host_t const *host) {
+    return (slice_t) {
+        .base = string_as_cptr(&host->key),
+        .len = string_len(&host->key),
+    };
+}
+
+static void pool_lock(pool_t *self) {
+    (void) self;
+#ifndef WAXY_PTHREADS_DISABLED
+    assert_mutex_lock(&self->mtx);
+#endif
+}
+
+static void pool_unlock(pool_t *self) {
+    (void) self;
+#ifndef WAXY_PTHREADS_DISABLED
+    assert_mutex_unlock(&self->mtx);
+#endif
+}
+
+static void pool_host_free(pool_host_t *host) {
+    string_free(&host->key);
+    dlist_conn_free(&host->idle);
+    dlist_request_free(&host->waiters);
+    free(host);
+}
+
+// Forgets the host if nothing refers to it anymore.
+//
+// The lock must be held.
+static void pool_host_trim_unsync(pool_t *self, pool_host_t *host) {
+    if (host->open_count > 0 || dlist_request_len(&host->waiters) > 0) {
+        return;
+    }
+
+    slice_t key = pool_host_key(host);
+    // only fails if the key was not found -- our invariant ensures this can't happen
+    error_assert(error_from_common(hash_host_remove(&self->hosts, &key, NULL, NULL)));
+    pool_host_free(host);
+}
+
+// Wakes up the first waiting request if there's a connection it could take.
+//
+// The lock must be held.
+static void pool_host_wake_unsync(pool_t *self, pool_host_t *host) {
+    dlist_request_node_t *head = dlist_request_head_mut(&host->waiters);
+
+    if (head == NULL) {
+        return;
+    }
+
+    if (dlist_conn_len(&host->idle) > 0 || host->open_count < self->config.max_per_host) {
+        handler_force(&(*dlist_request_get_mut(head))->handler);
+    }
+}
+
+// Removes an idle connection from the pool and closes it.
+//
+// The connection is freed along with its handler.
+//
+// The lock must be held.
+static void pool_conn_close_unsync(pool_t *self, pool_conn_t *conn) {
+    pool_host_t *host = conn->host;
+
+    dlist_conn_remove(&host->idle, conn->host_node);
+    conn->host_node = NULL;
+    conn->host = NULL;
+    --host->open_count;
+
+    handler_t *handler = (handler_t *) conn->tcp;
+    handler_unregister(handler);
+
+    if (handler_loop(handler) != NULL) {
+        loop_interrupt(handler_loop(handler));
+    }
+
+    pool_host_wake_unsync(self, host);
+    pool_host_trim_unsync(self, host);
+}
+
+// Finds the most recently released idle connection registered in `loop`.
+//
+// The most recently used connection is the least likely to have been closed by the peer.
+//
+// The lock must be held.
+static pool_conn_t *pool_host_find_idle_unsync(pool_host_t *host, loop_t *loop) {
+    for (dlist_conn_node_t *node = dlist_conn_end_mut(&host->idle);
+            node != NULL;
+            node = dlist_conn_prev_mut(node)) {
+        pool_conn_t *conn = *dlist_conn_get_mut(node);
+
+        if (handler_loop((handler_t *) conn->tcp) == loop) {
+            return conn;
+        }
+    }
+
+    return NULL;
+}
+
+// Takes an idle connection, or the spare one if the limit allows it.
+//
+// Only the idle connections registered in `loop` are reused, so that a connection is never handled
+// by two loops at once.
+// If the limit has been reached, an idle connection of another loop is closed to make room.
+//
+// Returns `NULL` if the request has to wait.
+//
+// The lock must be held.
+static pool_conn_t *pool_try_acquire_unsync(
+    pool_t *self,
+    pool_host_t *host,
+    loop_t *loop,
+    pool_conn_t **spare
+) {
+    pool_conn_t *conn = pool_host_find_idle_unsync(host, loop);
+
+    if (conn == NULL
+            && host->open_count >= self->config.max_per_host
+            && dlist_conn_len(&host->idle) > 0) {
+        log_printf(LOG_DEBUG, "Closing an idle connection to %s held by another loop",
+            string_as_cptr(&host->key));
+        // the request is among the waiters, so the host is not forgotten
+        pool_conn_close_unsync(self, *dlist_conn_get_mut(dlist_conn_head_mut(&host->idle)));
+    }
+
+    if (conn != NULL) {
+        dlist_conn_remove(&host->idle, conn->host_node);
+        conn->host_node = NULL;
+
+        ++self->stats.reused;
+        log_printf(LOG_DEBUG, "Reusing an idle connection to %s", string_as_cptr(&host->key));
+    } else if (host->open_count < self->config.max_per_host) {
+        conn = *spare;
+        *spare = NULL;
+
+        *conn = (pool_conn_t) {
+            .pool = self,
+            .host = host,
+            .tcp = NULL,
+            .host_node = NULL,
+        };
+        ++host->open_count;
+    } else {
+        return NULL;
+    }
+
+    ++self->stats.acquired;
+
+    return conn;
+}
+
+error_t *pool_new(pool_config_t const *config, pool_t **result) {
+    error_t *err = NULL;
+
+    pool_t *self = calloc(1, sizeof(pool_t));
+    err = error_wrap("Could not allocate memory for the connection pool", OK_IF(self != NULL));
+    if (err) goto calloc_fail;
+
+    self->config = *config;
+
+    if (self->config.max_per_host == 0) {
+        self->config.max_per_host = 1;
+    }
+
+    self->stats = (pool_stats_t) {0};
+
+    err = error_from_common(hash_host_new(
+        (hash_host_hasher_data_t) {
+            .hasher = slice_hash_primary,
+            .opaque_data = (void *) &slice_hasher_config_primary,
+        },
+        (hash_host_hasher_data_t) {
+            .hasher = slice_hash_secondary,
+            .opaque_data = (void *) &slice_hasher_config_secondary,
+        },
+        slice_eq, &self->hosts
+    ));
+    if (err) goto hash_new_fail;
+
+#ifndef WAXY_PTHREADS_DISABLED
+    err = error_wrap("Could not initialize a mutex", error_from_errno(
+        pthread_mutex_init(&self->mtx, NULL)));
+    if (err) goto mtx_init_fail;
+#endif
+
+    *result = self;
+
+    return err;
+
+#ifndef WAXY_PTHREADS_DISABLED
+mtx_init_fail:
+    hash_host_free(&self->hosts);
+#endif
+
+hash_new_fail:
+    free(self);
+
+calloc_fail:
+    return err;
+}
+
+static bool pool_free_host(slice_t const *, pool_host_ptr_t const *host, void *) {
+    pool_host_free(*host);
+
+    return false;
+}
+
+void pool_free(pool_t *self) {
+    if (self == NULL) return;
+
+    hash_host_for_each(&self->hosts, pool_free_host, NULL);
+    hash_host_free(&self->hosts);
+
+#ifndef WAXY_PTHREADS_DISABLED
+    pthread_mutex_destroy(&self->mtx);
+#endif
+
+    free(self);
+}
+
+void pool_stats(pool_t *self, pool_stats_t *result) {
+    pool_lock(self);
+    *result = self->stats;
+    pool_unlock(self);
+}
+
+static void pool_request_free(pool_request_t *self) {
+    pool_t *pool = self->pool;
+    pool_lock(pool);
+
+    if (self->node != NULL) {
+        dlist_request_remove(&self->host->waiters, self->node);
+        self->node = NULL;
+        pool_host_wake_unsync(pool, self->host);
+        pool_host_trim_unsync(pool, self->host);
+    }
+
+    pool_unlock(pool);
+
+    free(self->spare);
+}
+
+static error_t *pool_request_process(pool_request_t *self, loop_t *loop, poll_flags_t) {
+    error_t *err = NULL;
+
+    if (self->reported) {
+        return err;
+    }
+
+    pool_t *pool = self->pool;
+    pool_host_t *host = self->host;
+    pool_conn_t *conn = NULL;
+    pool_lock(pool);
+
+    // the requests are served in the order of arrival
+    if (self->node == dlist_request_head_mut(&host->waiters)) {
+        conn = pool_try_acquire_unsync(pool, host, loop, &self->spare);
+    }
+
+    if (conn != NULL) {
+        dlist_request_remove(&host->waiters, self->node);
+        self->node = NULL;
+        pool_host_wake_unsync(pool, host);
+    }
+
+    pool_unlock(pool);
+
+    if (conn == NULL) {
+        return err;
+    }
+
+    self->reported = true;
+
+    return self->on_acquired(loop, self, conn);
+}
+
+static handler_vtable_t const pool_request_vtable = {
+    .free = (handler_vtable_free_t) pool_request_free,
+    .on_error = NULL,
+    .process = (handler_vtable_process_t) pool_request_process,
+};
+
+// Finds the host for the key, creating it if necessary.
+//
+// `key` is taken over.
+//
+// The lock must be held.
+static error_t *pool_get_host_unsync(pool_t *self, string_t *key, pool_host_t **result) {
+    error_t *err = NULL;
+
+    slice_t key_slice = { .base = string_as_cptr(key), .len = string_len(key) };
+    pool_host_t **stored = hash_host_get_mut(&self->hosts, &key_slice);
+
+    if (stored != NULL) {
+        string_free(key);
+        *result = *stored;
+
+        return err;
+    }
+
+    pool_host_t *host = calloc(1, sizeof(pool_host_t));
+    err = error_wrap("Could not allocate a connection pool entry", OK_IF(host != NULL));
+    if (err) goto calloc_fail;
+
+    host->key = *key;
+    host->open_count = 0;
+    host->idle = dlist_conn_new();
+    host->waiters = dlist_request_new();
+
+    err = error_wrap("Could not add a connection pool entry", error_from_common(
+        hash_host_insert(&self->hosts, pool_host_key(host), host)));
+    if (err) goto insert_fail;
+
+    *result = host;
+
+    return err;
+
+insert_fail:
+    pool_host_free(host);
+
+    return err;
+
+calloc_fail:
+    string_free(key);
+
+    return err;
+}
+
+error_t *pool_request_new(
+    pool_t *self,
+    slice_t host,
+    uint16_t port,
+    pool_on_acquired_cb_t on_acquired,
+    pool_request_t **result
+) {
+    error_t *err = NULL;
+
+    pool_request_t *request = calloc(1, sizeof(pool_request_t));
+    err = error_wrap("Could not allocate a connection request", OK_IF(request != NULL));
+    if (err) goto calloc_fail;
+
+    handler_init(&request->handler, &pool_request_vtable, -1);
+    request->pool = self;
+    request->on_acquired = on_acquired;
+    request->host = NULL;
+    request->node = NULL;
+    request->reported = false;
+
+    request->spare = calloc(1, sizeof(pool_conn_t));
+    err = error_wrap("Could not allocate a connection request", OK_IF(request->spare != NULL));
+    if (err) goto spare_calloc_fail;
+
+    string_t key;
+    err = error_from_common(string_sprintf(&key, "%.*s:%u", (int) host.len, host.base, port));
+    if (err) goto key_fail;
+
+    pool_lock(self);
+
+    err = pool_get_host_unsync(self, &key, &request->host);
+    if (err) goto get_host_fail;
+
+    err = error_wrap("Could not enqueue a connection request", error_from_common(
+        dlist_request_append(&request->host->waiters, request, &request->node)));
+    if (err) goto append_fail;
+
+    pool_host_wake_unsync(self, request->host);
+
+    pool_unlock(self);
+
+    *result = request;
+
+    return err;
+
+append_fail:
+    pool_host_trim_unsync(self, request->host);
+
+get_host_fail:
+    pool_unlock(self);
+
+key_fail:
+spare_calloc_fail:
+    handler_free(&request->handler);
+
+calloc_fail:
+    return err;
+}
+
+tcp_handler_t *pool_conn_tcp(pool_conn_t const *self) {
+    return self->tcp;
+}
+
+void pool_conn_set_tcp(pool_conn_t *self, tcp_handler_t *tcp) {
+    self->tcp = tcp;
+}
+
+uint64_t pool_io_timeout_ms(pool_t const *self) {
+    return (uint64_t) self->config.io_timeout * 1000;
+}
+
+// Closes an idle connection once the peer closes it, sends something, or fails.
+static void pool_on_idle_event(tcp_handler_t *handler) {
+    pool_conn_t *conn = handler_custom_data((handler_t *) handler);
+    pool_t *pool = conn->pool;
+    pool_lock(pool);
+
+    // if it's no longer idle, it has been taken out of the pool and is about to be used
+    if (conn->host_node != NULL) {
+        log_printf(LOG_DEBUG, "An idle connection to %s has been closed by the peer",
+            string_as_cptr(&conn->host->key));
+        pool_conn_close_unsync(pool, conn);
+    }
+
+    pool_unlock(pool);
+}
+
+static error_t *pool_on_idle_read(loop_t *, tcp_handler_t *handler, slice_t) {
+    pool_on_idle_event(handler);
+
+    return NULL;
+}
+
+static error_t *pool_on_idle_error(loop_t *, tcp_handler_t *handler, error_t *err) {
+    error_log_free(&err, LOG_DEBUG, ERROR_VERBOSITY_SOURCE_CHAIN);
+    pool_on_idle_event(handler);
+
+    return NULL;
+}
+
+static error_t *pool_on_idle_timeout(loop_t *, tcp_handler_t *handler, tcp_timeout_t) {
+    pool_conn_t *conn = handler_custom_data((handler_t *) handler);
+    pool_t *pool = conn->pool;
+    pool_lock(pool);
+
+    if (conn->host_node != NULL) {
+        log_printf(LOG_DEBUG, "Closing an idle connection to %s", string_as_cptr(&conn->host->key));
+        ++pool->stats.expired;
+        pool_conn_close_unsync(pool, conn);
+    }
+
+    pool_unlock(pool);
+
+    return NULL;
+}
+
+static void pool_conn_on_free(handler_t *handler) {
+    pool_conn_t *conn = handler_custom_data(handler);
+
+    if (conn == NULL) {
+        return;
+    }
+
+    pool_t *pool = conn->pool;
+    pool_lock(pool);
+
+    if (conn->host_node != NULL) {
+        pool_conn_close_unsync(pool, conn);
+    }
+
+    pool_unlock(pool);
+
+    free(conn);
+}
+
+bool pool_conn_release(pool_conn_t *self, bool reusable) {
+    pool_t *pool = self->pool;
+    pool_host_t *host = self->host;
+    tcp_handler_t *tcp = self->tcp;
+    bool kept = false;
+    pool_lock(pool);
+
+    if (reusable && tcp != NULL
+            && dlist_conn_len(&host->idle) < pool->config.max_idle_per_host) {
+        error_t *err = error_from_common(
+            dlist_conn_append(&host->idle, self, &self->host_node));
+
+        if (err) {
+            error_log_free(&err, LOG_WARN, ERROR_VERBOSITY_SOURCE_CHAIN);
+        } else {
+            kept = true;
+        }
+    }
+
+    if (!kept) {
+        --host->open_count;
+    }
+
+    pool_host_wake_unsync(pool, host);
+
+    if (!kept) {
+        pool_host_trim_unsync(pool, host);
+    }
+
+    pool_unlock(pool);
+
+    if (!kept) {
+        free(self);
+
+        return false;
+    }
+
+    // the handler is locked by the caller, so it can't be used or freed before this is done
+    handler_set_custom_data((handler_t *) tcp, self);
+    handler_set_on_free((handler_t *) tcp, pool_conn_on_free);
+    tcp_set_on_error(tcp, pool_on_idle_error);
+    tcp_set_on_timeout(tcp, pool_on_idle_timeout);
+    tcp_read(tcp, pool_on_idle_read, pool_on_idle_error);
+    tcp_set_timeout(tcp, TCP_TIMEOUT_READ, 0);
+    tcp_set_timeout(tcp, TCP_TIMEOUT_WRITE, 0);
+    tcp_set_timeout(tcp, TCP_TIMEOUT_IDLE, (uint64_t) pool->config.idle_timeout * 1000);
+
+    return true;
+}
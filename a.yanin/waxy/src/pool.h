@@ -0,0 +1,109 @@
+#pragma once
+
+#include <stdint.h>
+#include <time.h>
+
+#include <common/error.h>
+#include <common/loop/io.h>
+#include <common/loop/loop.h>
+#include <common/loop/tcp.h>
+
+// A pool of persistent connections to origin servers, keyed by the host and the port.
+//
+// A connection is either busy, carrying a single request, or idle, waiting in the pool to be
+// reused.
+// The number of connections to an origin is limited: requests over the limit wait until one of the
+// connections is released.
+//
+// Idle connections are closed once the peer closes them or they have been idle for longer than the
+// timeout.
+typedef struct pool pool_t;
+
+typedef struct {
+    // The maximum number of connections (busy or idle) to a single origin.
+    size_t max_per_host;
+
+    // The maximum number of idle connections kept for a single origin.
+    size_t max_idle_per_host;
+
+    // The number of seconds a connection can stay idle for.
+    time_t idle_timeout;
+
+    // The number of seconds a busy connection can go without sending or receiving anything.
+    time_t io_timeout;
+} pool_config_t;
+
+typedef struct {
+    // The number of connections handed out by the pool.
+    uint64_t acquired;
+
+    // The number of those that were idle connections reused.
+    uint64_t reused;
+
+    // The number of idle connections closed because of the timeout.
+    uint64_t expired;
+} pool_stats_t;
+
+// A connection to an origin, counted against its limit.
+typedef struct pool_conn pool_conn_t;
+
+// A pending request for a connection.
+//
+// This is an instance of `handler_t` and should be registered in a `loop_t`.
+// Once a connection is available, the callback is invoked from the loop.
+typedef struct pool_request pool_request_t;
+
+// The acquisition callback.
+//
+// The callback takes over the connection, which must be released with `pool_conn_release`.
+//
+// The request is not unregistered automatically.
+typedef error_t *(*pool_on_acquired_cb_t)(loop_t *loop, pool_request_t *request, pool_conn_t *conn);
+
+error_t *pool_new(pool_config_t const *config, pool_t **result);
+
+// Frees the pool.
+//
+// All the connections must have been released, and the idle ones freed.
+void pool_free(pool_t *self);
+
+// Retrieves the usage counters.
+void pool_stats(pool_t *self, pool_stats_t *result);
+
+// Requests a connection to `host` and `port`.
+//
+// The host is copied.
+error_t *pool_request_new(
+    pool_t *self,
+    slice_t host,
+    uint16_t port,
+    pool_on_acquired_cb_t on_acquired,
+    pool_request_t **result
+);
+
+// Returns the idle connection handed out by the pool, or `NULL` if a new one has to be established.
+//
+// An idle connection stays registered in its loop, and its handler must be locked before use.
+// Only the idle connections of the loop the request is registered in are handed out.
+// Its custom data, callbacks, and timeouts belong to the pool until they are replaced by the
+// caller.
+// If the caller drops the handler instead, it must reset its custom data to `NULL` before
+// unregistering it.
+tcp_handler_t *pool_conn_tcp(pool_conn_t const *self);
+
+// Associates the connection with a newly established (or re-established) socket handler.
+void pool_conn_set_tcp(pool_conn_t *self, tcp_handler_t *tcp);
+
+// Returns the read and write timeout the users of the connections are expected to set, in
+// milliseconds (see `pool_config_t.io_timeout`).
+uint64_t pool_io_timeout_ms(pool_t const *self);
+
+// Releases the connection.
+//
+// If `reusable` is `true`, the handler is returned to the pool if there's room for it.
+// This must be done from the handler's synchronized context.
+// The pool then replaces the custom data and the callbacks of the handler, taking over it.
+//
+// Returns `true` if the pool has taken over the handler.
+// Otherwise it's still owned by the caller, who is expected to close it.
+bool pool_conn_release(pool_conn_t *self, bool reusable);
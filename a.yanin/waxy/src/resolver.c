@@ -0,0 +1,637 @@
+#include "resolver.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef WAXY_PTHREADS_DISABLED
+#include <pthread.h>
+#endif
+
+#include <common/collections/string.h>
+#include <common/error-codes/adapter.h>
+#include <common/log/log.h>
+
+#include "gai-adapter.h"
+#include "util.h"
+
+enum {
+    // once there are more cached lookups than this, the oldest complete ones are forgotten
+    RESOLVER_MAX_ENTRIES = 4096,
+};
+
+#define ARC_ELEMENT_TYPE addrinfo_t
+#define ARC_LABEL addrinfo
+#define ARC_FREE_CB freeaddrinfo
+#define ARC_CONFIG (COLLECTION_DEFINE)
+#include <common/memory/arc.h>
+
+typedef resolver_query_t *resolver_query_ptr_t;
+
+#define DLIST_ELEMENT_TYPE resolver_query_ptr_t
+#define DLIST_LABEL query
+#define DLIST_CONFIG (COLLECTION_DECLARE | COLLECTION_DEFINE | COLLECTION_STATIC)
+#include <common/collections/dlist.h>
+
+typedef enum {
+    // the result is cached until the entry expires (a new entry is created expired)
+    RESOLVER_ENTRY_DONE,
+
+    // the lookup is being done
+    RESOLVER_ENTRY_PENDING,
+} resolver_entry_state_t;
+
+typedef struct resolver_entry resolver_entry_t;
+typedef resolver_entry_t *resolver_entry_ptr_t;
+
+#define DLIST_ELEMENT_TYPE resolver_entry_ptr_t
+#define DLIST_LABEL entry
+#define DLIST_CONFIG (COLLECTION_DECLARE | COLLECTION_DEFINE | COLLECTION_STATIC)
+#include <common/collections/dlist.h>
+
+// A lookup of a host and port, cached along with its result.
+struct resolver_entry {
+    // `host:port`, used as the key in the cache
+    string_t key;
+    string_t host;
+    string_t port;
+    resolver_entry_state_t state;
+
+    // the result of the last lookup: either the address list or a getaddrinfo error code
+    arc_addrinfo_t *addrs;
+    int gai_code;
+    time_t expires;
+
+    // the queries waiting for the pending lookup
+    dlist_query_t waiters;
+
+    // the node in `resolver->order`
+    dlist_entry_node_t *node;
+};
+
+// the key slice points to the `key` of the entry stored as the value
+#define HASH_KEY_TYPE slice_t
+#define HASH_VALUE_TYPE resolver_entry_ptr_t
+#define HASH_LABEL entry
+#define HASH_CONFIG (COLLECTION_DECLARE | COLLECTION_DEFINE | COLLECTION_STATIC)
+#include <common/collections/hash.h>
+#include <common/collections/hash/byte_hasher.h>
+
+// `mtx` guards everything but the configuration and the threads.
+struct resolver {
+#ifndef WAXY_PTHREADS_DISABLED
+    pthread_mutex_t mtx;
+    pthread_cond_t cond;
+    pthread_t *threads;
+    size_t thread_count;
+    // the entries to be looked up by the resolver threads
+    dlist_entry_t jobs;
+    bool stopping;
+#endif
+    time_t positive_ttl;
+    time_t negative_ttl;
+
+    hash_entry_t entries;
+    // the entries from the least to the most recently looked up
+    dlist_entry_t order;
+};
+
+struct resolver_query {
+    handler_t handler;
+    resolver_t *resolver;
+    resolver_on_resolved_cb_t on_resolved;
+
+    // the following fields are guarded by the resolver lock
+
+    // the entry being looked up and the node in its list of waiters, or `NULL` once it's done
+    resolver_entry_t *entry;
+    dlist_query_node_t *node;
+    bool done;
+    arc_addrinfo_t *addrs;
+    int gai_code;
+
+    // accessed by the query handler only
+    bool reported;
+};
+
+static void slice_hash(slice_t const *slice, byte_hasher_state_t *state) {
+    byte_hasher_digest_slice(state, slice->base, slice->len);
+}
+
+static byte_hasher_config_t const slice_hasher_config_primary = {
+    .seed = 59,
+    .hash = (void (*)(void const *, byte_hasher_state_t *)) slice_hash,
+};
+
+static byte_hasher_config_t const slice_hasher_config_secondary = {
+    .seed = 163,
+    .hash = (void (*)(void const *, byte_hasher_state_t *)) slice_hash,
+};
+
+static size_t slice_hash_primary(slice_t const *slice, void *data) {
+    return byte_hasher(slice, data);
+}
+
+static size_t slice_hash_secondary(slice_t const *slice, void *data) {
+    return byte_hasher_secondary(slice, data);
+}
+
+static bool slice_eq(slice_t const *lhs, slice_t const *rhs) {
+    return lhs->len == rhs->len && memcmp(lhs->base, rhs->base, lhs->len) == 0;
+}
+
+static slice_t resolver_entry_key(resolver_entry_t const *entry) {
+    return (slice_t) {
+        .base = string_as_cptr(&entry->key),
+        .len = string_len(&entry->key),
+    };
+}
+
+static void resolver_entry_free(resolver_entry_t *self) {
+    string_free(&self->key);
+    string_free(&self->host);
+    string_free(&self->port);
+    arc_addrinfo_free(self->addrs);
+    dlist_query_free(&self->waiters);
+    free(self);
+}
+
+static error_t *resolver_entry_new(slice_t host, uint16_t port, resolver_entry_t **result) {
+    error_t *err = NULL;
+
+    resolver_entry_t *entry = calloc(1, sizeof(resolver_entry_t));
+    err = error_wrap("Could not allocate a resolver entry", OK_IF(entry != NULL));
+    if (err) goto calloc_fail;
+
+    err = error_from_common(string_from_slice(host.base, host.len, &entry->host));
+    if (err) goto host_fail;
+
+    err = error_from_common(string_sprintf(&entry->port, "%u", port));
+    if (err) goto port_fail;
+
+    err = error_from_common(string_sprintf(
+        &entry->key, "%.*s:%u", (int) host.len, host.base, port));
+    if (err) goto key_fail;
+
+    entry->state = RESOLVER_ENTRY_DONE;
+    entry->addrs = NULL;
+    entry->gai_code = EAI_AGAIN;
+    entry->expires = 0;
+    entry->waiters = dlist_query_new();
+    entry->node = NULL;
+
+    *result = entry;
+
+    return err;
+
+key_fail:
+    string_free(&entry->port);
+
+port_fail:
+    string_free(&entry->host);
+
+host_fail:
+    free(entry);
+
+calloc_fail:
+    return error_wrap("Could not allocate a resolver entry", err);
+}
+
+// Does the blocking lookup of the entry.
+//
+// Only reads the host and the port of the entry, which are never modified, so the lock is not
+// required.
+static int resolver_lookup(resolver_entry_t const *entry, arc_addrinfo_t **result) {
+    struct addrinfo *head = NULL;
+    int code = getaddrinfo(
+        string_as_cptr(&entry->host),
+        string_as_cptr(&entry->port),
+        &(struct addrinfo) {
+            .ai_family = AF_UNSPEC,
+            .ai_socktype = SOCK_STREAM,
+            .ai_protocol = IPPROTO_TCP,
+            .ai_flags = AI_ADDRCONFIG | AI_NUMERICSERV,
+        },
+        &head
+    );
+
+    if (code != 0) {
+        return code;
+    }
+
+    *result = arc_addrinfo_new(head);
+
+    if (*result == NULL) {
+        freeaddrinfo(head);
+
+        return EAI_MEMORY;
+    }
+
+    return code;
+}
+
+// Stores the result of a lookup and wakes up the waiting queries.
+//
+// `addrs` is taken over.
+//
+// The lock must be held.
+static void resolver_complete_unsync(
+    resolver_t *self,
+    resolver_entry_t *entry,
+    arc_addrinfo_t *addrs,
+    int gai_code
+) {
+    arc_addrinfo_free(entry->addrs);
+    entry->addrs = addrs;
+    entry->gai_code = gai_code;
+    entry->state = RESOLVER_ENTRY_DONE;
+    entry->expires = time(NULL) + (gai_code == 0 ? self->positive_ttl : self->negative_ttl);
+
+    if (gai_code != 0) {
+        log_printf(LOG_DEBUG, "Could not resolve %s: %s",
+            string_as_cptr(&entry->key), gai_strerror(gai_code));
+    }
+
+    for (dlist_query_node_t *node = dlist_query_head_mut(&entry->waiters);
+            node != NULL;
+            node = dlist_query_next_mut(node)) {
+        resolver_query_t *query = *dlist_query_get_mut(node);
+        query->entry = NULL;
+        query->node = NULL;
+        query->done = true;
+        query->addrs = addrs != NULL ? arc_addrinfo_share(addrs) : NULL;
+        query->gai_code = gai_code;
+        handler_force(&query->handler);
+    }
+
+    dlist_query_free(&entry->waiters);
+    entry->waiters = dlist_query_new();
+}
+
+// Forgets the oldest complete lookups once there are too many of them.
+//
+// The lock must be held.
+static void resolver_trim_unsync(resolver_t *self) {
+    dlist_entry_node_t *node = dlist_entry_head_mut(&self->order);
+
+    while (hash_entry_len(&self->entries) > RESOLVER_MAX_ENTRIES && node != NULL) {
+        dlist_entry_node_t *next = dlist_entry_next_mut(node);
+        resolver_entry_t *entry = *dlist_entry_get_mut(node);
+
+        if (entry->state == RESOLVER_ENTRY_DONE) {
+            slice_t key = resolver_entry_key(entry);
+            // only fails if the key was not found -- our invariant ensures this can't happen
+            error_assert(error_from_common(hash_entry_remove(&self->entries, &key, NULL, NULL)));
+            dlist_entry_remove(&self->order, node);
+            resolver_entry_free(entry);
+        }
+
+        node = next;
+    }
+}
+
+#ifndef WAXY_PTHREADS_DISABLED
+static void *resolver_thread(void *data) {
+    resolver_t *self = data;
+
+    assert_mutex_lock(&self->mtx);
+
+    while (true) {
+        while (dlist_entry_len(&self->jobs) == 0 && !self->stopping) {
+            error_assert(error_from_errno(pthread_cond_wait(&self->cond, &self->mtx)));
+        }
+
+        if (self->stopping) {
+            break;
+        }
+
+        resolver_entry_t *entry = dlist_entry_remove(
+            &self->jobs, dlist_entry_head_mut(&self->jobs));
+        assert_mutex_unlock(&self->mtx);
+
+        arc_addrinfo_t *addrs = NULL;
+        int gai_code = resolver_lookup(entry, &addrs);
+
+        assert_mutex_lock(&self->mtx);
+        resolver_complete_unsync(self, entry, addrs, gai_code);
+    }
+
+    assert_mutex_unlock(&self->mtx);
+
+    return NULL;
+}
+
+static void resolver_stop_threads(resolver_t *self, size_t count) {
+    assert_mutex_lock(&self->mtx);
+    self->stopping = true;
+    error_assert(error_from_errno(pthread_cond_broadcast(&self->cond)));
+    assert_mutex_unlock(&self->mtx);
+
+    for (size_t i = 0; i < count; ++i) {
+        error_assert(error_from_errno(pthread_join(self->threads[i], NULL)));
+    }
+}
+#endif
+
+error_t *resolver_new(resolver_config_t const *config, resolver_t **result) {
+    error_t *err = NULL;
+
+    resolver_t *self = calloc(1, sizeof(resolver_t));
+    err = error_wrap("Could not allocate memory for the resolver", OK_IF(self != NULL));
+    if (err) goto calloc_fail;
+
+    self->positive_ttl = config->positive_ttl;
+    self->negative_ttl = config->negative_ttl;
+    self->order = dlist_entry_new();
+
+    err = error_from_common(hash_entry_new(
+        (hash_entry_hasher_data_t) {
+            .hasher = slice_hash_primary,
+            .opaque_data = (void *) &slice_hasher_config_primary,
+        },
+        (hash_entry_hasher_data_t) {
+            .hasher = slice_hash_secondary,
+            .opaque_data = (void *) &slice_hasher_config_secondary,
+        },
+        slice_eq, &self->entries
+    ));
+    if (err) goto hash_new_fail;
+
+#ifndef WAXY_PTHREADS_DISABLED
+    self->jobs = dlist_entry_new();
+    self->stopping = false;
+    self->thread_count = config->thread_count > 0 ? config->thread_count : 1;
+
+    self->threads = calloc(self->thread_count, sizeof(pthread_t));
+    err = error_wrap("Could not allocate memory for the resolver", OK_IF(self->threads != NULL));
+    if (err) goto threads_calloc_fail;
+
+    err = error_wrap("Could not initialize a mutex", error_from_errno(
+        pthread_mutex_init(&self->mtx, NULL)));
+    if (err) goto mtx_init_fail;
+
+    err = error_wrap("Could not initialize a condition variable", error_from_errno(
+        pthread_cond_init(&self->cond, NULL)));
+    if (err) goto cond_init_fail;
+
+    size_t started = 0;
+
+    for (; started < self->thread_count; ++started) {
+        err = error_wrap("Could not start a resolver thread", error_from_errno(
+            pthread_create(&self->threads[started], NULL, resolver_thread, self)));
+        if (err) goto thread_create_fail;
+    }
+
+    log_printf(LOG_INFO, "Started %zu resolver threads", self->thread_count);
+#endif
+
+    *result = self;
+
+    return err;
+
+#ifndef WAXY_PTHREADS_DISABLED
+thread_create_fail:
+    resolver_stop_threads(self, started);
+    pthread_cond_destroy(&self->cond);
+
+cond_init_fail:
+    pthread_mutex_destroy(&self->mtx);
+
+mtx_init_fail:
+    free(self->threads);
+
+threads_calloc_fail:
+    hash_entry_free(&self->entries);
+#endif
+
+hash_new_fail:
+    free(self);
+
+calloc_fail:
+    return err;
+}
+
+void resolver_free(resolver_t *self) {
+    if (self == NULL) return;
+
+#ifndef WAXY_PTHREADS_DISABLED
+    resolver_stop_threads(self, self->thread_count);
+    dlist_entry_free(&self->jobs);
+    free(self->threads);
+    pthread_cond_destroy(&self->cond);
+    pthread_mutex_destroy(&self->mtx);
+#endif
+
+    hash_entry_free(&self->entries);
+
+    for (dlist_entry_node_t *node = dlist_entry_head_mut(&self->order);
+            node != NULL;
+            node = dlist_entry_next_mut(node)) {
+        resolver_entry_free(*dlist_entry_get_mut(node));
+    }
+
+    dlist_entry_free(&self->order);
+    free(self);
+}
+
+static void resolver_query_free(resolver_query_t *self) {
+#ifndef WAXY_PTHREADS_DISABLED
+    assert_mutex_lock(&self->resolver->mtx);
+#endif
+
+    if (self->node != NULL) {
+        dlist_query_remove(&self->entry->waiters, self->node);
+    }
+
+    arc_addrinfo_free(self->addrs);
+
+#ifndef WAXY_PTHREADS_DISABLED
+    assert_mutex_unlock(&self->resolver->mtx);
+#endif
+}
+
+static error_t *resolver_query_process(resolver_query_t *self, loop_t *loop, poll_flags_t) {
+    error_t *err = NULL;
+
+    if (self->reported) {
+        return err;
+    }
+
+#ifndef WAXY_PTHREADS_DISABLED
+    assert_mutex_lock(&self->resolver->mtx);
+#endif
+
+    bool done = self->done;
+    arc_addrinfo_t *addrs = self->addrs;
+    int gai_code = self->gai_code;
+    self->addrs = NULL;
+
+#ifndef WAXY_PTHREADS_DISABLED
+    assert_mutex_unlock(&self->resolver->mtx);
+#endif
+
+    if (!done) {
+        return err;
+    }
+
+    self->reported = true;
+
+    if (gai_code != 0) {
+        err = error_wrap("Could not resolve the host", error_from_gai(gai_code));
+    }
+
+    return self->on_resolved(loop, self, addrs, err);
+}
+
+static handler_vtable_t const resolver_query_vtable = {
+    .free = (handler_vtable_free_t) resolver_query_free,
+    .on_error = NULL,
+    .process = (handler_vtable_process_t) resolver_query_process,
+};
+
+// Finds the entry for the host and port, creating it if necessary.
+//
+// The lock must be held.
+static error_t *resolver_get_entry_unsync(
+    resolver_t *self,
+    slice_t host,
+    uint16_t port,
+    resolver_entry_t **result
+) {
+    error_t *err = NULL;
+
+    resolver_entry_t *entry = NULL;
+    err = resolver_entry_new(host, port, &entry);
+    if (err) goto entry_new_fail;
+
+    slice_t key = resolver_entry_key(entry);
+    resolver_entry_t **stored = hash_entry_get_mut(&self->entries, &key);
+
+    if (stored != NULL) {
+        resolver_entry_free(entry);
+        *result = *stored;
+
+        return err;
+    }
+
+    err = error_wrap("Could not allocate a resolver entry", error_from_common(
+        dlist_entry_append(&self->order, entry, &entry->node)));
+    if (err) goto append_fail;
+
+    err = error_wrap("Could not cache a resolver entry", error_from_common(
+        hash_entry_insert(&self->entries, resolver_entry_key(entry), entry)));
+    if (err) goto insert_fail;
+
+    *result = entry;
+
+    return err;
+
+insert_fail:
+    dlist_entry_remove(&self->order, entry->node);
+
+append_fail:
+    resolver_entry_free(entry);
+
+entry_new_fail:
+    return err;
+}
+
+error_t *resolver_query_new(
+    resolver_t *self,
+    slice_t host,
+    uint16_t port,
+    resolver_on_resolved_cb_t on_resolved,
+    resolver_query_t **result
+) {
+    error_t *err = NULL;
+
+    resolver_query_t *query = calloc(1, sizeof(resolver_query_t));
+    err = error_wrap("Could not allocate a resolver query", OK_IF(query != NULL));
+    if (err) goto calloc_fail;
+
+    handler_init(&query->handler, &resolver_query_vtable, -1);
+    query->resolver = self;
+    query->on_resolved = on_resolved;
+    query->entry = NULL;
+    query->node = NULL;
+    query->done = false;
+    query->addrs = NULL;
+    query->gai_code = 0;
+    query->reported = false;
+
+#ifndef WAXY_PTHREADS_DISABLED
+    assert_mutex_lock(&self->mtx);
+#endif
+
+    resolver_entry_t *entry = NULL;
+    err = resolver_get_entry_unsync(self, host, port, &entry);
+    if (err) goto get_entry_fail;
+
+    bool fresh = entry->state == RESOLVER_ENTRY_DONE && entry->expires > time(NULL);
+
+    if (fresh) {
+        log_printf(LOG_DEBUG, "Using the cached lookup of %s", string_as_cptr(&entry->key));
+        query->done = true;
+        query->addrs = entry->addrs != NULL ? arc_addrinfo_share(entry->addrs) : NULL;
+        query->gai_code = entry->gai_code;
+        handler_force(&query->handler);
+
+        goto done;
+    }
+
+    err = error_wrap("Could not enqueue a resolver query", error_from_common(
+        dlist_query_append(&entry->waiters, query, &query->node)));
+    if (err) goto append_fail;
+
+    query->entry = entry;
+
+    if (entry->state == RESOLVER_ENTRY_PENDING) {
+        // someone is already looking it up
+        goto done;
+    }
+
+    entry->state = RESOLVER_ENTRY_PENDING;
+    dlist_entry_move_before(&self->order, entry->node, NULL);
+
+#ifndef WAXY_PTHREADS_DISABLED
+    err = error_wrap("Could not enqueue a lookup", error_from_common(
+        dlist_entry_append(&self->jobs, entry, NULL)));
+    if (err) goto job_append_fail;
+
+    error_assert(error_from_errno(pthread_cond_signal(&self->cond)));
+#else
+    arc_addrinfo_t *addrs = NULL;
+    int gai_code = resolver_lookup(entry, &addrs);
+    resolver_complete_unsync(self, entry, addrs, gai_code);
+#endif
+
+done:
+    // the entry is either pending or no longer needed by the query, so it can't be forgotten here
+    resolver_trim_unsync(self);
+
+#ifndef WAXY_PTHREADS_DISABLED
+    assert_mutex_unlock(&self->mtx);
+#endif
+
+    *result = query;
+
+    return err;
+
+#ifndef WAXY_PTHREADS_DISABLED
+job_append_fail:
+    // nobody is going to look it up now, so the next query has to try again
+    entry->state = RESOLVER_ENTRY_DONE;
+    dlist_query_remove(&entry->waiters, query->node);
+    query->node = NULL;
+    query->entry = NULL;
+#endif
+
+append_fail:
+get_entry_fail:
+#ifndef WAXY_PTHREADS_DISABLED
+    assert_mutex_unlock(&self->mtx);
+#endif
+    handler_free(&query->handler);
+
+calloc_fail:
+    return err;
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <stdint.h>
+#include <time.h>
+
+#include <netdb.h>
+
+#include <common/error.h>
+#include <common/loop/io.h>
+#include <common/loop/loop.h>
+
+typedef struct addrinfo addrinfo_t;
+
+// A shared list of resolved addresses.
+#define ARC_ELEMENT_TYPE addrinfo_t
+#define ARC_LABEL addrinfo
+#define ARC_FREE_CB freeaddrinfo
+#define ARC_CONFIG (COLLECTION_DECLARE)
+#include <common/memory/arc.h>
+
+// An asynchronous host name resolver with a cache.
+//
+// If the threads are available, the lookups are done by a dedicated pool of resolver threads, so
+// a slow name server doesn't hold up the event loop.
+// Otherwise they're done inline.
+//
+// Successful lookups are cached for `positive_ttl` seconds, and failed ones for `negative_ttl`.
+// Concurrent lookups of the same host and port are collapsed into one.
+typedef struct resolver resolver_t;
+
+typedef struct {
+    // The number of resolver threads. Zero is treated as one.
+    size_t thread_count;
+
+    // The number of seconds a successful lookup is cached for.
+    time_t positive_ttl;
+
+    // The number of seconds a failed lookup is cached for.
+    time_t negative_ttl;
+} resolver_config_t;
+
+// A pending lookup.
+//
+// This is an instance of `handler_t` and should be registered in a `loop_t`.
+// Once the lookup completes, the callback is invoked from the loop.
+typedef struct resolver_query resolver_query_t;
+
+// The lookup completion callback.
+//
+// On success, `addrs` is a reference to the resolved address list, which must be released with
+// `arc_addrinfo_free`, and `err` is `NULL`.
+// On failure, `addrs` is `NULL` and `err` is owned by the callback.
+//
+// The query is not unregistered automatically.
+typedef error_t *(*resolver_on_resolved_cb_t)(
+    loop_t *loop,
+    resolver_query_t *query,
+    arc_addrinfo_t *addrs,
+    error_t *err
+);
+
+// Creates a new resolver and starts its threads.
+error_t *resolver_new(resolver_config_t const *config, resolver_t **result);
+
+// Stops the resolver threads and frees the resolver.
+//
+// All the queries must have been freed.
+void resolver_free(resolver_t *self);
+
+// Starts a lookup of the stream socket addresses of `host` and `port`.
+//
+// The host is copied.
+error_t *resolver_query_new(
+    resolver_t *self,
+    slice_t host,
+    uint16_t port,
+    resolver_on_resolved_cb_t on_resolved,
+    resolver_query_t **result
+);
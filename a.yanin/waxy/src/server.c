@@ -1,9 +1,16 @@
 #include "server.h"
 
 #include <arpa/inet.h>
+#include <assert.h>
+#include <inttypes.h>
 #include <netdb.h>
+#include <signal.h>
 #include <stdlib.h>
 
+#ifndef WAXY_PTHREADS_DISABLED
+#include <pthread.h>
+#endif
+
 #include "client.h"
 #include "executor.h"
 #include "gai-adapter.h"
@@ -21,11 +28,27 @@ typedef enum {
     SERVER_STATE_LISTEN,
 } server_state_t;
 
+typedef struct server_ctx server_ctx_t;
+
 struct server_ctx {
     server_t *self;
     struct addrinfo *addr_head;
     struct addrinfo *next_addr;
     server_state_t state;
+    // the listening socket shares the port with the other loops
+    bool reuse_port;
+};
+
+// An event loop with a listening socket of its own.
+struct server_loop {
+    loop_t *loop;
+    server_ctx_t ctx;
+#ifndef WAXY_PTHREADS_DISABLED
+    pthread_t thread;
+    bool started;
+#endif
+    // the error the loop was aborted with
+    error_t *err;
 };
 
 static error_t *server_new_tcp_serv(server_ctx_t *ctx, tcp_handler_server_t **result);
@@ -77,7 +100,13 @@ static error_t *server_on_new_conn(loop_t *loop, tcp_handler_server_t *serv) {
     err = error_wrap("Could not accept a connection", tcp_accept(serv, &handler));
     if (err) goto accept_fail;
 
-    err = client_init(handler, ctx->self->cache);
+    err = client_init(
+        handler,
+        ctx->self->cache,
+        ctx->self->resolver,
+        ctx->self->pool,
+        &ctx->self->client_config
+    );
     if (err) goto client_init_fail;
 
     err = error_wrap("Could not register a client handler",
@@ -111,7 +140,7 @@ static error_t *server_new_tcp_serv(server_ctx_t *ctx, tcp_handler_server_t **re
     ctx->next_addr = addr->ai_next;
 
     tcp_handler_server_t *serv = NULL;
-    err = tcp_server_new(addr->ai_addr, addr->ai_addrlen, true, &serv);
+    err = tcp_server_new(addr->ai_addr, addr->ai_addrlen, true, ctx->reuse_port, &serv);
     if (err) goto serv_new_fail;
 
     tcp_server_set_on_error(serv, server_on_fail);
@@ -132,21 +161,20 @@ next_addr_fail:
     return err;
 }
 
-error_t *server_new(char const *port, size_t cache_size, server_t *result) {
+// Creates a loop listening on `port` that waits for events with `backend`.
+static error_t *server_loop_init(
+    server_loop_t *self,
+    server_t *server,
+    char const *port,
+    loop_backend_t backend,
+    bool reuse_port
+) {
     error_t *err = NULL;
 
-    executor_t *executor = NULL;
-    err = create_default_executor(&executor);
-    if (err) goto executor_new_fail;
-
     loop_t *loop = NULL;
-    err = loop_new(executor, &loop);
+    err = loop_new_with_backend(server->executor, backend, &loop);
     if (err) goto loop_new_fail;
 
-    server_ctx_t *ctx = calloc(1, sizeof(server_ctx_t));
-    err = error_wrap("Could not allocate memory for the server", OK_IF(ctx != NULL));
-    if (err) goto ctx_calloc_fail;
-
     struct addrinfo *addr_head = NULL;
     err = error_from_gai(getaddrinfo(NULL, port, &(struct addrinfo) {
         .ai_family = AF_UNSPEC,
@@ -159,51 +187,126 @@ error_t *server_new(char const *port, size_t cache_size, server_t *result) {
     err = OK_IF(addr_head != NULL);
     if (err) goto gai_fail;
 
-    *ctx = (server_ctx_t) {
-        .self = result,
+    self->loop = loop;
+    self->ctx = (server_ctx_t) {
+        .self = server,
         .addr_head = addr_head,
         .next_addr = addr_head,
         .state = SERVER_STATE_BIND,
+        .reuse_port = reuse_port,
     };
+#ifndef WAXY_PTHREADS_DISABLED
+    self->started = false;
+#endif
+    self->err = NULL;
 
     log_printf(LOG_DEBUG, "Starting a listening socket");
 
     tcp_handler_server_t *serv = NULL;
-    err = server_new_tcp_serv(ctx, &serv);
+    err = server_new_tcp_serv(&self->ctx, &serv);
     if (err) goto serv_new_fail;
 
+    err = loop_register(loop, (handler_t *) serv);
+    if (err) goto loop_register_fail;
+
+    return err;
+
+loop_register_fail:
+    handler_free((handler_t *) serv);
+
+serv_new_fail:
+gai_fail:
+    if (addr_head != NULL) {
+        freeaddrinfo(addr_head);
+    }
+
+    loop_free(loop);
+
+loop_new_fail:
+    return err;
+}
+
+static void server_loop_free(server_loop_t *self) {
+    loop_free(self->loop);
+
+    if (self->ctx.addr_head != NULL) {
+        freeaddrinfo(self->ctx.addr_head);
+    }
+}
+
+error_t *server_new(
+    char const *port,
+    size_t loop_count,
+    loop_backend_t loop_backend,
+    cache_config_t const *cache_config,
+    resolver_config_t const *resolver_config,
+    pool_config_t const *pool_config,
+    client_config_t const *client_config,
+    server_t *result
+) {
+    assert(loop_count > 0);
+
+    error_t *err = NULL;
+
+    executor_t *executor = NULL;
+    err = create_default_executor(&executor);
+    if (err) goto executor_new_fail;
+
     cache_t *cache = NULL;
-    err = cache_new(cache_size, &cache);
+    err = cache_new(cache_config, &cache);
     if (err) goto cache_new_fail;
 
-    err = loop_register(loop, (handler_t *) serv);
-    if (err) goto loop_register_fail;
+    resolver_t *resolver = NULL;
+    err = resolver_new(resolver_config, &resolver);
+    if (err) goto resolver_new_fail;
+
+    pool_t *pool = NULL;
+    err = pool_new(pool_config, &pool);
+    if (err) goto pool_new_fail;
+
+    server_loop_t *loops = calloc(loop_count, sizeof(server_loop_t));
+    err = error_wrap("Could not allocate memory for the server", OK_IF(loops != NULL));
+    if (err) goto loops_calloc_fail;
 
     *result = (server_t) {
-        .loop = loop,
         .executor = executor,
         .cache = cache,
-        .ctx = ctx,
+        .resolver = resolver,
+        .pool = pool,
+        .client_config = *client_config,
+        .loop_count = 0,
+        .loops = loops,
     };
 
+    for (; result->loop_count < loop_count; ++result->loop_count) {
+        err = server_loop_init(&loops[result->loop_count], result, port, loop_backend,
+            loop_count > 1);
+        if (err) goto loop_init_fail;
+    }
+
+    if (loop_count > 1) {
+        log_printf(LOG_INFO, "Listening on port %s with %zu event loops", port, loop_count);
+    }
+
     return err;
 
-loop_register_fail:
-    cache_free(cache);
+loop_init_fail:
+    for (size_t i = 0; i < result->loop_count; ++i) {
+        server_loop_free(&loops[i]);
+    }
 
-cache_new_fail:
-    handler_free((handler_t *) serv);
+    free(loops);
 
-serv_new_fail:
-    freeaddrinfo(addr_head);
+loops_calloc_fail:
+    pool_free(pool);
 
-gai_fail:
-    free(ctx);
+pool_new_fail:
+    resolver_free(resolver);
 
-ctx_calloc_fail:
-    loop_free(loop);
+resolver_new_fail:
+    cache_free(cache);
 
-loop_new_fail:
+cache_new_fail:
     executor_free(executor);
 
 executor_new_fail:
@@ -211,7 +314,9 @@ executor_new_fail:
 }
 
 void server_stop(server_t *self) {
-    loop_stop(self->loop);
+    for (size_t i = 0; i < self->loop_count; ++i) {
+        loop_stop(self->loops[i].loop);
+    }
 }
 
 void server_await_termination(server_t *self) {
@@ -219,19 +324,96 @@ void server_await_termination(server_t *self) {
 }
 
 void server_free(server_t *self) {
-    loop_free(self->loop);
+    for (size_t i = 0; i < self->loop_count; ++i) {
+        server_loop_free(&self->loops[i]);
+    }
+
+    free(self->loops);
     executor_free(self->executor);
+
+    pool_stats_t stats;
+    pool_stats(self->pool, &stats);
+    log_printf(LOG_INFO, "Upstream connections: %" PRIu64 " acquired, %" PRIu64 " reused, "
+        "%" PRIu64 " expired while idle", stats.acquired, stats.reused, stats.expired);
+
+    // the idle connections have been freed along with the loops
+    pool_free(self->pool);
+    resolver_free(self->resolver);
     cache_free(self->cache);
+}
+
+#ifndef WAXY_PTHREADS_DISABLED
 
-    if (self->ctx->addr_head != NULL) {
-        freeaddrinfo(self->ctx->addr_head);
+static void *server_loop_thread(void *data) {
+    server_loop_t *self = data;
+    self->err = loop_run(self->loop);
+
+    if (self->err) {
+        // the rest of the loops are taken down as well
+        server_stop(self->ctx.self);
     }
 
-    free(self->ctx);
+    return NULL;
+}
+
+// Runs every loop but the first on a thread of its own.
+//
+// The signals are left for the calling thread to handle.
+static error_t *server_start_threads(server_t *self) {
+    error_t *err = NULL;
+
+    sigset_t signal_set;
+    sigset_t old_signal_set;
+    sigfillset(&signal_set);
+    err = error_wrap("Could not set the signal mask", error_from_errno(
+        pthread_sigmask(SIG_BLOCK, &signal_set, &old_signal_set)));
+    if (err) goto sigmask_block_fail;
+
+    for (size_t i = 1; i < self->loop_count; ++i) {
+        server_loop_t *loop = &self->loops[i];
+        err = error_wrap("Could not start an event loop thread", error_from_errno(
+            pthread_create(&loop->thread, NULL, server_loop_thread, loop)));
+        if (err) break;
+
+        loop->started = true;
+    }
+
+    err = error_combine(err, error_wrap("Could not restore the signal mask", error_from_errno(
+        pthread_sigmask(SIG_SETMASK, &old_signal_set, NULL))));
+
+sigmask_block_fail:
+    return err;
 }
 
+#endif
+
 error_t *server_run(server_t *self) {
-    error_t *err = loop_run(self->loop);
+    error_t *err = NULL;
+
+#ifndef WAXY_PTHREADS_DISABLED
+    err = server_start_threads(self);
+
+    if (!err) {
+        err = loop_run(self->loops[0].loop);
+    }
+
+    server_stop(self);
+
+    for (size_t i = 1; i < self->loop_count; ++i) {
+        server_loop_t *loop = &self->loops[i];
+
+        if (loop->started) {
+            pthread_join(loop->thread, NULL);
+            loop->started = false;
+            err = error_combine(err, loop->err);
+            loop->err = NULL;
+        }
+    }
+#else
+    assert(self->loop_count == 1);
+    err = loop_run(self->loops[0].loop);
+#endif
+
     executor_shutdown(self->executor);
 
     return err;
@@ -4,20 +4,53 @@
 #include <common/loop/tcp.h>
 
 #include "cache.h"
+#include "client.h"
 #include "executor.h"
+#include "pool.h"
+#include "resolver.h"
 
-typedef struct server_ctx server_ctx_t;
+typedef struct server_loop server_loop_t;
 
 // Listens on a socket for client connections.
+//
+// The server may run several event loops, each on a thread of its own and with its own listening
+// socket bound to the port with SO_REUSEPORT, letting the kernel spread the connections among them.
+// A client connection stays with the loop that has accepted it.
+// The cache, the resolver, and the upstream connection pool are shared by all the loops.
 typedef struct server {
-    loop_t *loop;
     executor_t *executor;
     cache_t *cache;
-    server_ctx_t *ctx;
+    resolver_t *resolver;
+    pool_t *pool;
+    client_config_t client_config;
+    size_t loop_count;
+    server_loop_t *loops;
 } server_t;
 
-error_t *server_new(char const *port, size_t cache_size, server_t *result);
+// Creates a server listening on `port` with `loop_count` event loops.
+//
+// Running more than one loop requires threads.
+// `loop_backend` selects how the loops wait for I/O events.
+error_t *server_new(
+    char const *port,
+    size_t loop_count,
+    loop_backend_t loop_backend,
+    cache_config_t const *cache_config,
+    resolver_config_t const *resolver_config,
+    pool_config_t const *pool_config,
+    client_config_t const *client_config,
+    server_t *result
+);
 void server_free(server_t *self);
+
+// Stops all the loops.
+//
+// This function is async-signal-safe.
 void server_stop(server_t *self);
+
 void server_await_termination(server_t *self);
+
+// Runs the loops until they're stopped or one of them fails.
+//
+// The first loop is run on the calling thread.
 error_t *server_run(server_t *self);
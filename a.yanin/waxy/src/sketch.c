@@ -0,0 +1,175 @@
+#include "sketch.h"
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+enum {
+    SKETCH_DEPTH = 4,
+    SKETCH_COUNTER_MAX = 15,
+    // the number of recorded occurrences per counter in a row after which the sketch is aged
+    SKETCH_SAMPLE_FACTOR = 10,
+    // the number of doorkeeper bits per counter in a row
+    SKETCH_DOORKEEPER_FACTOR = 4,
+};
+
+struct frequency_sketch {
+    // `width - 1`; the width is a power of two
+    size_t mask;
+    size_t sample_size;
+    atomic_size_t additions;
+
+    // `SKETCH_DEPTH` rows of `width` counters each
+    _Atomic uint8_t *counters;
+
+    // `doorkeeper_mask + 1` bits
+    size_t doorkeeper_mask;
+    _Atomic uint64_t *doorkeeper;
+};
+
+error_t *frequency_sketch_new(size_t width, frequency_sketch_t **result) {
+    error_t *err = NULL;
+
+    size_t actual_width = 64;
+
+    while (actual_width < width) {
+        actual_width *= 2;
+    }
+
+    frequency_sketch_t *self = calloc(1, sizeof(frequency_sketch_t));
+    err = error_wrap("Could not allocate memory for a frequency sketch", OK_IF(self != NULL));
+    if (err) goto calloc_fail;
+
+    self->counters = calloc(SKETCH_DEPTH * actual_width, sizeof(_Atomic uint8_t));
+    err = error_wrap("Could not allocate memory for a frequency sketch",
+        OK_IF(self->counters != NULL));
+    if (err) goto counters_calloc_fail;
+
+    size_t doorkeeper_bits = actual_width * SKETCH_DOORKEEPER_FACTOR;
+    self->doorkeeper = calloc(doorkeeper_bits / 64, sizeof(_Atomic uint64_t));
+    err = error_wrap("Could not allocate memory for a frequency sketch",
+        OK_IF(self->doorkeeper != NULL));
+    if (err) goto doorkeeper_calloc_fail;
+
+    self->mask = actual_width - 1;
+    self->sample_size = actual_width * SKETCH_SAMPLE_FACTOR;
+    self->additions = 0;
+    self->doorkeeper_mask = doorkeeper_bits - 1;
+
+    *result = self;
+
+    return err;
+
+doorkeeper_calloc_fail:
+    free(self->counters);
+
+counters_calloc_fail:
+    free(self);
+
+calloc_fail:
+    return err;
+}
+
+void frequency_sketch_free(frequency_sketch_t *self) {
+    if (self == NULL) return;
+
+    free(self->doorkeeper);
+    free(self->counters);
+    free(self);
+}
+
+// Derives the `i`-th index from the hash (Kirsch-Mitzenmacher double hashing).
+static size_t sketch_index(size_t hash, size_t i, size_t mask) {
+    uint64_t h = hash;
+    uint64_t step = (h >> 32) | 1;
+
+    return (size_t) ((h + i * step) & mask);
+}
+
+static bool doorkeeper_contains(frequency_sketch_t *self, size_t hash) {
+    for (size_t i = 0; i < 2; ++i) {
+        size_t bit = sketch_index(hash, i + SKETCH_DEPTH, self->doorkeeper_mask);
+        uint64_t word = atomic_load_explicit(&self->doorkeeper[bit / 64], memory_order_relaxed);
+
+        if ((word & ((uint64_t) 1 << (bit % 64))) == 0) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Returns whether the key was already present.
+static bool doorkeeper_insert(frequency_sketch_t *self, size_t hash) {
+    bool present = true;
+
+    for (size_t i = 0; i < 2; ++i) {
+        size_t bit = sketch_index(hash, i + SKETCH_DEPTH, self->doorkeeper_mask);
+        uint64_t flag = (uint64_t) 1 << (bit % 64);
+        uint64_t word = atomic_fetch_or_explicit(
+            &self->doorkeeper[bit / 64], flag, memory_order_relaxed);
+
+        if ((word & flag) == 0) {
+            present = false;
+        }
+    }
+
+    return present;
+}
+
+static void frequency_sketch_age(frequency_sketch_t *self) {
+    size_t counter_count = SKETCH_DEPTH * (self->mask + 1);
+
+    for (size_t i = 0; i < counter_count; ++i) {
+        uint8_t value = atomic_load_explicit(&self->counters[i], memory_order_relaxed);
+        atomic_store_explicit(&self->counters[i], value / 2, memory_order_relaxed);
+    }
+
+    for (size_t i = 0; i < (self->doorkeeper_mask + 1) / 64; ++i) {
+        atomic_store_explicit(&self->doorkeeper[i], 0, memory_order_relaxed);
+    }
+}
+
+void frequency_sketch_record(frequency_sketch_t *self, size_t hash) {
+    // exactly one thread observes the sample size being reached
+    if (atomic_fetch_add_explicit(&self->additions, 1, memory_order_relaxed) + 1
+            == self->sample_size) {
+        frequency_sketch_age(self);
+        atomic_store_explicit(&self->additions, 0, memory_order_relaxed);
+    }
+
+    if (!doorkeeper_insert(self, hash)) {
+        return;
+    }
+
+    size_t width = self->mask + 1;
+
+    for (size_t i = 0; i < SKETCH_DEPTH; ++i) {
+        _Atomic uint8_t *counter = &self->counters[i * width + sketch_index(hash, i, self->mask)];
+        uint8_t value = atomic_load_explicit(counter, memory_order_relaxed);
+
+        if (value < SKETCH_COUNTER_MAX) {
+            atomic_store_explicit(counter, value + 1, memory_order_relaxed);
+        }
+    }
+}
+
+unsigned int frequency_sketch_estimate(frequency_sketch_t *self, size_t hash) {
+    size_t width = self->mask + 1;
+    unsigned int estimate = SKETCH_COUNTER_MAX;
+
+    for (size_t i = 0; i < SKETCH_DEPTH; ++i) {
+        _Atomic uint8_t *counter = &self->counters[i * width + sketch_index(hash, i, self->mask)];
+        unsigned int value = atomic_load_explicit(counter, memory_order_relaxed);
+
+        if (value < estimate) {
+            estimate = value;
+        }
+    }
+
+    if (doorkeeper_contains(self, hash)) {
+        ++estimate;
+    }
+
+    return estimate;
+}
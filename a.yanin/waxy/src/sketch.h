@@ -0,0 +1,30 @@
+#pragma once
+
+#include <stddef.h>
+
+#include <common/error.h>
+
+// A probabilistic estimator of how often keys occur (the TinyLFU frequency sketch).
+//
+// The sketch is a count-min sketch with 4-bit saturating counters preceded by a doorkeeper bloom
+// filter, which absorbs the first occurrence of a key so that one-off keys don't pollute the
+// counters.
+// Once the number of recorded occurrences reaches ten times the width of the sketch, all counters
+// are halved and the doorkeeper is cleared, so that the estimates reflect recent history.
+//
+// Keys are represented by their (well-mixed) hashes.
+//
+// Recording and estimating can be done concurrently without external synchronization; the
+// counters are updated in a lossy but race-free manner.
+typedef struct frequency_sketch frequency_sketch_t;
+
+// Creates a sketch with at least `width` counters per row.
+error_t *frequency_sketch_new(size_t width, frequency_sketch_t **result);
+
+void frequency_sketch_free(frequency_sketch_t *self);
+
+// Records an occurrence of the key.
+void frequency_sketch_record(frequency_sketch_t *self, size_t hash);
+
+// Returns the estimated number of recent occurrences of the key.
+unsigned int frequency_sketch_estimate(frequency_sketch_t *self, size_t hash);
@@ -0,0 +1,368 @@
+#include "tunnel.h"
+
+#include <stdlib.h>
+
+#ifndef WAXY_PTHREADS_DISABLED
+#include <pthread.h>
+#endif
+
+#include <common/collections/string.h>
+#include <common/error-codes/adapter.h>
+#include <common/log/log.h>
+
+#include "util.h"
+
+// The state shared by the handlers of a tunnel.
+//
+// A reference to it is kept by the client handler and by the handler currently working on the
+// connection to the host.
+typedef struct {
+#ifndef WAXY_PTHREADS_DISABLED
+    // guards `client`
+    pthread_mutex_t mtx;
+#endif
+    // the client handler, or `NULL` once it's freed
+    tcp_handler_t *client;
+
+    string_t host;
+    uint16_t port;
+    // the data to forward to the host before relaying
+    string_t buffered;
+    slice_t buffered_slice;
+
+    arc_addrinfo_t *addrs;
+    // the address to try next
+    struct addrinfo *addr_next;
+} tunnel_t;
+
+static void tunnel_free(tunnel_t *tunnel) {
+#ifndef WAXY_PTHREADS_DISABLED
+    pthread_mutex_destroy(&tunnel->mtx);
+#endif
+
+    string_free(&tunnel->host);
+    string_free(&tunnel->buffered);
+    arc_addrinfo_free(tunnel->addrs);
+    free(tunnel);
+}
+
+#define ARC_ELEMENT_TYPE tunnel_t
+#define ARC_LABEL tunnel
+#define ARC_FREE_CB tunnel_free
+#define ARC_CONFIG (COLLECTION_DECLARE | COLLECTION_DEFINE | COLLECTION_STATIC)
+#include <common/memory/arc.h>
+
+// -1 is to account for the NUL terminator
+#define SLICE_INIT_FROM_CSTR(STR) { \
+        .base = STR, \
+        .len = sizeof(STR) - 1, \
+    }
+
+static slice_t const established_slice = SLICE_INIT_FROM_CSTR(
+    "HTTP/1.1 200 Connection Established\r\n"
+    "\r\n");
+static slice_t const bad_gateway_slice = SLICE_INIT_FROM_CSTR(
+    "HTTP/1.1 502 Bad Gateway\r\n"
+    "Server: waxy\r\n"
+    "Connection: close\r\n"
+    "Content-Type: text/plain\r\n"
+    "Content-Length: 17\r\n"
+    "\r\n"
+    "502 Bad Gateway\r\n");
+
+static void tunnel_lock(tunnel_t *tunnel) {
+    (void) tunnel;
+#ifndef WAXY_PTHREADS_DISABLED
+    assert_mutex_lock(&tunnel->mtx);
+#endif
+}
+
+static void tunnel_unlock(tunnel_t *tunnel) {
+    (void) tunnel;
+#ifndef WAXY_PTHREADS_DISABLED
+    assert_mutex_unlock(&tunnel->mtx);
+#endif
+}
+
+static void tunnel_on_handler_free(handler_t *handler) {
+    arc_tunnel_free(handler_custom_data(handler));
+}
+
+static void tunnel_on_client_free(handler_t *handler) {
+    arc_tunnel_t *arc = handler_custom_data(handler);
+    tunnel_t *tunnel = arc_tunnel_get(arc);
+
+    tunnel_lock(tunnel);
+    tunnel->client = NULL;
+    tunnel_unlock(tunnel);
+
+    arc_tunnel_free(arc);
+}
+
+static error_t *tunnel_on_error(loop_t *, tcp_handler_t *handler, error_t *err) {
+    char ip[INET6_ADDRSTRLEN] = {0};
+    uint16_t port = 0;
+    tcp_remote_info(handler, ip, &port);
+    log_printf(LOG_WARN, "A tunneled connection to %s:%u has failed", ip, port);
+    error_log_free(&err, LOG_WARN, ERROR_VERBOSITY_SOURCE_CHAIN);
+
+    // the other end of the relay follows suit
+    handler_unregister((handler_t *) handler);
+
+    return err;
+}
+
+static error_t *tunnel_on_bad_gateway_write(
+    loop_t *,
+    tcp_handler_t *handler,
+    size_t slice_count,
+    slice_t const[static slice_count]
+) {
+    handler_unregister((handler_t *) handler);
+
+    return NULL;
+}
+
+// Tells the client the host can't be reached and disconnects it.
+static void tunnel_fail(tunnel_t *tunnel, error_t *err) {
+    log_printf(LOG_WARN, "Could not open a tunnel to %s:%u",
+        string_as_cptr(&tunnel->host), tunnel->port);
+    error_log_free(&err, LOG_WARN, ERROR_VERBOSITY_SOURCE_CHAIN);
+
+    tunnel_lock(tunnel);
+    tcp_handler_t *client = tunnel->client;
+
+    if (client != NULL) {
+        handler_lock((handler_t *) client);
+        err = tcp_write(client, 1, &bad_gateway_slice, tunnel_on_bad_gateway_write, NULL);
+        handler_unlock((handler_t *) client);
+
+        if (err) {
+            error_log_free(&err, LOG_WARN, ERROR_VERBOSITY_SOURCE_CHAIN);
+            handler_unregister((handler_t *) client);
+            handler_force((handler_t *) client);
+        }
+    }
+
+    tunnel_unlock(tunnel);
+}
+
+static error_t *tunnel_on_connect(loop_t *, tcp_handler_t *handler) {
+    error_t *err = NULL;
+
+    tunnel_t *tunnel = arc_tunnel_get(handler_custom_data((handler_t *) handler));
+    tunnel_lock(tunnel);
+    tcp_handler_t *client = tunnel->client;
+
+    if (client == NULL) {
+        log_printf(LOG_DEBUG, "The client has left before the tunnel was opened");
+        handler_unregister((handler_t *) handler);
+
+        goto out;
+    }
+
+    handler_lock((handler_t *) client);
+    err = tcp_relay(handler, client);
+
+    if (err) {
+        handler_unlock((handler_t *) client);
+        tunnel_unlock(tunnel);
+        handler_unregister((handler_t *) handler);
+        tunnel_fail(tunnel, err);
+
+        return NULL;
+    }
+
+    // the write requests are processed before anything is relayed
+    err = tcp_write(client, 1, &established_slice, NULL, NULL);
+
+    if (!err && tunnel->buffered_slice.len > 0) {
+        err = tcp_write(handler, 1, &tunnel->buffered_slice, NULL, NULL);
+    }
+
+    handler_unlock((handler_t *) client);
+
+    if (err) {
+        log_printf(LOG_WARN, "Could not start relaying the tunnel to %s:%u",
+            string_as_cptr(&tunnel->host), tunnel->port);
+        error_log_free(&err, LOG_WARN, ERROR_VERBOSITY_SOURCE_CHAIN);
+
+        // the relay takes the client down along with this handler
+        handler_unregister((handler_t *) handler);
+
+        goto out;
+    }
+
+    log_printf(LOG_DEBUG, "Opened a tunnel to %s:%u", string_as_cptr(&tunnel->host), tunnel->port);
+
+out:
+    tunnel_unlock(tunnel);
+
+    return err;
+}
+
+static error_t *tunnel_on_connect_error(loop_t *loop, tcp_handler_t *handler, error_t *err);
+
+// Starts connecting to the next address of the host.
+static error_t *tunnel_connect(arc_tunnel_t *arc, loop_t *loop) {
+    error_t *err = NULL;
+
+    tunnel_t *tunnel = arc_tunnel_get(arc);
+    err = error_wrap("Could not connect to the host", OK_IF(tunnel->addr_next != NULL));
+    if (err) goto addr_next_fail;
+
+    struct addrinfo *addr = tunnel->addr_next;
+    tunnel->addr_next = addr->ai_next;
+
+    tcp_handler_t *tcp = NULL;
+    err = tcp_connect(addr->ai_addr, addr->ai_addrlen, tunnel_on_connect, tunnel_on_connect_error,
+        &tcp);
+    if (err) goto connect_fail;
+
+    tcp_set_on_error(tcp, tunnel_on_error);
+    handler_set_custom_data((handler_t *) tcp, arc_tunnel_share(arc));
+    handler_set_on_free((handler_t *) tcp, tunnel_on_handler_free);
+
+    err = error_wrap("Could not register the tunnel handler",
+        loop_register(loop, (handler_t *) tcp));
+    if (err) goto register_fail;
+
+    return err;
+
+register_fail:
+    // this releases the reference as well
+    handler_free((handler_t *) tcp);
+
+connect_fail:
+addr_next_fail:
+    return err;
+}
+
+static error_t *tunnel_on_connect_error(loop_t *loop, tcp_handler_t *handler, error_t *err) {
+    arc_tunnel_t *arc = handler_custom_data((handler_t *) handler);
+    handler_unregister((handler_t *) handler);
+    error_log_free(&err, LOG_DEBUG, ERROR_VERBOSITY_SOURCE_CHAIN);
+
+    err = tunnel_connect(arc, loop);
+
+    if (err) {
+        tunnel_fail(arc_tunnel_get(arc), err);
+    }
+
+    return NULL;
+}
+
+static error_t *tunnel_on_resolved(
+    loop_t *loop,
+    resolver_query_t *query,
+    arc_addrinfo_t *addrs,
+    error_t *err
+) {
+    arc_tunnel_t *arc = handler_custom_data((handler_t *) query);
+    tunnel_t *tunnel = arc_tunnel_get(arc);
+    handler_unregister((handler_t *) query);
+
+    if (err) goto fail;
+
+    tunnel->addrs = addrs;
+    tunnel->addr_next = arc_addrinfo_get(addrs);
+    err = tunnel_connect(arc, loop);
+    if (err) goto fail;
+
+    return err;
+
+fail:
+    tunnel_fail(tunnel, err);
+
+    return NULL;
+}
+
+error_t *tunnel_init(
+    tcp_handler_t *client,
+    slice_t host,
+    uint16_t port,
+    slice_t buffered,
+    resolver_t *resolver,
+    loop_t *loop
+) {
+    error_t *err = NULL;
+
+    tunnel_t *tunnel = calloc(1, sizeof(tunnel_t));
+    err = error_wrap("Could not allocate memory for the tunnel", OK_IF(tunnel != NULL));
+    if (err) goto calloc_fail;
+
+    err = error_wrap("Could not copy the host name", error_from_common(
+        string_from_slice(host.base, host.len, &tunnel->host)));
+    if (err) goto host_copy_fail;
+
+    err = error_wrap("Could not copy the buffered data", error_from_common(
+        string_from_slice(buffered.base, buffered.len, &tunnel->buffered)));
+    if (err) goto buffered_copy_fail;
+
+#ifndef WAXY_PTHREADS_DISABLED
+    err = error_wrap("Could not initialize a mutex", error_from_errno(
+        pthread_mutex_init(&tunnel->mtx, NULL)));
+    if (err) goto mtx_init_fail;
+#endif
+
+    tunnel->client = client;
+    tunnel->port = port;
+    tunnel->buffered_slice = (slice_t) {
+        .base = string_as_cptr(&tunnel->buffered),
+        .len = string_len(&tunnel->buffered),
+    };
+    tunnel->addrs = NULL;
+    tunnel->addr_next = NULL;
+
+    arc_tunnel_t *arc = arc_tunnel_new(tunnel);
+    err = error_wrap("Could not allocate memory for the tunnel", OK_IF(arc != NULL));
+    if (err) goto arc_new_fail;
+
+    resolver_query_t *query = NULL;
+    err = error_wrap("Could not resolve the tunnel host", resolver_query_new(
+        resolver, host, port, tunnel_on_resolved, &query));
+    if (err) goto query_new_fail;
+
+    handler_set_custom_data((handler_t *) query, arc_tunnel_share(arc));
+    handler_set_on_free((handler_t *) query, tunnel_on_handler_free);
+
+    err = error_wrap("Could not register the resolver query",
+        loop_register(loop, (handler_t *) query));
+    if (err) goto register_fail;
+
+    // nothing more is read from the client until the relay is set up
+    handler_set_custom_data((handler_t *) client, arc);
+    handler_set_on_free((handler_t *) client, tunnel_on_client_free);
+    tcp_set_on_error(client, tunnel_on_error);
+    tcp_read(client, NULL, NULL);
+
+    return err;
+
+register_fail:
+    // this releases the reference as well
+    handler_free((handler_t *) query);
+
+query_new_fail:
+    // the client is not taken over after all
+    tunnel->client = NULL;
+    arc_tunnel_free(arc);
+
+    return err;
+
+arc_new_fail:
+#ifndef WAXY_PTHREADS_DISABLED
+    pthread_mutex_destroy(&tunnel->mtx);
+
+mtx_init_fail:
+#endif
+    string_free(&tunnel->buffered);
+
+buffered_copy_fail:
+    string_free(&tunnel->host);
+
+host_copy_fail:
+    free(tunnel);
+
+calloc_fail:
+    return err;
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <common/error.h>
+#include <common/loop/io.h>
+#include <common/loop/loop.h>
+#include <common/loop/tcp.h>
+
+#include "resolver.h"
+
+// Opens a tunnel to `host` and `port` for a client that has sent a CONNECT request.
+//
+// The client handler is taken over: its custom data and callbacks are replaced.
+// Once the host is looked up through `resolver` and connected to, the client is sent a `200`
+// response, and from then on the data is relayed between the two connections (see `tcp_relay`).
+// If the host can't be reached, the client is sent an error response and disconnected.
+//
+// `buffered` is the data the client has sent after the request; it's forwarded to the host first.
+// Both it and `host` are copied.
+//
+// If an error is returned, the client handler is left as it was.
+//
+// Must be called from the client handler's context.
+error_t *tunnel_init(
+    tcp_handler_t *client,
+    slice_t host,
+    uint16_t port,
+    slice_t buffered,
+    resolver_t *resolver,
+    loop_t *loop
+);
@@ -2,29 +2,43 @@
 
 #include <assert.h>
 #include <stdlib.h>
-
-#include <netdb.h>
+#include <string.h>
+#include <time.h>
 
 #include <picohttpparser/picohttpparser.h>
 
 #include <common/error-codes/adapter.h>
 #include <common/loop/tcp.h>
 
-#include "gai-adapter.h"
+#include "http.h"
 #include "util.h"
 
 enum {
     UPSTREAM_MAX_HEADERS = 512,
+
+    // the largest number of slices a request is made of
+    UPSTREAM_MAX_REQUEST_SLICES = 14,
 };
 
 typedef struct {
     string_t buf;
+    // the value of the Range header to send, if not empty
+    string_t range;
     struct phr_header *headers;
-    struct addrinfo *addr_head;
+    arc_addrinfo_t *addrs;
     struct addrinfo *addr_next;
     cache_wr_t *wr;
+    pool_t *pool;
+    pool_conn_t *conn;
     tcp_handler_t *tcp;
+    http_framing_t framing;
     bool response_parsed;
+    // the connection was taken from the pool, and nothing has been received on it yet
+    bool reused;
+    // the response may be followed by another one on the same connection
+    bool persistent;
+    // the response is `304 Not Modified`, and the stale one is reused
+    bool not_modified;
 } upstream_ctx_t;
 
 // -1 is to account for the NUL terminator
@@ -37,40 +51,79 @@ static slice_t const request_slices[] = {
     SLICE_INIT_FROM_CSTR("GET "),
     SLICE_INIT_FROM_CSTR(" HTTP/1.1\r\n"
         "User-Agent: waxy/101\r\n"
-        "Connection: close\r\n"
         "Host: "
     ),
     SLICE_INIT_FROM_CSTR("\r\n"
         "Accept: */*\r\n"
-        "\r\n"
-    )
+    ),
+    SLICE_INIT_FROM_CSTR("If-None-Match: "),
+    SLICE_INIT_FROM_CSTR("If-Modified-Since: "),
+    SLICE_INIT_FROM_CSTR("Range: "),
+    SLICE_INIT_FROM_CSTR("\r\n"),
 };
 
-static void upstream_ctx_free(handler_t *data) {
-    upstream_ctx_t *ctx = handler_custom_data(data);
-
-    if (ctx == NULL) {
-        return;
-    }
+enum {
+    REQUEST_SLICE_GET,
+    REQUEST_SLICE_HOST,
+    REQUEST_SLICE_ACCEPT,
+    REQUEST_SLICE_IF_NONE_MATCH,
+    REQUEST_SLICE_IF_MODIFIED_SINCE,
+    REQUEST_SLICE_RANGE,
+    REQUEST_SLICE_CRLF,
+};
 
+static void upstream_ctx_destroy(upstream_ctx_t *ctx) {
     // freeing the string twice is ok
     string_free(&ctx->buf);
+    string_free(&ctx->range);
     // the headers are set to `NULL` after they are freed
     free(ctx->headers);
 
-    if (ctx->addr_head != NULL) {
-        freeaddrinfo(ctx->addr_head);
+    arc_addrinfo_free(ctx->addrs);
+
+    if (ctx->conn != NULL) {
+        // the connection is being closed
+        pool_conn_release(ctx->conn, false);
     }
 
     cache_wr_free(ctx->wr);
     free(ctx);
 }
 
+static void upstream_ctx_free(handler_t *data) {
+    upstream_ctx_t *ctx = handler_custom_data(data);
+
+    if (ctx != NULL) {
+        upstream_ctx_destroy(ctx);
+    }
+}
+
+static error_t *upstream_switch_handler(loop_t *loop, tcp_handler_t *handler);
+
+// A connection taken from the pool may have been closed by the peer before it received the request.
+// Since the request is idempotent, it can be safely retried on a new connection.
+static bool upstream_can_retry(upstream_ctx_t const *ctx) {
+    return ctx->reused && !ctx->response_parsed && string_len(&ctx->buf) == 0;
+}
+
 static error_t *upstream_on_error(
-    loop_t *,
+    loop_t *loop,
     tcp_handler_t *handler,
     error_t *err
 ) {
+    upstream_ctx_t *ctx = handler_custom_data((handler_t *) handler);
+
+    if (ctx != NULL && upstream_can_retry(ctx)) {
+        error_log_free(&err, LOG_DEBUG, ERROR_VERBOSITY_SOURCE_CHAIN);
+        log_printf(LOG_DEBUG, "A reused upstream connection has failed, retrying on a new one");
+
+        err = upstream_switch_handler(loop, handler);
+
+        if (!err) {
+            return err;
+        }
+    }
+
     char ip[INET6_ADDRSTRLEN] = {0};
     uint16_t port = 0;
     tcp_remote_info(handler, ip, &port);
@@ -83,89 +136,269 @@ static error_t *upstream_on_error(
     return err;
 }
 
-static error_t *upstream_on_read(loop_t *, tcp_handler_t *handler, slice_t slice) {
+// Makes the Last-Modified value of the stale response apply to a `304 Not Modified` response that
+// doesn't carry its own, so that the heuristic freshness lifetime can still be computed.
+static void upstream_add_stored_last_modified(
+    upstream_ctx_t *ctx,
+    size_t *num_headers,
+    slice_t last_modified
+) {
+    if (last_modified.len == 0 || *num_headers == UPSTREAM_MAX_HEADERS) {
+        return;
+    }
+
+    // the headers that come later take precedence
+    memmove(ctx->headers + 1, ctx->headers, *num_headers * sizeof(struct phr_header));
+    ctx->headers[0] = (struct phr_header) {
+        .name = "Last-Modified",
+        .name_len = sizeof("Last-Modified") - 1,
+        .value = last_modified.base,
+        .value_len = last_modified.len,
+    };
+    ++*num_headers;
+}
+
+// Hands the connection back to the pool once the response has been received in full.
+//
+// Otherwise, or if the pool is full, the connection is closed.
+static void upstream_finish(tcp_handler_t *handler, bool reusable) {
+    upstream_ctx_t *ctx = handler_custom_data((handler_t *) handler);
+    pool_conn_t *conn = ctx->conn;
+    ctx->conn = NULL;
+
+    if (pool_conn_release(conn, reusable)) {
+        // the handler now belongs to the pool
+        upstream_ctx_destroy(ctx);
+
+        return;
+    }
+
+    handler_unregister((handler_t *) handler);
+}
+
+// Returns the size the cached response is going to have: the head of `head_size` bytes followed by
+// the body, or `CACHE_SIZE_UNKNOWN` if the length of the body isn't known in advance.
+static size_t upstream_expected_size(upstream_ctx_t const *ctx, size_t head_size) {
+    if (ctx->framing.kind != HTTP_FRAMING_LENGTH || ctx->framing.remaining > SIZE_MAX - head_size) {
+        return CACHE_SIZE_UNKNOWN;
+    }
+
+    return head_size + ctx->framing.remaining;
+}
+
+// Parses the response head once it has been received.
+//
+// Stores the number of bytes of `slice` that belong to the head in `head_len`, or `SIZE_MAX` if
+// the head is incomplete.
+static error_t *upstream_parse_head(
+    upstream_ctx_t *ctx,
+    tcp_handler_t *handler,
+    slice_t slice,
+    size_t *head_len,
+    bool *failed
+) {
     error_t *err = NULL;
 
     char ip[INET6_ADDRSTRLEN] = {0};
     uint16_t port = 0;
     tcp_remote_info(handler, ip, &port);
 
-    upstream_ctx_t *ctx = handler_custom_data((handler_t *) handler);
+    size_t last_len = string_len(&ctx->buf);
+    *head_len = SIZE_MAX;
+    *failed = false;
 
-    if (!ctx->response_parsed) {
-        size_t last_len = string_len(&ctx->buf);
+    err = error_from_common(string_append_slice(&ctx->buf, slice.base, slice.len));
+    if (err) goto fail;
 
-        err = error_from_common(string_append_slice(&ctx->buf, slice.base, slice.len));
-        if (err) goto unregister;
+    int minor_version = -1;
+    int status = -1;
+    slice_t msg = slice_empty();
+    size_t num_headers = UPSTREAM_MAX_HEADERS;
+    int count = phr_parse_response(
+        string_as_cptr(&ctx->buf), string_len(&ctx->buf),
+        &minor_version,
+        &status,
+        &msg.base, &msg.len,
+        ctx->headers,
+        &num_headers,
+        last_len
+    );
+
+    if (count == -2) {
+        // partial data
+        if (tcp_is_eof(handler)) {
+            log_printf(LOG_ERR, "The upstream %s:%u has sent an abruptly ended response",
+                ip, port);
+            *failed = true;
+        }
+
+        return err;
+    } else if (count == -1) {
+        log_printf(LOG_ERR, "The upstream %s:%u has sent an invalid HTTP response", ip, port);
+        *failed = true;
 
-        int minor_version = -1;
-        int status = -1;
-        slice_t msg = slice_empty();
-        size_t num_headers = UPSTREAM_MAX_HEADERS;
-        int count = phr_parse_response(
-            string_as_cptr(&ctx->buf), string_len(&ctx->buf),
-            &minor_version,
-            &status,
-            &msg.base, &msg.len,
-            ctx->headers,
-            &num_headers,
-            last_len
-        );
-
-        if (count == -2) {
-            // partial data
-            if (tcp_is_eof(handler)) {
-                log_printf(LOG_ERR, "The upstream %s:%u has sent an abruptly ended response",
-                    ip, port);
-
-                goto unregister;
+        return err;
+    }
+
+    http_framing_init(&ctx->framing, status, false, num_headers, ctx->headers);
+    ctx->persistent = http_is_persistent(minor_version, num_headers, ctx->headers);
+
+    http_cache_info_t info;
+    slice_t etag = slice_empty();
+    slice_t last_modified = slice_empty();
+    bool revalidating = cache_wr_revalidation(ctx->wr, &etag, &last_modified);
+
+    if (status == 304 && revalidating) {
+        upstream_add_stored_last_modified(ctx, &num_headers, last_modified);
+        http_cache_info_from_headers(num_headers, ctx->headers, time(NULL), &info);
+        err = cache_wr_reuse_stale(ctx->wr, info.fresh_until);
+        if (err) goto fail;
+
+        log_printf(LOG_INFO, "Received a 304 status code, reusing the cached response");
+        ctx->not_modified = true;
+    } else {
+        time_t now = time(NULL);
+        http_cache_info_from_headers(num_headers, ctx->headers, now, &info);
+
+        if (status == 200 && info.no_store) {
+            log_printf(LOG_INFO, "The response forbids storing: not committing to the cache");
+        } else if (status == 200 && !http_cache_info_is_reusable(&info, now)) {
+            log_printf(
+                LOG_INFO,
+                "The response is neither fresh nor revalidatable: not committing to the cache"
+            );
+        } else if (status == 200) {
+            error_t *commit_err = cache_wr_set_freshness(
+                ctx->wr,
+                info.fresh_until,
+                info.etag,
+                info.last_modified
+            );
+
+            if (!commit_err) {
+                commit_err = cache_wr_commit(ctx->wr, upstream_expected_size(ctx, (size_t) count));
             }
-        } else if (count == -1) {
-            log_printf(LOG_ERR, "The upstream %s:%u has sent an invalid HTTP response", ip, port);
 
-            goto unregister;
-        } else {
-            if (status == 200) {
-                error_t *commit_err = cache_wr_commit(ctx->wr);
-
-                if (commit_err) {
-                    error_log_free(
-                        &commit_err,
-                        LOG_ERR,
-                        ERROR_VERBOSITY_SOURCE_CHAIN | ERROR_VERBOSITY_BACKTRACE
-                    );
-                    log_printf(
-                        LOG_ERR,
-                        "Could not commit a response from the upstream %s:%u to the cache",
-                        ip, port
-                    );
-                } else {
-                    log_printf(
-                        LOG_INFO,
-                        "Received a 200 status code, committing the response to the cache"
-                    );
-                }
+            if (commit_err) {
+                error_log_free(
+                    &commit_err,
+                    LOG_ERR,
+                    ERROR_VERBOSITY_SOURCE_CHAIN | ERROR_VERBOSITY_BACKTRACE
+                );
+                log_printf(
+                    LOG_ERR,
+                    "Could not commit a response from the upstream %s:%u to the cache",
+                    ip, port
+                );
             } else {
                 log_printf(
                     LOG_INFO,
-                    "Received a %d status code: not committing to the cache",
-                    status
+                    "Received a 200 status code, committing the response to the cache"
                 );
             }
+        } else {
+            log_printf(
+                LOG_INFO,
+                "Received a %d status code: not committing to the cache",
+                status
+            );
+        }
+    }
+
+    // the head ends within this slice, as it was incomplete before
+    *head_len = (size_t) count - last_len;
+
+    string_free(&ctx->buf);
+    free(ctx->headers);
+    ctx->headers = NULL;
+    ctx->response_parsed = true;
+
+fail:
+    return err;
+}
+
+static void upstream_release_read_buffer(void *buf) {
+    loop_read_buffer_release(buf);
+}
+
+static error_t *upstream_on_read(loop_t *loop, tcp_handler_t *handler, slice_t slice) {
+    error_t *err = NULL;
+
+    char ip[INET6_ADDRSTRLEN] = {0};
+    uint16_t port = 0;
+    tcp_remote_info(handler, ip, &port);
+
+    upstream_ctx_t *ctx = handler_custom_data((handler_t *) handler);
+
+    if (upstream_can_retry(ctx) && slice.len == 0 && tcp_is_eof(handler)) {
+        log_printf(LOG_DEBUG, "A reused upstream connection has been closed, retrying");
+
+        return upstream_switch_handler(loop, handler);
+    }
+
+    ctx->reused = false;
+    size_t head_len = 0;
+
+    if (!ctx->response_parsed) {
+        bool failed = false;
+        err = upstream_parse_head(ctx, handler, slice, &head_len, &failed);
+        if (err || failed) goto unregister;
 
-            string_free(&ctx->buf);
-            free(ctx->headers);
-            ctx->headers = NULL;
-            ctx->response_parsed = true;
+        if (!ctx->response_parsed) {
+            return err;
         }
     }
 
-    err = cache_wr_write(ctx->wr, slice);
-    if (err) goto unregister;
+    slice_t body = {
+        .base = slice.base + head_len,
+        .len = slice.len - head_len,
+    };
+    size_t consumed = 0;
+    http_framing_status_t status = http_framing_feed(&ctx->framing, body, &consumed);
+
+    if (status == HTTP_FRAMING_INVALID) {
+        log_printf(LOG_ERR, "The upstream %s:%u has sent a malformed response body", ip, port);
+
+        goto unregister;
+    }
+
+    if (!ctx->not_modified) {
+        // anything past the end of the response is not a part of it
+        slice_t data = {
+            .base = slice.base,
+            .len = head_len + consumed,
+        };
+        char *buf = data.len > 0 ? tcp_take_read_buffer(handler) : NULL;
+
+        if (buf != NULL) {
+            // the cache keeps the buffer rather than copy the data out of it
+            err = cache_wr_adopt(ctx->wr, data, upstream_release_read_buffer, buf);
+        } else {
+            err = cache_wr_write(ctx->wr, data);
+        }
+
+        if (err) goto unregister;
+    }
+
+    if (status == HTTP_FRAMING_DONE) {
+        if (!ctx->not_modified) {
+            cache_wr_complete(ctx->wr);
+        }
+
+        // nothing is expected to arrive before the next request
+        upstream_finish(handler, ctx->persistent && consumed == body.len && !tcp_is_eof(handler));
+
+        return err;
+    }
 
     if (tcp_is_eof(handler)) {
-        log_printf(LOG_DEBUG, "cache_wr_complete: eof");
-        cache_wr_complete(ctx->wr);
+        if (ctx->framing.kind == HTTP_FRAMING_CLOSE) {
+            log_printf(LOG_DEBUG, "cache_wr_complete: eof");
+            cache_wr_complete(ctx->wr);
+        } else {
+            log_printf(LOG_ERR, "The upstream %s:%u has sent an abruptly ended response",
+                ip, port);
+        }
 
         goto unregister;
     }
@@ -184,9 +417,6 @@ static error_t *upstream_on_request_write(
     size_t slice_count,
     slice_t const slices[static slice_count]
 ) {
-    // there's nothing we have left to tell the upstream
-    tcp_shutdown_output(handler);
-
     free((slice_t *) slices);
 
     tcp_read(handler, upstream_on_read, NULL);
@@ -202,33 +432,64 @@ static error_t *upstream_on_request_write_err(
     slice_t const slices[static slice_count],
     size_t
 ) {
-    assert(slice_count == 1);
     free((slice_t *) slices);
 
     return err;
 }
 
-static error_t *upstream_on_connect(loop_t *, tcp_handler_t *handler) {
+static error_t *upstream_send_request(upstream_ctx_t *ctx, tcp_handler_t *handler) {
     error_t *err = NULL;
 
-    upstream_ctx_t *ctx = handler_custom_data((handler_t *) handler);
-    freeaddrinfo(ctx->addr_head);
-    ctx->addr_head = NULL;
-    ctx->addr_next = NULL;
-
     url_t const *url = cache_wr_url(ctx->wr);
 
-    slice_t *slices = calloc(5, sizeof(slice_t));
+    slice_t *slices = calloc(UPSTREAM_MAX_REQUEST_SLICES, sizeof(slice_t));
     err = OK_IF(slices != NULL);
     if (err) goto calloc_fail;
 
-    slices[0] = request_slices[0];
-    slices[1] = url->path;
-    slices[2] = request_slices[1];
-    slices[3] = url->host;
-    slices[4] = request_slices[2];
+    size_t count = 0;
+    slices[count++] = request_slices[REQUEST_SLICE_GET];
+    slices[count++] = url->path;
+    slices[count++] = request_slices[REQUEST_SLICE_HOST];
+    slices[count++] = url->host;
+    slices[count++] = request_slices[REQUEST_SLICE_ACCEPT];
+
+    // the validators live as long as the write handle
+    slice_t etag = slice_empty();
+    slice_t last_modified = slice_empty();
+
+    if (cache_wr_revalidation(ctx->wr, &etag, &last_modified)) {
+        if (etag.len > 0) {
+            slices[count++] = request_slices[REQUEST_SLICE_IF_NONE_MATCH];
+            slices[count++] = etag;
+            slices[count++] = request_slices[REQUEST_SLICE_CRLF];
+        }
 
-    err = tcp_write(handler, 5, slices, upstream_on_request_write, upstream_on_request_write_err);
+        if (last_modified.len > 0) {
+            slices[count++] = request_slices[REQUEST_SLICE_IF_MODIFIED_SINCE];
+            slices[count++] = last_modified;
+            slices[count++] = request_slices[REQUEST_SLICE_CRLF];
+        }
+    }
+
+    if (string_len(&ctx->range) > 0) {
+        slices[count++] = request_slices[REQUEST_SLICE_RANGE];
+        slices[count++] = (slice_t) {
+            .base = string_as_cptr(&ctx->range),
+            .len = string_len(&ctx->range),
+        };
+        slices[count++] = request_slices[REQUEST_SLICE_CRLF];
+    }
+
+    slices[count++] = request_slices[REQUEST_SLICE_CRLF];
+    assert(count <= UPSTREAM_MAX_REQUEST_SLICES);
+
+    err = tcp_write(
+        handler,
+        count,
+        slices,
+        upstream_on_request_write,
+        upstream_on_request_write_err
+    );
     if (err) goto tcp_write_fail;
 
     return err;
@@ -240,8 +501,24 @@ calloc_fail:
     return err;
 }
 
+static error_t *upstream_on_connect(loop_t *, tcp_handler_t *handler) {
+    upstream_ctx_t *ctx = handler_custom_data((handler_t *) handler);
+
+    return upstream_send_request(ctx, handler);
+}
+
 static error_t *upstream_reconnect(loop_t *loop, tcp_handler_t *handler, error_t *err);
 
+// Makes the connection fail if the origin stops responding.
+static void upstream_set_timeouts(upstream_ctx_t *ctx, tcp_handler_t *tcp) {
+    uint64_t timeout_ms = pool_io_timeout_ms(ctx->pool);
+
+    tcp_set_on_timeout(tcp, NULL);
+    tcp_set_timeout(tcp, TCP_TIMEOUT_READ, timeout_ms);
+    tcp_set_timeout(tcp, TCP_TIMEOUT_WRITE, timeout_ms);
+    tcp_set_timeout(tcp, TCP_TIMEOUT_IDLE, 0);
+}
+
 static error_t *upstream_new_handler(upstream_ctx_t *ctx, tcp_handler_t **result) {
     error_t *err = NULL;
 
@@ -260,6 +537,7 @@ static error_t *upstream_new_handler(upstream_ctx_t *ctx, tcp_handler_t **result
     if (err) goto connect_fail;
 
     tcp_set_on_error(tcp, upstream_on_error);
+    upstream_set_timeouts(ctx, tcp);
     handler_set_custom_data((handler_t *) tcp, ctx);
     handler_set_on_free((handler_t *) tcp, upstream_ctx_free);
 
@@ -272,50 +550,203 @@ addr_next_fail:
     return err;
 }
 
-static error_t *upstream_reconnect(loop_t *loop, tcp_handler_t *handler, error_t *err) {
+// Moves the context over to a new connection attempt, using the next address of the upstream.
+static error_t *upstream_switch_handler(loop_t *loop, tcp_handler_t *handler) {
+    error_t *err = NULL;
+
     upstream_ctx_t *ctx = handler_custom_data((handler_t *) handler);
+
+    if (ctx->reused) {
+        // a pooled connection has failed: start over with a new one
+        ctx->reused = false;
+        ctx->addr_next = arc_addrinfo_get(ctx->addrs);
+    }
+
     tcp_handler_t *tcp = NULL;
-    error_t *reconnect_err = upstream_new_handler(ctx, &tcp);
+    err = upstream_new_handler(ctx, &tcp);
+    if (err) goto new_handler_fail;
 
-    if (reconnect_err) {
-        err = error_combine(reconnect_err, err);
+    handler_set_custom_data((handler_t *) handler, NULL);
+    handler_unregister((handler_t *) handler);
+    pool_conn_set_tcp(ctx->conn, tcp);
+    ctx->tcp = tcp;
+
+    err = error_wrap("Could not register the upstream handler",
+        loop_register(loop, (handler_t *) tcp));
+    if (err) goto register_fail;
+
+    return err;
+
+register_fail:
+    // this frees the context as well
+    handler_free((handler_t *) tcp);
+
+new_handler_fail:
+    return err;
+}
+
+static error_t *upstream_reconnect(loop_t *loop, tcp_handler_t *handler, error_t *err) {
+    error_t *reconnect_err = upstream_switch_handler(loop, handler);
 
-        goto fail;
+    if (reconnect_err) {
+        return error_combine(reconnect_err, err);
     }
 
     error_log_free(&err, LOG_DEBUG, ERROR_VERBOSITY_SOURCE_CHAIN);
-    handler_set_custom_data((handler_t *) handler, NULL);
-    handler_unregister((handler_t *) handler);
 
-    err = loop_register(loop, (handler_t *) tcp);
+    return err;
+}
+
+// Tries to send the request over an idle connection taken from the pool.
+//
+// Returns `false` if the connection turns out to be unusable, in which case it's dropped.
+static bool upstream_reuse(upstream_ctx_t *ctx, tcp_handler_t *tcp) {
+    handler_lock((handler_t *) tcp);
+
+    bool usable = !tcp_is_eof(tcp) && !tcp_is_input_shutdown(tcp) && !tcp_is_output_shutdown(tcp);
+
+    if (usable) {
+        // the response may be processed, and the context freed, as soon as the request is sent
+        ctx->tcp = tcp;
+        ctx->reused = true;
+        handler_set_custom_data((handler_t *) tcp, ctx);
+        handler_set_on_free((handler_t *) tcp, upstream_ctx_free);
+        tcp_set_on_error(tcp, upstream_on_error);
+        upstream_set_timeouts(ctx, tcp);
+        tcp_read(tcp, NULL, NULL);
+
+        error_t *err = upstream_send_request(ctx, tcp);
+
+        if (err) {
+            error_log_free(&err, LOG_DEBUG, ERROR_VERBOSITY_SOURCE_CHAIN);
+            usable = false;
+        }
+    }
+
+    if (!usable) {
+        ctx->tcp = NULL;
+        ctx->reused = false;
+        handler_set_custom_data((handler_t *) tcp, NULL);
+    }
+
+    handler_unlock((handler_t *) tcp);
+
+    if (!usable) {
+        handler_unregister((handler_t *) tcp);
+        pool_conn_set_tcp(ctx->conn, NULL);
+    }
+
+    return usable;
+}
+
+static error_t *upstream_on_acquired(loop_t *loop, pool_request_t *request, pool_conn_t *conn) {
+    upstream_ctx_t *ctx = handler_custom_data((handler_t *) request);
+    url_t const *url = cache_wr_url(ctx->wr);
+    ctx->conn = conn;
+
+    tcp_handler_t *tcp = pool_conn_tcp(conn);
+
+    if (tcp != NULL && upstream_reuse(ctx, tcp)) {
+        // the context is now owned by the connection
+        handler_set_custom_data((handler_t *) request, NULL);
+        handler_unregister((handler_t *) request);
+
+        return NULL;
+    }
+
+    ctx->addr_next = arc_addrinfo_get(ctx->addrs);
+    tcp = NULL;
+    error_t *err = upstream_new_handler(ctx, &tcp);
     if (err) goto fail;
 
+    pool_conn_set_tcp(conn, tcp);
+    handler_set_custom_data((handler_t *) request, NULL);
+    handler_unregister((handler_t *) request);
+
+    err = error_wrap("Could not register the upstream handler",
+        loop_register(loop, (handler_t *) tcp));
+    if (err) goto register_fail;
+
     ctx->tcp = tcp;
 
+    return err;
+
+register_fail:
+    // this frees the context as well
+    handler_free((handler_t *) tcp);
+    error_log_free(&err, LOG_ERR, ERROR_VERBOSITY_SOURCE_CHAIN | ERROR_VERBOSITY_BACKTRACE);
+
+    return err;
+
 fail:
+    // dropping the context invalidates the cache entry, which disconnects the clients waiting on it
+    error_log_free(&err, LOG_ERR, ERROR_VERBOSITY_SOURCE_CHAIN);
+    log_printf(LOG_ERR, "Could not connect to the upstream %.*s:%u",
+        (int) url->host.len, url->host.base, url->port);
+    handler_unregister((handler_t *) request);
+
     return err;
 }
 
-error_t *upstream_init(cache_wr_t *wr, loop_t *loop) {
+static error_t *upstream_on_resolved(
+    loop_t *loop,
+    resolver_query_t *query,
+    arc_addrinfo_t *addrs,
+    error_t *err
+) {
+    upstream_ctx_t *ctx = handler_custom_data((handler_t *) query);
+    url_t const *url = cache_wr_url(ctx->wr);
+
+    if (err) goto fail;
+
+    ctx->addrs = addrs;
+
+    pool_request_t *request = NULL;
+    err = pool_request_new(ctx->pool, url->host, url->port, upstream_on_acquired, &request);
+    if (err) goto fail;
+
+    // the context is now owned by the connection request
+    handler_set_custom_data((handler_t *) query, NULL);
+    handler_unregister((handler_t *) query);
+    handler_set_custom_data((handler_t *) request, ctx);
+    handler_set_on_free((handler_t *) request, upstream_ctx_free);
+
+    err = error_wrap("Could not register the connection request",
+        loop_register(loop, (handler_t *) request));
+    if (err) goto register_fail;
+
+    return err;
+
+register_fail:
+    // this frees the context as well
+    handler_free((handler_t *) request);
+    error_log_free(&err, LOG_ERR, ERROR_VERBOSITY_SOURCE_CHAIN | ERROR_VERBOSITY_BACKTRACE);
+
+    return err;
+
+fail:
+    // dropping the context invalidates the cache entry, which disconnects the clients waiting on it
+    error_log_free(&err, LOG_ERR, ERROR_VERBOSITY_SOURCE_CHAIN);
+    log_printf(LOG_ERR, "Could not connect to the upstream %.*s:%u",
+        (int) url->host.len, url->host.base, url->port);
+    handler_unregister((handler_t *) query);
+
+    return err;
+}
+
+error_t *upstream_init(
+    cache_wr_t *wr,
+    slice_t range,
+    resolver_t *resolver,
+    pool_t *pool,
+    loop_t *loop
+) {
     error_t *err = NULL;
 
     url_t const *url = cache_wr_url(wr);
     assert(!url->host_null);
     assert(!url->port_null);
 
-    bool host_owned = false;
-    bool port_owned = false;
-
-    string_t host;
-    err = error_from_common(string_from_slice(url->host.base, url->host.len, &host));
-    if (err) goto host_fail;
-    host_owned = true;
-
-    string_t port;
-    err = error_from_common(string_sprintf(&port, "%u", url->port));
-    if (err) goto port_fail;
-    port_owned = false;
-
     upstream_ctx_t *ctx = calloc(1, sizeof(upstream_ctx_t));
     err = error_wrap("Could not allocate memory for the upstream handler", OK_IF(ctx != NULL));
     if (err) goto ctx_calloc_fail;
@@ -324,73 +755,60 @@ error_t *upstream_init(cache_wr_t *wr, loop_t *loop) {
         string_new(&ctx->buf)));
     if (err) goto string_new_fail;
 
+    err = error_wrap("Could not copy the requested range", error_from_common(
+        string_from_slice(range.base, range.len, &ctx->range)));
+    if (err) goto range_copy_fail;
+
     ctx->headers = calloc(UPSTREAM_MAX_HEADERS, sizeof(struct phr_header));
     err = error_wrap("Could not allocate memory for the upstream handler",
         OK_IF(ctx->headers != NULL));
     if (err) goto header_calloc_fail;
 
-    struct addrinfo *addr_head = NULL;
-    err = error_wrap("Could not resolve the upstream URL", error_from_gai(getaddrinfo(
-        string_as_cptr(&host),
-        string_as_cptr(&port),
-        &(struct addrinfo) {
-            .ai_family = AF_UNSPEC,
-            .ai_socktype = SOCK_STREAM,
-            .ai_protocol = IPPROTO_TCP,
-            .ai_flags = AI_ADDRCONFIG | AI_NUMERICSERV,
-        },
-        &addr_head
-    )));
-    if (err) goto gai_fail;
-
-    ctx->addr_head = addr_head;
-    ctx->addr_next = addr_head;
-
-    string_free(&port);
-    string_free(&host);
-    host_owned = false;
-    port_owned = false;
-
-    tcp_handler_t *tcp = NULL;
-    err = upstream_new_handler(ctx, &tcp);
-    if (err) goto new_handler_fail;
-
+    ctx->addrs = NULL;
+    ctx->addr_next = NULL;
     ctx->wr = wr;
-    ctx->tcp = tcp;
+    ctx->pool = pool;
+    ctx->conn = NULL;
+    ctx->tcp = NULL;
     ctx->response_parsed = false;
+    ctx->reused = false;
+    ctx->persistent = false;
+    ctx->not_modified = false;
 
-    err = error_wrap("Could not register the upstream handler",
-        loop_register(loop, (handler_t *) tcp));
+    resolver_query_t *query = NULL;
+    err = error_wrap("Could not resolve the upstream URL", resolver_query_new(
+        resolver, url->host, url->port, upstream_on_resolved, &query));
+    if (err) goto query_new_fail;
+
+    // the context is owned by the query until the connection is established
+    handler_set_custom_data((handler_t *) query, ctx);
+    handler_set_on_free((handler_t *) query, upstream_ctx_free);
+
+    err = error_wrap("Could not register the resolver query",
+        loop_register(loop, (handler_t *) query));
     if (err) goto register_fail;
 
     return err;
 
 register_fail:
-    handler_free((handler_t *) tcp);
+    // this frees the context as well
+    handler_free((handler_t *) query);
 
-new_handler_fail:
-    freeaddrinfo(addr_head);
+    return err;
 
-gai_fail:
+query_new_fail:
     free(ctx->headers);
 
 header_calloc_fail:
+    string_free(&ctx->range);
+
+range_copy_fail:
     string_free(&ctx->buf);
 
 string_new_fail:
     free(ctx);
 
 ctx_calloc_fail:
-    if (port_owned) {
-        string_free(&port);
-    }
-
-port_fail:
-    if (host_owned) {
-        string_free(&host);
-    }
-
-host_fail:
     cache_wr_free(wr);
 
     return err;
@@ -1,5 +1,21 @@
 #pragma once
 
 #include "cache.h"
+#include "pool.h"
+#include "resolver.h"
 
-error_t *upstream_init(cache_wr_t *wr, loop_t *loop);
+// Fetches the resource associated with the write handle from its origin server.
+//
+// The host name is looked up through `resolver`, and the connection is taken from `pool` once
+// it's resolved.
+// When the response ends, the connection is returned to the pool if the origin allows it.
+//
+// If `range` is not empty, it's sent as the value of the `Range` header.
+// Only full (200) responses are committed to the cache, so a partial one is just relayed.
+error_t *upstream_init(
+    cache_wr_t *wr,
+    slice_t range,
+    resolver_t *resolver,
+    pool_t *pool,
+    loop_t *loop
+);
@@ -25,6 +25,24 @@ static inline void assert_mutex_unlock(pthread_mutex_t *mtx) {
     error_assert(error_wrap("Could not unlock a mutex", error_from_errno(
         pthread_mutex_unlock(mtx))));
 }
+
+[[maybe_unused]]
+static inline void assert_rwlock_rdlock(pthread_rwlock_t *lock) {
+    error_assert(error_wrap("Could not acquire a read lock", error_from_errno(
+        pthread_rwlock_rdlock(lock))));
+}
+
+[[maybe_unused]]
+static inline void assert_rwlock_wrlock(pthread_rwlock_t *lock) {
+    error_assert(error_wrap("Could not acquire a write lock", error_from_errno(
+        pthread_rwlock_wrlock(lock))));
+}
+
+[[maybe_unused]]
+static inline void assert_rwlock_unlock(pthread_rwlock_t *lock) {
+    error_assert(error_wrap("Could not release a read-write lock", error_from_errno(
+        pthread_rwlock_unlock(lock))));
+}
 #endif
 
 [[maybe_unused]]